@@ -0,0 +1,160 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    AnimBatch.cpp
+ * \author  Miroslav Hroncok
+ *
+ * Animates all the bottles at once instead of calling AnimNode::animate() one by one.
+ * Offsets are kept in one array and the path is evaluated for 4 bottles at once with SSE.
+ * Follows AnimNode::constantSpeed, the same as AnimNode::animate().
+ */
+//----------------------------------------------------------------------------------------
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include "AnimBatch.h"
+#include "AnimNode.h"
+
+AnimBatch::AnimBatch(): m_lastTime(-1.0f) {
+}
+
+/// \param node Node to be animated, it must not be animated by itself
+void AnimBatch::add(AnimNode * node) {
+	node->m_batchSlot = m_nodes.size();
+	m_nodes.push_back(node);
+	m_offsets.push_back(node->m_offset);
+	m_lastTime = -1.0f; // the new node has to be evaluated
+}
+
+/// \param node Node previously added
+void AnimBatch::remove(AnimNode * node) {
+	int slot = node->m_batchSlot;
+	if (slot < 0) return;
+	m_nodes[slot] = m_nodes.back();
+	m_offsets[slot] = m_offsets.back();
+	m_nodes[slot]->m_batchSlot = slot;
+	m_nodes.pop_back();
+	m_offsets.pop_back();
+	node->m_batchSlot = -1;
+}
+
+void AnimBatch::clear() {
+	for (unsigned i=0; i < m_nodes.size(); i++) m_nodes[i]->m_batchSlot = -1;
+	m_nodes.clear();
+	m_offsets.clear();
+}
+
+/// Evaluates positions of all the nodes, 4 at once
+/// \param time Animation time without the offsets (the same as mytime in AnimNode::animate())
+void AnimBatch::evaluate(float time) {
+	m_x.resize(m_nodes.size());
+	m_z.resize(m_nodes.size());
+	if (AnimNode::constantSpeed) evaluateTable(time);
+	else evaluateCurve(time);
+}
+
+/// \param time Animation time without the offsets
+void AnimBatch::evaluateCurve(float time) {
+	const unsigned count = m_nodes.size();
+	const int fragments = AnimNode::path.fragments();
+	const float * coef = AnimNode::path.coefficients();
+
+	unsigned i = 0;
+	const __m128 base = _mm_set1_ps(time);
+	for (; i+4 <= count; i+=4) {
+		__m128 t = _mm_add_ps(base, _mm_loadu_ps(&m_offsets[i]));
+		// the time is never negative, so truncating is the floor
+		__m128i full = _mm_cvttps_epi32(t);
+		__m128 dec = _mm_sub_ps(t, _mm_cvtepi32_ps(full));
+		int seconds[4];
+		_mm_storeu_si128((__m128i *) seconds, full);
+
+		// coefficients of the segment of every lane, transposed so one register holds one power for all 4
+		const float * c0 = coef + 8*(seconds[0]%fragments);
+		const float * c1 = coef + 8*(seconds[1]%fragments);
+		const float * c2 = coef + 8*(seconds[2]%fragments);
+		const float * c3 = coef + 8*(seconds[3]%fragments);
+		__m128 x0 = _mm_loadu_ps(c0), x1 = _mm_loadu_ps(c1), x2 = _mm_loadu_ps(c2), x3 = _mm_loadu_ps(c3);
+		__m128 z0 = _mm_loadu_ps(c0+4), z1 = _mm_loadu_ps(c1+4), z2 = _mm_loadu_ps(c2+4), z3 = _mm_loadu_ps(c3+4);
+		_MM_TRANSPOSE4_PS(x0, x1, x2, x3);
+		_MM_TRANSPOSE4_PS(z0, z1, z2, z3);
+
+		// Horner scheme, no pow() needed
+		__m128 x = _mm_add_ps(_mm_mul_ps(x3, dec), x2);
+		x = _mm_add_ps(_mm_mul_ps(x, dec), x1);
+		x = _mm_add_ps(_mm_mul_ps(x, dec), x0);
+		__m128 z = _mm_add_ps(_mm_mul_ps(z3, dec), z2);
+		z = _mm_add_ps(_mm_mul_ps(z, dec), z1);
+		z = _mm_add_ps(_mm_mul_ps(z, dec), z0);
+		_mm_storeu_ps(&m_x[i], x);
+		_mm_storeu_ps(&m_z[i], z);
+	}
+	// the rest one by one
+	for (; i < count; i++) {
+		float t = time + m_offsets[i];
+		float dec = t - floor(t);
+		const float * c = coef + 8*(int(t - dec)%fragments);
+		m_x[i] = ((c[3]*dec + c[2])*dec + c[1])*dec + c[0];
+		m_z[i] = ((c[7]*dec + c[6])*dec + c[5])*dec + c[4];
+	}
+}
+
+/// \param time Animation time without the offsets
+void AnimBatch::evaluateTable(float time) {
+	const unsigned count = m_nodes.size();
+	const ConveyorPath & path = AnimNode::path;
+	const float * tableX = path.tableX();
+	const float * tableZ = path.tableZ();
+	const int last = path.tableSize()-1;
+	// time in fragments -> index to the table, the loop is tableSize() entries long
+	const float scale = path.beltDistance(1.0f)/path.step();
+	const float size = float(path.tableSize());
+
+	unsigned i = 0;
+	const __m128 base = _mm_set1_ps(time);
+	const __m128 scale4 = _mm_set1_ps(scale);
+	const __m128 size4 = _mm_set1_ps(size);
+	const __m128 inverseSize4 = _mm_set1_ps(1.0f/size);
+	for (; i+4 <= count; i+=4) {
+		__m128 t = _mm_mul_ps(_mm_add_ps(base, _mm_loadu_ps(&m_offsets[i])), scale4);
+		// wrap to one loop, the time is never negative, so truncating is the floor
+		__m128 loops = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(t, inverseSize4)));
+		t = _mm_sub_ps(t, _mm_mul_ps(loops, size4));
+		__m128i index = _mm_cvttps_epi32(t);
+		__m128 part = _mm_sub_ps(t, _mm_cvtepi32_ps(index));
+		int entries[4];
+		_mm_storeu_si128((__m128i *) entries, index);
+		for (int lane=0; lane < 4; lane++) {
+			// rounding in the wrap may give a value just outside the loop
+			if (entries[lane] > last) entries[lane] = last;
+			else if (entries[lane] < 0) entries[lane] = 0;
+		}
+
+		__m128 x0 = _mm_set_ps(tableX[entries[3]], tableX[entries[2]], tableX[entries[1]], tableX[entries[0]]);
+		__m128 x1 = _mm_set_ps(tableX[entries[3]+1], tableX[entries[2]+1], tableX[entries[1]+1], tableX[entries[0]+1]);
+		__m128 z0 = _mm_set_ps(tableZ[entries[3]], tableZ[entries[2]], tableZ[entries[1]], tableZ[entries[0]]);
+		__m128 z1 = _mm_set_ps(tableZ[entries[3]+1], tableZ[entries[2]+1], tableZ[entries[1]+1], tableZ[entries[0]+1]);
+		// linear between the two nearest entries
+		_mm_storeu_ps(&m_x[i], _mm_add_ps(x0, _mm_mul_ps(_mm_sub_ps(x1, x0), part)));
+		_mm_storeu_ps(&m_z[i], _mm_add_ps(z0, _mm_mul_ps(_mm_sub_ps(z1, z0), part)));
+	}
+	// the rest one by one
+	for (; i < count; i++) {
+		glm::vec3 position = path.position(path.beltDistance(time + m_offsets[i]));
+		m_x[i] = position.x;
+		m_z[i] = position.z;
+	}
+}
+
+/// Calculates the local matrices, the global ones are calculated by the hierarchy afterwards
+/// \param elapsed_time Time in seconds
+void AnimBatch::update(double elapsed_time) {
+	float mytime;
+	if (AnimNode::animation) mytime = elapsed_time/3.0f; // make it slower, the same as AnimNode::animate()
+	else mytime = 0; // time 0
+	// stopped animation keeps the same time, so the matrices (and the subtrees) are left untouched
+	if (mytime == m_lastTime || m_nodes.empty()) return;
+	m_lastTime = mytime;
+
+	evaluate(mytime);
+	for (unsigned i=0; i < m_nodes.size(); i++)
+		m_nodes[i]->setLocalTranslation(glm::vec3(m_x[i], 0.0f, m_z[i]));
+}
@@ -0,0 +1,49 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    AnimBatch.h
+ * \author  Miroslav Hroncok
+ *
+ * Animates all the bottles at once instead of calling AnimNode::animate() one by one.
+ * Offsets are kept in one array and the path is evaluated for 4 bottles at once with SSE.
+ * Follows AnimNode::constantSpeed, the same as AnimNode::animate().
+ */
+//----------------------------------------------------------------------------------------
+
+#ifndef ANIM_BATCH_H
+#define ANIM_BATCH_H
+
+#include <vector>
+
+class AnimNode;
+
+class AnimBatch {
+public:
+	AnimBatch();
+
+	/// Adds the node, its local matrix is set by update() from now on
+	void add(AnimNode * node);
+	/// Removes the node (in O(1), the last node takes its place)
+	void remove(AnimNode * node);
+	/// Forgets all the nodes
+	void clear();
+	/// Number of nodes in the batch
+	unsigned size() const { return m_nodes.size(); }
+
+	/// Sets local matrices of all the nodes, call it before the update of the scene
+	void update(double elapsed_time);
+
+	/// Only evaluates the positions (to m_x and m_z), no matrices are touched
+	void evaluate(float time);
+protected:
+	/// Hermite curve in its own parametrisation, fragment by fragment
+	void evaluateCurve(float time);
+	/// Constant speed, looks into the table of the path
+	void evaluateTable(float time);
+
+	std::vector<AnimNode *> m_nodes;
+	std::vector<float> m_offsets; // offset of each node, the same order as m_nodes
+	std::vector<float> m_x, m_z; // evaluated positions
+	float m_lastTime; // time of the last evaluation, nothing to do if it does not change
+};
+
+#endif
@@ -10,13 +10,29 @@
 #include "AnimNode.h"
 
 AnimNode::AnimNode(const std::string &name, float offset, SceneNode* parent):
-	SceneNode(name, parent), m_offset(offset) {}
+	SceneNode(name, parent), m_offset(offset), m_lastTime(-1.0f), m_batchSlot(-1) {
+	if (batched) batch.add(this);
+	else setAnimated(true);
+}
+
+AnimNode::~AnimNode() {
+	batch.remove(this);
+}
 
-void AnimNode::update(double elapsed_time) {
+/// Calculates the local matrix, the global one is calculated by the hierarchy afterwards
+/// \param elapsed_time Time in seconds
+void AnimNode::animate(double elapsed_time) {
 	float mytime;
 	if (animation) mytime = elapsed_time/3.0f; // make it slower
 	else mytime = 0; // time 0
 	mytime += m_offset; // add the offset after the deviding
+	// stopped animation keeps the same time, so the matrix (and the subtree) is left untouched
+	if (mytime == m_lastTime) return;
+	m_lastTime = mytime;
+	if (constantSpeed) {
+		setLocalMatrix(glm::translate(glm::mat4(1.0f),path.position(path.beltDistance(mytime))));
+		return;
+	}
 	float dec = mytime - floor(mytime); // decimal part
 	int seconds = int(mytime - dec); // full part
 
@@ -44,7 +60,5 @@ void AnimNode::update(double elapsed_time) {
 	mat3.x = start.x*F.p + end.x*F.q + startv.x*F.r + endv.x*F.s;
 	//mat3.y = start.y*F.p + end.y*F.q + startv.y*F.r + endv.y*F.s; // if it is not 0 all time, uncomment this line
 	mat3.z = start.z*F.p + end.z*F.q + startv.z*F.r + endv.z*F.s;
-	m_local_mat = glm::translate(glm::mat4(1.0f),mat3);
-	/// call inherited update (which calculates global matrix and updates children)
-	SceneNode::update(elapsed_time);
+	setLocalMatrix(glm::translate(glm::mat4(1.0f),mat3));
 }
@@ -13,17 +13,27 @@
 
 #include "resources/SceneNode.h"
 #include "Configuration.h"
+#include "AnimBatch.h"
+#include "ConveyorPath.h"
 
 class AnimNode : public SceneNode {
 public:
 	AnimNode(const std::string & name = "<AnimNode>", float offset = 0.0f, SceneNode* parent = NULL);
-	~AnimNode() {}
+	~AnimNode();
 
-	void update(double elapsed_time);
+	void animate(double elapsed_time);
 	static bool animation; // is the animation working
 	static Configuration config;
+	static ConveyorPath path; // built from the config
+	static bool constantSpeed; // bottles move at the same speed on short and long fragments
+	static bool batched; // are the new nodes animated by the batch (true) or one by one (false)
+	static AnimBatch batch; // animates all the batched nodes, call batch.update() before updating the scene
 protected:
 	float m_offset;
+	float m_lastTime; // animation time of the current local matrix, nothing to do if it does not change
+	int m_batchSlot; // position in the batch, -1 when animated one by one
+
+	friend class AnimBatch;
 };
 
 #endif
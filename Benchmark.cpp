@@ -0,0 +1,283 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    Benchmark.cpp
+ * \author  Miroslav Hroncok
+ *
+ * Micro-benchmarks run from the command line instead of the application, no window is opened.
+ */
+//----------------------------------------------------------------------------------------
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "Benchmark.h"
+#include "AnimNode.h"
+#include "resources/MeshGeometry.h"
+
+double preciseTime() {
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return double(counter.QuadPart)/double(frequency.QuadPart);
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+#endif
+}
+
+/// Creates the bottles the same way as the scene does, just without the meshes
+/// \param root Parent of the bottles
+/// \param count Number of bottles
+/// \param nodes Created nodes are added here
+static void createBottles(SceneNode * root, int count, std::vector<SceneNode *> & nodes) {
+	nodes.clear();
+	nodes.reserve(count);
+	for (int i=0; i < count; i++)
+		nodes.push_back(new AnimNode("bottleAnim", i*float(AnimNode::config.fragments())/count, root));
+	root->update(0.0);
+}
+
+/// Average time of one tick of the per node animation
+/// \param count Number of bottles
+/// \param ticks Number of measured ticks
+/// \return Milliseconds per tick
+static double measurePerNode(int count, int ticks) {
+	AnimNode::batched = false;
+	SceneNode * root = new SceneNode("benchmark");
+	std::vector<SceneNode *> nodes;
+	createBottles(root, count, nodes);
+
+	double total = 0.0;
+	for (int t=1; t <= ticks; t++) {
+		double time = t*0.033;
+		double start = preciseTime();
+		// exactly what the hierarchy does for every animated node
+		for (unsigned i=0; i < nodes.size(); i++) nodes[i]->animate(time);
+		total += preciseTime() - start;
+		root->update(time); // not measured, only clears the changes
+	}
+
+	delete root;
+	return 1000.0*total/ticks;
+}
+
+/// Average time of one tick of the batched animation
+/// \param count Number of bottles
+/// \param ticks Number of measured ticks
+/// \return Milliseconds per tick
+static double measureBatched(int count, int ticks) {
+	AnimNode::batched = true;
+	SceneNode * root = new SceneNode("benchmark");
+	std::vector<SceneNode *> nodes;
+	createBottles(root, count, nodes);
+
+	double total = 0.0;
+	for (int t=1; t <= ticks; t++) {
+		double time = t*0.033;
+		double start = preciseTime();
+		AnimNode::batch.update(time);
+		total += preciseTime() - start;
+		root->update(time);
+	}
+
+	AnimNode::batch.clear(); // quicker than removing the nodes one by one
+	delete root;
+	return 1000.0*total/ticks;
+}
+
+void benchmarkAnimation() {
+	const bool wasBatched = AnimNode::batched;
+	const int counts[] = {1000, 100000, 1000000};
+
+	printf("%10s %16s %16s %10s\n", "bottles", "per node [ms]", "batched [ms]", "speedup");
+	for (int c=0; c < 3; c++) {
+		int ticks = 20000000/counts[c];
+		if (ticks < 10) ticks = 10;
+		double perNode = measurePerNode(counts[c], ticks);
+		double batched = measureBatched(counts[c], ticks);
+		printf("%10d %16.4f %16.4f %9.2fx\n", counts[c], perNode, batched, perNode/batched);
+	}
+
+	AnimNode::batched = wasBatched;
+}
+
+/// The heightmap loader as it was before MeshGeometry::ReadRawHeightMap() got mapped, parallel and SSE,
+/// only the resolution is a parameter instead of the fixed 513 and exit(1) is a return
+/// \param file The .raw file
+/// \param res Resolution of the square map
+static bool legacyReadRawHeightMap(const char * file, int res, std::vector<float> & vertices, std::vector<float> & normals, std::vector<float> & texCoords) {
+	const int _resX = res;
+	const int _resZ = res;
+	const float _deltaX = 1.0f / (_resX - 1);
+	const float _deltaZ = 1.0f / (_resZ - 1);
+	const float _deltaY = 1.0f / ((_resX - 1) * (_resZ - 1));
+	const float _originX = -0.5f;
+	const float _originZ = -0.5f;
+	long int m_nVertices = _resX*_resZ;
+
+	vertices.resize(3*m_nVertices);
+	float *m_pVertices = &vertices[0];
+
+	std::cout << "Loading terrain map file " << file << " [" << _resX << "x" << _resZ << "] ";
+	std::cout.flush();
+	FILE * rawFile = fopen(file, "rb");
+	if (rawFile == NULL) return false;
+
+	typedef unsigned char BYTE;
+	BYTE *buffer = new BYTE[3*_resX];
+	for (int z=0; z<_resZ; z++) {
+		int counter = 0;
+		fread(buffer, 1, 2*_resX, rawFile);
+		for (int x=0; x<_resX; x++) {
+			BYTE low = buffer[counter++];
+			BYTE high = buffer[counter++];
+			float height = (float) (high * 0xFFL + low);
+			int idx = (_resX * z + x) * 3;
+			m_pVertices[idx] = _originX + x*_deltaX;
+			m_pVertices[idx+1] = height * _deltaY;
+			m_pVertices[idx+2] = _originZ + z*_deltaZ;
+		}
+		std::cout << ".";
+		std::cout.flush();
+	}
+	std::cout << std::endl;
+	fclose(rawFile);
+	delete [] buffer;
+
+	texCoords.resize(2*m_nVertices);
+	normals.resize(3*m_nVertices);
+	float* m_pTexCoords = &texCoords[0];
+	float* m_pNormals = &normals[0];
+	int texCoordIndex = 0;
+	int normalIndex = 0;
+	float texCoordS = 0.0f;
+	float texCoordT = 0.0f;
+	float mul = _deltaX * _deltaZ;
+
+	for (int iz = 0; iz < _resZ; iz++) {
+		texCoordS = 0.0f;
+		for (int ix = 0; ix < _resX; ix++) {
+			m_pTexCoords[texCoordIndex++] = texCoordS;
+			m_pTexCoords[texCoordIndex++] = texCoordT;
+
+			float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+			int count = 0;
+			float * point0 = m_pVertices + 3L*(iz*_resX + ix) + 1;
+			float * point1, * point2;
+			if (iz<_resZ-1 && ix<_resX-1) {
+				point1 = point0 + 3L*_resX;
+				point2 = point0 + 3L;
+				nx -= _deltaZ * (*point2 - *point0);
+				ny += mul;
+				nz -= _deltaX * (*point1 - *point0);
+				count++;
+			}
+			if (iz>0 && ix<_resX-1) {
+				point1 = point0 + 3L;
+				point2 = point0 - 3L*_resX;
+				nx -= _deltaZ * (*point1 - *point0);
+				ny += mul;
+				nz += _deltaX * (*point2 - *point0);
+				count++;
+			}
+			if (iz>0 && ix>0) {
+				point1 = point0 - 3L*_resX;
+				point2 = point0 - 3L;
+				nx += _deltaZ * (*point2 - *point0);
+				ny += mul;
+				nz += _deltaX * (*point1 - *point0);
+				count++;
+			}
+			if (iz<_resZ-1 && ix>0) {
+				point1 = point0 - 3;
+				point2 = point0 + 3L*_resX;
+				nx -= _deltaZ * (*point1 - *point0);
+				ny -= mul;
+				nz += _deltaX * (*point2 - *point0);
+				count++;
+			}
+			if (count == 0) return false;
+
+			float length = sqrt(nx*nx + ny*ny + nz*nz);
+			if (length < 1.0E-5f) {
+				nx = 0.0f; ny = 1.0f; nz = 0.0f;
+			} else {
+				nx /= length; ny /= length; nz /= length;
+			}
+			m_pNormals[normalIndex] = nx;
+			m_pNormals[normalIndex+1] = ny;
+			m_pNormals[normalIndex+2] = nz;
+			normalIndex += 3;
+			texCoordS += _deltaX;
+		}
+		texCoordT += _deltaZ;
+	}
+	return true;
+}
+
+/// Writes a square map of rolling hills in the format of the terrain
+/// \param file The .raw file
+/// \param res Resolution of the map
+/// \return False if the file cannot be written
+static bool writeHeightMap(const char * file, int res) {
+	FILE * rawFile = fopen(file, "wb");
+	if (rawFile == NULL) return false;
+	std::vector<unsigned char> row(2*res);
+	for (int z=0; z < res; z++) {
+		for (int x=0; x < res; x++) {
+			int height = int(30000.0 + 15000.0*sin(x*12.0/res)*cos(z*9.0/res) + 5000.0*sin((x+2*z)*40.0/res));
+			row[2*x] = (unsigned char)(height & 0xFF);
+			row[2*x+1] = (unsigned char)(height >> 8);
+		}
+		fwrite(&row[0], 1, row.size(), rawFile);
+	}
+	fclose(rawFile);
+	return true;
+}
+
+void benchmarkHeightMap() {
+	const int resolutions[] = {513, 2049, 8193};
+	const char * path = "heightmap-benchmark";
+	const char * file = "heightmap-benchmark.raw";
+
+	double results[3][2];
+	float difference[3];
+	for (int r=0; r < 3; r++) {
+		const int res = resolutions[r];
+		if (!writeHeightMap(file, res)) {
+			printf("cannot write %s\n", file);
+			return;
+		}
+
+		// the vertices are compared, the rest is freed before the new loader runs
+		std::vector<float> legacyVertices, vertices, normals, texCoords;
+		double start = preciseTime();
+		legacyReadRawHeightMap(file, res, legacyVertices, normals, texCoords);
+		results[r][0] = 1000.0*(preciseTime() - start);
+		std::vector<float>().swap(normals);
+		std::vector<float>().swap(texCoords);
+
+		int resX = 0, resZ = 0;
+		start = preciseTime();
+		MeshGeometry::ReadRawHeightMap(path, resX, resZ, vertices, normals, texCoords);
+		results[r][1] = 1000.0*(preciseTime() - start);
+
+		difference[r] = 0.0f;
+		for (unsigned i=0; i < vertices.size() && i < legacyVertices.size(); i++)
+			difference[r] = std::max(difference[r], float(fabs(vertices[i] - legacyVertices[i])));
+	}
+	remove(file);
+
+	printf("%10s %16s %16s %10s %14s\n", "map", "previous [ms]", "current [ms]", "speedup", "max |dpos|");
+	for (int r=0; r < 3; r++)
+		printf("%4dx%-5d %16.1f %16.1f %9.2fx %14g\n", resolutions[r], resolutions[r], results[r][0], results[r][1],
+			results[r][0]/results[r][1], difference[r]);
+}
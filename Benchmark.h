@@ -0,0 +1,23 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    Benchmark.h
+ * \author  Miroslav Hroncok
+ *
+ * Micro-benchmarks run from the command line instead of the application, no window is opened.
+ */
+//----------------------------------------------------------------------------------------
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/// High resolution time for the measurements
+/// \return Time in seconds from some fixed point
+double preciseTime();
+
+/// Compares AnimNode::animate() called for every bottle with AnimBatch for 1k, 100k and 1M bottles
+void benchmarkAnimation();
+
+/// Compares the previous heightmap loader with MeshGeometry::ReadRawHeightMap() for 513^2, 2049^2 and 8193^2 maps
+void benchmarkHeightMap();
+
+#endif
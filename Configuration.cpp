@@ -9,32 +9,42 @@
 //----------------------------------------------------------------------------------------
 #include "Configuration.h"
 
-/// The constructor loads the values
-/// \param filename Filename of teh config file (config.txt is used as default)
-Configuration::Configuration(const std::string & filename) {
-	std::ifstream * m_config = new std::ifstream(filename);
-	if (!m_config->is_open() || !(*m_config >> m_bottles) || !(*m_config >> m_fragments)) {
-		printf("Cannot open/read config file %s\n",filename);
-		exit(1);
+Configuration::Configuration(): m_bottles(0), m_fragments(0), m_points(NULL), m_vectors(NULL) {
+}
+
+Configuration::~Configuration() {
+	free(m_points);
+	free(m_vectors);
+}
+
+/// \param filename Filename of the config file
+bool Configuration::load(const std::string & filename) {
+	std::ifstream config(filename.c_str());
+	int bottles, fragments;
+	if (!config.is_open() || !(config >> bottles) || !(config >> fragments) || fragments <= 0) {
+		printf("Cannot open/read config file %s\n",filename.c_str());
+		return false;
 	}
-	m_points = (glm::vec3 *) malloc(sizeof(glm::vec3)*m_fragments);
-	m_vectors = (glm::vec3 *) malloc(sizeof(glm::vec3)*m_fragments);
-	for (int i=0; i < m_fragments; i++) {
-		m_points[i] = glm::vec3(0.0f);
-		m_vectors[i] = glm::vec3(0.0f);
+	glm::vec3 * points = (glm::vec3 *) malloc(sizeof(glm::vec3)*fragments);
+	glm::vec3 * vectors = (glm::vec3 *) malloc(sizeof(glm::vec3)*fragments);
+	for (int i=0; i < fragments; i++) {
+		points[i] = glm::vec3(0.0f);
+		vectors[i] = glm::vec3(0.0f);
 		// the config file only works for 2D (add loading Y here, if you want different)
-		if (!(*m_config >> m_points[i].x) || !(*m_config >> m_points[i].z) || !(*m_config >> m_vectors[i].x) || !(*m_config >> m_vectors[i].z)) {
-			printf("Cannot open/read config file %s on point n. %d\n",filename,i);
-			exit(1);
+		if (!(config >> points[i].x) || !(config >> points[i].z) || !(config >> vectors[i].x) || !(config >> vectors[i].z)) {
+			printf("Cannot open/read config file %s on point n. %d\n",filename.c_str(),i);
+			free(points);
+			free(vectors);
+			return false;
 		}
 	}
-	m_config->close();
-	delete(m_config);
-}
-
-Configuration::~Configuration() {
-	delete(m_points);
-	delete(m_vectors);
+	free(m_points);
+	free(m_vectors);
+	m_bottles = bottles;
+	m_fragments = fragments;
+	m_points = points;
+	m_vectors = vectors;
+	return true;
 }
 
 /// Bottles getter
@@ -17,9 +17,15 @@
 
 class Configuration {
 public:
-	Configuration(const std::string & filename = "config.txt");
+	/// Empty, without any file read (a static one must not depend on the working directory), see load()
+	Configuration();
 	~Configuration();
+	/// Replaces the values by the ones from another file, they stay untouched if it cannot be read
+	/// \return False if the file cannot be opened or read
+	bool load(const std::string & filename);
 	int bottles();
+	/// Overrides the number of bottles from the file
+	void setBottles(int bottles) { m_bottles = bottles; }
 	int fragments();
 	glm::vec3 * points();
 	glm::vec3 * vectors();
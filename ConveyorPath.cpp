@@ -0,0 +1,86 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    ConveyorPath.cpp
+ * \author  Miroslav Hroncok
+ *
+ * The closed path of the conveyor belt built from the points and vectors in the config.
+ * Arc length is measured once at load, so the bottles can move at a constant speed
+ * and the position at any distance is just a look into a table.
+ */
+//----------------------------------------------------------------------------------------
+#include <cmath>
+#include "ConveyorPath.h"
+
+/// Builds the coefficients of the fragments, measures them and fills the table
+ConveyorPath::ConveyorPath(Configuration & config, int samples): m_fragments(config.fragments()), m_length(0.0f), m_step(0.0f) {
+	// The curve of one fragment is start*F1 + end*F2 + startv*F3 + endv*F4, multiplied out
+	// it is just a cubic polynomial in the decimal part of the time.
+	if (m_fragments == 0) return; // the config is not loaded yet
+	m_coefficients.resize(8*m_fragments);
+	for (int i=0; i < m_fragments; i++) {
+		glm::vec3 start = config.points()[i];
+		glm::vec3 end = config.points()[(i+1)%m_fragments];
+		// F.r and F.s in AnimNode::animate() are both the x component of the glm::vec4,
+		// so the startv is weighted by F4 as well, keep the bottles on the very same path
+		glm::vec3 v = config.vectors()[i] - config.vectors()[(i+1)%m_fragments];
+		float * c = &m_coefficients[8*i];
+		c[0] = start.x;
+		c[1] = 0.0f;
+		c[2] = 3*(end.x-start.x) - v.x;
+		c[3] = 2*(start.x-end.x) + v.x;
+		c[4] = start.z;
+		c[5] = 0.0f;
+		c[6] = 3*(end.z-start.z) - v.z;
+		c[7] = 2*(start.z-end.z) + v.z;
+	}
+
+	// cumulative arc length, the curve is approximated by short lines
+	const int count = m_fragments*samples;
+	std::vector<float> lengths(count+1, 0.0f);
+	glm::vec3 last = curvePosition(0.0f);
+	for (int k=1; k <= count; k++) {
+		glm::vec3 point = curvePosition(float(k)/samples);
+		glm::vec3 d = point - last;
+		lengths[k] = lengths[k-1] + sqrt(d.x*d.x + d.z*d.z);
+		last = point;
+	}
+	m_length = lengths[count];
+	m_step = m_length/count;
+
+	// the same number of entries, but evenly spaced by the distance instead of the time
+	m_tableX.resize(count+1);
+	m_tableZ.resize(count+1);
+	int k = 0;
+	for (int j=0; j < count; j++) {
+		float distance = j*m_step;
+		while (k < count-1 && lengths[k+1] <= distance) k++; // the distances only grow, no need to search from the start
+		float segment = lengths[k+1] - lengths[k];
+		float part = segment > 0.0f ? (distance - lengths[k])/segment : 0.0f;
+		glm::vec3 point = curvePosition((k + part)/samples);
+		m_tableX[j] = point.x;
+		m_tableZ[j] = point.z;
+	}
+	// the loop is closed
+	m_tableX[count] = m_tableX[0];
+	m_tableZ[count] = m_tableZ[0];
+}
+
+glm::vec3 ConveyorPath::curvePosition(float time) const {
+	float dec = time - floor(time); // decimal part
+	int seconds = int(time - dec); // full part
+	int fragment = seconds%m_fragments;
+	if (fragment < 0) fragment += m_fragments;
+	const float * c = &m_coefficients[8*fragment];
+	return glm::vec3(((c[3]*dec + c[2])*dec + c[1])*dec + c[0], 0.0f, ((c[7]*dec + c[6])*dec + c[5])*dec + c[4]);
+}
+
+glm::vec3 ConveyorPath::position(float distance) const {
+	float s = fmod(distance, m_length);
+	if (s < 0.0f) s += m_length;
+	float index = s/m_step;
+	unsigned i = unsigned(index);
+	if (i >= tableSize()) i = tableSize()-1; // rounding at the very end of the loop
+	float part = index - i;
+	// linear between the two nearest entries
+	return glm::vec3(m_tableX[i] + (m_tableX[i+1]-m_tableX[i])*part, 0.0f, m_tableZ[i] + (m_tableZ[i+1]-m_tableZ[i])*part);
+}
@@ -0,0 +1,57 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    ConveyorPath.h
+ * \author  Miroslav Hroncok
+ *
+ * The closed path of the conveyor belt built from the points and vectors in the config.
+ * Arc length is measured once at load, so the bottles can move at a constant speed
+ * and the position at any distance is just a look into a table.
+ */
+//----------------------------------------------------------------------------------------
+
+#ifndef CONVEYOR_PATH_H
+#define CONVEYOR_PATH_H
+
+#include <vector>
+#include "Configuration.h"
+
+class ConveyorPath {
+public:
+	/// \param config Config with the points and vectors, an empty (not loaded) one gives an empty path
+	/// \param samples Number of table entries per fragment
+	ConveyorPath(Configuration & config, int samples = 64);
+
+	/// Number of fragments (segments) of the path
+	int fragments() const { return m_fragments; }
+	/// Length of the whole loop
+	float length() const { return m_length; }
+
+	/// Position in the original parametrisation, where every fragment takes 1 regardless of its length
+	/// \param time Time in fragments, the same as in AnimNode::animate()
+	glm::vec3 curvePosition(float time) const;
+
+	/// Distance the belt moves in the time, one loop takes the same time as with curvePosition()
+	/// \param time Time in fragments
+	float beltDistance(float time) const { return time*m_length/m_fragments; }
+
+	/// Position at the distance from the first point, in O(1)
+	/// \param distance Distance along the path, any value, the path is a loop
+	glm::vec3 position(float distance) const;
+
+	/// Polynomial coefficients of the fragments, 8 per fragment: x for d^0 - d^3, then z
+	const float * coefficients() const { return &m_coefficients[0]; }
+
+	/// Positions evenly spaced by step(), tableSize() + 1 entries (the last one is the first point again)
+	const float * tableX() const { return &m_tableX[0]; }
+	const float * tableZ() const { return &m_tableZ[0]; }
+	unsigned tableSize() const { return m_tableX.size() - 1; }
+	float step() const { return m_step; }
+protected:
+	int m_fragments;
+	float m_length;
+	float m_step; // distance between two entries of the table
+	std::vector<float> m_coefficients;
+	std::vector<float> m_tableX, m_tableZ;
+};
+
+#endif
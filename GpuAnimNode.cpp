@@ -0,0 +1,382 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    GpuAnimNode.cpp
+ * \author  Miroslav Hroncok
+ *
+ * Draws all the bottles at once and moves them along the path in the vertex shader.
+ * The path is uploaded once, every bottle is just its offset, so there is no work
+ * per bottle on the CPU at all (no AnimNode, no matrices).
+ * The local matrix of this node is the transformation of one bottle without the path.
+ *
+ * With GPU culling, cull() first runs the bottles through a vertex and geometry shader
+ * with rasterization off, which test the bounding sphere of each bottle against the view
+ * frustum and capture the offsets of the visible ones by transform feedback. draw() then
+ * takes its instances from that compacted buffer. The number of the captured offsets never
+ * comes back to the CPU in the same frame: with OpenGL 4.4 the query writes it straight into
+ * the instance counts of indirect draws, otherwise the passes alternate between two buffers
+ * and draw() uses the one of the last frame as soon as its query is available (all the
+ * bottles before), so the visible set is one frame late there.
+ */
+//----------------------------------------------------------------------------------------
+#include <iostream>
+#include <algorithm>
+#include <cstddef>
+#include "GpuAnimNode.h"
+#include "AnimNode.h"
+#include "resources/MeshGeometry.h"
+#include "resources/Resources.h"
+#include "resources/ShaderProgram.h"
+#include "resources/Frustum.h"
+#include "resources/ShaderVariants.h"
+#include "resources/GLState.h"
+
+/// Texture units of the path, 0 is the texture of the mesh and 1 the cube map
+const int PATH_TABLE_UNIT = 2;
+const int PATH_CURVE_UNIT = 3;
+
+/// The layout glDrawElementsIndirect() reads
+struct DrawCommand {
+	GLuint count;
+	GLuint instanceCount; // written by the culling query
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+GpuAnimNode::GpuAnimNode(const std::string &name, SceneNode* parent):
+	SceneNode(name, parent), m_program(NULL), m_entriesPerFragment(0.0f), m_mesh(NULL), m_offsetsChanged(false),
+	m_gpuCulling(false), m_cullProgram(NULL), m_cullSlot(0), m_culled(false), m_queryBuffer(queryBufferSupported()), m_visibleCount(0) {
+	glGenVertexArrays(1, &m_vertexArrayObject);
+	glGenVertexArrays(1, &m_cullVertexArrayObject);
+	glGenVertexArrays(2, m_visibleVertexArrayObject);
+	glGenBuffers(1, &m_offsetBufferObject);
+	glGenBuffers(2, m_visibleBufferObject);
+	glGenQueries(2, m_visibleQuery);
+	m_captured[0] = m_captured[1] = false;
+	glGenBuffers(1, &m_commandBufferObject);
+	glGenBuffers(1, &m_tableBufferObject);
+	glGenBuffers(1, &m_curveBufferObject);
+	glGenTextures(1, &m_tableTexture);
+	glGenTextures(1, &m_curveTexture);
+}
+
+GpuAnimNode::~GpuAnimNode() {
+	GLState::Instance()->deleteTextures(1, &m_curveTexture);
+	GLState::Instance()->deleteTextures(1, &m_tableTexture);
+	GLState::Instance()->deleteBuffers(1, &m_curveBufferObject);
+	GLState::Instance()->deleteBuffers(1, &m_tableBufferObject);
+	GLState::Instance()->deleteBuffers(1, &m_commandBufferObject);
+	glDeleteQueries(2, m_visibleQuery);
+	GLState::Instance()->deleteBuffers(2, m_visibleBufferObject);
+	GLState::Instance()->deleteBuffers(1, &m_offsetBufferObject);
+	GLState::Instance()->deleteVertexArrays(2, m_visibleVertexArrayObject);
+	GLState::Instance()->deleteVertexArrays(1, &m_cullVertexArrayObject);
+	GLState::Instance()->deleteVertexArrays(1, &m_vertexArrayObject);
+	if (m_program) ShaderVariants::Instance()->release(m_program);
+	if (m_cullProgram) ShaderManager::Instance()->release("GpuAnimCull-shader");
+}
+
+bool GpuAnimNode::gpuCullingSupported() {
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	return major > 3 || (major == 3 && minor >= 2);
+}
+
+bool GpuAnimNode::queryBufferSupported() {
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	return major > 4 || (major == 4 && minor >= 4);
+}
+
+void GpuAnimNode::loadProgram() {
+	if (m_program) ShaderVariants::Instance()->release(m_program);
+	m_program = ShaderVariants::Instance()->get("resources/GpuAnimNode.vert", "resources/MeshNode.frag", ShaderVariants::Instance()->sceneFeatures());
+	m_pathTime = glGetUniformLocation(m_program->m_programId, "pathTime");
+	m_constantSpeed = glGetUniformLocation(m_program->m_programId, "constantSpeed");
+	m_pathScale = glGetUniformLocation(m_program->m_programId, "pathScale");
+	m_pathTable = glGetUniformLocation(m_program->m_programId, "pathTable");
+	m_pathCurve = glGetUniformLocation(m_program->m_programId, "pathCurve");
+	m_instanceOffset = glGetAttribLocation(m_program->m_programId, "instanceOffset");
+
+	m_gpuCulling = gpuCullingSupported() && loadCullProgram();
+}
+
+bool GpuAnimNode::loadCullProgram() {
+	if (m_cullProgram) ShaderManager::Instance()->release("GpuAnimCull-shader");
+	if (!ShaderManager::Instance()->exists("GpuAnimCull-shader")) {
+		GLuint shaderList[] = {
+			pgr::createShaderFromFile(GL_VERTEX_SHADER,   "resources/GpuAnimCull.vert"),
+			pgr::createShaderFromFile(GL_GEOMETRY_SHADER, "resources/GpuAnimCull.geom"),
+			0
+		};
+		GLuint program = pgr::createProgram(shaderList);
+		// the captured output has to be known before linking, so link once more
+		const char * varyings[] = { "visibleOffset" };
+		glTransformFeedbackVaryings(program, 1, varyings, GL_INTERLEAVED_ATTRIBS);
+		glLinkProgram(program);
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE) {
+			std::cerr << "GpuAnimNode::loadCullProgram(): culling program failed to link, bottles are not culled" << std::endl;
+			GLState::Instance()->deleteProgram(program);
+			m_cullProgram = NULL;
+			return false;
+		}
+		m_cullProgram = new BasicShaderProgram(program);
+		ShaderManager::Instance()->insert("GpuAnimCull-shader", m_cullProgram);
+	}
+	else m_cullProgram = ShaderManager::Instance()->get("GpuAnimCull-shader");
+
+	m_cullProgram->initLocations();
+	m_cullPathTime = glGetUniformLocation(m_cullProgram->m_programId, "pathTime");
+	m_cullConstantSpeed = glGetUniformLocation(m_cullProgram->m_programId, "constantSpeed");
+	m_cullPathScale = glGetUniformLocation(m_cullProgram->m_programId, "pathScale");
+	m_cullPathTable = glGetUniformLocation(m_cullProgram->m_programId, "pathTable");
+	m_cullPathCurve = glGetUniformLocation(m_cullProgram->m_programId, "pathCurve");
+	m_cullSphereCenter = glGetUniformLocation(m_cullProgram->m_programId, "sphereCenter");
+	m_cullSphereRadius = glGetUniformLocation(m_cullProgram->m_programId, "sphereRadius");
+	m_cullPlanes = glGetUniformLocation(m_cullProgram->m_programId, "planes");
+	m_cullInstanceOffset = glGetAttribLocation(m_cullProgram->m_programId, "instanceOffset");
+	return true;
+}
+
+/// \param mesh Mesh of one bottle
+void GpuAnimNode::setGeometry(MeshGeometry * mesh) {
+	if (m_program == NULL) loadProgram();
+	if (mesh == NULL) return;
+	m_mesh = mesh;
+
+	GLState::Instance()->bindVertexArray(m_vertexArrayObject);
+	mesh->bindAttributes(m_program->m_pos, m_program->m_normal, m_program->m_texCoord);
+
+	// the offset advances once per bottle instead of once per vertex
+	GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_offsetBufferObject);
+	glEnableVertexAttribArray(m_instanceOffset);
+	glVertexAttribPointer(m_instanceOffset, 1, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribDivisor(m_instanceOffset, 1);
+
+	// the same, with the offsets of the visible bottles only
+	for (int slot=0; slot < 2; slot++) {
+		GLState::Instance()->bindVertexArray(m_visibleVertexArrayObject[slot]);
+		mesh->bindAttributes(m_program->m_pos, m_program->m_normal, m_program->m_texCoord);
+		GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_visibleBufferObject[slot]);
+		glEnableVertexAttribArray(m_instanceOffset);
+		glVertexAttribPointer(m_instanceOffset, 1, GL_FLOAT, GL_FALSE, 0, 0);
+		glVertexAttribDivisor(m_instanceOffset, 1);
+	}
+
+	// the draws of the culled bottles, cull() fills in the instance counts
+	if (m_queryBuffer) {
+		std::vector<DrawCommand> commands(mesh->getSubMeshCount());
+		for (unsigned mat=0; mat < commands.size(); mat++) {
+			const MeshGeometry::SubMesh & subMesh = *mesh->getSubMesh(mat);
+			commands[mat].count = subMesh.nIndices;
+			commands[mat].instanceCount = 0;
+			commands[mat].firstIndex = GLuint(size_t(mesh->getIndexOffset(subMesh)) / mesh->getIndexSize());
+			commands[mat].baseVertex = mesh->getBaseVertex(subMesh);
+			commands[mat].baseInstance = 0;
+		}
+		GLState::Instance()->bindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBufferObject);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size()*sizeof(DrawCommand), commands.empty() ? NULL : &commands[0], GL_DYNAMIC_COPY);
+		GLState::Instance()->bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// the culling pass reads every offset as a point
+	if (m_cullProgram) {
+		GLState::Instance()->bindVertexArray(m_cullVertexArrayObject);
+		GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_offsetBufferObject);
+		glEnableVertexAttribArray(m_cullInstanceOffset);
+		glVertexAttribPointer(m_cullInstanceOffset, 1, GL_FLOAT, GL_FALSE, 0, 0);
+	}
+
+	GLState::Instance()->bindVertexArray(0);
+	GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/// \param path Path of the belt, the node does not keep it
+void GpuAnimNode::setPath(const ConveyorPath & path) {
+	// table entries interleaved, so one texel is one (x, z) position
+	std::vector<float> table(2*(path.tableSize()+1));
+	for (unsigned i=0; i <= path.tableSize(); i++) {
+		table[2*i] = path.tableX()[i];
+		table[2*i+1] = path.tableZ()[i];
+	}
+	m_entriesPerFragment = path.beltDistance(1.0f)/path.step();
+
+	GLState::Instance()->bindBuffer(GL_TEXTURE_BUFFER, m_tableBufferObject);
+	glBufferData(GL_TEXTURE_BUFFER, table.size()*sizeof(float), &table[0], GL_STATIC_DRAW);
+	GLState::Instance()->bindBuffer(GL_TEXTURE_BUFFER, m_curveBufferObject);
+	glBufferData(GL_TEXTURE_BUFFER, 8*path.fragments()*sizeof(float), path.coefficients(), GL_STATIC_DRAW);
+	GLState::Instance()->bindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	// left bound to the units the draws read them from
+	GLState::Instance()->bindTexture(GL_TEXTURE0 + PATH_TABLE_UNIT, GL_TEXTURE_BUFFER, m_tableTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, m_tableBufferObject);
+	GLState::Instance()->bindTexture(GL_TEXTURE0 + PATH_CURVE_UNIT, GL_TEXTURE_BUFFER, m_curveTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_curveBufferObject);
+}
+
+/// \param offset Time offset of the bottle, the same as the one of AnimNode
+void GpuAnimNode::addInstance(float offset) {
+	m_offsets.push_back(offset);
+	m_offsetsChanged = true;
+}
+
+void GpuAnimNode::uploadOffsets() {
+	// the offsets only change when bottles are added, not every frame
+	if (!m_offsetsChanged) return;
+	GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_offsetBufferObject);
+	glBufferData(GL_ARRAY_BUFFER, m_offsets.size()*sizeof(float), &m_offsets[0], GL_STATIC_DRAW);
+	// room for all of them being visible, the passes captured so far are gone
+	for (int slot=0; slot < 2; slot++) {
+		GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_visibleBufferObject[slot]);
+		glBufferData(GL_ARRAY_BUFFER, m_offsets.size()*sizeof(float), NULL, GL_DYNAMIC_COPY);
+		m_captured[slot] = false;
+	}
+	GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, 0);
+	m_offsetsChanged = false;
+}
+
+void GpuAnimNode::cull(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix) {
+	if (!m_gpuCulling || m_mesh == NULL || m_offsets.empty()) return;
+	uploadOffsets();
+
+	// bounding sphere of one bottle, the path only translates it
+	const glm::mat4 & Mmatrix = globalMatrix();
+	const glm::vec3 center = 0.5f * (m_mesh->getBoundsMin() + m_mesh->getBoundsMax());
+	const glm::vec3 halfSize = 0.5f * (m_mesh->getBoundsMax() - m_mesh->getBoundsMin());
+	const float scale = std::max(glm::length(glm::vec3(Mmatrix[0])), std::max(glm::length(glm::vec3(Mmatrix[1])), glm::length(glm::vec3(Mmatrix[2]))));
+	const Frustum frustum(projection_matrix * view_matrix);
+	glm::vec4 planes[Frustum::PLANE_COUNT];
+	for (unsigned i = 0; i < Frustum::PLANE_COUNT; i++) planes[i] = frustum.plane(i);
+
+	GLState::Instance()->useProgram(m_cullProgram->m_programId);
+	GLState::Instance()->uniformMatrix4fv(m_cullProgram->m_Mmatrix, glm::value_ptr(Mmatrix));
+	GLState::Instance()->uniform3fv(m_cullSphereCenter, 1, glm::value_ptr(center));
+	GLState::Instance()->uniform1f(m_cullSphereRadius, scale * glm::length(halfSize));
+	GLState::Instance()->uniform4fv(m_cullPlanes, Frustum::PLANE_COUNT, glm::value_ptr(planes[0]));
+	// the same path uniforms as draw() sets
+	GLState::Instance()->uniform1f(m_cullPathTime, AnimNode::animation ? elapsedTime()/3.0f : 0.0f);
+	GLState::Instance()->uniform1i(m_cullConstantSpeed, AnimNode::constantSpeed);
+	GLState::Instance()->uniform1f(m_cullPathScale, m_entriesPerFragment);
+	GLState::Instance()->uniform1i(m_cullPathTable, PATH_TABLE_UNIT);
+	GLState::Instance()->uniform1i(m_cullPathCurve, PATH_CURVE_UNIT);
+	GLState::Instance()->bindTexture(GL_TEXTURE0 + PATH_TABLE_UNIT, GL_TEXTURE_BUFFER, m_tableTexture);
+	GLState::Instance()->bindTexture(GL_TEXTURE0 + PATH_CURVE_UNIT, GL_TEXTURE_BUFFER, m_curveTexture);
+	GLState::Instance()->activeTexture(GL_TEXTURE0);
+
+	// the other slot than the last frame used, draw() may still take that one
+	const int slot = m_cullSlot = 1 - m_cullSlot;
+
+	// nothing is rasterized, the visible offsets are only captured
+	GLState::Instance()->setEnabled(GL_RASTERIZER_DISCARD, true);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_visibleBufferObject[slot]);
+	glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, m_visibleQuery[slot]);
+	glBeginTransformFeedback(GL_POINTS);
+	GLState::Instance()->bindVertexArray(m_cullVertexArrayObject);
+	glDrawArrays(GL_POINTS, 0, m_offsets.size());
+	glEndTransformFeedback();
+	glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	GLState::Instance()->setEnabled(GL_RASTERIZER_DISCARD, false);
+
+	// the GPU copies the count to the instance counts of the draws when the pass is done, the CPU does not wait
+	if (m_queryBuffer) {
+		glBindBuffer(GL_QUERY_BUFFER, m_commandBufferObject);
+		for (unsigned mat=0; mat < m_mesh->getSubMeshCount(); mat++)
+			glGetQueryObjectuiv(m_visibleQuery[slot], GL_QUERY_RESULT, (GLuint *) (mat*sizeof(DrawCommand) + offsetof(DrawCommand, instanceCount)));
+		glBindBuffer(GL_QUERY_BUFFER, 0);
+	}
+
+	// get the pass going, the next frame finds its query available
+	glFlush();
+	m_captured[slot] = true;
+	m_culled = true;
+}
+
+void GpuAnimNode::draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix) {
+	SceneNode::draw(view_matrix, projection_matrix);
+	if (m_mesh == NULL || m_offsets.empty()) return;
+
+	uploadOffsets();
+
+	// the count of this frame's pass would make the CPU wait for the GPU, the last frame's one is
+	// only read once it is available
+	GLuint instances = m_offsets.size();
+	GLuint vertexArray = m_vertexArrayObject;
+	bool indirect = false;
+	if (m_culled) {
+		const int last = 1 - m_cullSlot;
+		GLuint available = GL_FALSE, lastCount = 0;
+		if (m_captured[last]) glGetQueryObjectuiv(m_visibleQuery[last], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			glGetQueryObjectuiv(m_visibleQuery[last], GL_QUERY_RESULT, &lastCount);
+			m_captured[last] = false; // read, no need to ask again
+			m_visibleCount = lastCount;
+		}
+		if (m_queryBuffer) {
+			// this frame's pass, its count is in m_commandBufferObject
+			vertexArray = m_visibleVertexArrayObject[m_cullSlot];
+			indirect = true;
+		}
+		else if (available) {
+			vertexArray = m_visibleVertexArrayObject[last];
+			instances = lastCount;
+		}
+		m_culled = false;
+	}
+	else {
+		// culling is off, the slots would be stale when it is on again
+		m_captured[0] = m_captured[1] = false;
+		m_visibleCount = instances;
+	}
+	if (instances == 0) return;
+
+	GLState::Instance()->polygonMode(GL_FILL);
+
+	// view, projection and time are in the Frame block (FrameUniforms)
+	glm::mat4 Mmatrix = globalMatrix();
+
+	GLState::Instance()->useProgram(m_program->m_programId);
+	GLState::Instance()->uniformMatrix4fv(m_program->m_Mmatrix, glm::value_ptr(Mmatrix));
+	glm::mat4 NormalMatrix = glm::transpose(glm::inverse(view_matrix * Mmatrix));
+	GLState::Instance()->uniformMatrix4fv(m_program->m_NormalMatrix, glm::value_ptr(NormalMatrix));
+	GLState::Instance()->uniform3fv(m_program->m_positionOffset, 1, glm::value_ptr(m_mesh->getPositionOffset()));
+	GLState::Instance()->uniform3fv(m_program->m_positionScale, 1, glm::value_ptr(m_mesh->getPositionScale()));
+
+	// the same time as AnimNode::animate() uses, stopped animation shows the time 0
+	GLState::Instance()->uniform1f(m_pathTime, AnimNode::animation ? elapsedTime()/3.0f : 0.0f);
+	GLState::Instance()->uniform1i(m_constantSpeed, AnimNode::constantSpeed);
+	GLState::Instance()->uniform1f(m_pathScale, m_entriesPerFragment);
+	GLState::Instance()->uniform1i(m_pathTable, PATH_TABLE_UNIT);
+	GLState::Instance()->uniform1i(m_pathCurve, PATH_CURVE_UNIT);
+	GLState::Instance()->bindTexture(GL_TEXTURE0 + PATH_TABLE_UNIT, GL_TEXTURE_BUFFER, m_tableTexture);
+	GLState::Instance()->bindTexture(GL_TEXTURE0 + PATH_CURVE_UNIT, GL_TEXTURE_BUFFER, m_curveTexture);
+
+	GLState::Instance()->bindVertexArray(vertexArray);
+	for (unsigned mat=0; mat < m_mesh->getSubMeshCount(); mat++) {
+		MeshGeometry::SubMesh * subMesh_p = m_mesh->getSubMesh(mat);
+
+		GLState::Instance()->uniform3fv(m_program->m_diffuse,  1, subMesh_p->diffuse);
+		GLState::Instance()->uniform3fv(m_program->m_ambient,  1, subMesh_p->ambient);
+		GLState::Instance()->uniform3fv(m_program->m_specular, 1, subMesh_p->specular);
+		GLState::Instance()->uniform1f(m_program->m_shininess,    subMesh_p->shininess);
+
+		if (subMesh_p->textureID != 0 && m_mesh->hasTexCoords()) {
+			GLState::Instance()->uniform1i(m_program->m_useTexture, 1);
+			GLState::Instance()->uniform1i(m_program->m_texSampler, 0);
+			GLState::Instance()->bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, subMesh_p->textureID);
+		}
+		else GLState::Instance()->uniform1i(m_program->m_useTexture, 0);
+
+		if (indirect) {
+			GLState::Instance()->bindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBufferObject);
+			glDrawElementsIndirect(GL_TRIANGLES, m_mesh->getIndexType(), (const void *) (mat*sizeof(DrawCommand)));
+		}
+		else glDrawElementsInstancedBaseVertex(GL_TRIANGLES, subMesh_p->nIndices, m_mesh->getIndexType(), m_mesh->getIndexOffset(*subMesh_p),
+		                                       instances, m_mesh->getBaseVertex(*subMesh_p));
+	}
+	GLState::Instance()->activeTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,99 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    GpuAnimNode.h
+ * \author  Miroslav Hroncok
+ *
+ * Draws all the bottles at once and moves them along the path in the vertex shader.
+ * The path is uploaded once, every bottle is just its offset, so there is no work
+ * per bottle on the CPU at all (no AnimNode, no matrices).
+ * The local matrix of this node is the transformation of one bottle without the path.
+ *
+ * With GPU culling, cull() first runs the bottles through a vertex and geometry shader
+ * with rasterization off, which test the bounding sphere of each bottle against the view
+ * frustum and capture the offsets of the visible ones by transform feedback. draw() then
+ * takes its instances from that compacted buffer. The number of the captured offsets never
+ * comes back to the CPU in the same frame: with OpenGL 4.4 the query writes it straight into
+ * the instance counts of indirect draws, otherwise the passes alternate between two buffers
+ * and draw() uses the one of the last frame as soon as its query is available (all the
+ * bottles before), so the visible set is one frame late there.
+ */
+//----------------------------------------------------------------------------------------
+
+#ifndef GPU_ANIM_NODE_H
+#define GPU_ANIM_NODE_H
+
+#include <vector>
+#include "resources/SceneNode.h"
+#include "ConveyorPath.h"
+
+class MeshGeometry;
+class BasicShaderProgram;
+class MeshShaderProgram;
+
+class GpuAnimNode : public SceneNode {
+public:
+	GpuAnimNode(const std::string & name = "<GpuAnimNode>", SceneNode* parent = NULL);
+	~GpuAnimNode();
+
+	/// Associates mesh with this node (also loads the shader)
+	void setGeometry(MeshGeometry * mesh);
+	/// Uploads the table and the curve of the path, do it once
+	void setPath(const ConveyorPath & path);
+	/// Adds one bottle
+	void addInstance(float offset);
+	/// Number of bottles
+	unsigned getInstanceCount() const { return m_offsets.size(); }
+
+	/// Culls the bottles on the GPU, call before drawing the scene so the draw does not wait for it
+	void cull(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+	/// Switches the culling pass, stays off without OpenGL 3.2 (geometry shaders)
+	void setGpuCulling(bool enabled) { m_gpuCulling = enabled && gpuCullingSupported(); }
+	bool gpuCulling() const { return m_gpuCulling; }
+	/// Bottles visible by the latest culling pass the GPU finished, all of them without culling
+	unsigned visibleCount() const { return m_visibleCount; }
+	/// True if the context has geometry shaders, transform feedback comes with OpenGL 3.0
+	static bool gpuCullingSupported();
+	/// True with OpenGL 4.4, queries can write their results to a buffer and the draws take it from there
+	static bool queryBufferSupported();
+
+	void draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+protected:
+	void loadProgram();
+	/// Builds the culling program, returns false if it failed to link
+	bool loadCullProgram();
+	/// Uploads the offsets if bottles were added
+	void uploadOffsets();
+
+	MeshShaderProgram * m_program;
+	// locations only this shader has
+	GLint m_pathTime, m_constantSpeed, m_pathScale, m_pathTable, m_pathCurve, m_instanceOffset;
+
+	GLuint m_vertexArrayObject;
+	GLuint m_offsetBufferObject; // one float per bottle
+	GLuint m_tableBufferObject, m_tableTexture; // ConveyorPath table, (x, z) per entry
+	GLuint m_curveBufferObject, m_curveTexture; // ConveyorPath coefficients, two texels per fragment
+	float m_entriesPerFragment; // table entries per fragment of time (pathScale in the shader)
+	MeshGeometry * m_mesh;
+
+	std::vector<float> m_offsets;
+	bool m_offsetsChanged; // upload the offsets before the next draw
+
+	bool m_gpuCulling;
+	BasicShaderProgram * m_cullProgram;
+	// locations of the culling shader
+	GLint m_cullPathTime, m_cullConstantSpeed, m_cullPathScale, m_cullPathTable, m_cullPathCurve;
+	GLint m_cullSphereCenter, m_cullSphereRadius, m_cullPlanes, m_cullInstanceOffset;
+	GLuint m_cullVertexArrayObject; // the offsets as points
+	// cull() alternates between two slots, so the last frame's one can be drawn while the GPU fills the other
+	GLuint m_visibleVertexArrayObject[2]; // the mesh with the visible offsets per instance
+	GLuint m_visibleBufferObject[2]; // offsets of the visible bottles, captured by cull()
+	GLuint m_visibleQuery[2]; // number of the captured offsets
+	bool m_captured[2]; // the slot holds a pass of the current offsets, its query was issued
+	int m_cullSlot; // slot of the last cull()
+	bool m_culled; // cull() ran since the last draw
+	bool m_queryBuffer; // queryBufferSupported(), the count goes to m_commandBufferObject
+	GLuint m_commandBufferObject; // one indirect draw per submesh, the instance count written by the query
+	unsigned m_visibleCount;
+};
+
+#endif
@@ -0,0 +1,299 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    Headless.cpp
+ * \author  Miroslav Hroncok
+ *
+ * The scene rendered without a window into a framebuffer object, with the times of every frame
+ * printed for the build servers.
+ */
+//----------------------------------------------------------------------------------------
+#if defined(HEADLESS_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#elif defined(HEADLESS_OSMESA)
+#include <GL/osmesa.h>
+#endif
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include "Headless.h"
+#ifdef _WIN32
+#include <io.h>
+// the POSIX names of the descriptor functions, after the headers which declare them
+#define dup _dup
+#define dup2 _dup2
+#define fileno _fileno
+#define fdopen _fdopen
+#define close _close
+#else
+#include <unistd.h>
+#endif
+
+HeadlessOptions::HeadlessOptions(): bottles(-1), camera(1), frames(300), warmup(10), width(1280), height(720), step(1.0/60.0) {
+}
+
+/// Prints the arguments HeadlessOptions::parse() reads
+static void printUsage() {
+	std::cerr << "usage: semestralka --headless [--config file] [--bottles n] [--camera 1-3] [--frames n]" << std::endl
+	          << "                   [--warmup n] [--size WxH] [--step seconds] [--output file]" << std::endl
+	          << "--config is read instead of config.txt, which is not needed then" << std::endl;
+}
+
+bool HeadlessOptions::parse(int argc, char** argv) {
+	for (int i=0; i < argc; i++) {
+		const char * name = argv[i];
+		const char * value = i+1 < argc ? argv[i+1] : NULL;
+		bool valid = value != NULL;
+		if (valid) {
+			if (strcmp(name, "--config") == 0) config = value;
+			else if (strcmp(name, "--output") == 0) output = value;
+			else if (strcmp(name, "--bottles") == 0) valid = sscanf(value, "%d", &bottles) == 1 && bottles >= 0;
+			else if (strcmp(name, "--camera") == 0) valid = sscanf(value, "%d", &camera) == 1 && camera >= 1 && camera <= 3;
+			else if (strcmp(name, "--frames") == 0) valid = sscanf(value, "%d", &frames) == 1 && frames > 0;
+			else if (strcmp(name, "--warmup") == 0) valid = sscanf(value, "%d", &warmup) == 1 && warmup >= 0;
+			else if (strcmp(name, "--size") == 0) valid = sscanf(value, "%dx%d", &width, &height) == 2 && width > 0 && height > 0;
+			else if (strcmp(name, "--step") == 0) valid = sscanf(value, "%lf", &step) == 1 && step >= 0.0;
+			else valid = false;
+		}
+		if (!valid) {
+			std::cerr << "Invalid argument " << name << (value != NULL ? " " : "") << (value != NULL ? value : "") << std::endl;
+			printUsage();
+			return false;
+		}
+		i++; // the value
+	}
+	return true;
+}
+
+static int savedStdout = -1;
+
+FILE * openHeadlessOutput(const std::string & path) {
+	if (!path.empty()) return fopen(path.c_str(), "w");
+	// the timings keep the real standard output, everything else printed there goes to stderr
+	fflush(stdout);
+	std::cout.flush();
+	savedStdout = dup(fileno(stdout));
+	FILE * out = savedStdout >= 0 ? fdopen(dup(savedStdout), "w") : NULL;
+	if (out == NULL || dup2(fileno(stderr), fileno(stdout)) < 0) {
+		if (out != NULL) fclose(out);
+		closeHeadlessOutput(NULL);
+		return NULL;
+	}
+	return out;
+}
+
+void closeHeadlessOutput(FILE * out) {
+	if (out != NULL) fclose(out);
+	if (savedStdout < 0) return;
+	fflush(stdout);
+	std::cout.flush();
+	dup2(savedStdout, fileno(stdout));
+	close(savedStdout);
+	savedStdout = -1;
+}
+
+#if defined(HEADLESS_EGL)
+
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+
+bool createHeadlessContext(int, int) {
+	// the surfaceless platform needs no display server at all, the default display is the fallback
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != NULL)
+		eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (eglDisplay == EGL_NO_DISPLAY)
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) {
+		std::cerr << "Cannot initialize EGL" << std::endl;
+		return false;
+	}
+
+	// the surface type defaults to EGL_WINDOW_BIT, the surfaceless platform has the pbuffer configs only
+	const EGLint configAttributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint configs = 0;
+	if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configs) || configs == 0) {
+		std::cerr << "No EGL config for OpenGL" << std::endl;
+		return false;
+	}
+
+	// the same version and flags as the GLUT window asks for
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR, pgr::OGL_VER_MAJOR,
+		EGL_CONTEXT_MINOR_VERSION_KHR, pgr::OGL_VER_MINOR,
+		EGL_CONTEXT_FLAGS_KHR, EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE_BIT_KHR,
+		EGL_NONE
+	};
+	eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+	// no surface at all, everything goes to the framebuffer object
+	if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+		std::cerr << "Cannot create a surfaceless OpenGL " << pgr::OGL_VER_MAJOR << "." << pgr::OGL_VER_MINOR << " context" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void destroyHeadlessContext() {
+	if (eglDisplay == EGL_NO_DISPLAY)
+		return;
+	eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (eglContext != EGL_NO_CONTEXT)
+		eglDestroyContext(eglDisplay, eglContext);
+	eglTerminate(eglDisplay);
+	eglContext = EGL_NO_CONTEXT;
+	eglDisplay = EGL_NO_DISPLAY;
+}
+
+#elif defined(HEADLESS_OSMESA)
+
+static OSMesaContext osmesaContext = NULL;
+/// OSMesa needs some memory to make the context current with, the drawing goes to the framebuffer object anyway
+static std::vector<unsigned char> osmesaBuffer;
+
+bool createHeadlessContext(int width, int height) {
+	const int attributes[] = {
+		OSMESA_FORMAT, OSMESA_RGBA,
+		OSMESA_DEPTH_BITS, 24,
+		OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+		OSMESA_CONTEXT_MAJOR_VERSION, pgr::OGL_VER_MAJOR,
+		OSMESA_CONTEXT_MINOR_VERSION, pgr::OGL_VER_MINOR,
+		0
+	};
+	osmesaContext = OSMesaCreateContextAttribs(attributes, NULL);
+	osmesaBuffer.resize(size_t(width) * height * 4);
+	if (osmesaContext == NULL || !OSMesaMakeCurrent(osmesaContext, &osmesaBuffer[0], GL_UNSIGNED_BYTE, width, height)) {
+		std::cerr << "Cannot create an OSMesa OpenGL " << pgr::OGL_VER_MAJOR << "." << pgr::OGL_VER_MINOR << " context" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void destroyHeadlessContext() {
+	if (osmesaContext != NULL)
+		OSMesaDestroyContext(osmesaContext);
+	osmesaContext = NULL;
+	osmesaBuffer.clear();
+}
+
+#else
+
+bool createHeadlessContext(int, int) {
+	std::cerr << "The headless mode is not built in, define HEADLESS_EGL or HEADLESS_OSMESA" << std::endl;
+	return false;
+}
+
+void destroyHeadlessContext() {
+}
+
+#endif
+
+static GLuint framebuffer = 0;
+static GLuint renderbuffers[2] = { 0, 0 };
+
+bool createHeadlessFramebuffer(int width, int height) {
+	glGenRenderbuffers(2, renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	// bound for good, nothing else in the program binds a framebuffer
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "The headless framebuffer is not complete" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void destroyHeadlessFramebuffer() {
+	// nothing created, maybe not even the GL functions loaded
+	if (renderbuffers[0] == 0)
+		return;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(2, renderbuffers);
+	framebuffer = 0;
+	renderbuffers[0] = renderbuffers[1] = 0;
+}
+
+FrameTimings::FrameTimings() {
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	m_timerQueries = major > 3 || (major == 3 && minor >= 3);
+}
+
+FrameTimings::~FrameTimings() {
+	if (!m_queries.empty())
+		glDeleteQueries(m_queries.size(), &m_queries[0]);
+}
+
+void FrameTimings::beginFrame() {
+	if (!m_timerQueries)
+		return;
+	GLuint query;
+	glGenQueries(1, &query);
+	m_queries.push_back(query);
+	glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void FrameTimings::endFrame(double update, double draw) {
+	if (m_timerQueries)
+		glEndQuery(GL_TIME_ELAPSED);
+	m_update.push_back(1000.0*update);
+	m_draw.push_back(1000.0*draw);
+}
+
+/// Nearest rank percentile
+/// \param sorted Values in ascending order, not empty
+/// \param percent 0-100
+static double percentile(const std::vector<double> & sorted, double percent) {
+	size_t rank = size_t(ceil(percent/100.0*sorted.size()));
+	return sorted[rank > 0 ? rank-1 : 0];
+}
+
+void FrameTimings::print(FILE * out) {
+	const size_t frames = m_update.size();
+	std::vector<double> gpu(frames, -1.0);
+	for (size_t i=0; i < m_queries.size() && i < frames; i++) {
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(m_queries[i], GL_QUERY_RESULT, &nanoseconds);
+		gpu[i] = nanoseconds*1e-6;
+	}
+
+	fprintf(out, "frame,update_ms,draw_ms,gpu_ms\n");
+	for (size_t i=0; i < frames; i++)
+		fprintf(out, "%u,%.4f,%.4f,%.4f\n", unsigned(i), m_update[i], m_draw[i], gpu[i]);
+	if (frames == 0)
+		return;
+
+	std::vector<double> * columns[3] = { &m_update, &m_draw, &gpu };
+	std::vector<double> sorted[3];
+	double mean[3];
+	for (int c=0; c < 3; c++) {
+		sorted[c] = *columns[c];
+		std::sort(sorted[c].begin(), sorted[c].end());
+		mean[c] = 0.0;
+		for (size_t i=0; i < frames; i++) mean[c] += sorted[c][i];
+		mean[c] /= frames;
+	}
+
+	const char * names[] = { "p50", "p90", "p99", "max" };
+	const double percents[] = { 50.0, 90.0, 99.0, 100.0 };
+	fprintf(out, "stat,update_ms,draw_ms,gpu_ms\n");
+	for (int s=0; s < 4; s++)
+		fprintf(out, "%s,%.4f,%.4f,%.4f\n", names[s], percentile(sorted[0], percents[s]), percentile(sorted[1], percents[s]), percentile(sorted[2], percents[s]));
+	fprintf(out, "mean,%.4f,%.4f,%.4f\n", mean[0], mean[1], mean[2]);
+}
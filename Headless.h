@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file    Headless.h
+ * \author  Miroslav Hroncok
+ *
+ * The scene rendered without a window into a framebuffer object, with the times of every frame
+ * printed for the build servers (no display, no GPU, Mesa's software rasteriser is enough).
+ *
+ * The context comes from EGL (surfaceless platform) when built with HEADLESS_EGL defined, linked
+ * against libEGL, or from OSMesa with HEADLESS_OSMESA, linked against libOSMesa. Without either
+ * of them the headless mode only reports it is not available.
+ */
+//----------------------------------------------------------------------------------------
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "pgr.h"
+
+/// Settings of the headless run
+struct HeadlessOptions {
+	std::string config; ///< config file read instead of config.txt, empty reads config.txt
+	std::string output; ///< file for the timings, empty for the standard output
+	int bottles;        ///< overrides the config, -1 keeps its number
+	int camera;         ///< preset of switchCam()
+	int frames;         ///< measured frames
+	int warmup;         ///< frames drawn before the measured ones, not recorded
+	int width;
+	int height;
+	double step;        ///< simulated seconds per frame, the same for every run
+
+	HeadlessOptions();
+
+	/// Reads the arguments following --headless:
+	/// --config file, --bottles n, --camera n, --frames n, --warmup n, --size WxH, --step seconds, --output file
+	/// \return False (the usage is printed) for an unknown or malformed argument
+	bool parse(int argc, char** argv);
+};
+
+/// Opens the file for the timings, for an empty path a copy of the standard output, which itself
+/// goes to stderr until closeHeadlessOutput(), so only the timings are left in it (init() and the
+/// loaders print there, by printf and std::cout alike)
+/// \return NULL if the file cannot be opened
+FILE * openHeadlessOutput(const std::string & path);
+/// Closes the file of openHeadlessOutput() and gives the standard output back, NULL only gives it back
+void closeHeadlessOutput(FILE * out);
+
+/// Creates the OpenGL context without any window and makes it current
+/// \return False if it cannot be created or the headless mode was not built in
+bool createHeadlessContext(int width, int height);
+/// Releases what createHeadlessContext() got, also after its failure
+void destroyHeadlessContext();
+
+/// Creates a framebuffer with a color and a depth renderbuffer and binds it instead of the window
+/// (needs the GL functions, so after pgr::initialize())
+bool createHeadlessFramebuffer(int width, int height);
+/// Deletes what createHeadlessFramebuffer() created, if anything, so it is safe after any failure
+void destroyHeadlessFramebuffer();
+
+/// CPU and GPU times of the frames
+///
+/// The GPU time of a frame is a GL_TIME_ELAPSED query (OpenGL 3.3), one per frame, read only
+/// by print(), so the measurement never waits for the GPU. Without the timer queries the GPU
+/// times are -1.
+class FrameTimings {
+public:
+	FrameTimings();
+	~FrameTimings();
+
+	/// Starts the GPU timer of a new frame
+	void beginFrame();
+	/// Stops the GPU timer, the CPU times of the frame are in seconds
+	void endFrame(double update, double draw);
+
+	/// CSV: one line per frame, then p50, p90, p99, max and mean of every column, in milliseconds
+	void print(FILE * out);
+protected:
+	bool m_timerQueries;
+	std::vector<GLuint> m_queries;
+	std::vector<double> m_update;
+	std::vector<double> m_draw;
+};
+
+#endif
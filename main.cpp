@@ -21,13 +21,31 @@
 #include "resources/SceneNode.h" // superclass of all scene graph nodes
 #include "resources/TransformNode.h" // model transformation
 #include "resources/MeshNode.h" // model loaded from the file
+#include "resources/InstancedMeshNode.h" // many copies of one model drawn at once
 #include "resources/Resources.h"
 #include "resources/MeshGeometry.h"
+#include "resources/GeometryArena.h" // shared buffers of all the meshes
+#include "resources/RingBuffer.h" // per-frame data written straight to the GPU
+#include "resources/GLState.h" // skips the state calls setting the current value
 #include "resources/AxesNode.h" // coordinate axes
 #include "resources/ShaderProgram.h"
+#include "resources/ShaderVariants.h" // shaders specialized by #define features
+#include "resources/Lights.h" // light structures
+#include "resources/LightClusters.h" // spot lights sorted to the clusters of the view
+#include "resources/TaskPool.h" // threads for the parallel scene update
+#include "resources/RenderQueue.h" // draws sorted by the state they need
+#include "resources/FrameUniforms.h" // per-frame data of all the shaders
+#include "resources/TerrainGeometry.h" // heightmap split to tiles with levels of detail
+#include "resources/TerrainNode.h" // draws the tiles at the level the view needs
+#include "resources/DisplacedTerrainNode.h" // terrain displaced from a heightmap texture
+#include "resources/CullingHierarchy.h" // bounding boxes of the drawn nodes against the view frustum
+#include "resources/OcclusionCulling.h" // draws hidden in the last frame dropped by the GPU
 // my own includes
 #include "AnimNode.h"
+#include "GpuAnimNode.h" // bottles animated in the vertex shader
 #include "Configuration.h"
+#include "Benchmark.h" // command line micro-benchmarks
+#include "Headless.h" // offscreen rendering with the frame times
 
 #if _MSC_VER
 /// Define this for snprintf function
@@ -64,6 +82,54 @@ const int NUM_SPOT_LIGHTS = 1;
 /// Scene graph root node
 SceneNode * rootNode_p = NULL; // scene root
 
+/// Draws all the bottles at once, NULL when every bottle has its own MeshNode
+InstancedMeshNode * bottlesNode_p = NULL;
+
+/// Determinates whether are the bottles drawn using instancing (one draw call per submesh for all of them)
+const bool INSTANCED_BOTTLES = true;
+
+/// Draws and animates all the bottles on the GPU, NULL when the bottles have their AnimNodes
+GpuAnimNode * gpuBottlesNode_p = NULL;
+
+/// Determinates whether are the bottles moved along the path in the vertex shader (no CPU work per bottle)
+const bool GPU_ANIMATED_BOTTLES = true;
+
+/// Determinates whether are the GPU animated bottles culled on the GPU (needs OpenGL 3.2, ignored without it)
+const bool GPU_CULLING = true;
+
+/// Collects the draws of the MeshNodes and submits them sorted by state, front to back
+RenderQueue renderQueue;
+
+/// Determinates whether are the MeshNodes drawn through the renderQueue (or each one immediately)
+const bool QUEUED_DRAWING = true;
+
+/// Determinates whether does the renderQueue submit by multi-draw indirect (needs OpenGL 4.3, ignored without it)
+const bool MULTI_DRAW_INDIRECT = true;
+
+/// Space of one frame in the RingBuffer (instance matrices, indirect commands and their draw data)
+const size_t RING_FRAME_SIZE = 2 << 20;
+
+/// Vertex format of the terrain and the bottle, the big meshes (the stream stays in floats)
+const MeshGeometry::VertexFormat PACKED_FORMAT = MeshGeometry::FORMAT_PACKED_QUANTIZED;
+
+/// Draws the terrain tiles, NULL when the terrain is one MeshNode
+TerrainNode * terrainNode_p = NULL;
+
+/// Determinates whether is the terrain split to tiles with the level of detail chosen per tile (or drawn whole)
+const bool CHUNKED_TERRAIN = true;
+
+/// Determinates whether is the terrain one grid patch displaced in the vertex shader (no terrain vertex buffers at all)
+const bool DISPLACED_TERRAIN = false;
+
+/// Determinates whether are the meshes and bottle instances outside the view frustum skipped
+const bool FRUSTUM_CULLING = true;
+
+/// Determinates whether are the MeshNodes hidden behind the scene in the last frame dropped (conditional rendering)
+const bool OCCLUSION_CULLING = true;
+
+/// Worker threads for the parallel scene update, GL calls stay in this thread
+TaskPool * taskPool_p = NULL;
+
 /// Aspect ratio
 float g_aspect_ratio = 1.0f;
 
@@ -76,9 +142,17 @@ bool freeCam = false;
 /// Determinates whether is theanimation of bottles turned on
 bool AnimNode::animation = true;
 
-/// Loads and handles the config form the file
+/// Handles the config, empty until main() loads it by loadConfig()
 Configuration AnimNode::config;
 
+/// Path of the belt measured from the config, empty until loadConfig() as well
+ConveyorPath AnimNode::path(AnimNode::config);
+bool AnimNode::constantSpeed = true;
+
+/// Bottles are animated all at once by AnimNode::batch instead of one by one
+bool AnimNode::batched = true;
+AnimBatch AnimNode::batch;
+
 /// Animation time step for glutTimer
 const int TIMER_STEP = 20;   // next event in [ms]
 
@@ -97,25 +171,17 @@ glm::vec4 reflector = glm::vec4(0.0f);
 /// Cubemap crap
 GLuint texID = 0;
 
-/// Handles light information
-struct Light {
-	glm::vec4 ambient;
-	glm::vec4 diffuse;
-	glm::vec4 specular;
-};
-
-/// Adds directional light attributes
-struct DirectionalLight: public Light {
-	glm::vec4 direction;
-};
-
-/// Adds spot light attributes
-struct SpotLight: public Light {
-	glm::vec4 position;
-	glm::vec4 spotDirection;
-	float spotCosCutoff;
-	float spotExponent;
-};
+/// Lamps above the belts, in world space, drawn through the lightClusters
+std::vector<SpotLight> hallLamps;
+
+/// Number of the lamps, spread evenly along the belt
+const int NUM_HALL_LAMPS = 256;
+
+/// Spot lights sorted to the clusters of the view frustum every frame
+LightClusters lightClusters;
+
+/// Determinates whether does every fragment only evaluate the lights of its cluster (and the lamps are on)
+const bool CLUSTERED_LIGHTING = true;
 
 /// Some of the global variables for camera and reflector
 struct State {
@@ -129,81 +195,79 @@ struct State {
 	glm::mat4 view;
 } state;
 
-
-/// From lihgting seminar, used to send information to the shader
-class LightingShader: public MeshShaderProgram {
-public:
-	struct LightLocations {
-		GLint ambient;
-		GLint diffuse;
-		GLint specular;
-		GLint position;
-		GLint spotDirection;
-		GLint spotCosCutoff;
-		GLint spotExponent;
-	};
-	
-	LightingShader(GLint prId): MeshShaderProgram(prId) {}
-	
-	void initLocations() {
-		MeshShaderProgram::initLocations();
-
-		for(int l = 0; l < NUM_SPOT_LIGHTS; ++l) {
-			char buf[255];
-			snprintf(buf, 255, "lights[%i].ambient", l);
-			m_lights[l].ambient = glGetUniformLocation(m_programId, buf);
-			snprintf(buf, 255, "lights[%i].diffuse", l);
-			m_lights[l].diffuse = glGetUniformLocation(m_programId, buf);
-			snprintf(buf, 255, "lights[%i].specular", l);
-			m_lights[l].specular = glGetUniformLocation(m_programId, buf);
-			snprintf(buf, 255, "lights[%i].position", l);
-			m_lights[l].position = glGetUniformLocation(m_programId, buf);
-			snprintf(buf, 255, "lights[%i].spotDirection", l);
-			m_lights[l].spotDirection = glGetUniformLocation(m_programId, buf);
-			snprintf(buf, 255, "lights[%i].spotCosCutoff", l);
-			m_lights[l].spotCosCutoff = glGetUniformLocation(m_programId, buf);
-			snprintf(buf, 255, "lights[%i].spotExponent", l);
-			m_lights[l].spotExponent = glGetUniformLocation(m_programId, buf);
-		}
+/// Moves the scene to the time
+/// \param time Time in seconds
+void updateScene(double time) {
+	state.time = time;
+	if(rootNode_p) {
+		AnimNode::batch.update(state.time); // local matrices of the bottles first
+		rootNode_p->update(state.time);
 	}
-
-	LightLocations m_lights[NUM_SPOT_LIGHTS];
-};
-
-/// From lihgting seminar, used to send information to the shader
-struct Resources {
-	LightingShader * shaderProgram;
-} resources;
+}
 
 /// For handling time events
 void FuncTimerCallback(int) {
 	// this is from screenGraph
-	state.time = 0.001 * (double)glutGet(GLUT_ELAPSED_TIME); // milliseconds => seconds
+	updateScene(0.001 * (double)glutGet(GLUT_ELAPSED_TIME)); // milliseconds => seconds
 	// ELAPSED_TIME is number of milliseconds since glutInit called 
 
-	if(rootNode_p)
-		rootNode_p->update(state.time);
-
 	glutTimerFunc(33, FuncTimerCallback, 0);
 	glutPostRedisplay();
 }
 
-/// Reloads the shader
+/// Reloads the shaders, every variant the nodes use is compiled again from the files
 void reloadShader() {
-	if(resources.shaderProgram)
-		delete resources.shaderProgram;
-
-	GLuint shaderList[] = {
-		pgr::createShaderFromFile(GL_VERTEX_SHADER,   "resources/MeshNode.vert"),
-		pgr::createShaderFromFile(GL_FRAGMENT_SHADER, "resources/MeshNode.frag"),
-		0
-	};
-	
-	resources.shaderProgram = new LightingShader(pgr::createProgram(shaderList));
-	resources.shaderProgram->initLocations();
+	ShaderVariants::Instance()->reload();
 	CHECK_GL_ERROR();
 }
 
+/// Fills the per-frame block shared by all the shaders and uploads it at once
+/// \param projection Projection matrix of the frame
+void uploadFrame(const glm::mat4 & projection) {
+	FrameUniforms * frame = FrameUniforms::Instance();
+	frame->setCamera(state.view, projection);
+	frame->setTime(state.time);
+
+	// the sun goes around in the x-y plane, the same for every fragment, so it is computed here
+	const float sunSpeed = 0.2f;
+	const float sunAngle = float(state.time) * sunSpeed;
+	glm::vec4 sunDirection = glm::vec4(sin(sunAngle), cos(sunAngle), 0.0f, 0.0f) * state.view;
+	frame->setSun(glm::vec3(sunDirection), glm::vec3(fabs(cos(sunAngle))));
+
+	frame->setLightCount(NUM_SPOT_LIGHTS);
+	for(int l = 0; l < NUM_SPOT_LIGHTS; ++l) {
+		FrameUniforms::Light & light = frame->light(l);
+		light.ambient = state.refLights[l].ambient;
+		light.diffuse = state.refLights[l].diffuse;
+		light.specular = state.refLights[l].specular;
+		light.position = state.refLights[l].position;
+		light.spotDirection = state.refLights[l].spotDirection;
+		light.spotCosCutoff = state.refLights[l].spotCosCutoff;
+		light.spotExponent = state.refLights[l].spotExponent;
+	}
+	// Disco! (the first light is the reflector)
+	if(NUM_SPOT_LIGHTS > 0 && int(floor(state.time * 5)) % 2 == 0)
+		frame->light(0).diffuse = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+
+	if(CLUSTERED_LIGHTING) {
+		// the reflectors and the lamps in the camera space, the same as the block has them
+		static std::vector<SpotLight> lights;
+		lights.assign(state.refLights, state.refLights + NUM_SPOT_LIGHTS);
+		if(NUM_SPOT_LIGHTS > 0)
+			lights[0].diffuse = frame->light(0).diffuse;
+		for(unsigned l = 0; l < hallLamps.size(); ++l) {
+			SpotLight lamp = hallLamps[l];
+			lamp.position = state.view * lamp.position;
+			lamp.spotDirection = state.view * lamp.spotDirection;
+			lights.push_back(lamp);
+		}
+		lightClusters.build(lights, projection, 1.0f, 10000.0f);
+		lightClusters.upload();
+		frame->setClusters(lightClusters.scale(g_win_w, g_win_h), lightClusters.tilesX(), lightClusters.tilesY(), lightClusters.slices());
+	}
+	frame->upload();
+}
+
 /// Turns the reflector on or off (to oposite value)
 void reflectorSwitch() {
 	if (reflector == glm::vec4(0.0f)) reflector = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
@@ -216,6 +280,17 @@ void animationSwitch() {
 	AnimNode::animation = !AnimNode::animation;
 }
 
+/// Turns the parallel scene update on or off (to oposite value)
+void parallelUpdateSwitch() {
+	TransformHierarchy * hierarchy = TransformHierarchy::Instance();
+	if (hierarchy->taskPool()) hierarchy->setTaskPool(NULL);
+	else {
+		if (!taskPool_p) taskPool_p = new TaskPool();
+		hierarchy->setTaskPool(taskPool_p);
+	}
+	std::cout << "Parallel update " << (hierarchy->taskPool() ? "on" : "off") << std::endl;
+}
+
 /// Basic stuff that draw things, defines the view and such
 void functionDraw() {
 	glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
@@ -229,27 +304,27 @@ void functionDraw() {
 	//glActiveTexture(GL_TEXTURE0);
 	//glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
 
-	for(int l = 0; l < NUM_SPOT_LIGHTS; ++l) {
-		glUniform3fv(resources.shaderProgram->m_lights[l].ambient, 1, glm::value_ptr(state.refLights[l].ambient));
-		glUniform3fv(resources.shaderProgram->m_lights[l].diffuse, 1, glm::value_ptr(state.refLights[l].diffuse));
-		glUniform3fv(resources.shaderProgram->m_lights[l].specular, 1, glm::value_ptr(state.refLights[l].specular));
-		glUniform3fv(resources.shaderProgram->m_lights[l].position, 1, glm::value_ptr(state.refLights[l].position));
-		glUniform3fv(resources.shaderProgram->m_lights[l].spotDirection, 1, glm::value_ptr(state.refLights[l].spotDirection));
-		glUniform1f(resources.shaderProgram->m_lights[l].spotCosCutoff, state.refLights[l].spotCosCutoff);
-		glUniform1f(resources.shaderProgram->m_lights[l].spotExponent, state.refLights[l].spotExponent);
-	}
-
-	//glUniform1f(resources.shaderProgram->m_reflectFactor, 0.2f);
-	glUniform1i(resources.shaderProgram->m_cubeMapTex, 1);
-	//glUniform3fv(resources.shaderProgram->m_worldCameraPosition, 1, glm::value_ptr(state.cameraPosition));
-	//glUniform3fv(resources.shaderProgram->m_worldCameraPosition, 1, glm::value_ptr(glm::vec3(0.0f)));
-
 	// Position of the reflector
 	state.refLights[0].position = state.view * glm::vec4(1.0f, 20.0f, 1.0f, 1.0f);
 	state.refLights[0].spotDirection = state.view * reflector;
 
-	if(rootNode_p)
+	// camera, lights and time for all the shaders at once
+	uploadFrame(projection);
+
+	if(rootNode_p) {
+		// visibility of all the nodes at once, their draw() only looks it up
+		CullingHierarchy::Instance()->setEnabled(FRUSTUM_CULLING);
+		if(FRUSTUM_CULLING) CullingHierarchy::Instance()->cull(state.view, projection);
+		// first on the GPU, the bottles read its result much later
+		if(gpuBottlesNode_p) gpuBottlesNode_p->cull(state.view, projection);
+		OcclusionCulling::Instance()->setEnabled(OCCLUSION_CULLING);
+		OcclusionCulling::Instance()->begin();
+		if(QUEUED_DRAWING) renderQueue.begin(state.view, 10000.0f);
 		rootNode_p->draw(state.view, projection);
+		if(QUEUED_DRAWING) renderQueue.flush();
+		// boxes against the whole scene, for the next frame
+		OcclusionCulling::Instance()->flush(state.view, projection);
+	}
 }
 
 /// Creates the terrain and adds it to the scene graph
@@ -259,8 +334,27 @@ void createTerrain() {
 	terrain_transform->translate(glm::vec3(0.0, -17, 0.0));
 	terrain_transform->scale(glm::vec3(80.0, 0.01, 80.0));
 
+	if(DISPLACED_TERRAIN) {
+		DisplacedTerrainNode * terrain_p = new DisplacedTerrainNode(TERRAIN_FILE_NAME, terrain_transform);
+		terrain_p->loadHeightMap(TERRAIN_FILE_NAME);
+		CHECK_GL_ERROR();
+		return;
+	}
+
+	if(CHUNKED_TERRAIN) {
+		// 64 x 64 quads (65 x 65 vertices) per tile
+		if(!MeshManager::Instance()->exists(TERRAIN_FILE_NAME))
+			MeshManager::Instance()->insert(TERRAIN_FILE_NAME, TerrainGeometry::LoadRawHeightMap(TERRAIN_FILE_NAME, 64, PACKED_FORMAT));
+		TerrainGeometry * terrain_p = static_cast<TerrainGeometry *>(MeshManager::Instance()->get(TERRAIN_FILE_NAME));
+
+		terrainNode_p = new TerrainNode(TERRAIN_FILE_NAME, terrain_transform);
+		terrainNode_p->setGeometry(terrain_p);
+		CHECK_GL_ERROR();
+		return;
+	}
+
 	if(!MeshManager::Instance()->exists(TERRAIN_FILE_NAME))
-		MeshManager::Instance()->insert(TERRAIN_FILE_NAME, MeshGeometry::LoadRawHeightMap(TERRAIN_FILE_NAME));
+		MeshManager::Instance()->insert(TERRAIN_FILE_NAME, MeshGeometry::LoadRawHeightMap(TERRAIN_FILE_NAME, PACKED_FORMAT));
 	MeshGeometry * mesh_p = MeshManager::Instance()->get(TERRAIN_FILE_NAME);
 	
 	MeshNode* terrain_mesh_p = new MeshNode(TERRAIN_FILE_NAME, terrain_transform);
@@ -283,6 +377,12 @@ void createStream() {
 /// \param index Numeric identification of the bottle
 /// \param offset Time offset of the bottle animation, where 1 represens movement between two points duration
 void createBottle(int index = 0, float offset = 0.0f) {
+	// the GPU only needs the offset, no nodes at all
+	if(gpuBottlesNode_p) {
+		gpuBottlesNode_p->addInstance(offset);
+		return;
+	}
+
 	// Index the names so more bottles are possible
 	std::stringstream ss; ss << index << std::flush;
 	AnimNode* bottle_anim = new AnimNode("bottleAnim"+ss.str(),offset,rootNode_p);
@@ -291,6 +391,12 @@ void createBottle(int index = 0, float offset = 0.0f) {
 	bottle_transform->translate(glm::vec3(0.0, -12.5, 0.0));
 	bottle_transform->scale(glm::vec3(4));
 
+	// instanced bottles only need the transformation, the mesh is drawn by bottlesNode_p
+	if(bottlesNode_p) {
+		bottlesNode_p->addInstance(bottle_transform);
+		return;
+	}
+
 	MeshGeometry* meshGeom_p = MeshManager::Instance()->get(BOTTLE_FILE_NAME);
 	MeshNode * bottle_mesh_p = new MeshNode("bottle"+ss.str(), bottle_transform);
 	bottle_mesh_p->setGeometry(meshGeom_p);
@@ -309,11 +415,48 @@ void flushState(void) {
 	std::cout << "state.cameraPosition = glm::vec3(" << state.cameraPosition.x << "f, " << state.cameraPosition.y << "f, " << state.cameraPosition.x << "f);"  << std::endl;
 	std::cout << "state.cameraPitch = " << state.cameraPitch << "f;"  << std::endl;
 	std::cout << "state.cameraYaw = " << state.cameraYaw << "f;"  << std::endl;
+	std::cout << "// shader variants compiled: " << ShaderVariants::Instance()->compiled() << std::endl;
+	std::cout << "// recalculated nodes in the last update: " << TransformHierarchy::Instance()->recalculatedCount() << std::endl;
+	const RenderQueue::Stats & stats = renderQueue.stats();
+	std::cout << "// queued draws: " << stats.packets << ", programs: " << stats.programs << ", vertex arrays: " << stats.vertexArrays
+		<< ", textures: " << stats.textures << ", materials: " << stats.materials << ", draw calls: " << stats.drawCalls << " for " << stats.packets << " draws" << std::endl;
+	const GeometryArena::Stats & arena = GeometryArena::Instance()->stats();
+	std::cout << "// geometry arena: vertices " << arena.usedVertexBytes / 1024 << " of " << arena.vertexBytes / 1024 << " KiB, indices "
+		<< arena.usedIndexBytes / 1024 << " of " << arena.indexBytes / 1024 << " KiB, free ranges: " << arena.fragments << ", grown: " << arena.grows << std::endl;
+	const GLState::Stats & glState = GLState::Instance()->stats();
+	std::cout << "// GL state calls: " << glState.issued << ", skipped: " << glState.elided
+		<< ", uniforms: " << glState.uniformsIssued << ", skipped: " << glState.uniformsElided << std::endl;
+	const RingBuffer::Stats & ring = RingBuffer::Instance()->stats();
+	std::cout << "// ring buffer: " << (RingBuffer::Instance()->persistent() ? "persistent" : "glBufferSubData") << ", frame " << ring.frameBytes / 1024
+		<< " KiB (peak " << ring.peakFrameBytes / 1024 << " of " << RingBuffer::Instance()->frameSize() / 1024 << "), wraps: " << ring.wraps
+		<< ", waits: " << ring.waits << " (" << ring.waitTime * 1000.0 << " ms, longest " << ring.maxWaitTime * 1000.0 << " ms), overruns: " << ring.overruns << std::endl;
+	if(terrainNode_p) {
+		const TerrainNode::Stats & terrain = terrainNode_p->stats();
+		std::cout << "// terrain tiles: " << terrain.tiles << ", culled: " << terrain.culled << ", triangles: " << terrain.triangles << std::endl;
+	}
+	if(FRUSTUM_CULLING) {
+		const CullingHierarchy::Stats & culling = CullingHierarchy::Instance()->stats();
+		std::cout << "// culled objects: " << culling.objects - culling.visible << " of " << culling.objects << ", boxes tested: " << culling.tested
+			<< ", moved: " << culling.moved << ", reinserted: " << culling.reinserted << std::endl;
+	}
+	if(CLUSTERED_LIGHTING) {
+		const LightClusters::Stats & clusters = lightClusters.stats();
+		std::cout << "// clustered lights: " << clusters.lights << ", light references: " << clusters.references
+			<< ", max per cluster: " << clusters.maxPerCluster << ", empty clusters: " << clusters.emptyClusters << std::endl;
+	}
+	if(OCCLUSION_CULLING) {
+		const OcclusionCulling::Stats & occlusion = OcclusionCulling::Instance()->stats();
+		std::cout << "// occlusion boxes tested: " << occlusion.tested << ", conditional draws: " << occlusion.conditional
+			<< ", skipped in the frame before: " << occlusion.skipped << std::endl;
+	}
+	if(gpuBottlesNode_p)
+		std::cout << "// GPU culling: " << (gpuBottlesNode_p->gpuCulling() ? "on" : "off") << ", drawn bottles: "
+			<< gpuBottlesNode_p->visibleCount() << " of " << gpuBottlesNode_p->getInstanceCount() << std::endl;
 }
 
-/// Switches the camera
+/// Sets the camera preset, without asking for a redisplay (works without the window)
 /// \param cam Numeric identification of the camera
-void switchCam(int cam) {
+void setCamera(int cam) {
 	switch (cam) {
 	case 1:
 		freeCam = false;
@@ -321,7 +464,6 @@ void switchCam(int cam) {
 		state.cameraYaw = -6.0f;
 		state.cameraPitch = -1.0f;
 		calculateState();
-		glutPostRedisplay();
 		break;
 	case 2:
 		freeCam = false;
@@ -329,7 +471,6 @@ void switchCam(int cam) {
 		state.cameraYaw = -8.7f;
 		state.cameraPitch = -0.2f;
 		calculateState();
-		glutPostRedisplay();
 		break;
 	case 3:
 		freeCam = true;
@@ -337,6 +478,13 @@ void switchCam(int cam) {
 	}
 }
 
+/// Switches the camera
+/// \param cam Numeric identification of the camera
+void switchCam(int cam) {
+	setCamera(cam);
+	if(cam != 3) glutPostRedisplay();
+}
+
 /// Event processing of the menu commands
 /// \param item Numeric identification of the menu command
 void myMenu(int item) {
@@ -346,6 +494,9 @@ void myMenu(int item) {
 	case 3:
 		switchCam(item);
 		break;
+	case 55:
+		parallelUpdateSwitch();
+		break;
 	case 66:
 		animationSwitch();
 		break;
@@ -371,6 +522,7 @@ void createMenu(void) {
 	glutCreateMenu(myMenu);
 	glutAddSubMenu("Camera", submenuID);
 
+	glutAddMenuEntry("Parallel on/off  [P]", 55);
 	glutAddMenuEntry("Animation on/off [A]", 66);
 	glutAddMenuEntry("Reflector on/off [R]", 77);
 	glutAddMenuEntry("Debug info       [D]", 88);
@@ -381,10 +533,8 @@ void createMenu(void) {
 /// Cubemap from cubemap example
 /// \author Tomas Barak & Jaroslav Sloup
 void loadCubeMap( const char * baseFileName ) {
-	glActiveTexture(GL_TEXTURE1);
-	
 	glGenTextures(1, &texID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+	GLState::Instance()->bindTexture(GL_TEXTURE1, GL_TEXTURE_CUBE_MAP, texID);
 	
 	const char * suffixes[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
 	GLuint targets[] = {
@@ -440,12 +590,31 @@ void loadCubeMap( const char * baseFileName ) {
 	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	// unbind the texture (just in case someone will mess up with texture calls later)
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+	// the cube map stays bound to unit 1 for good, the shaders sample it there
 	CHECK_GL_ERROR();
 }
 
 
+/// Hangs the lamps above the belt, evenly along the path of the bottles
+void createHallLamps() {
+	const ConveyorPath & path = AnimNode::path;
+	hallLamps.clear();
+	for(int i = 0; i < NUM_HALL_LAMPS; ++i) {
+		const unsigned entry = i * path.tableSize() / NUM_HALL_LAMPS;
+		SpotLight lamp;
+		lamp.ambient = glm::vec4(0.0f);
+		lamp.diffuse = glm::vec4(0.8f, 0.7f, 0.5f, 1.0f);
+		lamp.specular = glm::vec4(0.5f);
+		// a few units above the bottles (see the bottles node in initializeScene()), looking down
+		lamp.position = glm::vec4(path.tableX()[entry], -4.5f, path.tableZ()[entry], 1.0f);
+		lamp.spotDirection = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
+		lamp.spotCosCutoff = 0.8f;
+		lamp.spotExponent = 4.0f;
+		lamp.range = 12.0f;
+		hallLamps.push_back(lamp);
+	}
+}
+
 /// Putts objects to the scene, creates screene graph
 void initializeScene() {
 	
@@ -454,6 +623,20 @@ void initializeScene() {
 	createTerrain();
 	loadCubeMap("data/cubemap/texture");
 	createStream();
+	if(!MeshManager::Instance()->exists(BOTTLE_FILE_NAME))
+		MeshManager::Instance()->insert(BOTTLE_FILE_NAME, MeshGeometry::LoadFromFile(BOTTLE_FILE_NAME, PACKED_FORMAT));
+	if(GPU_ANIMATED_BOTTLES) {
+		gpuBottlesNode_p = new GpuAnimNode("bottles", rootNode_p);
+		// the same as the TransformNode of every bottle, the path is added in the shader
+		gpuBottlesNode_p->setLocalMatrix(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0, -12.5, 0.0)), glm::vec3(4)));
+		gpuBottlesNode_p->setGeometry(MeshManager::Instance()->get(BOTTLE_FILE_NAME));
+		gpuBottlesNode_p->setPath(AnimNode::path);
+		gpuBottlesNode_p->setGpuCulling(GPU_CULLING);
+	}
+	else if(INSTANCED_BOTTLES) {
+		bottlesNode_p = new InstancedMeshNode("bottles", rootNode_p);
+		bottlesNode_p->setGeometry(MeshManager::Instance()->get(BOTTLE_FILE_NAME));
+	}
 	// calculate the offset so bottles are evanly positioned
 	for (int i=0; i < AnimNode::config.bottles(); i++) {
 		createBottle(i,i*float(AnimNode::config.fragments())/AnimNode::config.bottles()); // casting to float has to be done at least on one of those integers
@@ -462,10 +645,18 @@ void initializeScene() {
 	rootNode_p->dump();
 }
 
-/// OpenGL crap doing magic
-void display() {
+/// Draws the whole frame to the bound framebuffer
+void drawFrame() {
 	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 	functionDraw();
+	// the pieces of the ring written in this frame are free once the GPU gets here
+	RingBuffer::Instance()->endFrame();
+	GLState::Instance()->endFrame();
+}
+
+/// OpenGL crap doing magic
+void display() {
+	drawFrame();
 	glutSwapBuffers();
 }
 
@@ -477,6 +668,7 @@ void reshape (int w, int h) {
 	g_aspect_ratio = (float)w/(float)h;
 	g_win_w = w;
 	g_win_h = h;
+	if(terrainNode_p) terrainNode_p->setViewportHeight(h);
 }
 
 /// Handles pressing normal keys on the keyboard
@@ -512,6 +704,10 @@ void myKeyboard(unsigned char key, int x, int y) {
 	case'A':
 		animationSwitch();
 		break;
+	case'p':
+	case'P':
+		parallelUpdateSwitch();
+		break;
 	}
 }
 
@@ -552,32 +748,118 @@ void mySpecialKeyboard(int specKey, int x, int y) {
 
 /// Initialise the program
 void init() {
-	reloadShader();
-	
-	
+	// the variants of the shaders are built with the lights the scene has
+	ShaderVariants::Features sceneFeatures;
+	sceneFeatures.spotLights = NUM_SPOT_LIGHTS;
+	sceneFeatures.sun = 1;
+	sceneFeatures.clustered = CLUSTERED_LIGHTING ? 1 : 0;
+	ShaderVariants::Instance()->setSceneFeatures(sceneFeatures);
+	if(CLUSTERED_LIGHTING) createHallLamps();
+
+	RingBuffer::Instance()->setFrameSize(RING_FRAME_SIZE);
 	initializeScene();
+	// pgr bound the textures it loaded by itself
+	GLState::Instance()->invalidate();
+	renderQueue.setIndirect(MULTI_DRAW_INDIRECT);
+	std::cout << "Multi-draw indirect " << (renderQueue.indirect() ? "on" : "off") << std::endl;
 	
 	state.refLights[0].ambient = glm::vec4(0.0f);
 	state.refLights[0].diffuse = glm::vec4(1.0f);
 	state.refLights[0].specular = glm::vec4(1.0f);
 	state.refLights[0].spotCosCutoff = 0.7f;
 	state.refLights[0].spotExponent = 3.0f;
-	switchCam(1);
+	state.refLights[0].range = 100.0f;
+	setCamera(1);
 	
 	//glDisable(GL_CULL_FACE); // draw both back and front faces
-	glCullFace(GL_BACK);
-	glEnable(GL_CULL_FACE); // draw front faces only
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDepthFunc(GL_LEQUAL);
+	GLState::Instance()->cullFace(GL_BACK);
+	GLState::Instance()->setEnabled(GL_CULL_FACE, true); // draw front faces only
+	GLState::Instance()->setEnabled(GL_DEPTH_TEST, true);
+	GLState::Instance()->setEnabled(GL_BLEND, true);
+	GLState::Instance()->blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLState::Instance()->depthFunc(GL_LEQUAL);
 
 	
 }
 
+/// Loads the config of the bottles and measures the path from it
+/// \param filename Config file, the program needs one before anything is created
+/// \return False if it cannot be read
+bool loadConfig(const std::string & filename) {
+	if(!AnimNode::config.load(filename)) return false;
+	AnimNode::path = ConveyorPath(AnimNode::config);
+	return true;
+}
+
+/// Renders the scene without a window, every frame the same simulated time step, and prints the frame times
+/// \param options Parsed command line
+/// \return Exit code of the program
+int runHeadless(const HeadlessOptions & options) {
+	if(options.bottles >= 0) AnimNode::config.setBottles(options.bottles);
+
+	FILE * out = openHeadlessOutput(options.output);
+	if(out == NULL) {
+		std::cerr << "Cannot write " << (options.output.empty() ? "the standard output" : options.output) << std::endl;
+		return 1;
+	}
+	if(!createHeadlessContext(options.width, options.height) || !pgr::initialize(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR)
+		|| !createHeadlessFramebuffer(options.width, options.height)) {
+		destroyHeadlessFramebuffer();
+		destroyHeadlessContext();
+		closeHeadlessOutput(out);
+		return 1;
+	}
+	init();
+	reshape(options.width, options.height);
+	setCamera(options.camera);
+
+	{
+		// its queries have to be deleted while the context still exists
+		FrameTimings timings;
+		for(int frame = 0; frame < options.warmup + options.frames; frame++) {
+			const bool measured = frame >= options.warmup;
+			double start = preciseTime();
+			updateScene(frame * options.step);
+			double updated = preciseTime();
+			if(measured) timings.beginFrame();
+			drawFrame();
+			double drawn = preciseTime();
+			if(measured) timings.endFrame(updated - start, drawn - updated);
+		}
+		glFinish();
+
+		fprintf(out, "# renderer: %s, OpenGL %s\n", (const char *) glGetString(GL_RENDERER), (const char *) glGetString(GL_VERSION));
+		fprintf(out, "# bottles: %d, camera: %d, frames: %d, warmup: %d, size: %dx%d, step: %g s\n", AnimNode::config.bottles(), options.camera,
+			options.frames, options.warmup, options.width, options.height, options.step);
+		timings.print(out);
+	}
+	closeHeadlessOutput(out);
+
+	destroyHeadlessFramebuffer();
+	destroyHeadlessContext();
+	return 0;
+}
+
 /// Program starts here, might be mixed with init()
 /// I have no idea why something is here and something there
 int main(int argc, char** argv) {
+	// the headless mode may read another config, so it is loaded only now and not with the static one
+	const bool headless = argc > 1 && strcmp(argv[1], "--headless") == 0;
+	HeadlessOptions options;
+	if (headless && !options.parse(argc - 2, argv + 2)) return 1;
+	if (!loadConfig(headless && !options.config.empty() ? options.config : "config.txt")) return 1;
+
+	// benchmarks do not need any window
+	if (argc > 1 && strcmp(argv[1], "--benchmark-animation") == 0) {
+		benchmarkAnimation();
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--benchmark-heightmap") == 0) {
+		benchmarkHeightMap();
+		return 0;
+	}
+	// no window either, for the build servers
+	if (headless) return runHeadless(options);
 	glutInit(&argc, argv);
 	glutInitContextVersion(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR);
 	glutInitContextFlags(GLUT_FORWARD_COMPATIBLE);
@@ -2,6 +2,7 @@
 #include "pgr.h"   // includes all PGR libraries, like shader, glm, assimp ...
 
 #include "AxesNode.h"
+#include "GLState.h"
 
 GLuint AxesNode::m_vertexArrayObject  = 0;
 GLuint AxesNode::m_vertexBufferObject = 0;
@@ -70,20 +71,20 @@ AxesNode::AxesNode(const std::string &name, SceneNode * parent):
   if(m_vertexArrayObject == 0)
   {
     glGenBuffers(1, &m_vertexBufferObject);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferObject);
+    GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_vertexBufferObject);
       glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, 0);
 
     glGenVertexArrays(1, &m_vertexArrayObject );
-    glBindVertexArray( m_vertexArrayObject );
-      glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferObject);
+    GLState::Instance()->bindVertexArray( m_vertexArrayObject );
+      GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_vertexBufferObject);
       // vertices of triangles
       glEnableVertexAttribArray(m_posLoc);
       glVertexAttribPointer(m_posLoc, 4, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*) 0);
       // 8 = 4 + 4 floats per vertex - color
       glEnableVertexAttribArray(m_colLoc);
       glVertexAttribPointer(m_colLoc, 4, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(4*sizeof(float)));
-    glBindVertexArray( 0 );
+    GLState::Instance()->bindVertexArray( 0 );
   }
 
 }
@@ -91,11 +92,11 @@ AxesNode::AxesNode(const std::string &name, SceneNode * parent):
 AxesNode::~AxesNode(void)
 {
   if(m_program == 0)
-     pgr::deleteProgramAndShaders( m_program );
+     GLState::Instance()->deleteProgram(m_program);
   if(m_vertexArrayObject == 0)  // vertex array with one red point ;-(
   {
-     glDeleteBuffers     (1, &m_vertexBufferObject);
-     glDeleteVertexArrays(1, &m_vertexArrayObject );
+     GLState::Instance()->deleteBuffers(1, &m_vertexBufferObject);
+     GLState::Instance()->deleteVertexArrays(1, &m_vertexArrayObject );
   }
 }
 
@@ -106,10 +107,9 @@ void AxesNode::draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_
 
   glm::mat4 matrix = projection_matrix * view_matrix * globalMatrix();
 
-  glUseProgram(m_program);
-  glUniformMatrix4fv(m_PVMmatrixLoc, 1, GL_FALSE, glm::value_ptr(matrix) );
+  GLState::Instance()->useProgram(m_program);
+  GLState::Instance()->uniformMatrix4fv(m_PVMmatrixLoc, glm::value_ptr(matrix) );
 
-  glBindVertexArray( m_vertexArrayObject );
+  GLState::Instance()->bindVertexArray( m_vertexArrayObject );
     glDrawArrays(GL_LINES, 0, 6);
-  glBindVertexArray( 0 );
 }
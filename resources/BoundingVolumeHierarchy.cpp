@@ -0,0 +1,253 @@
+
+#include <algorithm>
+
+#include "BoundingVolumeHierarchy.h"
+#include "Frustum.h"
+
+/// surface area of the box, the cost of the node in the heuristic
+static float area(const glm::vec3 & box_min, const glm::vec3 & box_max)
+{
+  glm::vec3 size = box_max - box_min;
+  return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(float margin):
+  m_root(-1), m_free(-1), m_leafCount(0), m_margin(margin)
+{
+}
+
+int BoundingVolumeHierarchy::allocateNode()
+{
+  int node = m_free;
+  if(node < 0)
+  {
+    m_nodes.push_back(Node());
+    node = m_nodes.size() - 1;
+  }
+  else
+    m_free = m_nodes[node].parent;
+
+  Node & n = m_nodes[node];
+  n.parent = -1;
+  n.child[0] = n.child[1] = -1;
+  n.height = 0;
+  n.object = -1;
+  return node;
+}
+
+void BoundingVolumeHierarchy::freeNode(int node)
+{
+  m_nodes[node].parent = m_free;
+  m_nodes[node].height = -1;
+  m_free = node;
+}
+
+int BoundingVolumeHierarchy::insert(const glm::vec3 & box_min, const glm::vec3 & box_max, int object)
+{
+  const int leaf = allocateNode();
+  const glm::vec3 margin = (box_max - box_min) * m_margin;
+  m_nodes[leaf].min = box_min - margin;
+  m_nodes[leaf].max = box_max + margin;
+  m_nodes[leaf].object = object;
+  insertLeaf(leaf);
+  m_leafCount++;
+  return leaf;
+}
+
+void BoundingVolumeHierarchy::remove(int leaf)
+{
+  removeLeaf(leaf);
+  freeNode(leaf);
+  m_leafCount--;
+}
+
+bool BoundingVolumeHierarchy::move(int leaf, const glm::vec3 & box_min, const glm::vec3 & box_max)
+{
+  Node & node = m_nodes[leaf];
+  if(node.min.x <= box_min.x && node.min.y <= box_min.y && node.min.z <= box_min.z &&
+     box_max.x <= node.max.x && box_max.y <= node.max.y && box_max.z <= node.max.z)
+    return false;
+
+  removeLeaf(leaf);
+  const glm::vec3 margin = (box_max - box_min) * m_margin;
+  m_nodes[leaf].min = box_min - margin;
+  m_nodes[leaf].max = box_max + margin;
+  insertLeaf(leaf);
+  return true;
+}
+
+void BoundingVolumeHierarchy::insertLeaf(int leaf)
+{
+  if(m_root < 0)
+  {
+    m_root = leaf;
+    m_nodes[leaf].parent = -1;
+    return;
+  }
+
+  // descend to the sibling for which the areas of the new and the enlarged nodes grow the least
+  const glm::vec3 leafMin = m_nodes[leaf].min, leafMax = m_nodes[leaf].max;
+  int sibling = m_root;
+  while(!m_nodes[sibling].isLeaf())
+  {
+    const Node & node = m_nodes[sibling];
+    const float combined = area(glm::min(node.min, leafMin), glm::max(node.max, leafMax));
+    // a new parent of this node and the leaf
+    const float here = 2.0f * combined;
+    // every node on the way down grows to contain the leaf
+    const float inheritance = 2.0f * (combined - area(node.min, node.max));
+
+    float below[2];
+    for(int c = 0; c < 2; c++)
+    {
+      const Node & child = m_nodes[node.child[c]];
+      below[c] = area(glm::min(child.min, leafMin), glm::max(child.max, leafMax)) + inheritance;
+      if(!child.isLeaf())
+        below[c] -= area(child.min, child.max);
+    }
+
+    if(here < below[0] && here < below[1])
+      break;
+    sibling = below[0] < below[1] ? node.child[0] : node.child[1];
+  }
+
+  // the new parent takes the place of the sibling
+  const int oldParent = m_nodes[sibling].parent;
+  const int parent = allocateNode();
+  m_nodes[parent].parent = oldParent;
+  m_nodes[parent].child[0] = sibling;
+  m_nodes[parent].child[1] = leaf;
+  m_nodes[sibling].parent = parent;
+  m_nodes[leaf].parent = parent;
+  if(oldParent < 0)
+    m_root = parent;
+  else
+    m_nodes[oldParent].child[m_nodes[oldParent].child[0] == sibling ? 0 : 1] = parent;
+
+  refit(parent);
+}
+
+void BoundingVolumeHierarchy::removeLeaf(int leaf)
+{
+  if(leaf == m_root)
+  {
+    m_root = -1;
+    return;
+  }
+
+  // the sibling takes the place of the parent
+  const int parent = m_nodes[leaf].parent;
+  const int grandParent = m_nodes[parent].parent;
+  const int sibling = m_nodes[parent].child[m_nodes[parent].child[0] == leaf ? 1 : 0];
+  m_nodes[sibling].parent = grandParent;
+  freeNode(parent);
+  m_nodes[leaf].parent = -1;
+
+  if(grandParent < 0)
+  {
+    m_root = sibling;
+    return;
+  }
+  m_nodes[grandParent].child[m_nodes[grandParent].child[0] == parent ? 0 : 1] = sibling;
+  refit(grandParent);
+}
+
+void BoundingVolumeHierarchy::refit(int node)
+{
+  while(node >= 0)
+  {
+    node = balance(node);
+    Node & n = m_nodes[node];
+    const Node & a = m_nodes[n.child[0]];
+    const Node & b = m_nodes[n.child[1]];
+    n.height = 1 + std::max(a.height, b.height);
+    n.min = glm::min(a.min, b.min);
+    n.max = glm::max(a.max, b.max);
+    node = n.parent;
+  }
+}
+
+int BoundingVolumeHierarchy::balance(int a)
+{
+  if(m_nodes[a].isLeaf() || m_nodes[a].height < 2)
+    return a;
+
+  // the higher child (up) takes the place of a, a takes the place of the lower grandchild
+  const int difference = m_nodes[m_nodes[a].child[1]].height - m_nodes[m_nodes[a].child[0]].height;
+  if(difference >= -1 && difference <= 1)
+    return a;
+
+  const int upSide = difference > 1 ? 1 : 0;
+  const int up = m_nodes[a].child[upSide];
+  const int stays = m_nodes[a].child[1 - upSide];
+  const int f = m_nodes[up].child[0];
+  const int g = m_nodes[up].child[1];
+  // the higher grandchild stays under up, the lower one goes under a
+  const int higher = m_nodes[f].height > m_nodes[g].height ? f : g;
+  const int lower = higher == f ? g : f;
+
+  Node & upNode = m_nodes[up];
+  Node & aNode = m_nodes[a];
+  upNode.parent = aNode.parent;
+  if(upNode.parent < 0)
+    m_root = up;
+  else
+    m_nodes[upNode.parent].child[m_nodes[upNode.parent].child[0] == a ? 0 : 1] = up;
+  aNode.parent = up;
+  upNode.child[0] = a;
+  upNode.child[1] = higher;
+  aNode.child[upSide] = lower;
+  m_nodes[lower].parent = a;
+
+  const Node & s = m_nodes[stays];
+  const Node & l = m_nodes[lower];
+  aNode.min = glm::min(s.min, l.min);
+  aNode.max = glm::max(s.max, l.max);
+  aNode.height = 1 + std::max(s.height, l.height);
+  const Node & h = m_nodes[higher];
+  upNode.min = glm::min(aNode.min, h.min);
+  upNode.max = glm::max(aNode.max, h.max);
+  upNode.height = 1 + std::max(aNode.height, h.height);
+  return up;
+}
+
+void BoundingVolumeHierarchy::collect(int node, std::vector<int> & objects) const
+{
+  const Node & n = m_nodes[node];
+  if(n.isLeaf())
+  {
+    objects.push_back(n.object);
+    return;
+  }
+  collect(n.child[0], objects);
+  collect(n.child[1], objects);
+}
+
+unsigned BoundingVolumeHierarchy::cull(const Frustum & frustum, std::vector<int> & objects) const
+{
+  if(m_root < 0)
+    return 0;
+
+  unsigned tested = 0;
+  std::vector<int> stack(1, m_root);
+  while(!stack.empty())
+  {
+    const Node & node = m_nodes[stack.back()];
+    const int index = stack.back();
+    stack.pop_back();
+    tested++;
+
+    if(!frustum.intersects(node.min, node.max))
+      continue;
+    if(node.isLeaf())
+      objects.push_back(node.object);
+    else if(frustum.contains(node.min, node.max))
+      collect(index, objects);
+    else
+    {
+      stack.push_back(node.child[0]);
+      stack.push_back(node.child[1]);
+    }
+  }
+  return tested;
+}
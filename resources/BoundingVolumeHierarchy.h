@@ -0,0 +1,82 @@
+#ifndef BOUNDINGVOLUMEHIERARCHY_H
+#define BOUNDINGVOLUMEHIERARCHY_H
+
+#include <vector>
+
+#include "pgr.h"
+
+class Frustum;
+
+/** Dynamic tree of axis aligned bounding boxes
+ *
+ * Every leaf holds the box of one object enlarged by a margin, every inner node the union
+ * of its two children. A leaf is inserted next to the node whose box grows the least
+ * (surface area heuristic) and the tree is kept balanced by rotations on the way up.
+ *
+ * move() does nothing while the new box still fits the enlarged one, so objects moving
+ * a little every frame only touch the tree once in a while; otherwise the leaf is taken
+ * out and inserted again and only its ancestors are refitted.
+ */
+class BoundingVolumeHierarchy
+{
+public:
+  /// the leaves are enlarged by margin times the size of the box in every direction
+  explicit BoundingVolumeHierarchy(float margin = 0.1f);
+
+  /// adds the box of the object, returns its leaf
+  int insert(const glm::vec3 & box_min, const glm::vec3 & box_max, int object);
+  void remove(int leaf);
+  /// sets the new box of the leaf, returns true if the tree had to change
+  bool move(int leaf, const glm::vec3 & box_min, const glm::vec3 & box_max);
+
+  /// object of the leaf
+  int object(int leaf) const { return m_nodes[leaf].object; }
+
+  /** appends the objects whose boxes intersect the frustum
+   *
+   * Subtrees outside are skipped at once, subtrees completely inside are added without
+   * any more tests. Returns the number of boxes tested.
+   */
+  unsigned cull(const Frustum & frustum, std::vector<int> & objects) const;
+
+  /// levels of the tree, 0 if empty
+  int height() const { return m_root < 0 ? 0 : m_nodes[m_root].height + 1; }
+  unsigned leafCount() const { return m_leafCount; }
+
+protected:
+  struct Node
+  {
+    glm::vec3 min;
+    glm::vec3 max;
+    int parent;
+    /// -1 for leaves
+    int child[2];
+    /// leaves 0, else one more than the higher child
+    int height;
+    int object;
+
+    bool isLeaf() const { return child[0] < 0; }
+  };
+
+  int allocateNode();
+  void freeNode(int node);
+
+  void insertLeaf(int leaf);
+  void removeLeaf(int leaf);
+  /// rotates the subtree of the node if its children differ in height by more than one, returns its new root
+  int balance(int node);
+  /// refits and balances the node and all its ancestors
+  void refit(int node);
+
+  /// objects of all the leaves under the node
+  void collect(int node, std::vector<int> & objects) const;
+
+  std::vector<Node> m_nodes;
+  int m_root;
+  /// first unused node, linked through parent
+  int m_free;
+  unsigned m_leafCount;
+  float m_margin;
+};
+
+#endif // BOUNDINGVOLUMEHIERARCHY_H
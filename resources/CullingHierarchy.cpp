@@ -0,0 +1,107 @@
+
+#include <cstring>
+#include <cmath>
+
+#include "CullingHierarchy.h"
+#include "SceneNode.h"
+#include "Frustum.h"
+
+CullingHierarchy * CullingHierarchy::m_instance = 0;
+
+CullingHierarchy * CullingHierarchy::Instance()
+{
+  if(m_instance == 0)
+    m_instance = new CullingHierarchy();
+  return m_instance;
+}
+
+CullingHierarchy::CullingHierarchy():
+  m_frame(0), m_enabled(true)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+int CullingHierarchy::add(const SceneNode * node, const glm::vec3 & box_min, const glm::vec3 & box_max)
+{
+  int handle;
+  if(m_freeEntries.empty())
+  {
+    m_entries.push_back(Entry());
+    handle = m_entries.size() - 1;
+  }
+  else
+  {
+    handle = m_freeEntries.back();
+    m_freeEntries.pop_back();
+  }
+
+  Entry & entry = m_entries[handle];
+  entry.node = node;
+  entry.min = box_min;
+  entry.max = box_max;
+  entry.leaf = -1;
+  entry.stamp = 0;
+  // visible until the first cull() which sees it
+  entry.visibleFrame = m_frame;
+  return handle;
+}
+
+void CullingHierarchy::remove(int handle)
+{
+  Entry & entry = m_entries[handle];
+  if(entry.leaf >= 0)
+    m_tree.remove(entry.leaf);
+  entry.node = NULL;
+  entry.leaf = -1;
+  m_freeEntries.push_back(handle);
+}
+
+void CullingHierarchy::transformBox(const glm::mat4 & matrix, const glm::vec3 & box_min, const glm::vec3 & box_max,
+                                    glm::vec3 & result_min, glm::vec3 & result_max)
+{
+  // the centre moves, the half size is spread over the axes by the absolute values of the matrix
+  const glm::vec3 center = glm::vec3(matrix * glm::vec4(0.5f * (box_min + box_max), 1.0f));
+  const glm::vec3 half = 0.5f * (box_max - box_min);
+  glm::vec3 extent;
+  for(int row = 0; row < 3; row++)
+    extent[row] = fabs(matrix[0][row]) * half.x + fabs(matrix[1][row]) * half.y + fabs(matrix[2][row]) * half.z;
+  result_min = center - extent;
+  result_max = center + extent;
+}
+
+void CullingHierarchy::cull(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_frame++;
+
+  // only the nodes whose global matrix changed
+  for(unsigned i = 0; i < m_entries.size(); i++)
+  {
+    Entry & entry = m_entries[i];
+    if(entry.node == NULL)
+      continue;
+    m_stats.objects++;
+
+    const unsigned stamp = entry.node->globalMatrixStamp();
+    if(entry.leaf >= 0 && stamp == entry.stamp)
+      continue;
+
+    glm::vec3 worldMin, worldMax;
+    transformBox(entry.node->globalMatrix(), entry.min, entry.max, worldMin, worldMax);
+    if(entry.leaf < 0)
+    {
+      entry.leaf = m_tree.insert(worldMin, worldMax, i);
+      m_stats.reinserted++;
+    }
+    else if(m_tree.move(entry.leaf, worldMin, worldMax))
+      m_stats.reinserted++;
+    entry.stamp = stamp;
+    m_stats.moved++;
+  }
+
+  m_visible.clear();
+  m_stats.tested = m_tree.cull(Frustum(projection_matrix * view_matrix), m_visible);
+  m_stats.visible = m_visible.size();
+  for(unsigned i = 0; i < m_visible.size(); i++)
+    m_entries[m_visible[i]].visibleFrame = m_frame;
+}
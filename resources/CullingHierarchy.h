@@ -0,0 +1,82 @@
+#ifndef CULLINGHIERARCHY_H
+#define CULLINGHIERARCHY_H
+
+#include <vector>
+
+#include "pgr.h"
+#include "BoundingVolumeHierarchy.h"
+
+class SceneNode;
+
+/** Visibility of the drawn nodes, tested against the view frustum once per frame
+ *
+ * Nodes register the bounding box of what they draw, in their own space. cull() transforms
+ * the boxes of the nodes whose global matrix changed since the last frame to world space,
+ * refits them in a BoundingVolumeHierarchy and marks the objects whose boxes intersect the
+ * frustum; isVisible() is then a lookup in draw().
+ */
+class CullingHierarchy
+{
+public:
+  /// what the last cull() did
+  struct Stats
+  {
+    unsigned objects;
+    unsigned visible;
+    unsigned moved;       ///< boxes transformed again
+    unsigned reinserted;  ///< moved out of their leaf
+    unsigned tested;      ///< boxes of the tree tested against the frustum
+  };
+
+  /// hierarchy used by all scene nodes
+  static CullingHierarchy * Instance();
+
+  /// registers the box of the node (globalMatrix() applies), returns its handle
+  int add(const SceneNode * node, const glm::vec3 & box_min, const glm::vec3 & box_max);
+  void remove(int handle);
+
+  /// refits the moved nodes and marks the visible ones, call once per frame before drawing
+  void cull(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+
+  /// false if the node was outside the frustum in the last cull(), true while disabled
+  bool isVisible(int handle) const { return !m_enabled || m_entries[handle].visibleFrame == m_frame; }
+
+  void setEnabled(bool enabled) { m_enabled = enabled; }
+  bool enabled() const { return m_enabled; }
+
+  const Stats & stats() const { return m_stats; }
+
+  /// axis aligned box containing the box transformed by the matrix
+  static void transformBox(const glm::mat4 & matrix, const glm::vec3 & box_min, const glm::vec3 & box_max,
+                           glm::vec3 & result_min, glm::vec3 & result_max);
+
+protected:
+  CullingHierarchy();
+
+  struct Entry
+  {
+    /// NULL for free entries
+    const SceneNode * node;
+    glm::vec3 min;
+    glm::vec3 max;
+    /// leaf in m_tree, -1 until the first cull()
+    int leaf;
+    /// SceneNode::globalMatrixStamp() of the refitted box
+    unsigned stamp;
+    unsigned visibleFrame;
+  };
+
+  static CullingHierarchy * m_instance;
+
+  std::vector<Entry> m_entries;
+  std::vector<int> m_freeEntries;
+  BoundingVolumeHierarchy m_tree;
+  /// handles of the visible entries, reused every frame
+  std::vector<int> m_visible;
+  /// number of cull() calls, 0 means everything is visible
+  unsigned m_frame;
+  bool m_enabled;
+  Stats m_stats;
+};
+
+#endif // CULLINGHIERARCHY_H
@@ -0,0 +1,184 @@
+
+#include <iostream>
+#include <vector>
+#include <cstdio>
+
+#include "DisplacedTerrainNode.h"
+#include "ShaderProgram.h"
+#include "ShaderVariants.h"
+#include "MappedFile.h"
+#include "Resources.h"
+#include "GLState.h"
+
+/// texture unit of the heights, 0 is the colour of the terrain and 1 the cube map
+static const int HEIGHT_MAP_UNIT = 2;
+
+DisplacedTerrainNode::DisplacedTerrainNode(const std::string &name, SceneNode* parent):
+  SceneNode(name, parent), m_program(NULL), m_patchIndices(0), m_resX(0), m_resZ(0),
+  m_patchColumns(0), m_patchRows(0), m_texelHeight(0.0f)
+{
+  glGenVertexArrays(1, &m_vertexArrayObject);
+  glGenBuffers(1, &m_patchBufferObject);
+  glGenBuffers(1, &m_patchIndexBufferObject);
+  glGenTextures(1, &m_heightTexture);
+  MeshGeometry::SetTerrainMaterial(m_material, 0);
+}
+
+DisplacedTerrainNode::~DisplacedTerrainNode()
+{
+  GLState::Instance()->deleteTextures(1, &m_heightTexture);
+  GLState::Instance()->deleteBuffers(1, &m_patchIndexBufferObject);
+  GLState::Instance()->deleteBuffers(1, &m_patchBufferObject);
+  GLState::Instance()->deleteVertexArrays(1, &m_vertexArrayObject);
+  if(m_program)
+    ShaderVariants::Instance()->release(m_program);
+}
+
+void DisplacedTerrainNode::loadProgram()
+{
+  if(m_program)
+    ShaderVariants::Instance()->release(m_program);
+  m_program = ShaderVariants::Instance()->get("resources/DisplacedTerrainNode.vert", "resources/MeshNode.frag", ShaderVariants::Instance()->sceneFeatures());
+  m_heightMap = glGetUniformLocation(m_program->m_programId, "heightMap");
+  m_heightScale = glGetUniformLocation(m_program->m_programId, "heightScale");
+  m_patchesX = glGetUniformLocation(m_program->m_programId, "patchesX");
+  m_patchQuads = glGetUniformLocation(m_program->m_programId, "patchQuads");
+  m_patchPosition = glGetAttribLocation(m_program->m_programId, "patchPosition");
+}
+
+void DisplacedTerrainNode::createPatch()
+{
+  // grid coordinates of the vertices, 2 bytes each
+  const unsigned row = PATCH_QUADS + 1;
+  std::vector<GLubyte> vertices(2 * row * row);
+  for(unsigned z = 0; z < row; z++)
+  {
+    for(unsigned x = 0; x < row; x++)
+    {
+      vertices[2 * (z * row + x)] = GLubyte(x);
+      vertices[2 * (z * row + x) + 1] = GLubyte(z);
+    }
+  }
+
+  // the same triangles as MeshGeometry::LoadRawHeightMap()
+  std::vector<GLushort> indices;
+  indices.reserve(6 * PATCH_QUADS * PATCH_QUADS);
+  for(unsigned z = 0; z < PATCH_QUADS; z++)
+  {
+    for(unsigned x = 0; x < PATCH_QUADS; x++)
+    {
+      const GLushort i = GLushort(z * row + x);
+      indices.push_back(i);
+      indices.push_back(i + row);
+      indices.push_back(i + 1);
+      indices.push_back(i + 1);
+      indices.push_back(i + row);
+      indices.push_back(i + row + 1);
+    }
+  }
+  m_patchIndices = indices.size();
+
+  GLState::Instance()->bindVertexArray(m_vertexArrayObject);
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_patchBufferObject);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size(), &vertices[0], GL_STATIC_DRAW);
+  glEnableVertexAttribArray(m_patchPosition);
+  glVertexAttribPointer(m_patchPosition, 2, GL_UNSIGNED_BYTE, GL_FALSE, 0, 0);
+  GLState::Instance()->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_patchIndexBufferObject);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+  GLState::Instance()->bindVertexArray(0);
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool DisplacedTerrainNode::loadHeightMap(const std::string & path, int resX, int resZ)
+{
+  if(m_program == NULL)
+  {
+    loadProgram();
+    createPatch();
+  }
+
+  char file[256];
+  sprintf(file, "%s.raw", path.c_str());
+  MappedFile raw;
+  if(!raw.open(file))
+  {
+    std::cerr << "DisplacedTerrainNode::loadHeightMap(): Can't open input raw file " << file << std::endl;
+    return false;
+  }
+  if(!MeshGeometry::RawHeightMapResolution(file, raw.size(), resX, resZ))
+    return false;
+
+  std::cout << "Loading terrain height texture " << file << " [" << resX << "x" << resZ << "] ";
+  std::cout.flush();
+
+  // high * 0xFF + low, the same heights as MeshGeometry::ReadRawHeightMap() computes
+  const size_t count = size_t(resX) * resZ;
+  std::vector<GLushort> heights(count);
+  const unsigned char * data = raw.data();
+  for(size_t i = 0; i < count; i++)
+    heights[i] = GLushort(data[2*i + 1] * 0xFF + data[2*i]);
+
+  GLState::Instance()->bindTexture(GL_TEXTURE0 + HEIGHT_MAP_UNIT, GL_TEXTURE_2D, m_heightTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, resX, resZ, 0, GL_RED, GL_UNSIGNED_SHORT, &heights[0]);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  // texelFetch only, no filtering and no mipmaps
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  m_resX = resX;
+  m_resZ = resZ;
+  m_patchColumns = (resX - 1 + PATCH_QUADS - 1) / PATCH_QUADS;
+  m_patchRows = (resZ - 1 + PATCH_QUADS - 1) / PATCH_QUADS;
+  // the texel is normalized, the grid is 1 x 1 (see MeshGeometry::ReadRawHeightMap())
+  m_texelHeight = 65535.0f / ((resX - 1) * (resZ - 1));
+
+  sprintf(file, "%s.tga", path.c_str());
+  m_material.textureID = TextureManager::Instance()->get(file);
+
+  std::cout << m_patchColumns << "x" << m_patchRows << " patches" << std::endl;
+  return true;
+}
+
+void DisplacedTerrainNode::draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
+{
+  // inherited draw - draws all children
+  SceneNode::draw(view_matrix, projection_matrix);
+  if(m_program == NULL || m_resX == 0)
+    return;
+
+  GLState::Instance()->polygonMode(GL_FILL);
+
+  // view, projection and time are in the Frame block (FrameUniforms)
+  const glm::mat4 & Mmatrix = globalMatrix();
+  GLState::Instance()->useProgram(m_program->m_programId);
+  GLState::Instance()->uniformMatrix4fv(m_program->m_Mmatrix, glm::value_ptr(Mmatrix));
+  glm::mat4 NormalMatrix = glm::transpose(glm::inverse(view_matrix * Mmatrix));
+  GLState::Instance()->uniformMatrix4fv(m_program->m_NormalMatrix, glm::value_ptr(NormalMatrix));
+
+  GLState::Instance()->uniform1f(m_heightScale, m_texelHeight);
+  GLState::Instance()->uniform1i(m_patchesX, m_patchColumns);
+  GLState::Instance()->uniform1i(m_patchQuads, PATCH_QUADS);
+  GLState::Instance()->uniform1i(m_heightMap, HEIGHT_MAP_UNIT);
+  GLState::Instance()->bindTexture(GL_TEXTURE0 + HEIGHT_MAP_UNIT, GL_TEXTURE_2D, m_heightTexture);
+
+  GLState::Instance()->uniform3fv(m_program->m_diffuse,  1, m_material.diffuse);
+  GLState::Instance()->uniform3fv(m_program->m_ambient,  1, m_material.ambient);
+  GLState::Instance()->uniform3fv(m_program->m_specular, 1, m_material.specular);
+  GLState::Instance()->uniform1f(m_program->m_shininess,    m_material.shininess);
+  if(m_material.textureID != 0) {
+    GLState::Instance()->uniform1i(m_program->m_useTexture, 1);
+    GLState::Instance()->uniform1i(m_program->m_texSampler, 0);
+    GLState::Instance()->bindTexture(GL_TEXTURE0 + 0, GL_TEXTURE_2D, m_material.textureID);
+  }
+  else {
+    GLState::Instance()->uniform1i(m_program->m_useTexture, 0);
+  }
+
+  // one instance of the patch per part of the map
+  GLState::Instance()->bindVertexArray( m_vertexArrayObject );
+  glDrawElementsInstanced(GL_TRIANGLES, m_patchIndices, GL_UNSIGNED_SHORT, 0, m_patchColumns * m_patchRows);
+  GLState::Instance()->activeTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,63 @@
+#ifndef DISPLACEDTERRAINNODE_H
+#define DISPLACEDTERRAINNODE_H
+
+#include "pgr.h"
+#include "SceneNode.h"
+#include "MeshGeometry.h"
+
+class MeshShaderProgram;
+
+/** Terrain displaced in the vertex shader from a heightmap texture
+ *
+ * The heights stay in a GL_R16 texture with one texel per sample of the raw file, the only
+ * geometry is one small grid patch of PATCH_QUADS x PATCH_QUADS quads. The patch is drawn
+ * instanced to cover the map, the instance picks its part of the texture and every vertex
+ * fetches its height and the neighbouring ones for the normal.
+ *
+ * The terrain is the same as the one of MeshGeometry::LoadRawHeightMap() (-0.5 .. 0.5 in x and z),
+ * but its memory is the size of the texture and loading another heightmap is just its upload.
+ */
+class DisplacedTerrainNode : public SceneNode
+{
+public:
+  /// quads along the edge of the grid patch (the patch vertices are bytes)
+  static const unsigned PATCH_QUADS = 64;
+
+  DisplacedTerrainNode(const std::string & name = "<DisplacedTerrainNode>", SceneNode* parent = NULL);
+  ~DisplacedTerrainNode();
+
+  /** uploads the heightmap path.raw and takes path.tga for the colour, replaces the previous one
+   *
+   * The resolution as in MeshGeometry::ReadRawHeightMap(), false if the file cannot be read.
+   */
+  bool loadHeightMap(const std::string & path, int resX = 0, int resZ = 0);
+
+  int resX() const { return m_resX; }
+  int resZ() const { return m_resZ; }
+
+  /// reimplemented draw
+  void draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+
+protected:
+  void loadProgram();
+  /// fills the buffers of the patch and sets up the vertex array
+  void createPatch();
+
+  MeshShaderProgram * m_program;
+  // locations only this shader has
+  GLint m_heightMap, m_heightScale, m_patchesX, m_patchQuads, m_patchPosition;
+
+  GLuint m_vertexArrayObject;
+  GLuint m_patchBufferObject;
+  GLuint m_patchIndexBufferObject;
+  unsigned m_patchIndices;
+  GLuint m_heightTexture;
+
+  int m_resX, m_resZ;
+  unsigned m_patchColumns, m_patchRows;
+  /// texel value (0 .. 1) to the height in the space of the terrain
+  float m_texelHeight;
+  MeshGeometry::SubMesh m_material;
+};
+
+#endif // DISPLACEDTERRAINNODE_H
@@ -0,0 +1,84 @@
+#version 140
+
+#define MAX_LIGHTS 8
+
+struct FrameLight {
+   vec4  ambient;
+   vec4  diffuse;
+   vec4  specular;
+   vec4  position;       // camera space
+   vec4  spotDirection;  // camera space
+   float spotCosCutoff;
+   float spotExponent;
+};
+
+// per-frame data shared by all the shaders, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Frame {
+  mat4  Vmatrix;     // View                       --> world to eye coordinates
+  mat4  Pmatrix;     // Projection                 --> eye to clip coordinates
+  mat4  PVmatrix;    // Projection * View          --> world to clip coordinates
+  vec4  sunDirection; // camera space direction of the sun light
+  vec4  sunAmbient;  // ambient part of the sun, changes with its height
+  vec4  clusterScale; // tile size in pixels, log(distance) scale and bias of the slice (see LightClusters)
+  ivec4 clusterGrid; // tiles in x and y, slices, 0 without clustered lights
+  float time;        // in seconds
+  int   lightCount;  // number of used lights
+  FrameLight lights[MAX_LIGHTS];
+};
+
+uniform mat4 Mmatrix;      // Model                      --> model to world coordinates
+uniform mat4 NormalMatrix; // inverse transposed VMmatrix
+
+uniform sampler2D heightMap; // GL_R16, one texel per vertex of the whole terrain
+uniform float heightScale;   // texel value (0 .. 1) to the height in model space
+uniform int   patchesX;      // patches in one row of the instances
+uniform int   patchQuads;    // quads along the edge of the patch
+
+in vec2 patchPosition;       // vertex of the grid patch, 0 .. patchQuads
+
+smooth out vec3 normal_v;    // camera space normal
+smooth out vec3 position_v;  // camera space fragment position
+
+smooth out vec2 texCoord_v;	// outgoing texture coordinates
+noperspective out vec3 reflectDir;
+
+float heightAt(ivec2 texel) {
+  return texelFetch(heightMap, texel, 0).r * heightScale;
+}
+
+void main() {
+  // the patch of this instance, the vertices past the edge of the map stay on the edge
+  ivec2 last = textureSize(heightMap, 0) - ivec2(1);
+  ivec2 patchIndex = ivec2(gl_InstanceID % patchesX, gl_InstanceID / patchesX);
+  ivec2 texel = min(patchIndex * patchQuads + ivec2(patchPosition), last);
+
+  // the grid spans -0.5 .. 0.5 like the one of MeshGeometry::LoadRawHeightMap()
+  vec2 delta = vec2(1.0) / vec2(last);
+  vec3 objectPosition = vec3(-0.5 + float(texel.x) * delta.x, heightAt(texel), -0.5 + float(texel.y) * delta.y);
+
+  // central differences of the neighbours, one sided on the edges
+  ivec2 west  = max(texel - ivec2(1, 0), ivec2(0));
+  ivec2 east  = min(texel + ivec2(1, 0), last);
+  ivec2 south = max(texel - ivec2(0, 1), ivec2(0));
+  ivec2 north = min(texel + ivec2(0, 1), last);
+  vec3 normal = normalize(vec3((heightAt(west) - heightAt(east)) / (float(east.x - west.x) * delta.x),
+                               1.0,
+                               (heightAt(south) - heightAt(north)) / (float(north.y - south.y) * delta.y)));
+
+  vec4 worldPosition = Mmatrix * vec4(objectPosition, 1);
+
+  // vertex position after the projection (gl_Position is predefined output variable)
+  gl_Position = PVmatrix * worldPosition;   // out:v vertex in clip coordinates
+
+  // eye-coordinate position of vertex
+  vec4 VMposition = Vmatrix * worldPosition;              //vertex in eye coordinates
+  vec3 VMnormal   = normalize( NormalMatrix * vec4(normal, 0.0) ).xyz;  //normal in eye coordinates by NormalMatrix
+
+  // outputs entering the fragment shader
+  normal_v   = VMnormal;
+  position_v = VMposition.xyz;
+
+  texCoord_v = vec2(texel) * delta;
+  vec3 worldView = normalize(objectPosition);
+  reflectDir = reflect(-worldView, normal);
+}
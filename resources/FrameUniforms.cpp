@@ -0,0 +1,46 @@
+
+#include "FrameUniforms.h"
+
+FrameUniforms * FrameUniforms::m_instance = 0;
+
+FrameUniforms * FrameUniforms::Instance()
+{
+  if(m_instance == 0)
+    m_instance = new FrameUniforms();
+  return m_instance;
+}
+
+FrameUniforms::FrameUniforms():
+  m_buffer(0), m_block()
+{
+}
+
+void FrameUniforms::bindProgram(GLuint program)
+{
+  GLuint index = glGetUniformBlockIndex(program, "Frame");
+  if(index != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, index, BINDING);
+}
+
+void FrameUniforms::setCamera(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
+{
+  m_block.Vmatrix = view_matrix;
+  m_block.Pmatrix = projection_matrix;
+  m_block.PVmatrix = projection_matrix * view_matrix;
+}
+
+void FrameUniforms::upload()
+{
+  if(m_buffer == 0)
+  {
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, m_buffer);
+  }
+  else
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &m_block);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
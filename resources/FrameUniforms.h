@@ -0,0 +1,90 @@
+#ifndef FRAMEUNIFORMS_H
+#define FRAMEUNIFORMS_H
+
+#include "pgr.h"
+
+/** Per-frame data shared by all the shaders through one std140 uniform block
+ *
+ * The shaders declare the block "Frame" (see MeshNode.vert), the structures
+ * below mirror its std140 layout byte by byte. The data are filled once per frame
+ * and uploaded by a single glBufferSubData, the programs only keep per-draw
+ * uniforms (model and normal matrix, material).
+ */
+class FrameUniforms
+{
+public:
+  enum {
+    MAX_LIGHTS = 8, ///< size of the lights array in the shaders
+    BINDING = 0     ///< uniform buffer binding point of the block
+  };
+
+  /// spot light, positions and directions in camera space
+  struct Light
+  {
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+    glm::vec4 position;
+    glm::vec4 spotDirection;
+    float spotCosCutoff;
+    float spotExponent;
+    float padding[2]; ///< std140 rounds structures to 16 bytes
+  };
+
+  /// the whole block
+  struct Block
+  {
+    glm::mat4 Vmatrix;
+    glm::mat4 Pmatrix;
+    glm::mat4 PVmatrix;
+    glm::vec4 sunDirection;
+    glm::vec4 sunAmbient;
+    glm::vec4 clusterScale;
+    int clusterGrid[4];
+    float time;
+    int lightCount;
+    float padding[2]; ///< the array of structures starts at 16 bytes
+    Light lights[MAX_LIGHTS];
+  };
+
+  /// block used by all the shaders
+  static FrameUniforms * Instance();
+
+  /// connects the "Frame" block of the program to the shared buffer, does nothing if the program has none
+  static void bindProgram(GLuint program);
+
+  void setCamera(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+  void setTime(float time) { m_block.time = time; }
+  /// directional light of the sun, the direction already in camera space
+  void setSun(const glm::vec3 & direction, const glm::vec3 & ambient) { m_block.sunDirection = glm::vec4(direction, 0.0f); m_block.sunAmbient = glm::vec4(ambient, 1.0f); }
+
+  /// grid of the LightClusters, the scale as LightClusters::scale() returns it
+  void setClusters(const glm::vec4 & scale, int tiles_x, int tiles_y, int slices)
+  {
+    m_block.clusterScale = scale;
+    m_block.clusterGrid[0] = tiles_x;
+    m_block.clusterGrid[1] = tiles_y;
+    m_block.clusterGrid[2] = slices;
+    m_block.clusterGrid[3] = 0;
+  }
+
+  /// number of lights used by the shaders, at most MAX_LIGHTS
+  void setLightCount(int count) { m_block.lightCount = count < int(MAX_LIGHTS) ? count : int(MAX_LIGHTS); }
+  Light & light(unsigned index) { return m_block.lights[index]; }
+
+  const Block & block() const { return m_block; }
+
+  /// sends the block to the GPU, call once per frame before drawing
+  void upload();
+
+protected:
+  FrameUniforms();
+
+  static FrameUniforms * m_instance;
+
+  /// uniform buffer, created by the first upload() (needs the GL context)
+  GLuint m_buffer;
+  Block m_block;
+};
+
+#endif // FRAMEUNIFORMS_H
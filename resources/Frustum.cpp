@@ -0,0 +1,72 @@
+
+#include "Frustum.h"
+
+Frustum::Frustum()
+{
+  for(unsigned i = 0; i < PLANE_COUNT; i++)
+    m_planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+Frustum::Frustum(const glm::mat4 & clip_matrix)
+{
+  // rows of the matrix, glm stores columns
+  glm::vec4 rows[4];
+  for(int r = 0; r < 4; r++)
+    rows[r] = glm::vec4(clip_matrix[0][r], clip_matrix[1][r], clip_matrix[2][r], clip_matrix[3][r]);
+
+  // -w <= x, y, z <= w
+  m_planes[LEFT]       = rows[3] + rows[0];
+  m_planes[RIGHT]      = rows[3] - rows[0];
+  m_planes[BOTTOM]     = rows[3] + rows[1];
+  m_planes[TOP]        = rows[3] - rows[1];
+  m_planes[NEAR_PLANE] = rows[3] + rows[2];
+  m_planes[FAR_PLANE]  = rows[3] - rows[2];
+
+  for(unsigned i = 0; i < PLANE_COUNT; i++)
+  {
+    float length = glm::length(glm::vec3(m_planes[i]));
+    if(length > 0.0f)
+      m_planes[i] = m_planes[i] * (1.0f / length);
+  }
+}
+
+bool Frustum::intersects(const glm::vec3 & box_min, const glm::vec3 & box_max) const
+{
+  for(unsigned i = 0; i < PLANE_COUNT; i++)
+  {
+    // the corner of the box furthest along the normal
+    const glm::vec4 & p = m_planes[i];
+    glm::vec3 corner(p.x >= 0.0f ? box_max.x : box_min.x,
+                     p.y >= 0.0f ? box_max.y : box_min.y,
+                     p.z >= 0.0f ? box_max.z : box_min.z);
+    if(p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+bool Frustum::contains(const glm::vec3 & point) const
+{
+  for(unsigned i = 0; i < PLANE_COUNT; i++)
+  {
+    const glm::vec4 & p = m_planes[i];
+    if(p.x * point.x + p.y * point.y + p.z * point.z + p.w < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+bool Frustum::contains(const glm::vec3 & box_min, const glm::vec3 & box_max) const
+{
+  for(unsigned i = 0; i < PLANE_COUNT; i++)
+  {
+    // the corner of the box furthest against the normal
+    const glm::vec4 & p = m_planes[i];
+    glm::vec3 corner(p.x >= 0.0f ? box_min.x : box_max.x,
+                     p.y >= 0.0f ? box_min.y : box_max.y,
+                     p.z >= 0.0f ? box_min.z : box_max.z);
+    if(p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0.0f)
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,36 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "pgr.h"
+
+/** View frustum as six planes, for culling bounding boxes
+ *
+ * The planes are extracted from a clip matrix (Gribb & Hartmann). Built from
+ * projection * view they are in world space, from projection * view * model
+ * in the space of the model, so its boxes are tested without transforming them.
+ */
+class Frustum
+{
+public:
+  enum { LEFT, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, PLANE_COUNT };
+
+  /// frustum containing everything
+  Frustum();
+  explicit Frustum(const glm::mat4 & clip_matrix);
+
+  /// false only if the box is completely outside (boxes near the corners may pass anyway)
+  bool intersects(const glm::vec3 & box_min, const glm::vec3 & box_max) const;
+
+  bool contains(const glm::vec3 & point) const;
+
+  /// true if the whole box is inside, so nothing in it needs testing
+  bool contains(const glm::vec3 & box_min, const glm::vec3 & box_max) const;
+
+  /// plane i as (normal, distance), points inside have dot(normal, point) + distance >= 0
+  const glm::vec4 & plane(unsigned i) const { return m_planes[i]; }
+
+private:
+  glm::vec4 m_planes[PLANE_COUNT];
+};
+
+#endif // FRUSTUM_H
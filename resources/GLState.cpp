@@ -0,0 +1,296 @@
+
+#include <cstring>
+
+#include "GLState.h"
+
+GLState * GLState::m_instance = 0;
+
+GLState * GLState::Instance()
+{
+  if(m_instance == 0)
+    m_instance = new GLState();
+  return m_instance;
+}
+
+GLState::GLState()
+{
+  memset(&m_frame, 0, sizeof(m_frame));
+  memset(&m_stats, 0, sizeof(m_stats));
+  invalidate();
+}
+
+void GLState::invalidate()
+{
+  m_program = UNKNOWN;
+  m_vertexArray = UNKNOWN;
+  for(int b = 0; b < BUFFER_TARGETS; b++)
+    m_buffers[b] = UNKNOWN;
+  m_activeTexture = UNKNOWN;
+  for(int u = 0; u < UNITS; u++)
+    for(int t = 0; t < TEXTURE_TARGETS; t++)
+      m_textures[u][t] = UNKNOWN;
+  m_polygonMode = UNKNOWN;
+  m_capabilities.clear();
+  m_blendSource = m_blendDestination = UNKNOWN;
+  m_depthFunc = UNKNOWN;
+  m_depthMask = UNKNOWN;
+  m_colorMask = UNKNOWN;
+  m_cullFace = UNKNOWN;
+  // the uniforms belong to the programs, only a glUniform*() outside could change them
+  m_uniforms.clear();
+  m_programUniforms = NULL;
+}
+
+int GLState::textureTarget(GLenum target)
+{
+  switch(target)
+  {
+    case GL_TEXTURE_2D:       return 0;
+    case GL_TEXTURE_CUBE_MAP: return 1;
+    case GL_TEXTURE_BUFFER:   return 2;
+    case GL_TEXTURE_2D_ARRAY: return 3;
+    default:                  return -1;
+  }
+}
+
+int GLState::bufferTarget(GLenum target)
+{
+  switch(target)
+  {
+    case GL_ARRAY_BUFFER:         return 0;
+    case GL_ELEMENT_ARRAY_BUFFER: return 1;
+    case GL_DRAW_INDIRECT_BUFFER: return 2;
+    case GL_TEXTURE_BUFFER:       return 3;
+    default:                      return -1;
+  }
+}
+
+bool GLState::set(GLuint & current, GLuint value)
+{
+  if(current == value)
+  {
+    m_frame.elided++;
+    return false;
+  }
+  current = value;
+  m_frame.issued++;
+  return true;
+}
+
+void GLState::useProgram(GLuint program)
+{
+  if(!set(m_program, program))
+    return;
+  glUseProgram(program);
+  m_programUniforms = &m_uniforms[program];
+}
+
+void GLState::bindVertexArray(GLuint vertex_array)
+{
+  if(!set(m_vertexArray, vertex_array))
+    return;
+  glBindVertexArray(vertex_array);
+  // the element buffer is a part of the vertex array
+  m_buffers[bufferTarget(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer)
+{
+  const int index = bufferTarget(target);
+  if(index < 0)
+    m_frame.issued++;
+  else if(!set(m_buffers[index], buffer))
+    return;
+  glBindBuffer(target, buffer);
+}
+
+void GLState::activeTexture(GLenum unit)
+{
+  if(set(m_activeTexture, unit))
+    glActiveTexture(unit);
+}
+
+void GLState::bindTexture(GLenum unit, GLenum target, GLuint texture)
+{
+  // the unit is activated even for a skipped bind, glTex*() calls after it may need it
+  activeTexture(unit);
+  const int index = textureTarget(target);
+  const GLuint u = unit - GL_TEXTURE0;
+  if(index >= 0 && u < UNITS && m_textures[u][index] == texture)
+  {
+    m_frame.elided++;
+    return;
+  }
+
+  if(index >= 0 && u < UNITS)
+    m_textures[u][index] = texture;
+  glBindTexture(target, texture);
+  m_frame.issued++;
+}
+
+void GLState::polygonMode(GLenum mode)
+{
+  if(set(m_polygonMode, mode))
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void GLState::setEnabled(GLenum capability, bool enabled)
+{
+  std::map<GLenum, GLuint>::iterator it = m_capabilities.insert(std::make_pair(capability, UNKNOWN)).first;
+  if(!set(it->second, enabled ? GL_TRUE : GL_FALSE))
+    return;
+  if(enabled)
+    glEnable(capability);
+  else
+    glDisable(capability);
+}
+
+bool GLState::isEnabled(GLenum capability)
+{
+  std::map<GLenum, GLuint>::iterator it = m_capabilities.insert(std::make_pair(capability, UNKNOWN)).first;
+  if(it->second == UNKNOWN)
+    it->second = glIsEnabled(capability) ? GL_TRUE : GL_FALSE;
+  return it->second == GL_TRUE;
+}
+
+void GLState::blendFunc(GLenum source, GLenum destination)
+{
+  if(m_blendSource == source && m_blendDestination == destination)
+  {
+    m_frame.elided++;
+    return;
+  }
+  m_blendSource = source;
+  m_blendDestination = destination;
+  glBlendFunc(source, destination);
+  m_frame.issued++;
+}
+
+void GLState::depthFunc(GLenum function)
+{
+  if(set(m_depthFunc, function))
+    glDepthFunc(function);
+}
+
+void GLState::depthMask(GLboolean mask)
+{
+  if(set(m_depthMask, mask))
+    glDepthMask(mask);
+}
+
+void GLState::colorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+  const GLuint mask = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+  if(set(m_colorMask, mask))
+    glColorMask(red, green, blue, alpha);
+}
+
+void GLState::cullFace(GLenum face)
+{
+  if(set(m_cullFace, face))
+    glCullFace(face);
+}
+
+bool GLState::setUniform(GLint location, GLenum type, const void * value, size_t size)
+{
+  if(location < 0)
+    return false;
+  // without a known program there is nothing to compare with
+  if(m_programUniforms == NULL)
+  {
+    m_frame.uniformsIssued++;
+    return true;
+  }
+
+  if(size_t(location) >= m_programUniforms->size())
+    m_programUniforms->resize(location + 1);
+  Uniform & uniform = (*m_programUniforms)[location];
+  if(uniform.type == type && uniform.value.size() == size && memcmp(&uniform.value[0], value, size) == 0)
+  {
+    m_frame.uniformsElided++;
+    return false;
+  }
+  uniform.type = type;
+  uniform.value.assign(static_cast<const unsigned char *>(value), static_cast<const unsigned char *>(value) + size);
+  m_frame.uniformsIssued++;
+  return true;
+}
+
+void GLState::uniform1i(GLint location, GLint value)
+{
+  if(setUniform(location, GL_INT, &value, sizeof(value)))
+    glUniform1i(location, value);
+}
+
+void GLState::uniform1f(GLint location, GLfloat value)
+{
+  if(setUniform(location, GL_FLOAT, &value, sizeof(value)))
+    glUniform1f(location, value);
+}
+
+void GLState::uniform3fv(GLint location, GLsizei count, const GLfloat * value)
+{
+  if(setUniform(location, GL_FLOAT_VEC3, value, count * 3 * sizeof(GLfloat)))
+    glUniform3fv(location, count, value);
+}
+
+void GLState::uniform4fv(GLint location, GLsizei count, const GLfloat * value)
+{
+  if(setUniform(location, GL_FLOAT_VEC4, value, count * 4 * sizeof(GLfloat)))
+    glUniform4fv(location, count, value);
+}
+
+void GLState::uniformMatrix4fv(GLint location, const GLfloat * value)
+{
+  if(setUniform(location, GL_FLOAT_MAT4, value, 16 * sizeof(GLfloat)))
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
+
+void GLState::deleteBuffers(GLsizei count, const GLuint * buffers)
+{
+  // deleting a bound buffer binds 0 instead
+  for(GLsizei i = 0; i < count; i++)
+    for(int b = 0; b < BUFFER_TARGETS; b++)
+      if(m_buffers[b] == buffers[i])
+        m_buffers[b] = 0;
+  glDeleteBuffers(count, buffers);
+}
+
+void GLState::deleteVertexArrays(GLsizei count, const GLuint * vertex_arrays)
+{
+  for(GLsizei i = 0; i < count; i++)
+    if(m_vertexArray == vertex_arrays[i])
+    {
+      m_vertexArray = 0;
+      m_buffers[bufferTarget(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+    }
+  glDeleteVertexArrays(count, vertex_arrays);
+}
+
+void GLState::deleteTextures(GLsizei count, const GLuint * textures)
+{
+  for(GLsizei i = 0; i < count; i++)
+    for(int u = 0; u < UNITS; u++)
+      for(int t = 0; t < TEXTURE_TARGETS; t++)
+        if(m_textures[u][t] == textures[i])
+          m_textures[u][t] = 0;
+  glDeleteTextures(count, textures);
+}
+
+void GLState::deleteProgram(GLuint program)
+{
+  // a program created later may get the name, it must not find the values of this one
+  m_uniforms.erase(program);
+  if(m_program == program)
+  {
+    m_program = UNKNOWN;
+    m_programUniforms = NULL;
+  }
+  pgr::deleteProgramAndShaders(program);
+}
+
+void GLState::endFrame()
+{
+  m_stats = m_frame;
+  memset(&m_frame, 0, sizeof(m_frame));
+}
@@ -0,0 +1,130 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <map>
+#include <vector>
+
+#include "pgr.h"
+
+/** Copy of the OpenGL state the drawing code sets, calls setting the current value are skipped
+ *
+ * Tracked are the program, the vertex array, the buffers bound to GL_ARRAY_BUFFER,
+ * GL_ELEMENT_ARRAY_BUFFER (a part of the vertex array, so forgotten when it changes),
+ * GL_DRAW_INDIRECT_BUFFER and GL_TEXTURE_BUFFER, the active texture unit and the textures
+ * of the first UNITS units, the polygon mode, the enabled capabilities, the blend and depth
+ * functions, the depth and color masks, the culled face and the uniforms of every program.
+ * Other buffer targets and texture targets are passed through.
+ *
+ * The copy is only right while everything goes through this class. Code which changes the
+ * state by itself (pgr, the texture loading) must be followed by invalidate(), deleting
+ * the objects (the programs too) goes through the delete* methods so their names are forgotten.
+ *
+ * The uniforms are kept per program and location. An array is compared as a whole under
+ * the location of its first element, it must not be set by the single elements then.
+ */
+class GLState
+{
+public:
+  enum { UNITS = 16 };
+
+  struct Stats
+  {
+    unsigned issued;          ///< state calls passed to OpenGL, the uniforms excluded
+    unsigned elided;          ///< state calls skipped as they set the current value
+    unsigned uniformsIssued;
+    unsigned uniformsElided;
+  };
+
+  /// state of the one GL context
+  static GLState * Instance();
+
+  /// forgets the whole copy, the next call of everything is issued
+  void invalidate();
+
+  void useProgram(GLuint program);
+  void bindVertexArray(GLuint vertex_array);
+  void bindBuffer(GLenum target, GLuint buffer);
+  void activeTexture(GLenum unit);
+  /// binds the texture to the unit (GL_TEXTURE0 + n), the unit is active afterwards
+  void bindTexture(GLenum unit, GLenum target, GLuint texture);
+
+  void polygonMode(GLenum mode);
+  /// glEnable() or glDisable()
+  void setEnabled(GLenum capability, bool enabled);
+  /// the copy of glIsEnabled(), which is asked only while the capability is unknown
+  bool isEnabled(GLenum capability);
+  void blendFunc(GLenum source, GLenum destination);
+  void depthFunc(GLenum function);
+  void depthMask(GLboolean mask);
+  void colorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+  void cullFace(GLenum face);
+
+  /// uniforms of the current program, a location of -1 is skipped like OpenGL does
+  void uniform1i(GLint location, GLint value);
+  void uniform1f(GLint location, GLfloat value);
+  void uniform3fv(GLint location, GLsizei count, const GLfloat * value);
+  void uniform4fv(GLint location, GLsizei count, const GLfloat * value);
+  void uniformMatrix4fv(GLint location, const GLfloat * value);
+
+  /// glDelete*(), the deleted names are forgotten, a new object may get them again
+  void deleteBuffers(GLsizei count, const GLuint * buffers);
+  void deleteVertexArrays(GLsizei count, const GLuint * vertex_arrays);
+  void deleteTextures(GLsizei count, const GLuint * textures);
+  /// pgr::deleteProgramAndShaders(), its uniforms are forgotten as well
+  void deleteProgram(GLuint program);
+
+  /// counts of the last frame
+  const Stats & stats() const { return m_stats; }
+  /// moves the counts of the frame to stats()
+  void endFrame();
+
+protected:
+  GLState();
+
+  /// value meaning "not known", no call is skipped against it
+  static const GLuint UNKNOWN = GLuint(-1);
+
+  enum { TEXTURE_TARGETS = 4, BUFFER_TARGETS = 4 };
+
+  /// index of the target in m_textures or m_buffers, -1 for the ones passed through
+  static int textureTarget(GLenum target);
+  static int bufferTarget(GLenum target);
+
+  /// true (and the value remembered) if the call setting the value must be issued
+  bool set(GLuint & current, GLuint value);
+  bool setUniform(GLint location, GLenum type, const void * value, size_t size);
+
+  struct Uniform
+  {
+    Uniform(): type(0) {}
+
+    GLenum type;  ///< 0 until set
+    std::vector<unsigned char> value;
+  };
+
+  static GLState * m_instance;
+
+  GLuint m_program;
+  GLuint m_vertexArray;
+  GLuint m_buffers[BUFFER_TARGETS];
+  GLuint m_activeTexture;
+  GLuint m_textures[UNITS][TEXTURE_TARGETS];
+  GLuint m_polygonMode;
+  std::map<GLenum, GLuint> m_capabilities;  ///< GL_TRUE or GL_FALSE, missing ones unknown
+  GLuint m_blendSource;
+  GLuint m_blendDestination;
+  GLuint m_depthFunc;
+  GLuint m_depthMask;
+  GLuint m_colorMask;  ///< the four flags in the low four bits
+  GLuint m_cullFace;
+
+  /// program -> its uniforms by location
+  std::map<GLuint, std::vector<Uniform> > m_uniforms;
+  /// uniforms of m_program, NULL if it is not known
+  std::vector<Uniform> * m_programUniforms;
+
+  Stats m_frame;
+  Stats m_stats;
+};
+
+#endif // GLSTATE_H
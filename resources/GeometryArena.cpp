@@ -0,0 +1,298 @@
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "GeometryArena.h"
+#include "ShaderVariants.h"
+#include "GLState.h"
+
+GeometryArena::FreeList::FreeList(size_t capacity):
+  m_capacity(0), m_used(0)
+{
+  grow(capacity);
+}
+
+size_t GeometryArena::FreeList::allocate(size_t size, size_t alignment)
+{
+  if(size == 0)
+    return 0;
+
+  for(std::map<size_t, size_t>::iterator it = m_free.begin(); it != m_free.end(); ++it)
+  {
+    const size_t start = it->first;
+    const size_t end = start + it->second;
+    const size_t offset = (start + alignment - 1) / alignment * alignment;
+    if(offset + size > end)
+      continue;
+
+    // the padding in front and the rest behind stay free
+    m_free.erase(it);
+    if(offset > start)
+      m_free[start] = offset - start;
+    if(offset + size < end)
+      m_free[offset + size] = end - offset - size;
+    m_used += size;
+    return offset;
+  }
+  return NO_SPACE;
+}
+
+void GeometryArena::FreeList::release(size_t offset, size_t size)
+{
+  if(size == 0)
+    return;
+  m_used -= size;
+
+  std::map<size_t, size_t>::iterator next = m_free.lower_bound(offset);
+  if(next != m_free.end() && offset + size == next->first)
+  {
+    size += next->second;
+    m_free.erase(next++);
+  }
+  if(next != m_free.begin())
+  {
+    std::map<size_t, size_t>::iterator previous = next;
+    --previous;
+    if(previous->first + previous->second == offset)
+    {
+      previous->second += size;
+      return;
+    }
+  }
+  m_free.insert(next, std::make_pair(offset, size));
+}
+
+void GeometryArena::FreeList::grow(size_t capacity)
+{
+  if(capacity <= m_capacity)
+    return;
+  // the new space is released as if it was used, so it merges with a free range at the end
+  const size_t start = m_capacity;
+  m_used += capacity - start;
+  m_capacity = capacity;
+  release(start, capacity - start);
+}
+
+size_t GeometryArena::FreeList::largestFree() const
+{
+  size_t largest = 0;
+  for(std::map<size_t, size_t>::const_iterator it = m_free.begin(); it != m_free.end(); ++it)
+    largest = std::max(largest, it->second);
+  return largest;
+}
+
+GeometryArena * GeometryArena::m_instance = 0;
+
+GeometryArena * GeometryArena::Instance()
+{
+  if(m_instance == 0)
+    m_instance = new GeometryArena();
+  return m_instance;
+}
+
+GeometryArena::GeometryArena():
+  m_elementBufferObject(0), m_indices(INITIAL_INDEX_BYTES), m_drawIdBufferObject(0), m_drawIdCount(0)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+  for(unsigned f = 0; f < MeshGeometry::FORMAT_COUNT; f++)
+  {
+    m_pools[f].vertexArrayObject = 0;
+    memset(m_pools[f].bufferObjects, 0, sizeof(m_pools[f].bufferObjects));
+  }
+
+  glGenBuffers(1, &m_elementBufferObject);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_elementBufferObject);
+  glBufferData(GL_COPY_WRITE_BUFFER, INITIAL_INDEX_BYTES, NULL, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GeometryArena::Pool & GeometryArena::pool(MeshGeometry::VertexFormat format)
+{
+  Pool & pool = m_pools[format];
+  if(pool.vertexArrayObject != 0)
+    return pool;
+
+  pool.vertices.grow(INITIAL_VERTICES);
+  for(unsigned s = 0; s < MeshGeometry::STREAM_COUNT; s++)
+  {
+    const GLuint stride = MeshGeometry::StreamStride(format, s);
+    if(stride == 0)
+      continue;
+    glGenBuffers(1, &pool.bufferObjects[s]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.bufferObjects[s]);
+    glBufferData(GL_COPY_WRITE_BUFFER, INITIAL_VERTICES * stride, NULL, GL_STATIC_DRAW);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  // every attribute is enabled, the streams of meshes without normals or texture coordinates hold zeros
+  glGenVertexArrays(1, &pool.vertexArrayObject);
+  GLState::Instance()->bindVertexArray(pool.vertexArrayObject);
+  MeshGeometry::SetAttributes(format, pool.bufferObjects, ShaderVariants::ATTRIBUTE_POSITION, ShaderVariants::ATTRIBUTE_NORMAL, ShaderVariants::ATTRIBUTE_TEXCOORD);
+  GLState::Instance()->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_elementBufferObject);
+  if(m_drawIdBufferObject != 0)
+    bindDrawIds();
+  GLState::Instance()->bindVertexArray(0);
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, 0);
+
+  return pool;
+}
+
+void GeometryArena::bindDrawIds()
+{
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_drawIdBufferObject);
+  glEnableVertexAttribArray(ShaderVariants::ATTRIBUTE_DRAW_ID);
+  glVertexAttribIPointer(ShaderVariants::ATTRIBUTE_DRAW_ID, 1, GL_UNSIGNED_INT, 0, 0);
+  glVertexAttribDivisor(ShaderVariants::ATTRIBUTE_DRAW_ID, 1);
+}
+
+void GeometryArena::reserveDrawIds(GLuint count)
+{
+  if(m_drawIdBufferObject != 0 && count <= m_drawIdCount)
+    return;
+
+  GLuint capacity = std::max(m_drawIdCount, GLuint(1024));
+  while(capacity < count)
+    capacity *= 2;
+  std::vector<GLuint> ids(capacity);
+  for(GLuint i = 0; i < capacity; i++)
+    ids[i] = i;
+
+  // a new name for the first time only, the vertex arrays keep pointing at it afterwards
+  const bool created = m_drawIdBufferObject == 0;
+  if(created)
+    glGenBuffers(1, &m_drawIdBufferObject);
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_drawIdBufferObject);
+  glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GLuint), &ids[0], GL_STATIC_DRAW);
+  m_drawIdCount = capacity;
+
+  if(created)
+  {
+    for(unsigned f = 0; f < MeshGeometry::FORMAT_COUNT; f++)
+    {
+      if(m_pools[f].vertexArrayObject == 0)
+        continue;
+      GLState::Instance()->bindVertexArray(m_pools[f].vertexArrayObject);
+      bindDrawIds();
+    }
+    GLState::Instance()->bindVertexArray(0);
+  }
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::resize(GLuint buffer, size_t size, size_t capacity)
+{
+  GLuint copy = 0;
+  glGenBuffers(1, &copy);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, copy);
+  glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_COPY);
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+
+  // the storage is replaced under the same name, then the content comes back
+  glBufferData(GL_COPY_READ_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+  glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, size);
+
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  GLState::Instance()->deleteBuffers(1, &copy);
+  m_stats.grows++;
+}
+
+GLuint GeometryArena::allocateVertices(MeshGeometry::VertexFormat format, GLuint count)
+{
+  Pool & pool = this->pool(format);
+  size_t first = pool.vertices.allocate(count);
+  if(first == FreeList::NO_SPACE)
+  {
+    const size_t capacity = std::max(2 * pool.vertices.capacity(), pool.vertices.capacity() + count);
+    for(unsigned s = 0; s < MeshGeometry::STREAM_COUNT; s++)
+    {
+      const GLuint stride = MeshGeometry::StreamStride(format, s);
+      if(stride != 0)
+        resize(pool.bufferObjects[s], pool.vertices.capacity() * stride, capacity * stride);
+    }
+    pool.vertices.grow(capacity);
+    first = pool.vertices.allocate(count);
+  }
+  return GLuint(first);
+}
+
+void GeometryArena::releaseVertices(MeshGeometry::VertexFormat format, GLuint first, GLuint count)
+{
+  m_pools[format].vertices.release(first, count);
+}
+
+GLuint GeometryArena::allocateIndices(GLuint size)
+{
+  size_t offset = m_indices.allocate(size, INDEX_ALIGNMENT);
+  if(offset == FreeList::NO_SPACE)
+  {
+    // the aligned range may need up to INDEX_ALIGNMENT - 1 bytes more
+    const size_t capacity = std::max(2 * m_indices.capacity(), m_indices.capacity() + size + INDEX_ALIGNMENT);
+    resize(m_elementBufferObject, m_indices.capacity(), capacity);
+    m_indices.grow(capacity);
+    offset = m_indices.allocate(size, INDEX_ALIGNMENT);
+  }
+  return GLuint(offset);
+}
+
+void GeometryArena::releaseIndices(GLuint offset, GLuint size)
+{
+  m_indices.release(offset, size);
+}
+
+void GeometryArena::uploadVertices(MeshGeometry::VertexFormat format, unsigned stream, GLuint first, GLuint count, const void * data)
+{
+  const GLuint stride = MeshGeometry::StreamStride(format, stream);
+  if(stride == 0 || count == 0)
+    return;
+
+  std::vector<unsigned char> zeros;
+  if(data == NULL)
+  {
+    zeros.assign(count * stride, 0);
+    data = &zeros[0];
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, pool(format).bufferObjects[stream]);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, first * stride, count * stride, data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GeometryArena::uploadIndices(GLuint offset, GLuint size, const void * data)
+{
+  if(size == 0)
+    return;
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_elementBufferObject);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GLuint GeometryArena::vertexArray(MeshGeometry::VertexFormat format)
+{
+  return pool(format).vertexArrayObject;
+}
+
+GLuint GeometryArena::vertexBuffer(MeshGeometry::VertexFormat format, unsigned stream)
+{
+  return pool(format).bufferObjects[stream];
+}
+
+const GeometryArena::Stats & GeometryArena::stats()
+{
+  m_stats.vertexBytes = m_stats.usedVertexBytes = 0;
+  m_stats.fragments = m_indices.fragments();
+  for(unsigned f = 0; f < MeshGeometry::FORMAT_COUNT; f++)
+  {
+    GLuint stride = 0;
+    for(unsigned s = 0; s < MeshGeometry::STREAM_COUNT; s++)
+      stride += MeshGeometry::StreamStride(MeshGeometry::VertexFormat(f), s);
+    m_stats.vertexBytes += m_pools[f].vertices.capacity() * stride;
+    m_stats.usedVertexBytes += m_pools[f].vertices.used() * stride;
+    m_stats.fragments += m_pools[f].vertices.fragments();
+  }
+  m_stats.indexBytes = m_indices.capacity();
+  m_stats.usedIndexBytes = m_indices.used();
+  return m_stats;
+}
@@ -0,0 +1,129 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <map>
+
+#include "pgr.h"
+#include "MeshGeometry.h"
+
+/** Buffer objects shared by all the meshes, suballocated
+ *
+ * Every MeshGeometry::VertexFormat has a pool: the vertex buffers of its streams (three
+ * for FORMAT_FLOAT, one interleaved buffer for the packed formats) and one vertex array
+ * with the attributes at the fixed locations of ShaderVariants. All the pools share one
+ * element buffer, bound to each of the vertex arrays.
+ *
+ * A mesh is then a range of vertices in the pool of its format and a range of bytes in
+ * the element buffer. Its draws add the start of the ranges to the base vertex and to the
+ * index offset, so meshes of one format are switched without binding anything.
+ *
+ * The ranges come from free lists (first fit, neighbours merged on release). A full buffer
+ * grows to twice its size in place, through a temporary copy on the GPU, so the names never
+ * change and every vertex array pointing at the buffers stays valid.
+ *
+ * For the indirect draws (see RenderQueue) the vertex arrays also get a stream of draw IDs,
+ * 0, 1, 2, ... advancing once per instance, so the base instance of a draw is its ID.
+ */
+class GeometryArena
+{
+public:
+  /// ranges of [0, capacity) taken first fit, the free neighbours are merged on release
+  class FreeList
+  {
+  public:
+    static const size_t NO_SPACE = size_t(-1);
+
+    explicit FreeList(size_t capacity = 0);
+
+    /// start of a free range of size units aligned to alignment, NO_SPACE if there is none (0 for size 0)
+    size_t allocate(size_t size, size_t alignment = 1);
+    void release(size_t offset, size_t size);
+    /// adds [capacity(), capacity) to the free space
+    void grow(size_t capacity);
+
+    size_t capacity() const { return m_capacity; }
+    size_t used() const { return m_used; }
+    /// number of the separate free ranges
+    unsigned fragments() const { return m_free.size(); }
+    size_t largestFree() const;
+
+  private:
+    std::map<size_t, size_t> m_free;  ///< start -> size of the free ranges
+    size_t m_capacity;
+    size_t m_used;
+  };
+
+  struct Stats
+  {
+    unsigned vertexBytes;     ///< capacity of the vertex buffers of all the pools
+    unsigned usedVertexBytes;
+    unsigned indexBytes;      ///< capacity of the element buffer
+    unsigned usedIndexBytes;
+    unsigned fragments;       ///< free ranges of all the lists
+    unsigned grows;           ///< buffers grown so far
+  };
+
+  /// arena used by all the meshes
+  static GeometryArena * Instance();
+
+  /// first vertex of count new vertices in the pool of the format
+  GLuint allocateVertices(MeshGeometry::VertexFormat format, GLuint count);
+  void releaseVertices(MeshGeometry::VertexFormat format, GLuint first, GLuint count);
+
+  /// byte offset of size new bytes of the element buffer, aligned for any index type
+  GLuint allocateIndices(GLuint size);
+  void releaseIndices(GLuint offset, GLuint size);
+
+  /// copies count vertices of the stream (MeshGeometry::Stream) to the range starting at first, NULL writes zeros
+  void uploadVertices(MeshGeometry::VertexFormat format, unsigned stream, GLuint first, GLuint count, const void * data);
+  void uploadIndices(GLuint offset, GLuint size, const void * data);
+
+  /// vertex array of the format, all the streams and the element buffer set up
+  GLuint vertexArray(MeshGeometry::VertexFormat format);
+  /// buffer of the stream of the format, 0 for the streams the format does not use
+  GLuint vertexBuffer(MeshGeometry::VertexFormat format, unsigned stream);
+  GLuint elementBuffer() const { return m_elementBufferObject; }
+
+  /// sets up the draw ID stream (ShaderVariants::ATTRIBUTE_DRAW_ID) of all the vertex arrays with at least count IDs
+  void reserveDrawIds(GLuint count);
+
+  const Stats & stats();
+
+protected:
+  GeometryArena();
+
+  enum
+  {
+    INITIAL_VERTICES = 1 << 16,  ///< per pool
+    INITIAL_INDEX_BYTES = 1 << 20,
+    INDEX_ALIGNMENT = sizeof(GLuint)
+  };
+
+  struct Pool
+  {
+    GLuint vertexArrayObject;  ///< 0 until the pool is first used
+    GLuint bufferObjects[MeshGeometry::STREAM_COUNT];
+    FreeList vertices;
+  };
+
+  /// the pool of the format, created on the first use
+  Pool & pool(MeshGeometry::VertexFormat format);
+
+  /// makes the buffer capacity bytes big keeping its first size bytes, the name stays the same
+  void resize(GLuint buffer, size_t size, size_t capacity);
+
+  /// points the draw ID attribute of the bound vertex array to the stream
+  void bindDrawIds();
+
+  static GeometryArena * m_instance;
+
+  Pool m_pools[MeshGeometry::FORMAT_COUNT];
+  GLuint m_elementBufferObject;
+  FreeList m_indices;
+  /// 0 until the first reserveDrawIds()
+  GLuint m_drawIdBufferObject;
+  GLuint m_drawIdCount;
+  Stats m_stats;
+};
+
+#endif // GEOMETRYARENA_H
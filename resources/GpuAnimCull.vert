@@ -0,0 +1,52 @@
+#version 150
+
+// first half of the bottle culling pass, one point per bottle, see GpuAnimNode::cull()
+
+uniform mat4 Mmatrix;            // Model, the same for all bottles
+
+uniform float pathTime;          // animation time in fragments, without the offset
+uniform bool  constantSpeed;     // use pathTable (true) or pathCurve (false)
+uniform float pathScale;         // pathTable entries per fragment of time
+uniform samplerBuffer pathTable; // positions (x, z) evenly spaced along the path, the last one is the first one again
+uniform samplerBuffer pathCurve; // polynomial coefficients, x and z texel for every fragment
+
+uniform vec3  sphereCenter;      // bounding sphere of the mesh, the center in model space
+uniform float sphereRadius;      //   and the radius in world space
+uniform vec4  planes[6];         // world space frustum planes, inside is dot(plane.xyz, p) + plane.w >= 0
+
+in float instanceOffset;         // time offset of the bottle
+
+out float offset_v;              // instanceOffset passed through
+flat out int visible_v;          // sphere of the bottle intersects the frustum
+
+// the same as pathPosition() in GpuAnimNode.vert
+vec2 pathPosition(float time) {
+  if(constantSpeed) {
+    int entries = textureSize(pathTable) - 1;
+    float t = mod(time * pathScale, float(entries));
+    int i = min(int(t), entries - 1);
+    return mix(texelFetch(pathTable, i).rg, texelFetch(pathTable, i + 1).rg, t - float(i));
+  }
+
+  int fragments = textureSize(pathCurve) / 2;
+  float dec = fract(time);
+  int fragment = int(time - dec) % fragments;
+  vec4 x = texelFetch(pathCurve, 2 * fragment);
+  vec4 z = texelFetch(pathCurve, 2 * fragment + 1);
+  vec4 powers = vec4(1.0, dec, dec * dec, dec * dec * dec);
+  return vec2(dot(x, powers), dot(z, powers));
+}
+
+void main() {
+  vec2 path = pathPosition(pathTime + instanceOffset);
+  vec3 center = (Mmatrix * vec4(sphereCenter, 1.0)).xyz + vec3(path.x, 0.0, path.y);
+
+  int visible = 1;
+  for(int i = 0; i < 6; i++)
+    if(dot(planes[i].xyz, center) + planes[i].w < -sphereRadius)
+      visible = 0;
+
+  offset_v = instanceOffset;
+  visible_v = visible;
+  gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,88 @@
+#version 140
+
+#define MAX_LIGHTS 8
+
+struct FrameLight {
+   vec4  ambient;
+   vec4  diffuse;
+   vec4  specular;
+   vec4  position;       // camera space
+   vec4  spotDirection;  // camera space
+   float spotCosCutoff;
+   float spotExponent;
+};
+
+// per-frame data shared by all the shaders, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Frame {
+  mat4  Vmatrix;     // View                       --> world to eye coordinates
+  mat4  Pmatrix;     // Projection                 --> eye to clip coordinates
+  mat4  PVmatrix;    // Projection * View          --> world to clip coordinates
+  vec4  sunDirection; // camera space direction of the sun light
+  vec4  sunAmbient;  // ambient part of the sun, changes with its height
+  vec4  clusterScale; // tile size in pixels, log(distance) scale and bias of the slice (see LightClusters)
+  ivec4 clusterGrid; // tiles in x and y, slices, 0 without clustered lights
+  float time;        // in seconds
+  int   lightCount;  // number of used lights
+  FrameLight lights[MAX_LIGHTS];
+};
+
+uniform mat4 Mmatrix;      // Model                      --> model to world coordinates (the same for all bottles)
+uniform mat4 NormalMatrix; // inverse transposed VMmatrix
+
+uniform float pathTime;          // animation time in fragments, without the offset
+uniform bool  constantSpeed;     // use pathTable (true) or pathCurve (false)
+uniform float pathScale;         // pathTable entries per fragment of time
+uniform samplerBuffer pathTable; // positions (x, z) evenly spaced along the path, the last one is the first one again
+uniform samplerBuffer pathCurve; // polynomial coefficients, x and z texel for every fragment
+
+in vec3 position;     // vertex position in world space
+uniform vec3 positionOffset; // dequantization of the position, (0,0,0) and (1,1,1) unless the mesh is quantized
+uniform vec3 positionScale;  //   (see MeshGeometry::getPositionOffset())
+in vec3 normal;       // vertex normal
+in float instanceOffset; // time offset of the bottle, the only thing stored per instance
+
+smooth out vec3 normal_v;    // camera space normal
+smooth out vec3 position_v;  // camera space fragment position
+
+in vec2 texCoord;			// incoming texture coordinates
+smooth out vec2 texCoord_v;	// outgoing texture coordinates
+noperspective out vec3 reflectDir;
+
+// the same as ConveyorPath::position() and ConveyorPath::curvePosition()
+vec2 pathPosition(float time) {
+  if(constantSpeed) {
+    int entries = textureSize(pathTable) - 1;
+    float t = mod(time * pathScale, float(entries));
+    int i = min(int(t), entries - 1);
+    return mix(texelFetch(pathTable, i).rg, texelFetch(pathTable, i + 1).rg, t - float(i));
+  }
+
+  int fragments = textureSize(pathCurve) / 2;
+  float dec = fract(time);
+  int fragment = int(time - dec) % fragments;
+  vec4 x = texelFetch(pathCurve, 2 * fragment);
+  vec4 z = texelFetch(pathCurve, 2 * fragment + 1);
+  vec4 powers = vec4(1.0, dec, dec * dec, dec * dec * dec);
+  return vec2(dot(x, powers), dot(z, powers));
+}
+
+void main() {
+
+  vec3 objectPosition = positionOffset + positionScale * position;
+
+  // the path only moves the bottle, so the normals are not affected
+  vec2 path = pathPosition(pathTime + instanceOffset);
+  vec4 worldPosition = Mmatrix * vec4(objectPosition, 1) + vec4(path.x, 0.0, path.y, 0.0);
+
+  gl_Position = PVmatrix * worldPosition;
+
+  vec4 VMposition = Vmatrix * worldPosition;
+  vec3 VMnormal   = normalize( NormalMatrix * vec4(normal, 0.0) ).xyz;
+
+  normal_v   = VMnormal;
+  position_v = VMposition.xyz;
+
+  texCoord_v = texCoord;
+  vec3 worldView = normalize(objectPosition);
+  reflectDir = reflect(-worldView, normal);
+}
@@ -0,0 +1,183 @@
+
+#include <algorithm>
+
+#include "InstancedMeshNode.h"
+#include "MeshGeometry.h"
+#include "Resources.h"
+#include "ShaderProgram.h"
+#include "CullingHierarchy.h"
+#include "ShaderVariants.h"
+#include "RingBuffer.h"
+#include "GLState.h"
+
+
+InstancedMeshNode::InstancedMeshNode(const std::string &name, SceneNode* parent):
+  SceneNode(name, parent), m_program(0), m_vertexArrayObject(0), m_instanceCount(0), m_mesh(NULL)
+{
+  glGenVertexArrays(1, &m_vertexArrayObject );
+}
+
+InstancedMeshNode::~InstancedMeshNode()
+{
+  GLState::Instance()->deleteVertexArrays( 1, &m_vertexArrayObject );
+  if(m_program)
+    ShaderVariants::Instance()->release(m_program);
+  for(unsigned i = 0; i < m_cullingHandles.size(); i++)
+    CullingHierarchy::Instance()->remove(m_cullingHandles[i]);
+}
+
+void InstancedMeshNode::loadProgram()
+{
+  if(m_program)
+    ShaderVariants::Instance()->release(m_program);
+  // the submeshes share the instance buffer, the texture stays a uniform
+  m_program = ShaderVariants::Instance()->get("resources/InstancedMeshNode.vert", "resources/MeshNode.frag", ShaderVariants::Instance()->sceneFeatures());
+}
+
+void InstancedMeshNode::setGeometry(MeshGeometry* mesh_p)
+{
+  if(m_program == 0)
+  {
+    loadProgram();
+  }
+
+  if(mesh_p == NULL)
+    return;
+
+  m_mesh = mesh_p;
+
+  // the boxes of the instances are the ones of the mesh
+  for(unsigned i = 0; i < m_cullingHandles.size(); i++)
+    CullingHierarchy::Instance()->remove(m_cullingHandles[i]);
+  m_cullingHandles.clear();
+  for(unsigned i = 0; i < m_instances.size(); i++)
+    m_cullingHandles.push_back(CullingHierarchy::Instance()->add(m_instances[i], m_mesh->getBoundsMin(), m_mesh->getBoundsMax()));
+
+  GLState::Instance()->bindVertexArray( m_vertexArrayObject );
+  mesh_p->bindAttributes(m_program->m_pos, m_program->m_normal, m_program->m_texCoord);
+
+  // mat4 attribute occupies four consecutive locations, one column each,
+  // advanced once per instance instead of once per vertex (pointed to the matrices by uploadInstances())
+  for(int column = 0; column < 4; column++) {
+    glEnableVertexAttribArray(m_program->m_instanceMatrix + column);
+    glVertexAttribDivisor(m_program->m_instanceMatrix + column, 1);
+  }
+
+  GLState::Instance()->bindVertexArray( 0 );
+}
+
+void InstancedMeshNode::addInstance(const SceneNode* node)
+{
+  if(node == NULL)
+    return;
+  m_instances.push_back(node);
+  if(m_mesh != NULL)
+    m_cullingHandles.push_back(CullingHierarchy::Instance()->add(node, m_mesh->getBoundsMin(), m_mesh->getBoundsMax()));
+}
+
+void InstancedMeshNode::removeInstance(const SceneNode* node)
+{
+  std::vector<const SceneNode*>::iterator it = std::find(m_instances.begin(), m_instances.end(), node);
+  if(it == m_instances.end())
+    return;
+  if(m_mesh != NULL)
+  {
+    std::vector<int>::iterator handle = m_cullingHandles.begin() + (it - m_instances.begin());
+    CullingHierarchy::Instance()->remove(*handle);
+    m_cullingHandles.erase(handle);
+  }
+  m_instances.erase(it);
+}
+
+void InstancedMeshNode::uploadInstances()
+{
+  // the boxes are culled in the space of the instances, which is the world one only without a transformation of this node
+  const CullingHierarchy * culling = CullingHierarchy::Instance();
+  const bool cull = culling->enabled() && globalMatrix() == glm::mat4(1.0f);
+
+  m_instanceCount = 0;
+  for(unsigned i = 0; i < m_instances.size(); i++)
+  {
+    if(!cull || culling->isVisible(m_cullingHandles[i]))
+      m_instanceCount++;
+  }
+  if(m_instanceCount == 0)
+    return;
+
+  // a new piece of the ring every frame, the GPU may still read the one of the last frame
+  RingBuffer * ring = RingBuffer::Instance();
+  GLintptr offset = 0;
+  glm::mat4 * matrices = static_cast<glm::mat4 *>(ring->allocate(m_instanceCount * sizeof(glm::mat4), sizeof(glm::vec4), offset));
+  if(matrices == NULL)
+  {
+    m_instanceCount = 0;
+    return;
+  }
+  for(unsigned i = 0; i < m_instances.size(); i++)
+  {
+    if(!cull || culling->isVisible(m_cullingHandles[i]))
+      *matrices++ = m_instances[i]->globalMatrix();
+  }
+  ring->flush();
+
+  GLState::Instance()->bindVertexArray( m_vertexArrayObject );
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, ring->buffer());
+  for(int column = 0; column < 4; column++)
+    glVertexAttribPointer(m_program->m_instanceMatrix + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *) (offset + column * sizeof(glm::vec4)));
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstancedMeshNode::draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
+{
+  // inherited draw - draws all children
+  SceneNode::draw(view_matrix, projection_matrix);
+
+  if(m_mesh == NULL || m_instances.empty())
+    return;
+
+  uploadInstances();
+  if(m_instanceCount == 0)
+    return;
+
+  GLState::Instance()->polygonMode(GL_FILL);
+
+  // the instance matrix is applied on top of the global matrix of this node,
+  // view, projection and time are in the Frame block (FrameUniforms)
+  glm::mat4   Vmatrix = view_matrix;
+  glm::mat4   Mmatrix = globalMatrix();
+
+  GLState::Instance()->useProgram(m_program->m_programId);
+
+  GLState::Instance()->uniformMatrix4fv(m_program->m_Mmatrix, glm::value_ptr(  Mmatrix) );
+  glm::mat4 NormalMatrix = glm::transpose( glm::inverse( Vmatrix * Mmatrix ));
+  GLState::Instance()->uniformMatrix4fv(m_program->m_NormalMatrix, glm::value_ptr(NormalMatrix) );
+  GLState::Instance()->uniform3fv(m_program->m_positionOffset, 1, glm::value_ptr(m_mesh->getPositionOffset()));
+  GLState::Instance()->uniform3fv(m_program->m_positionScale,  1, glm::value_ptr(m_mesh->getPositionScale()));
+
+  GLState::Instance()->bindVertexArray( m_vertexArrayObject );
+
+  // one draw call per submesh for all the instances together
+  MeshGeometry::SubMesh* subMesh_p = NULL;
+
+  for(unsigned mat=0; mat<m_mesh->getSubMeshCount(); mat++) {
+
+    subMesh_p = m_mesh->getSubMesh(mat);
+
+    GLState::Instance()->uniform3fv(m_program->m_diffuse,  1, subMesh_p->diffuse);
+    GLState::Instance()->uniform3fv(m_program->m_ambient,  1, subMesh_p->ambient);
+    GLState::Instance()->uniform3fv(m_program->m_specular, 1, subMesh_p->specular);
+    GLState::Instance()->uniform1f(m_program->m_shininess,    subMesh_p->shininess);
+
+    if(subMesh_p->textureID != 0 && m_mesh->hasTexCoords() == true) {
+      GLState::Instance()->uniform1i(m_program->m_useTexture, 1);
+      GLState::Instance()->uniform1i(m_program->m_texSampler,   0);
+      GLState::Instance()->bindTexture(GL_TEXTURE0 + 0, GL_TEXTURE_2D, subMesh_p->textureID);
+    }
+    else {
+      GLState::Instance()->uniform1i(m_program->m_useTexture, 0);
+    }
+
+    glDrawElementsInstancedBaseVertex( GL_TRIANGLES, subMesh_p->nIndices, m_mesh->getIndexType(), m_mesh->getIndexOffset(*subMesh_p),
+                                       m_instanceCount, m_mesh->getBaseVertex(*subMesh_p) );
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef INSTANCED_MESH_NODE_H
+#define INSTANCED_MESH_NODE_H
+
+#include <vector>
+
+#include "pgr.h"
+#include "SceneNode.h"
+
+class MeshGeometry;
+class MeshShaderProgram;
+
+/** Draws one MeshGeometry many times using hardware instancing
+ *
+ * Instead of having a MeshNode under every transformation, the nodes which
+ * should display the mesh are registered using addInstance(). Their global
+ * matrices are written straight to a piece of the RingBuffer every frame, read
+ * as a per-instance attribute, and each submesh is then drawn by a single
+ * glDrawElementsInstancedBaseVertex call.
+ *
+ * Every instance has the bounding box of the mesh in the CullingHierarchy and only the
+ * visible ones are gathered, as long as the node itself is not transformed.
+ */
+class InstancedMeshNode : public SceneNode
+{
+public:
+  InstancedMeshNode(const std::string & name = "<InstancedMeshNode>", SceneNode* parent = NULL);
+  ~InstancedMeshNode();
+
+  /// associates mesh with this node (also calls loadProgram())
+  void setGeometry(MeshGeometry* mesh);
+
+  /// global matrix of the node is used as the model matrix of one instance
+  void addInstance(const SceneNode* node);
+
+  /// removes the instance (in O(n))
+  void removeInstance(const SceneNode* node);
+
+  /// number of registered instances
+  unsigned getInstanceCount() const { return m_instances.size(); }
+
+  /// reimplemented draw
+  void draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+
+protected:
+  /// creates shader
+  virtual void loadProgram();
+
+  /// writes global matrices of the visible instances to the RingBuffer and points the attribute to them
+  void uploadInstances();
+
+  /// shader program to use during the draw() procedure
+  MeshShaderProgram * m_program;
+  /// identifier for the vertex array object
+  GLuint m_vertexArrayObject;
+  /// number of matrices uploaded for this frame
+  unsigned m_instanceCount;
+  /// geometry associated with this node
+  MeshGeometry* m_mesh;
+
+  /// nodes providing model matrices of the instances
+  std::vector<const SceneNode*> m_instances;
+  /// boxes of the instances in the CullingHierarchy, empty without a mesh
+  std::vector<int> m_cullingHandles;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#version 140
+
+#define MAX_LIGHTS 8
+
+struct FrameLight {
+   vec4  ambient;
+   vec4  diffuse;
+   vec4  specular;
+   vec4  position;       // camera space
+   vec4  spotDirection;  // camera space
+   float spotCosCutoff;
+   float spotExponent;
+};
+
+// per-frame data shared by all the shaders, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Frame {
+  mat4  Vmatrix;     // View                       --> world to eye coordinates
+  mat4  Pmatrix;     // Projection                 --> eye to clip coordinates
+  mat4  PVmatrix;    // Projection * View          --> world to clip coordinates
+  vec4  sunDirection; // camera space direction of the sun light
+  vec4  sunAmbient;  // ambient part of the sun, changes with its height
+  vec4  clusterScale; // tile size in pixels, log(distance) scale and bias of the slice (see LightClusters)
+  ivec4 clusterGrid; // tiles in x and y, slices, 0 without clustered lights
+  float time;        // in seconds
+  int   lightCount;  // number of used lights
+  FrameLight lights[MAX_LIGHTS];
+};
+
+uniform mat4 Mmatrix;      // Model                      --> model to world coordinates
+uniform mat4 NormalMatrix; // inverse transposed VMmatrix
+
+in vec3 position;     // vertex position in world space
+uniform vec3 positionOffset; // dequantization of the position, (0,0,0) and (1,1,1) unless the mesh is quantized
+uniform vec3 positionScale;  //   (see MeshGeometry::getPositionOffset())
+in vec3 normal;       // vertex normal
+in mat4 instanceMatrix; // model matrix of the instance, applied before Mmatrix
+
+smooth out vec3 normal_v;    // camera space normal
+smooth out vec3 position_v;  // camera space fragment position
+
+in vec2 texCoord;			// incoming texture coordinates
+smooth out vec2 texCoord_v;	// outgoing texture coordinates
+noperspective out vec3 reflectDir;
+
+void main() {
+
+  vec3 objectPosition = positionOffset + positionScale * position;
+
+  vec4 worldPosition = Mmatrix * instanceMatrix * vec4(objectPosition, 1);
+
+  gl_Position = PVmatrix * worldPosition;
+
+  // instances are expected to be rotated, translated and uniformly scaled only,
+  // so the upper 3x3 of the instance matrix transforms normals correctly after normalization
+  vec4 VMposition = Vmatrix * worldPosition;
+  vec3 VMnormal   = normalize( NormalMatrix * vec4(mat3(instanceMatrix) * normal, 0.0) ).xyz;
+
+  normal_v   = VMnormal;
+  position_v = VMposition.xyz;
+
+  texCoord_v = texCoord;
+  vec3 worldView = normalize(objectPosition);
+  reflectDir = reflect(-worldView, normal);
+}
@@ -0,0 +1,240 @@
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "LightClusters.h"
+#include "GLState.h"
+
+LightClusters::LightClusters(unsigned tiles_x, unsigned tiles_y, unsigned slices):
+  m_tilesX(tiles_x), m_tilesY(tiles_y), m_slices(slices), m_nearPlane(0.0f), m_farPlane(0.0f),
+  m_sliceScale(0.0f), m_sliceBias(0.0f), m_projection(0.0f)
+{
+  // GL objects are created by the first upload(), the GL context may not exist yet
+  memset(m_buffers, 0, sizeof(m_buffers));
+  memset(m_textures, 0, sizeof(m_textures));
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_clusterLights.resize(m_tilesX * m_tilesY * m_slices);
+}
+
+LightClusters::~LightClusters()
+{
+  if(m_buffers[0] != 0)
+  {
+    GLState::Instance()->deleteTextures(3, m_textures);
+    GLState::Instance()->deleteBuffers(3, m_buffers);
+  }
+}
+
+void LightClusters::boundingSphere(const SpotLight & light, glm::vec3 & center, float & radius)
+{
+  const glm::vec3 position(light.position);
+  const glm::vec3 direction = glm::normalize(glm::vec3(light.spotDirection));
+  const float cosAngle = light.spotCosCutoff;
+
+  if(cosAngle <= 0.0f)
+  {
+    // half a space or more, the whole ball of the range
+    center = position;
+    radius = light.range;
+  }
+  else if(cosAngle < 0.70710678f)
+  {
+    // wide cone, the sphere through the rim of its base
+    center = position + direction * (light.range * cosAngle);
+    radius = light.range * sqrtf(1.0f - cosAngle * cosAngle);
+  }
+  else
+  {
+    // narrow cone, the sphere through the apex and the rim
+    center = position + direction * (light.range / (2.0f * cosAngle));
+    radius = light.range / (2.0f * cosAngle);
+  }
+}
+
+int LightClusters::slice(float distance) const
+{
+  const int k = int(floorf(logf(distance) * m_sliceScale + m_sliceBias));
+  return std::max(0, std::min(int(m_slices) - 1, k));
+}
+
+void LightClusters::updateBoxes(const glm::mat4 & projection_matrix, float near_plane, float far_plane)
+{
+  if(projection_matrix == m_projection && near_plane == m_nearPlane && far_plane == m_farPlane)
+    return;
+  m_projection = projection_matrix;
+  m_nearPlane = near_plane;
+  m_farPlane = far_plane;
+
+  // slice k spans the distances near * (far / near)^(k / slices) to the next one
+  const float logRatio = logf(far_plane / near_plane);
+  m_sliceScale = m_slices / logRatio;
+  m_sliceBias = -(m_slices * logf(near_plane)) / logRatio;
+
+  m_boxMin.resize(m_clusterLights.size());
+  m_boxMax.resize(m_clusterLights.size());
+  for(unsigned k = 0; k < m_slices; k++)
+  {
+    const float sliceNear = near_plane * powf(far_plane / near_plane, float(k) / m_slices);
+    const float sliceFar = near_plane * powf(far_plane / near_plane, float(k + 1) / m_slices);
+    for(unsigned j = 0; j < m_tilesY; j++)
+    {
+      const float y0 = -1.0f + 2.0f * j / m_tilesY, y1 = -1.0f + 2.0f * (j + 1) / m_tilesY;
+      for(unsigned i = 0; i < m_tilesX; i++)
+      {
+        const float x0 = -1.0f + 2.0f * i / m_tilesX, x1 = -1.0f + 2.0f * (i + 1) / m_tilesX;
+        // the tile in normalized device coordinates is at the view space x = ndc * distance / P[0][0]
+        const unsigned cluster = (k * m_tilesY + j) * m_tilesX + i;
+        glm::vec3 & boxMin = m_boxMin[cluster];
+        glm::vec3 & boxMax = m_boxMax[cluster];
+        boxMin.x = std::min(x0 * sliceNear, x0 * sliceFar) / projection_matrix[0][0];
+        boxMax.x = std::max(x1 * sliceNear, x1 * sliceFar) / projection_matrix[0][0];
+        boxMin.y = std::min(y0 * sliceNear, y0 * sliceFar) / projection_matrix[1][1];
+        boxMax.y = std::max(y1 * sliceNear, y1 * sliceFar) / projection_matrix[1][1];
+        boxMin.z = -sliceFar;
+        boxMax.z = -sliceNear;
+      }
+    }
+  }
+}
+
+/// tile range of the interval [a, b] of normalized device coordinates
+static void tileRange(float a, float b, unsigned tiles, int & first, int & last)
+{
+  first = std::max(0, int(floorf((a + 1.0f) * 0.5f * tiles)));
+  last = std::min(int(tiles) - 1, int(floorf((b + 1.0f) * 0.5f * tiles)));
+}
+
+void LightClusters::build(const std::vector<SpotLight> & lights, const glm::mat4 & projection_matrix, float near_plane, float far_plane)
+{
+  updateBoxes(projection_matrix, near_plane, far_plane);
+
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_stats.lights = lights.size();
+  for(unsigned c = 0; c < m_clusterLights.size(); c++)
+    m_clusterLights[c].clear();
+
+  for(unsigned l = 0; l < lights.size(); l++)
+  {
+    const SpotLight & light = lights[l];
+    // switched off (the reflector has no direction then)
+    if(light.spotDirection == glm::vec4(0.0f) || light.range <= 0.0f)
+      continue;
+
+    glm::vec3 center;
+    float radius;
+    boundingSphere(light, center, radius);
+
+    // the camera looks along -z
+    const float closest = std::max(-center.z - radius, near_plane);
+    const float farthest = std::min(-center.z + radius, far_plane);
+    if(closest > farthest)
+      continue;
+
+    // screen bounds of the box around the sphere, the extremes are at the nearest or the farthest distance
+    float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f;
+    const float distances[] = { closest, farthest };
+    for(unsigned d = 0; d < 2; d++)
+    {
+      const float xs[] = { center.x - radius, center.x + radius };
+      const float ys[] = { center.y - radius, center.y + radius };
+      for(unsigned e = 0; e < 2; e++)
+      {
+        const float x = projection_matrix[0][0] * xs[e] / distances[d];
+        const float y = projection_matrix[1][1] * ys[e] / distances[d];
+        minX = std::min(minX, x); maxX = std::max(maxX, x);
+        minY = std::min(minY, y); maxY = std::max(maxY, y);
+      }
+    }
+    if(minX > 1.0f || maxX < -1.0f || minY > 1.0f || maxY < -1.0f)
+      continue;
+
+    int x0, x1, y0, y1;
+    tileRange(minX, maxX, m_tilesX, x0, x1);
+    tileRange(minY, maxY, m_tilesY, y0, y1);
+    const int k0 = slice(closest), k1 = slice(farthest);
+
+    // the exact test against the box of every cluster in the range
+    for(int k = k0; k <= k1; k++)
+    {
+      for(int j = y0; j <= y1; j++)
+      {
+        for(int i = x0; i <= x1; i++)
+        {
+          const unsigned cluster = (k * m_tilesY + j) * m_tilesX + i;
+          const glm::vec3 closestPoint = glm::clamp(center, m_boxMin[cluster], m_boxMax[cluster]);
+          const glm::vec3 offset = closestPoint - center;
+          if(glm::dot(offset, offset) <= radius * radius)
+            m_clusterLights[cluster].push_back(l);
+        }
+      }
+    }
+  }
+
+  // the lists one after another
+  m_table.resize(2 * m_clusterLights.size());
+  m_indices.clear();
+  for(unsigned c = 0; c < m_clusterLights.size(); c++)
+  {
+    const std::vector<GLuint> & list = m_clusterLights[c];
+    m_table[2 * c] = m_indices.size();
+    m_table[2 * c + 1] = list.size();
+    m_indices.insert(m_indices.end(), list.begin(), list.end());
+    m_stats.maxPerCluster = std::max<unsigned>(m_stats.maxPerCluster, list.size());
+    if(list.empty())
+      m_stats.emptyClusters++;
+  }
+  m_stats.references = m_indices.size();
+
+  // position and range, direction and cutoff, diffuse and exponent, specular, ambient
+  m_lightData.resize(5 * lights.size());
+  for(unsigned l = 0; l < lights.size(); l++)
+  {
+    const SpotLight & light = lights[l];
+    glm::vec3 direction = glm::vec3(light.spotDirection);
+    if(direction != glm::vec3(0.0f))
+      direction = glm::normalize(direction);
+    m_lightData[5 * l]     = glm::vec4(glm::vec3(light.position), light.range);
+    m_lightData[5 * l + 1] = glm::vec4(direction, light.spotCosCutoff);
+    m_lightData[5 * l + 2] = glm::vec4(glm::vec3(light.diffuse), light.spotExponent);
+    m_lightData[5 * l + 3] = light.specular;
+    m_lightData[5 * l + 4] = light.ambient;
+  }
+}
+
+void LightClusters::upload()
+{
+  if(m_buffers[0] == 0)
+  {
+    glGenBuffers(3, m_buffers);
+    glGenTextures(3, m_textures);
+  }
+
+  // texture buffers must not be empty
+  if(m_indices.empty())
+    m_indices.push_back(0);
+  if(m_lightData.empty())
+    m_lightData.push_back(glm::vec4(0.0f));
+
+  const GLsizeiptr sizes[] = { GLsizeiptr(m_table.size() * sizeof(GLuint)), GLsizeiptr(m_indices.size() * sizeof(GLuint)), GLsizeiptr(m_lightData.size() * sizeof(glm::vec4)) };
+  const void * data[] = { &m_table[0], &m_indices[0], &m_lightData[0] };
+  const GLenum formats[] = { GL_RG32UI, GL_R32UI, GL_RGBA32F };
+  const GLenum units[] = { TABLE_UNIT, INDEX_UNIT, LIGHT_UNIT };
+  for(unsigned b = 0; b < 3; b++)
+  {
+    // orphaned, the draws of the last frame may still read the old data
+    GLState::Instance()->bindBuffer(GL_TEXTURE_BUFFER, m_buffers[b]);
+    glBufferData(GL_TEXTURE_BUFFER, sizes[b], NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[b], data[b]);
+
+    GLState::Instance()->bindTexture(GL_TEXTURE0 + units[b], GL_TEXTURE_BUFFER, m_textures[b]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[b], m_buffers[b]);
+  }
+  GLState::Instance()->bindBuffer(GL_TEXTURE_BUFFER, 0);
+  GLState::Instance()->activeTexture(GL_TEXTURE0);
+}
+
+glm::vec4 LightClusters::scale(unsigned viewport_width, unsigned viewport_height) const
+{
+  return glm::vec4(float(viewport_width) / m_tilesX, float(viewport_height) / m_tilesY, m_sliceScale, m_sliceBias);
+}
@@ -0,0 +1,91 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <vector>
+
+#include "pgr.h"
+#include "Lights.h"
+
+/** Spot lights sorted to the clusters of the view frustum, for clustered forward shading
+ *
+ * The frustum is split to a grid of clusters (froxels), tiles of the screen in x and y
+ * and slices growing exponentially with the distance in z. build() assigns every spot
+ * light to the clusters its bounding sphere touches and upload() sends three texture
+ * buffers to the texture units below:
+ *
+ *  - table: (first, count) of every cluster into the index list (RG32UI),
+ *  - indices: the light indices of all the clusters one after another (R32UI),
+ *  - lights: five texels per light (RGBA32F), see upload().
+ *
+ * The fragment shader (MeshNode.frag with CLUSTERED) thus only evaluates the lights of
+ * its own cluster. The grid parameters it needs are in the Frame block (FrameUniforms).
+ */
+class LightClusters
+{
+public:
+  enum {
+    TABLE_UNIT = 4,   ///< texture unit of the cluster table
+    INDEX_UNIT = 5,   ///< texture unit of the light index list
+    LIGHT_UNIT = 6    ///< texture unit of the light data
+  };
+
+  /// what the last build() did
+  struct Stats
+  {
+    unsigned lights;
+    unsigned references; ///< length of the index list
+    unsigned maxPerCluster;
+    unsigned emptyClusters;
+  };
+
+  LightClusters(unsigned tiles_x = 16, unsigned tiles_y = 9, unsigned slices = 24);
+  ~LightClusters();
+
+  /** sorts the lights to the clusters
+   *
+   * The lights are in camera space (as in the Frame block), the projection is a perspective
+   * one with the near and far planes given, the clusters cover the frustum between them.
+   */
+  void build(const std::vector<SpotLight> & lights, const glm::mat4 & projection_matrix, float near_plane, float far_plane);
+
+  /// sends the clusters to the texture buffers and binds them to their units
+  void upload();
+
+  /// grid for the Frame block, the viewport is in pixels
+  glm::vec4 scale(unsigned viewport_width, unsigned viewport_height) const;
+  unsigned tilesX() const { return m_tilesX; }
+  unsigned tilesY() const { return m_tilesY; }
+  unsigned slices() const { return m_slices; }
+
+  const Stats & stats() const { return m_stats; }
+
+  /// sphere around the lit cone of the light, in its space
+  static void boundingSphere(const SpotLight & light, glm::vec3 & center, float & radius);
+
+protected:
+  /// view space boxes of all the clusters, recalculated only when the projection changes
+  void updateBoxes(const glm::mat4 & projection_matrix, float near_plane, float far_plane);
+
+  /// slice of the distance (positive), clamped to the grid
+  int slice(float distance) const;
+
+  unsigned m_tilesX, m_tilesY, m_slices;
+  float m_nearPlane, m_farPlane;
+  /// log(distance) * m_sliceScale + m_sliceBias is the slice
+  float m_sliceScale, m_sliceBias;
+  glm::mat4 m_projection;
+
+  std::vector<glm::vec3> m_boxMin, m_boxMax;
+
+  /// lights of every cluster, built cluster by cluster into m_indices
+  std::vector<std::vector<GLuint> > m_clusterLights;
+  std::vector<GLuint> m_table;
+  std::vector<GLuint> m_indices;
+  std::vector<glm::vec4> m_lightData;
+
+  GLuint m_buffers[3];
+  GLuint m_textures[3];
+  Stats m_stats;
+};
+
+#endif // LIGHTCLUSTERS_H
@@ -0,0 +1,28 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "pgr.h"
+
+/// Handles light information
+struct Light {
+  glm::vec4 ambient;
+  glm::vec4 diffuse;
+  glm::vec4 specular;
+};
+
+/// Adds directional light attributes
+struct DirectionalLight: public Light {
+  glm::vec4 direction;
+};
+
+/// Adds spot light attributes
+struct SpotLight: public Light {
+  glm::vec4 position;
+  glm::vec4 spotDirection;
+  float spotCosCutoff;
+  float spotExponent;
+  /// distance where the light fades out, the clusters of LightClusters do not reach further
+  float range;
+};
+
+#endif // LIGHTS_H
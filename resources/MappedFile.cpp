@@ -0,0 +1,121 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "MappedFile.h"
+
+MappedFile::MappedFile():
+  m_data(NULL), m_size(0), m_file(NULL), m_mapping(NULL)
+{
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string & path)
+{
+  close();
+
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if(file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  HANDLE mapping = NULL;
+  if(GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(mapping == NULL)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  m_data = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if(m_data == NULL)
+  {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  m_size = size_t(size.QuadPart);
+  m_file = file;
+  m_mapping = mapping;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if(m_data != NULL)
+  {
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+    CloseHandle(m_file);
+  }
+  m_data = NULL;
+  m_size = 0;
+  m_file = m_mapping = NULL;
+}
+
+bool MappedFile::stat(const std::string & path, long long & time, long long & size)
+{
+  struct _stat64 info;
+  if(_stat64(path.c_str(), &info) != 0)
+    return false;
+  time = info.st_mtime;
+  size = info.st_size;
+  return true;
+}
+
+#else
+
+bool MappedFile::open(const std::string & path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct ::stat info;
+  void * data = MAP_FAILED;
+  if(fstat(fd, &info) == 0 && info.st_size > 0)
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);  // the mapping keeps the file open
+  if(data == MAP_FAILED)
+    return false;
+
+  m_data = static_cast<const unsigned char *>(data);
+  m_size = info.st_size;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if(m_data != NULL)
+    munmap(const_cast<unsigned char *>(m_data), m_size);
+  m_data = NULL;
+  m_size = 0;
+}
+
+bool MappedFile::stat(const std::string & path, long long & time, long long & size)
+{
+  struct ::stat info;
+  if(::stat(path.c_str(), &info) != 0)
+    return false;
+  time = info.st_mtime;
+  size = info.st_size;
+  return true;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+/** Read only memory mapping of a whole file
+ *
+ * The pages are read by the system on the first touch, so data() can be handed
+ * straight to glBufferData() or parsed without an intermediate copy.
+ */
+class MappedFile
+{
+public:
+  MappedFile();
+  ~MappedFile();
+
+  /// maps the file, false if it does not exist or cannot be mapped (empty files cannot)
+  bool open(const std::string & path);
+  void close();
+
+  bool isOpen() const { return m_data != NULL; }
+  const unsigned char * data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+  /// modification time of the file in seconds and its size, false if it does not exist
+  static bool stat(const std::string & path, long long & time, long long & size);
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile & operator=(const MappedFile &);
+
+  const unsigned char * m_data;
+  size_t m_size;
+  /// file and mapping handles on Windows, the descriptor is not needed after mmap
+  void * m_file;
+  void * m_mapping;
+};
+
+#endif // MAPPEDFILE_H
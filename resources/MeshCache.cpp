@@ -0,0 +1,317 @@
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "GeometryArena.h"
+#include "Resources.h"
+
+namespace {
+
+const char MAGIC[4] = { 'P', 'G', 'R', 'M' };
+const unsigned ALIGNMENT = 16;
+
+/// the buffers of MeshGeometry in the order they are stored
+enum { VERTEX_BUFFER, NORMAL_BUFFER, TEXCOORD_BUFFER, ELEMENT_BUFFER, BUFFER_COUNT };
+
+struct Header
+{
+  char magic[4];
+  GLuint version;
+  long long sourceTime;  ///< modification time of the source in seconds
+  long long sourceSize;
+  GLuint format;         ///< MeshGeometry::VertexFormat
+  GLuint optimized;
+  GLuint indexType;
+  GLuint nVertices;
+  GLuint nIndices;
+  GLuint subMeshCount;
+  GLuint hasNormals;
+  GLuint hasTexCoords;
+  GLfloat positionOffset[3];
+  GLfloat positionScale[3];
+  GLfloat boundsMin[3];
+  GLfloat boundsMax[3];
+  GLuint bufferSize[BUFFER_COUNT];  ///< in bytes
+};
+
+struct SubMeshRecord
+{
+  GLfloat ambient[3];
+  GLfloat diffuse[3];
+  GLfloat specular[3];
+  GLfloat shininess;
+  GLuint nIndices;
+  GLuint startIndex;
+  GLuint baseVertex;
+  GLfloat boundsMin[3];
+  GLfloat boundsMax[3];
+  GLuint nameLength;
+  GLuint textureNameLength;
+};
+
+size_t aligned(size_t offset)
+{
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+/// true if size bytes are exactly count elements of element_size bytes, computed without any overflow
+bool holds(size_t size, size_t count, size_t element_size)
+{
+  return element_size != 0 && size % element_size == 0 && size / element_size == count;
+}
+
+/// the largest of the count indices from the start, the indices are GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+GLuint maxIndex(const unsigned char * indices, GLenum index_type, GLuint start, GLuint count)
+{
+  GLuint result = 0;
+  if(index_type == GL_UNSIGNED_SHORT)
+  {
+    const GLushort * shorts = reinterpret_cast<const GLushort *>(indices) + start;
+    for(GLuint i = 0; i < count; i++)
+      result = std::max<GLuint>(result, shorts[i]);
+  }
+  else
+  {
+    const GLuint * ints = reinterpret_cast<const GLuint *>(indices) + start;
+    for(GLuint i = 0; i < count; i++)
+      result = std::max(result, ints[i]);
+  }
+  return result;
+}
+
+/// size bytes of the buffer from the offset
+std::vector<unsigned char> readBuffer(GLuint buffer, size_t offset, size_t size)
+{
+  std::vector<unsigned char> data(size);
+  if(size == 0)
+    return data;
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, offset, size, &data[0]);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  return data;
+}
+
+} // anonymous namespace
+
+std::string MeshCache::cachePath(const std::string & source)
+{
+  return source + ".cache";
+}
+
+MeshGeometry * MeshCache::load(const std::string & source, MeshGeometry::VertexFormat format, bool optimized)
+{
+  long long sourceTime, sourceSize;
+  if(!MappedFile::stat(source, sourceTime, sourceSize))
+    return NULL;
+
+  MappedFile file;
+  if(!file.open(cachePath(source)) || file.size() < sizeof(Header))
+    return NULL;
+
+  Header header;
+  memcpy(&header, file.data(), sizeof(header));
+  if(memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+     || header.sourceTime != sourceTime || header.sourceSize != sourceSize
+     || header.format != GLuint(format) || header.optimized != GLuint(optimized))
+    return NULL;
+
+  // a broken cache is rebuilt from the source, so every value of the file is checked before it is used,
+  // the sizes as the differences to the end of the file so nothing overflows
+  if(header.indexType != GL_UNSIGNED_SHORT && header.indexType != GL_UNSIGNED_INT)
+    return NULL;
+  if(header.subMeshCount > (file.size() - sizeof(Header)) / sizeof(SubMeshRecord))
+    return NULL;
+
+  // the records, checking every length against the size of the file and the ranges against the counts
+  MeshGeometry::SubMeshList subMeshes(header.subMeshCount);
+  size_t offset = sizeof(Header);
+  for(unsigned s = 0; s < header.subMeshCount; s++)
+  {
+    SubMeshRecord record;
+    if(sizeof(record) > file.size() - offset)
+      return NULL;
+    memcpy(&record, file.data() + offset, sizeof(record));
+    offset += sizeof(record);
+    if(record.nameLength > file.size() - offset || record.textureNameLength > file.size() - offset - record.nameLength)
+      return NULL;
+    if(record.startIndex > header.nIndices || record.nIndices > header.nIndices - record.startIndex)
+      return NULL;
+
+    MeshGeometry::SubMesh & subMesh = subMeshes[s];
+    memcpy(subMesh.ambient, record.ambient, sizeof(subMesh.ambient));
+    memcpy(subMesh.diffuse, record.diffuse, sizeof(subMesh.diffuse));
+    memcpy(subMesh.specular, record.specular, sizeof(subMesh.specular));
+    subMesh.shininess = record.shininess;
+    subMesh.nIndices = record.nIndices;
+    subMesh.startIndex = record.startIndex;
+    subMesh.baseVertex = record.baseVertex;
+    subMesh.boundsMin = glm::vec3(record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]);
+    subMesh.boundsMax = glm::vec3(record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]);
+    subMesh.name.assign(reinterpret_cast<const char *>(file.data() + offset), record.nameLength);
+    offset += record.nameLength;
+    subMesh.textureName.assign(reinterpret_cast<const char *>(file.data() + offset), record.textureNameLength);
+    offset += record.textureNameLength;
+  }
+
+  const unsigned char * buffers[BUFFER_COUNT];
+  for(unsigned b = 0; b < BUFFER_COUNT; b++)
+  {
+    offset = aligned(offset);
+    if(offset > file.size() || header.bufferSize[b] > file.size() - offset)
+      return NULL;
+    buffers[b] = file.data() + offset;
+    offset += header.bufferSize[b];
+  }
+
+  // the ranges in the GeometryArena are sized by the counts, the buffers must fill them
+  // (the positions are always there, the other streams may be missing or not a part of the format)
+  const size_t indexSize = header.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+  if(!holds(header.bufferSize[ELEMENT_BUFFER], header.nIndices, indexSize))
+    return NULL;
+  for(unsigned b = VERTEX_BUFFER; b <= TEXCOORD_BUFFER; b++)
+  {
+    const GLuint stride = MeshGeometry::StreamStride(format, b);
+    const bool missing = header.bufferSize[b] == 0 && b != VERTEX_BUFFER;
+    if(stride == 0 ? header.bufferSize[b] != 0 : !missing && !holds(header.bufferSize[b], header.nVertices, stride))
+      return NULL;
+  }
+
+  // no draw of a submesh may read behind the vertices of the mesh
+  for(unsigned s = 0; s < subMeshes.size(); s++)
+  {
+    const MeshGeometry::SubMesh & subMesh = subMeshes[s];
+    if(subMesh.nIndices == 0)
+      continue;
+    const unsigned long long last = subMesh.baseVertex + (unsigned long long) maxIndex(buffers[ELEMENT_BUFFER], header.indexType, subMesh.startIndex, subMesh.nIndices);
+    if(last >= header.nVertices)
+      return NULL;
+  }
+
+  // the same textures LoadFromFile() would get
+  for(unsigned s = 0; s < subMeshes.size(); s++)
+    subMeshes[s].textureID = subMeshes[s].textureName.empty() ? 0 : TextureManager::Instance()->get(subMeshes[s].textureName);
+
+  MeshGeometry * mesh = new MeshGeometry();
+  mesh->m_subMeshList.swap(subMeshes);
+  mesh->m_format = format;
+  mesh->m_indexType = header.indexType;
+  mesh->m_nVertices = header.nVertices;
+  mesh->m_nIndices = header.nIndices;
+  mesh->m_hasNormals = header.hasNormals != 0;
+  mesh->m_hasTexCoords = header.hasTexCoords != 0;
+  mesh->m_positionOffset = glm::vec3(header.positionOffset[0], header.positionOffset[1], header.positionOffset[2]);
+  mesh->m_positionScale = glm::vec3(header.positionScale[0], header.positionScale[1], header.positionScale[2]);
+  mesh->m_boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+  mesh->m_boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+
+  // straight from the mapped pages to the ranges of the mesh, no copy on our side (the buffer order is MeshGeometry::Stream)
+  mesh->allocate();
+  GeometryArena * arena = GeometryArena::Instance();
+  for(unsigned b = VERTEX_BUFFER; b <= TEXCOORD_BUFFER; b++)
+    arena->uploadVertices(format, b, mesh->m_firstVertex, mesh->m_nVertices, header.bufferSize[b] ? buffers[b] : NULL);
+  arena->uploadIndices(mesh->m_indexOffset, mesh->m_indexBytes, buffers[ELEMENT_BUFFER]);
+
+  std::cout << "loaded " << source << " from " << cachePath(source) << std::endl;
+  return mesh;
+}
+
+bool MeshCache::save(const std::string & source, const MeshGeometry * mesh, bool optimized)
+{
+  Header header;
+  memset(&header, 0, sizeof(header));
+  if(mesh == NULL || !MappedFile::stat(source, header.sourceTime, header.sourceSize))
+    return false;
+
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.format = mesh->m_format;
+  header.optimized = optimized;
+  header.indexType = mesh->m_indexType;
+  header.nVertices = mesh->m_nVertices;
+  header.nIndices = mesh->m_nIndices;
+  header.subMeshCount = mesh->m_subMeshList.size();
+  header.hasNormals = mesh->m_hasNormals;
+  header.hasTexCoords = mesh->m_hasTexCoords;
+  for(int i = 0; i < 3; i++)
+  {
+    header.positionOffset[i] = mesh->m_positionOffset[i];
+    header.positionScale[i] = mesh->m_positionScale[i];
+    header.boundsMin[i] = mesh->m_boundsMin[i];
+    header.boundsMax[i] = mesh->m_boundsMax[i];
+  }
+
+  // the ranges of the mesh in the GeometryArena, the packed formats and the missing streams stay empty
+  GeometryArena * arena = GeometryArena::Instance();
+  const bool present[] = { true, mesh->m_hasNormals, mesh->m_hasTexCoords };
+  std::vector<unsigned char> buffers[BUFFER_COUNT];
+  for(unsigned b = VERTEX_BUFFER; b <= TEXCOORD_BUFFER; b++)
+  {
+    const GLuint stride = MeshGeometry::StreamStride(mesh->m_format, b);
+    if(present[b] && stride != 0)
+      buffers[b] = readBuffer(arena->vertexBuffer(mesh->m_format, b), size_t(mesh->m_firstVertex) * stride, size_t(mesh->m_nVertices) * stride);
+  }
+  buffers[ELEMENT_BUFFER] = readBuffer(arena->elementBuffer(), mesh->m_indexOffset, mesh->m_indexBytes);
+  for(unsigned b = 0; b < BUFFER_COUNT; b++)
+    header.bufferSize[b] = buffers[b].size();
+
+  const std::string path = cachePath(source);
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  if(!out)
+  {
+    std::cerr << "cannot write mesh cache " << path << std::endl;
+    return false;
+  }
+
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  size_t offset = sizeof(header);
+
+  for(unsigned s = 0; s < mesh->m_subMeshList.size(); s++)
+  {
+    const MeshGeometry::SubMesh & subMesh = mesh->m_subMeshList[s];
+    SubMeshRecord record;
+    memcpy(record.ambient, subMesh.ambient, sizeof(record.ambient));
+    memcpy(record.diffuse, subMesh.diffuse, sizeof(record.diffuse));
+    memcpy(record.specular, subMesh.specular, sizeof(record.specular));
+    record.shininess = subMesh.shininess;
+    record.nIndices = subMesh.nIndices;
+    record.startIndex = subMesh.startIndex;
+    record.baseVertex = subMesh.baseVertex;
+    for(int i = 0; i < 3; i++)
+    {
+      record.boundsMin[i] = subMesh.boundsMin[i];
+      record.boundsMax[i] = subMesh.boundsMax[i];
+    }
+    record.nameLength = subMesh.name.size();
+    record.textureNameLength = subMesh.textureName.size();
+
+    out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    out.write(subMesh.name.data(), subMesh.name.size());
+    out.write(subMesh.textureName.data(), subMesh.textureName.size());
+    offset += sizeof(record) + subMesh.name.size() + subMesh.textureName.size();
+  }
+
+  const char padding[ALIGNMENT] = { 0 };
+  for(unsigned b = 0; b < BUFFER_COUNT; b++)
+  {
+    out.write(padding, aligned(offset) - offset);
+    offset = aligned(offset);
+    if(!buffers[b].empty())
+      out.write(reinterpret_cast<const char *>(&buffers[b][0]), buffers[b].size());
+    offset += buffers[b].size();
+  }
+
+  if(!out)
+  {
+    std::cerr << "cannot write mesh cache " << path << std::endl;
+    out.close();
+    remove(path.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <string>
+
+#include "pgr.h"
+#include "MeshGeometry.h"
+
+/** Binary cache of the meshes loaded by MeshGeometry::LoadFromFile()
+ *
+ * Stores the final buffers (after MeshOptimizer and the vertex packing, as the ranges of the
+ * mesh in the GeometryArena hold them) and the SubMesh records in a file next to the source
+ * asset, so the next start maps the file and uploads it to new ranges instead of running
+ * Assimp. The layout:
+ *
+ *   Header, Header::subMeshCount times (SubMeshRecord, name, texture name),
+ *   then the vertex, normal, texture coordinate and element buffers, each 16 bytes aligned
+ *
+ * The cache is ignored (and rewritten) when its version, the vertex format, the optimization
+ * or the modification time and size of the source file differ.
+ */
+class MeshCache
+{
+public:
+  /// bump on any change of the layout or of what the loader produces
+  static const GLuint VERSION = 2;
+
+  /// the cache of the source asset, next to it
+  static std::string cachePath(const std::string & source);
+
+  /// mesh from a valid cache of the source, NULL if there is none
+  static MeshGeometry * load(const std::string & source, MeshGeometry::VertexFormat format, bool optimized);
+
+  /// reads the buffers of the mesh back from the GL and writes them, false on failure
+  static bool save(const std::string & source, const MeshGeometry * mesh, bool optimized);
+};
+
+#endif // MESHCACHE_H
@@ -1,60 +1,303 @@
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <emmintrin.h>
 
 #include "MeshGeometry.h"
+#include "MeshOptimizer.h"
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "TaskPool.h"
+#include "GeometryArena.h"
 #include "Resources.h"
+#include "GLState.h"
 
-MeshGeometry::MeshGeometry(void) : m_nVertices(0), m_nIndices(0), m_hasNormals(false), m_hasTexCoords(false)
+MeshGeometry::MeshGeometry(void) : m_firstVertex(0), m_indexOffset(0), m_indexBytes(0), m_allocatedVertices(0),
+  m_nVertices(0), m_nIndices(0), m_hasNormals(false), m_hasTexCoords(false),
+  m_format(FORMAT_FLOAT), m_indexType(GL_UNSIGNED_INT), m_positionOffset(0.0f), m_positionScale(1.0f),
+  m_boundsMin(0.0f), m_boundsMax(0.0f)
 {
-  glGenBuffers(1, &m_vertexBufferObject);
-  glGenBuffers(1, &m_normalBufferObject);
-  glGenBuffers(1, &m_texCoordBufferObject);
-  glGenBuffers(1, &m_elementArrayBufferObject);
 }
 
 MeshGeometry::~MeshGeometry()
 {
-  glDeleteBuffers(1, &m_vertexBufferObject);
-  glDeleteBuffers(1, &m_normalBufferObject);
-  glDeleteBuffers(1, &m_texCoordBufferObject);
-  glDeleteBuffers(1, &m_elementArrayBufferObject );
+  release();
 }
 
-// pass the data as blocks of bytes to OpenGL buffers
-void MeshGeometry::setMesh(unsigned int verticesCount, float* vertices, float* normals, float* texCoords, unsigned int indicesCount, GLuint* indices) {
+void MeshGeometry::allocate(void)
+{
+  release();
+  GeometryArena * arena = GeometryArena::Instance();
+  m_allocatedVertices = m_nVertices;
+  m_firstVertex = arena->allocateVertices(m_format, m_allocatedVertices);
+  m_indexBytes = m_nIndices * getIndexSize();
+  m_indexOffset = arena->allocateIndices(m_indexBytes);
+}
+
+void MeshGeometry::release(void)
+{
+  if(m_allocatedVertices == 0 && m_indexBytes == 0)
+    return;
+  GeometryArena * arena = GeometryArena::Instance();
+  arena->releaseVertices(m_format, m_firstVertex, m_allocatedVertices);
+  arena->releaseIndices(m_indexOffset, m_indexBytes);
+  m_allocatedVertices = m_indexBytes = 0;
+}
+
+GLuint MeshGeometry::getVertexArray(void) const
+{
+  return GeometryArena::Instance()->vertexArray(m_format);
+}
+
+/// IEEE 754 half float, rounded to nearest, tiny values flushed to zero and big ones clamped
+static GLushort toHalf(float value)
+{
+  GLuint bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  GLuint sign = (bits >> 16) & 0x8000;
+  int exponent = int((bits >> 23) & 0xFF) - 127 + 15;
+  GLuint mantissa = bits & 0x7FFFFF;
+
+  if(exponent <= 0)
+    return GLushort(sign);
+  if(exponent >= 31)
+    return GLushort(sign | 0x7BFF);
+
+  GLuint half = sign | (exponent << 10) | (mantissa >> 13);
+  if(mantissa & 0x1000)  // a carry to the exponent still gives the right number
+    half++;
+  return GLushort(half);
+}
+
+/// signed normalized GL_INT_2_10_10_10_REV, x in the lowest bits, w = 0
+static GLuint packNormal(const float* normal)
+{
+  GLuint packed = 0;
+  for(int i = 0; i < 3; i++)
+  {
+    float value = std::min(std::max(normal[i], -1.0f), 1.0f);
+    int quantized = int(floor(value * 511.0f + 0.5f));
+    packed |= (GLuint(quantized) & 0x3FF) << (10 * i);
+  }
+  return packed;
+}
+
+// stride and offsets of the attributes in the interleaved buffer
+static GLuint packedStride(MeshGeometry::VertexFormat format)
+{
+  return format == MeshGeometry::FORMAT_PACKED_QUANTIZED ? 16 : 20;
+}
+
+static GLuint packedPositionSize(MeshGeometry::VertexFormat format)
+{
+  // 3 shorts padded to 4 to keep the normal aligned
+  return format == MeshGeometry::FORMAT_PACKED_QUANTIZED ? 4 * sizeof(GLushort) : 3 * sizeof(float);
+}
+
+GLuint MeshGeometry::StreamStride(VertexFormat format, unsigned stream)
+{
+  if(format != FORMAT_FLOAT)
+    return stream == STREAM_VERTEX ? packedStride(format) : 0;
+  return stream == STREAM_TEXCOORD ? 2 * sizeof(float) : 3 * sizeof(float);
+}
+
+// pass the data as blocks of bytes to the buffers of the GeometryArena
+void MeshGeometry::setMesh(unsigned int verticesCount, float* vertices, float* normals, float* texCoords, unsigned int indicesCount, GLuint* indices, VertexFormat format) {
 
   // TODO: asssert if vertices == NULL or indices == NULL
 
+  // the ranges of the previous mesh go back with the old format
+  release();
+
   m_nVertices = verticesCount;
+  m_format = format;
+  computeBounds(verticesCount, vertices, indices);
+
+  // the index type decides the size of the index range, so the indices go first
+  setIndices(indicesCount, indices, format != FORMAT_FLOAT);
+
+  if(format != FORMAT_FLOAT) {
+    setPackedMesh(verticesCount, vertices, normals, texCoords, format == FORMAT_PACKED_QUANTIZED);
+    return;
+  }
 
-  glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferObject);
-  glBufferData(GL_ARRAY_BUFFER, m_nVertices * 3 * sizeof(float), vertices, GL_STATIC_DRAW);    // xyz
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  // the missing streams are zeros, the shared vertex array reads all of them
+  m_hasNormals = normals != NULL;
+  m_hasTexCoords = texCoords != NULL;
+  GeometryArena * arena = GeometryArena::Instance();
+  arena->uploadVertices(m_format, STREAM_VERTEX, m_firstVertex, m_nVertices, vertices);     // xyz
+  arena->uploadVertices(m_format, STREAM_NORMAL, m_firstVertex, m_nVertices, normals);      // nor
+  arena->uploadVertices(m_format, STREAM_TEXCOORD, m_firstVertex, m_nVertices, texCoords);  // st
+}
 
-  if(normals != NULL) {
-    m_hasNormals = true;
-    glBindBuffer(GL_ARRAY_BUFFER, m_normalBufferObject);
-    glBufferData(GL_ARRAY_BUFFER, m_nVertices * 3 * sizeof(float), normals, GL_STATIC_DRAW);   // nor
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+void MeshGeometry::computeBounds(unsigned int verticesCount, const float* vertices, const GLuint* indices)
+{
+  m_boundsMin = m_boundsMax = glm::vec3(0.0f);
+  if(verticesCount > 0) {
+    m_boundsMin = m_boundsMax = glm::vec3(vertices[0], vertices[1], vertices[2]);
+    for(unsigned v = 1; v < verticesCount; v++) {
+      const glm::vec3 position(vertices[3*v], vertices[3*v + 1], vertices[3*v + 2]);
+      m_boundsMin = glm::min(m_boundsMin, position);
+      m_boundsMax = glm::max(m_boundsMax, position);
+    }
   }
 
-  if(texCoords != NULL) {
-    m_hasTexCoords = true;
-    glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBufferObject);
-    glBufferData(GL_ARRAY_BUFFER, m_nVertices * 2 * sizeof(float), texCoords, GL_STATIC_DRAW); // st
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  // only the vertices the submesh indexes, the ranges of the submeshes may overlap
+  for(unsigned s = 0; s < m_subMeshList.size(); s++) {
+    SubMesh & subMesh = m_subMeshList[s];
+    subMesh.boundsMin = subMesh.boundsMax = glm::vec3(0.0f);
+    for(unsigned i = 0; i < subMesh.nIndices; i++) {
+      const GLuint v = subMesh.baseVertex + indices[subMesh.startIndex + i];
+      const glm::vec3 position(vertices[3*v], vertices[3*v + 1], vertices[3*v + 2]);
+      subMesh.boundsMin = i == 0 ? position : glm::min(subMesh.boundsMin, position);
+      subMesh.boundsMax = i == 0 ? position : glm::max(subMesh.boundsMax, position);
+    }
+  }
+}
+
+void MeshGeometry::setPackedMesh(unsigned int verticesCount, const float* vertices, const float* normals, const float* texCoords, bool quantize)
+{
+  m_hasNormals = normals != NULL;
+  m_hasTexCoords = texCoords != NULL;
+
+  // quantized positions are stored relative to the bounding box, 0 .. 65535 from its min to its max
+  m_positionOffset = glm::vec3(0.0f);
+  m_positionScale = glm::vec3(1.0f);
+  if(quantize && verticesCount > 0) {
+    glm::vec3 low(vertices[0], vertices[1], vertices[2]);
+    glm::vec3 high = low;
+    for(unsigned v = 1; v < verticesCount; v++) {
+      for(int i = 0; i < 3; i++) {
+        low[i] = std::min(low[i], vertices[3*v + i]);
+        high[i] = std::max(high[i], vertices[3*v + i]);
+      }
+    }
+    m_positionOffset = low;
+    m_positionScale = high - low;
+  }
+
+  const GLuint stride = packedStride(m_format);
+  const GLuint normalOffset = packedPositionSize(m_format);
+  const GLuint texCoordOffset = normalOffset + sizeof(GLuint);
+
+  std::vector<unsigned char> data(verticesCount * stride, 0);
+  for(unsigned v = 0; v < verticesCount; v++) {
+    unsigned char* vertex = &data[v * stride];
+
+    if(quantize) {
+      GLushort position[4] = { 0, 0, 0, 0 };
+      for(int i = 0; i < 3; i++) {
+        if(m_positionScale[i] > 0.0f)
+          position[i] = GLushort(floor((vertices[3*v + i] - m_positionOffset[i]) / m_positionScale[i] * 65535.0f + 0.5f));
+      }
+      memcpy(vertex, position, sizeof(position));
+    }
+    else
+      memcpy(vertex, &vertices[3*v], 3 * sizeof(float));
+
+    if(normals != NULL) {
+      GLuint normal = packNormal(&normals[3*v]);
+      memcpy(vertex + normalOffset, &normal, sizeof(normal));
+    }
+
+    if(texCoords != NULL) {
+      GLushort texCoord[2] = { toHalf(texCoords[2*v]), toHalf(texCoords[2*v + 1]) };
+      memcpy(vertex + texCoordOffset, texCoord, sizeof(texCoord));
+    }
   }
 
+  GeometryArena::Instance()->uploadVertices(m_format, STREAM_VERTEX, m_firstVertex, verticesCount, data.empty() ? NULL : &data[0]);
+}
+
+void MeshGeometry::setIndices(unsigned int indicesCount, const GLuint* indices, bool allowShort)
+{
   m_nIndices = indicesCount;
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_elementArrayBufferObject);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_nIndices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  // indices are relative to the base vertex of the submesh, so the largest one decides, not the vertex count
+  bool fits = allowShort;
+  for(unsigned i = 0; fits && i < indicesCount; i++)
+    fits = indices[i] <= 0xFFFF;
+
+  m_indexType = fits ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  allocate();
+
+  if(fits) {
+    std::vector<GLushort> shortIndices(indices, indices + indicesCount);
+    GeometryArena::Instance()->uploadIndices(m_indexOffset, m_indexBytes, shortIndices.empty() ? NULL : &shortIndices[0]);
+  }
+  else
+    GeometryArena::Instance()->uploadIndices(m_indexOffset, m_indexBytes, indices);
+}
+
+void MeshGeometry::bindAttributes(GLint position, GLint normal, GLint texCoord) const
+{
+  GeometryArena * arena = GeometryArena::Instance();
+  GLuint buffers[STREAM_COUNT];
+  for(unsigned s = 0; s < STREAM_COUNT; s++)
+    buffers[s] = arena->vertexBuffer(m_format, s);
+
+  SetAttributes(m_format, buffers, position, m_hasNormals ? normal : -1, m_hasTexCoords ? texCoord : -1);
+  GLState::Instance()->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->elementBuffer());
+}
+
+void MeshGeometry::SetAttributes(VertexFormat format, const GLuint * buffers, GLint position, GLint normal, GLint texCoord)
+{
+  if(format == FORMAT_FLOAT) {
+    if(position >= 0) {
+      GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, buffers[STREAM_VERTEX]);
+      glEnableVertexAttribArray(position);
+      glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    }
+
+    if(normal >= 0) {
+      GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, buffers[STREAM_NORMAL]);
+      glEnableVertexAttribArray(normal);
+      glVertexAttribPointer(normal, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    }
+
+    // todo: up to 4 texture coordinates can be there
+    if(texCoord >= 0) {
+      GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, buffers[STREAM_TEXCOORD]);
+      glEnableVertexAttribArray(texCoord);
+      glVertexAttribPointer(texCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);   //(str)
+    }
+  }
+  else {
+    const GLsizei stride = packedStride(format);
+    const size_t normalOffset = packedPositionSize(format);
+    const size_t texCoordOffset = normalOffset + sizeof(GLuint);
+
+    GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, buffers[STREAM_VERTEX]);
+
+    if(position >= 0) {
+      glEnableVertexAttribArray(position);
+      if(format == FORMAT_PACKED_QUANTIZED)  // 0 .. 1 inside the bounding box, see getPositionOffset()
+        glVertexAttribPointer(position, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, 0);
+      else
+        glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, stride, 0);
+    }
+
+    if(normal >= 0) {
+      glEnableVertexAttribArray(normal);
+      glVertexAttribPointer(normal, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void *) normalOffset);
+    }
+
+    if(texCoord >= 0) {
+      glEnableVertexAttribArray(texCoord);
+      glVertexAttribPointer(texCoord, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void *) texCoordOffset);
+    }
+  }
 }
 
-MeshGeometry *MeshGeometry::LoadFromFile(const std::string &path)
+MeshGeometry *MeshGeometry::LoadFromFile(const std::string &path, VertexFormat format, bool optimize)
 {
-  MeshGeometry* ret = 0;
+  MeshGeometry* ret = MeshCache::load(path, format, optimize);
+  if(ret != NULL)
+    return ret;
+
   Assimp::Importer importer;   // asset loader
 
   //importer.SetExtraVerbose(true);
@@ -122,21 +365,14 @@ MeshGeometry *MeshGeometry::LoadFromFile(const std::string &path)
   ////////// create MeshGeometry /////
   ret = new MeshGeometry();          // complete geometry (vertices with normals and indices for all subMeshes)
 
-  glBindBuffer(GL_ARRAY_BUFFER, ret->m_vertexBufferObject);
-  glBufferData(GL_ARRAY_BUFFER, nVertices * 3 * sizeof(float), 0, GL_STATIC_DRAW);    // xyz
+  // positions and normals of all the meshes one after another, aiVector3D is 3 floats
+  float * vertices = new float[3 * nVertices];
+  float * normals = new float[3 * nVertices];
   for(unsigned m = 0, offset = 0; m < scn->mNumMeshes; ++m)
   {
-    unsigned size = scn->mMeshes[m]->mNumVertices * 3 * sizeof(float);
-    glBufferSubData(GL_ARRAY_BUFFER, offset, size, scn->mMeshes[m]->mVertices);
-    offset += size;
-  }
-
-  glBindBuffer(GL_ARRAY_BUFFER, ret->m_normalBufferObject);
-  glBufferData(GL_ARRAY_BUFFER, nVertices * 3 * sizeof(float), 0, GL_STATIC_DRAW);    // xyz
-  for(unsigned m = 0, offset = 0; m < scn->mNumMeshes; ++m)
-  {
-    unsigned size = scn->mMeshes[m]->mNumVertices * 3 * sizeof(float);
-    glBufferSubData(GL_ARRAY_BUFFER, offset, size, scn->mMeshes[m]->mNormals);
+    unsigned size = scn->mMeshes[m]->mNumVertices * 3;
+    memcpy(vertices + offset, scn->mMeshes[m]->mVertices, size * sizeof(float));
+    memcpy(normals + offset, scn->mMeshes[m]->mNormals, size * sizeof(float));
     offset += size;
   }
 
@@ -243,306 +479,331 @@ MeshGeometry *MeshGeometry::LoadFromFile(const std::string &path)
 
   }
 
-  ret->m_nIndices = nIndices;
-  ret->m_nVertices = nVertices;
-  ret->m_hasTexCoords = true;
-  ret->m_hasNormals = true;
-
-  glBindBuffer(GL_ARRAY_BUFFER, ret->m_texCoordBufferObject);
-  glBufferData(GL_ARRAY_BUFFER, nVertices * 2 * sizeof(float), textureCoords, GL_STATIC_DRAW); // st
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  // what the commented out aiProcess_ImproveCacheLocality and aiProcess_RemoveRedundantMaterials would do, and more
+  if(optimize) {
+    MeshOptimizer optimizer(nVertices, vertices, normals, textureCoords, nIndices, indices, ret->m_subMeshList);
+    optimizer.optimize(path);
+  }
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ret->m_elementArrayBufferObject);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, nIndices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  ret->setMesh(nVertices, vertices, normals, textureCoords, nIndices, indices, format);
 
+  delete [] vertices;
+  delete [] normals;
   delete [] textureCoords;
   delete [] indices;
 
+  MeshCache::save(path, ret, optimize);
+
   return ret;
 }
 
-MeshGeometry *MeshGeometry::LoadRawHeightMap(const std::string &path)
+void MeshGeometry::SetTerrainMaterial(SubMesh &subMesh, GLuint texture)
 {
-  MeshGeometry* meshGeometry_p = NULL;
+  subMesh.ambient[0] = 0.5f;
+  subMesh.ambient[1] = 0.5f;
+  subMesh.ambient[2] = 0.5f;
 
-  long int m_nVertices;
-  FILE* rawFile;
-  char file[256];
+  subMesh.diffuse[0] = 0.7f;
+  subMesh.diffuse[1] = 0.7f;
+  subMesh.diffuse[2] = 0.7f;
+
+  subMesh.specular[0] = 0.3f;
+  subMesh.specular[1] = 0.3f;
+  subMesh.specular[2] = 0.3f;
+
+  subMesh.shininess = 10.0f;
+
+  subMesh.textureID = texture;
+}
+
+namespace {
 
-  // resolution of raw file -> 513 x 513 grid
-  const int _resX = 513;
-  const int _resZ = 513;
+/// stores x, y, z of 4 vertices interleaved (x0 y0 z0 x1 ...) to 12 floats
+static inline void store3(float * target, __m128 x, __m128 y, __m128 z)
+{
+  const __m128 xy = _mm_unpacklo_ps(x, y);                          // x0 y0 x1 y1
+  const __m128 z0x1 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)); // z0 z0 x1 x1
+  const __m128 y1z1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)); // y1 y1 z1 z1
+  const __m128 z2x3 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)); // z2 z2 x3 x3
+  const __m128 y3z3 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)); // y3 y3 z3 z3
+  _mm_storeu_ps(target,     _mm_shuffle_ps(xy, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));
+  _mm_storeu_ps(target + 4, _mm_shuffle_ps(y1z1, _mm_unpackhi_ps(x, y), _MM_SHUFFLE(1, 0, 2, 0)));
+  _mm_storeu_ps(target + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+}
 
-  // distances between neighbour grid points along x, y, and z axis
-  const float _deltaX = 1.0f / (_resX - 1);
-  const float _deltaZ = 1.0f / (_resZ - 1);
-  const float _deltaY = 1.0f / ((_resX - 1) * (_resZ - 1)); //256.0f; // height modulation
+/// smaller maps are converted on the calling thread, starting the pool costs more
+const int PARALLEL_MIN_VERTICES = 1 << 20;
 
-  // size of the grid
-  const float _sizeX = 1.0f;
-  const float _sizeZ = 1.0f;
+/// rows of the heightmap converted to the grid on one thread of the pool
+struct HeightMapRowsTask: public TaskPool::Task
+{
+  /// the raw file, 2 bytes per height (low first), row by row
+  const unsigned char * raw;
+  int resX, resZ;
+  float deltaX, deltaZ, deltaY;
+  float originX, originZ;
+  float * vertices;
+  float * normals;
+  float * texCoords;
+  /// rows first .. last - 1 are written
+  int first, last;
+
+  void run();
+
+  /// heights of row z scaled to the grid
+  void decodeRow(int z, float * heights) const;
+  /// one vertex of row z, the normal from the height difference over the given distance
+  void writeVertex(int x, int z, float height, float dx, float invX, float dz, float invZ) const;
+};
+
+void HeightMapRowsTask::decodeRow(int z, float * heights) const
+{
+  const unsigned char * row = raw + 2 * size_t(z) * resX;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 scale = _mm_set1_ps(deltaY);
 
-  // origin of the grid - move the grid to the center of coordinate system
-  const float _originX = -0.5f;
-  const float _originZ = -0.5f;
+  int x = 0;
+  for(; x + 8 <= resX; x += 8)
+  {
+    __m128i value = _mm_loadu_si128((const __m128i *) (row + 2*x));
+    // high * 0xFF + low, the weight the terrain has always been made with
+    value = _mm_sub_epi16(value, _mm_srli_epi16(value, 8));
+    _mm_storeu_ps(heights + x,     _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(value, zero)), scale));
+    _mm_storeu_ps(heights + x + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(value, zero)), scale));
+  }
+  for(; x < resX; x++)
+    heights[x] = float(row[2*x + 1] * 0xFF + row[2*x]) * deltaY;
+}
 
-  // the number of floats to read for heights and colors
-  m_nVertices = _resX*_resZ;
+void HeightMapRowsTask::writeVertex(int x, int z, float height, float dx, float invX, float dz, float invZ) const
+{
+  const size_t i = size_t(z) * resX + x;
+  vertices[3*i]     = originX + x * deltaX;
+  vertices[3*i + 1] = height;
+  vertices[3*i + 2] = originZ + z * deltaZ;
+
+  // (-dh/dx, 1, -dh/dz)
+  const float nx = dx * invX, nz = dz * invZ;
+  const float length = sqrtf(nx * nx + 1.0f + nz * nz);
+  normals[3*i]     = nx / length;
+  normals[3*i + 1] = 1.0f / length;
+  normals[3*i + 2] = nz / length;
+
+  texCoords[2*i]     = x * deltaX;
+  texCoords[2*i + 1] = z * deltaZ;
+}
 
-  float *m_pVertices = NULL;
-  m_pVertices = new float[3*m_nVertices];
-  assert(m_pVertices);
+void HeightMapRowsTask::run()
+{
+  // rows z - 1, z and z + 1, clamped to the map
+  std::vector<float> buffer(3 * resX);
+  float * previous = &buffer[0];
+  float * current = &buffer[resX];
+  float * next = &buffer[2 * resX];
+  decodeRow(std::max(first - 1, 0), previous);
+  decodeRow(first, current);
+
+  // central differences inside, one sided ones on the edges of the map
+  const float invX = 0.5f / deltaX;
+
+  for(int z = first; z < last; z++)
+  {
+    const bool hasPrevious = z > 0, hasNext = z + 1 < resZ;
+    decodeRow(hasNext ? z + 1 : z, next);
+    const float * south = hasPrevious ? previous : current;
+    const float * north = hasNext ? next : current;
+    const float invZ = (hasPrevious && hasNext ? 0.5f : 1.0f) / deltaZ;
+
+    writeVertex(0, z, current[0], current[0] - current[1], 2.0f * invX, south[0] - north[0], invZ);
+
+    const size_t rowStart = size_t(z) * resX;
+    float * vertex = vertices + 3 * rowStart;
+    float * normal = normals + 3 * rowStart;
+    float * texCoord = texCoords + 2 * rowStart;
+
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 vInvX = _mm_set1_ps(invX);
+    const __m128 vInvZ = _mm_set1_ps(invZ);
+    const __m128 vDeltaX = _mm_set1_ps(deltaX);
+    const __m128 vOriginX = _mm_set1_ps(originX);
+    const __m128 vPositionZ = _mm_set1_ps(originZ + z * deltaZ);
+    const __m128 vTexCoordT = _mm_set1_ps(z * deltaZ);
+    __m128 vx = _mm_set_ps(4.0f, 3.0f, 2.0f, 1.0f);
+
+    // 4 vertices at once, no branches
+    int x = 1;
+    for(; x + 4 < resX; x += 4, vx = _mm_add_ps(vx, four))
+    {
+      const __m128 height = _mm_loadu_ps(current + x);
+      const __m128 nx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(current + x - 1), _mm_loadu_ps(current + x + 1)), vInvX);
+      const __m128 nz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(south + x), _mm_loadu_ps(north + x)), vInvZ);
+      const __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), one), _mm_mul_ps(nz, nz))));
+      const __m128 s = _mm_mul_ps(vx, vDeltaX);
+
+      // the arrays are interleaved: x, y, z of 4 vertices are 3 stores
+      store3(vertex + 3*x, _mm_add_ps(vOriginX, s), height, vPositionZ);
+      store3(normal + 3*x, _mm_mul_ps(nx, inverseLength), inverseLength, _mm_mul_ps(nz, inverseLength));
+      _mm_storeu_ps(texCoord + 2*x,     _mm_unpacklo_ps(s, vTexCoordT));
+      _mm_storeu_ps(texCoord + 2*x + 4, _mm_unpackhi_ps(s, vTexCoordT));
+    }
+    for(; x < resX - 1; x++)
+      writeVertex(x, z, current[x], current[x - 1] - current[x + 1], invX, south[x] - north[x], invZ);
 
-  //float *_colors = NULL;
-  //_colors = new float[size];
-  //assert(_colors);
+    const int end = resX - 1;
+    writeVertex(end, z, current[end], current[end - 1] - current[end], 2.0f * invX, south[end] - north[end], invZ);
+
+    // the next row reuses the two decoded ones
+    float * spare = previous;
+    previous = current;
+    current = next;
+    next = spare;
+  }
+}
+
+} // anonymous namespace
+
+bool MeshGeometry::RawHeightMapResolution(const std::string &file, size_t size, int &resX, int &resZ)
+{
+  // the raw file has no header, a square map is assumed unless the resolution is given
+  const size_t heights = size / 2;
+  if(resX <= 0 || resZ <= 0)
+  {
+    resX = resZ = int(sqrt(double(heights)) + 0.5);
+    if(size_t(resX) * resZ != heights)
+    {
+      std::cerr << "MeshGeometry::RawHeightMapResolution(): " << file << " is not a square map, " << heights << " heights" << std::endl;
+      return false;
+    }
+  }
+  if(resX < 2 || resZ < 2 || size_t(resX) * resZ > heights)
+  {
+    std::cerr << "MeshGeometry::RawHeightMapResolution(): " << file << " is too small for " << resX << "x" << resZ << " heights" << std::endl;
+    return false;
+  }
+  return true;
+}
 
-  // read the heights of terrain
+bool MeshGeometry::ReadRawHeightMap(const std::string &path, int &resX, int &resZ, std::vector<float> &vertices, std::vector<float> &normals, std::vector<float> &texCoords)
+{
+  char file[256];
   sprintf(file, "%s.raw", path.c_str());
-  std::cout << "Loading terrain map file " << file << " [" << _resX << "x" << _resZ << "] ";
-  std::cout.flush();
 
-  rawFile = fopen(file, "rb");
-  if (rawFile == NULL) {
-    std::cerr << "MeshManager::LoadTerrain(): Can't open input raw file" << file << std::endl;
-  return meshGeometry_p;
+  MappedFile raw;
+  if(!raw.open(file))
+  {
+    std::cerr << "MeshGeometry::ReadRawHeightMap(): Can't open input raw file " << file << std::endl;
+    return false;
   }
 
-  typedef unsigned char BYTE;
-  BYTE *buffer = new BYTE[3*_resX]; // 2 bytes per one height, 3 bytes per one color
-  int counter;
-  float height;//, *cPtr;
-  BYTE low, high;
+  if(!RawHeightMapResolution(file, raw.size(), resX, resZ))
+    return false;
 
-  // read a terragen file that contains grid heights
-  for(int z=0; z<_resZ; z++) {
-  counter = 0;
-    fread(buffer, 1, 2*_resX, rawFile);
-
-    for(int x=0; x<_resX; x++) {
-    low = buffer[counter++];   // fread((char*)&low, 1, 1, rawFile);
-    high = buffer[counter++];  // fread((char*)&high, 1, 1, rawFile);
-      height = (float) (high * 0xFFL + low);
-    // index for vertex in the array of floats
-    int idx = (_resX * z + x) * 3;
-
-      m_pVertices[idx] = _originX + x*_deltaX;
-      m_pVertices[idx+1] = height * _deltaY;
-      m_pVertices[idx+2] = _originZ + z*_deltaZ;
-      //_colors[i] = _colors[i+1] = _colors[i+2] = 0.5; // color is grey by default
+  std::cout << "Loading terrain map file " << file << " [" << resX << "x" << resZ << "] ";
+  std::cout.flush();
+
+  const size_t count = size_t(resX) * resZ;
+  vertices.resize(3 * count);
+  normals.resize(3 * count);
+  texCoords.resize(2 * count);
+
+  HeightMapRowsTask task;
+  task.raw = raw.data();
+  task.resX = resX;
+  task.resZ = resZ;
+  // distances between neighbour grid points along x, y, and z axis, the grid spans -0.5 .. 0.5
+  task.deltaX = 1.0f / (resX - 1);
+  task.deltaZ = 1.0f / (resZ - 1);
+  task.deltaY = 1.0f / ((resX - 1) * (resZ - 1)); // height modulation
+  task.originX = -0.5f;
+  task.originZ = -0.5f;
+  task.vertices = &vertices[0];
+  task.normals = &normals[0];
+  task.texCoords = &texCoords[0];
+  task.first = 0;
+  task.last = resZ;
+
+  if(count < size_t(PARALLEL_MIN_VERTICES))
+  {
+    task.run();
+  }
+  else
+  {
+    // several bands per thread so the stealing evens out the page faults
+    TaskPool pool;
+    const int bands = std::min(int(pool.concurrency()) * 4, resZ);
+    std::vector<HeightMapRowsTask> tasks(bands, task);
+    for(int b = 0; b < bands; b++)
+    {
+      tasks[b].first = resZ * b / bands;
+      tasks[b].last = resZ * (b + 1) / bands;
+      pool.submit(&tasks[b]);
     }
-    std::cout << ".";
-    std::cout.flush();
+    pool.wait();
   }
-  std::cout << std::endl;
-  fclose(rawFile);
 
-  delete [] buffer;
+  std::cout << "done" << std::endl;
+  return true;
+}
+
+MeshGeometry *MeshGeometry::LoadRawHeightMap(const std::string &path, VertexFormat format)
+{
+  MeshGeometry* meshGeometry_p = NULL;
+
+  int resX = 0, resZ = 0;
+  std::vector<float> vertices, normals, texCoords;
+  if(!ReadRawHeightMap(path, resX, resZ, vertices, normals, texCoords))
+    return meshGeometry_p;
 
+  char file[256];
   sprintf(file, "%s.tga", path.c_str());
-  std::cout << "Loading terrain texture " << file << " [" << _resX << "x" << _resZ << "] ";
+  std::cout << "Loading terrain texture " << file << " [" << resX << "x" << resZ << "] ";
   std::cout.flush();
 
   GLuint texture = TextureManager::Instance()->get(file);
 
-  unsigned int m_nIndices = 2 * 3 * (_resX-1) * (_resZ-1);
+  unsigned int m_nIndices = 2 * 3 * (resX-1) * (resZ-1);
   unsigned int* m_pIndices = NULL;
   m_pIndices = new unsigned int[m_nIndices];
 
   int triIndex;
+  int counter;
 
   // build array of indices
   // asi by to chtelo zvazit, zda nepouzit tringle strip (mit na vyber jak kreslit mesh - tringles nebo strip)
   counter = 0;
-  for (int iz = 0; iz < _resZ-1; iz++) {
-  triIndex = iz*_resX;
-  for (int ix = 0; ix < _resX-1; ix++) {
+  for (int iz = 0; iz < resZ-1; iz++) {
+  triIndex = iz*resX;
+  for (int ix = 0; ix < resX-1; ix++) {
 
     m_pIndices[counter++] = triIndex;
-    m_pIndices[counter++] = triIndex+_resX;
+    m_pIndices[counter++] = triIndex+resX;
     m_pIndices[counter++] = triIndex+1;
 
     m_pIndices[counter++] = triIndex+1;
-    m_pIndices[counter++] = triIndex+_resX;
-    m_pIndices[counter++] = triIndex+_resX+1;
+    m_pIndices[counter++] = triIndex+resX;
+    m_pIndices[counter++] = triIndex+resX+1;
 
     triIndex++;
   }
   }
 
 
-  // generate texture coords & normals
-  GLfloat* m_pTexCoords = new GLfloat[2*m_nVertices];
-  GLfloat* m_pNormals = new GLfloat[3*m_nVertices];
-
-#define X 0
-#define Y 1
-#define Z 2
-
-  float length;//, *ptr;
-
-  int texCoordIndex = 0;
-  int normalIndex = 0;
-
-  float texCoordS = 0.0f;
-  float texCoordT = 0.0f;
-
-  float *point0, *point1, *point2;
-  float mul = _deltaX * _deltaZ;
-  float nx, ny, nz;
-
-  int count;
-
-  // For now we will do it the hard way - by generating the normals individually for each elevation point
-  for (int iz = 0; iz < _resZ; iz++) {
-    texCoordS = 0.0f;
-  for (int ix = 0; ix < _resX; ix++) {
-
-    // texture coordinates
-    m_pTexCoords[texCoordIndex++] = texCoordS;
-    m_pTexCoords[texCoordIndex++] = texCoordT;
-
-    nx = ny = nz = 0.0f;
-
-    // count of normals added to current vertex
-    count = 0;
-
-    point0 = m_pVertices + 3L*(iz*_resX + ix) + Y;
-
-    if(iz<_resZ-1 && ix<_resX-1) {
-      point1 = point0 + 3L*_resX; //m_pVertices + 3L*((iz+1)*_resX + ix) + Y;
-      point2 = point0 + 3L;
-
-      //nx += -_deltaZ * (*point2 - *point0);
-      //ny += mul;
-      //nz += -_deltaX * (*point1 - *point0);
-      nx -= _deltaZ * (*point2 - *point0);
-      ny += mul;
-      nz -= _deltaX * (*point1 - *point0);
-
-      count++;
-    }
-
-    if(iz>0 && ix<_resX-1) {
-      point1 = point0 + 3L;
-      point2 = point0 - 3L*_resX; //m_pVertices + 3L*((iz-1)*_resX + ix) + Y;
-
-      //nx -= _deltaZ * (*point1 - *point0);
-      //ny += mul;
-      //nz += _deltaX * (*point2 - *point0);
-      nx -= _deltaZ * (*point1 - *point0);
-      ny += mul;
-      nz += _deltaX * (*point2 - *point0);
-
-      count++;
-    }
-
-    if(iz>0 && ix>0) {
-      point1 = point0 - 3L*_resX; //m_pVertices + 3L*((iz-1)*_resX+ix) + Y;
-      point2 = point0 - 3L;
-
-      //nx += _deltaZ * (*point2 - *point0);
-      //ny += mul;
-      //nz += _deltaX * (*point1 - *point0);
-      nx += _deltaZ * (*point2 - *point0);
-      ny += mul;
-      nz += _deltaX * (*point1 - *point0);
-
-      count++;
-    }
-
-    if(iz<_resZ-1 && ix>0) {
-      point1 = point0 - 3;
-      point2 = point0 + 3L*_resX; //m_pVertices + 3L*((iz+1)*_resX + ix) + Y;
-
-      //nx += _deltaZ * (*point1 - *point0);
-      //ny += mul;
-      //nz += -_deltaX * (*point2 - *point0);
-      nx -= _deltaZ * (*point1 - *point0);
-      ny -= mul;
-      nz += _deltaX * (*point2 - *point0);
-
-      count++;
-    }
-
-    if(count == 0) {
-      char errorStr[256];
-      sprintf(errorStr, "MeshManager::LoadTerrain(): Failed to find any normals at: [%d, %d]", ix, iz);
-      std::cerr << errorStr << std::endl;
-      exit(1);
-    }
-
-    // normalize it
-    length = sqrt( nx*nx +	ny*ny +	nz*nz );
-
-    if(length < 1.0E-5f) {
-      nx = 0.0f;
-      ny = 1.0f;
-      nz = 0.0f;
-    }
-      else {
-      nx /= length;
-      ny /= length;
-      nz /= length;
-    }
-
-    //char errorStr[256];
-    //sprintf(errorStr, "Normal at: [%d, %d] = [%lg, %lg, %lg]", ix, iz, nx, ny, nz);
-    //std::cout << errorStr << std::endl;
-
-    //normalIndex = 3*(iz*_resX + ix);
-
-    m_pNormals[normalIndex+X] = nx;
-    m_pNormals[normalIndex+Y] = ny;
-    m_pNormals[normalIndex+Z] = nz;
-
-    normalIndex += 3;
-
-    texCoordS += _deltaX;
-  }
-  texCoordT += _deltaZ;
-  }
-
-
-#undef X
-#undef Y
-#undef Z
-
-
   ////////// create MeshGeometry /////
   meshGeometry_p = new MeshGeometry();          // complete geometry (vertices with normals and indices for all subMeshes)
   meshGeometry_p->m_subMeshList.resize(1);
 
   MeshGeometry::SubMesh* subMesh_p = meshGeometry_p->getSubMesh(0);
-
-  subMesh_p->ambient[0] = 0.5f;
-  subMesh_p->ambient[1] = 0.5f;
-  subMesh_p->ambient[2] = 0.5f;
-
-  subMesh_p->diffuse[0] = 0.7f;
-  subMesh_p->diffuse[1] = 0.7f;
-  subMesh_p->diffuse[2] = 0.7f;
-
-  subMesh_p->specular[0] = 0.3f;
-  subMesh_p->specular[1] = 0.3f;
-  subMesh_p->specular[2] = 0.3f;
-
-  subMesh_p->shininess = 10.0f;
+  SetTerrainMaterial(*subMesh_p, texture);
 
   // indices to the element array
   subMesh_p->nIndices = m_nIndices;
   subMesh_p->startIndex = 0;
   subMesh_p->baseVertex = 0;
 
-  subMesh_p->textureID = texture;
-
   // Finish the mesh by creating the buffer objects holding all vertices and indices
-  meshGeometry_p->setMesh(m_nVertices, m_pVertices, m_pNormals, m_pTexCoords, m_nIndices, m_pIndices);
+  meshGeometry_p->setMesh(resX*resZ, &vertices[0], &normals[0], &texCoords[0], m_nIndices, m_pIndices, format);
 
-  delete [] m_pVertices;
-  delete [] m_pNormals;
-  delete [] m_pTexCoords;
   delete [] m_pIndices;
 
   return meshGeometry_p;
@@ -6,11 +6,16 @@
 /** Container for the mesh data.
  *
  * Holds the complete geometry of the mesh, grouped to materialGroups with single material each.
- * Holds all vertices from all submeshes packed to buffer objects
- * called m_vertexBufferObject, m_normalBufferObject and m_texCoordBufferObject
+ * The vertices of all the submeshes and their indices live in the buffers of the GeometryArena,
+ * the mesh is a range of vertices in the pool of its format and a range of its element buffer.
+ * Draw with the vertex array of the format (getVertexArray()), shared by all the meshes,
+ * and the base vertex and the index offset of the submesh in the arena (getBaseVertex(),
+ * getIndexOffset()). Use bindAttributes() to set up another vertex array for the mesh.
  */
 class MeshGeometry
 {
+  friend class MeshCache;
+
 public:
   /// one material/vertex group - submesh
   struct SubMesh
@@ -37,15 +42,81 @@ public:
     GLuint startIndex;
     /// vertex in array of vertices added to index in the index buffer
     GLuint baseVertex;
+
+    /// bounding box of the vertices of the submesh, in the space of the mesh
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
   };
 
   typedef std::vector<SubMesh> SubMeshList;
 
-  MeshGeometry(void);
-  ~MeshGeometry();
+  /// how the vertices are stored in the buffer objects
+  enum VertexFormat
+  {
+    /// three buffers of floats (positions, normals, texture coordinates), 32 bit indices, 32 bytes per vertex
+    FORMAT_FLOAT,
+    /// one interleaved buffer: float position, GL_INT_2_10_10_10_REV normal, half float texture coordinates, 20 bytes per vertex
+    FORMAT_PACKED,
+    /// FORMAT_PACKED with the position quantized to 16 bits inside the bounding box, 16 bytes per vertex
+    FORMAT_PACKED_QUANTIZED,
+    FORMAT_COUNT
+  };
+
+  /// vertex buffers of the formats, FORMAT_FLOAT uses all of them, the packed ones the interleaved STREAM_VERTEX only
+  enum Stream
+  {
+    STREAM_VERTEX,
+    STREAM_NORMAL,
+    STREAM_TEXCOORD,
+    STREAM_COUNT
+  };
 
-  static MeshGeometry * LoadFromFile(const std::string & path);
-  static MeshGeometry * LoadRawHeightMap(const std::string & path);
+  MeshGeometry(void);
+  virtual ~MeshGeometry();
+
+  /** loads the mesh by Assimp
+   *
+   * The packed formats also use 16 bit indices when all the (submesh relative) indices fit.
+   * With optimize, the triangles and vertices are reordered by MeshOptimizer before the upload.
+   * The result is kept in a MeshCache next to the file, the following loads skip Assimp.
+   */
+  static MeshGeometry * LoadFromFile(const std::string & path, VertexFormat format = FORMAT_FLOAT, bool optimize = true);
+  static MeshGeometry * LoadRawHeightMap(const std::string & path, VertexFormat format = FORMAT_FLOAT);
+
+  /** reads the heightmap (path without the .raw extension) and computes its grid
+   *
+   * The raw file holds 2 bytes per height, row by row, and has no header: resX and resZ
+   * give the resolution, when they are not positive a square map is assumed and they are
+   * set from the file size. Fills resX * resZ vertices row by row: 3 floats of the position,
+   * 3 of the normal and 2 texture coordinates each. The grid spans -0.5 .. 0.5 in x and z.
+   *
+   * The file is mapped, big maps are converted by a TaskPool, 4 vertices at once (SSE).
+   * Makes no GL calls, false when the file is missing or too small.
+   */
+  static bool ReadRawHeightMap(const std::string & path, int & resX, int & resZ,
+                               std::vector<float> & vertices, std::vector<float> & normals, std::vector<float> & texCoords);
+
+  /** checks the resolution of a raw heightmap of size bytes, derives a square one if resX or resZ is not positive
+   *
+   * The heights are 2 bytes each, high * 0xFF + low. False (with a message) if the file does not fit.
+   */
+  static bool RawHeightMapResolution(const std::string & file, size_t size, int & resX, int & resZ);
+
+  /// material of the terrain loaded from the heightmap
+  static void SetTerrainMaterial(SubMesh & subMesh, GLuint texture);
+
+  /** sets the attribute pointers of the bound vertex array for the format of the mesh
+   *
+   * Binds the element buffer to the vertex array as well. Locations of -1 are skipped.
+   * All the meshes of the format share the buffers, so the vertex array serves them all.
+   */
+  void bindAttributes(GLint position, GLint normal, GLint texCoord) const;
+
+  /// bytes per vertex in the stream of the format, 0 for the streams the format does not use
+  static GLuint StreamStride(VertexFormat format, unsigned stream);
+
+  /// sets the attribute pointers of the bound vertex array for the format, buffers holds one per Stream
+  static void SetAttributes(VertexFormat format, const GLuint * buffers, GLint position, GLint normal, GLint texCoord);
 
   GLuint getSubMeshCount(void) const {
     return m_subMeshList.size();
@@ -58,20 +129,54 @@ public:
       return NULL;
   }
 
-  GLuint getVertexBuffer(void) const {
-    return m_vertexBufferObject;
+  VertexFormat getVertexFormat(void) const {
+    return m_format;
+  }
+
+  /// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, for the draw calls
+  GLenum getIndexType(void) const {
+    return m_indexType;
   }
 
-  GLuint getNormalBuffer(void) const {
-    return m_normalBufferObject;
+  /// size of one index in bytes, SubMesh::startIndex * getIndexSize() is the offset in the element buffer
+  size_t getIndexSize(void) const {
+    return m_indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
   }
 
-  GLuint getTexCoordBuffer(void) const {
-    return m_texCoordBufferObject;
+  /// position = offset + scale * stored position, (0,0,0) and (1,1,1) unless quantized
+  const glm::vec3 & getPositionOffset(void) const {
+    return m_positionOffset;
   }
 
-  GLuint getElementBuffer(void) const {
-    return m_elementArrayBufferObject;
+  const glm::vec3 & getPositionScale(void) const {
+    return m_positionScale;
+  }
+
+  /// bounding box of all the vertices (see SubMesh::boundsMin for the submeshes), set with the mesh
+  const glm::vec3 & getBoundsMin(void) const {
+    return m_boundsMin;
+  }
+
+  const glm::vec3 & getBoundsMax(void) const {
+    return m_boundsMax;
+  }
+
+  /// vertex array of the GeometryArena shared by all the meshes of the format
+  GLuint getVertexArray(void) const;
+
+  /// first vertex of the mesh in the pool of its format
+  GLuint getFirstVertex(void) const {
+    return m_firstVertex;
+  }
+
+  /// base vertex of the submesh for glDrawElementsBaseVertex(), in the pool of the format
+  GLint getBaseVertex(const SubMesh & subMesh) const {
+    return m_firstVertex + subMesh.baseVertex;
+  }
+
+  /// offset of the first index of the submesh in the element buffer of the arena
+  const void * getIndexOffset(const SubMesh & subMesh) const {
+    return (const void *) (size_t(m_indexOffset) + subMesh.startIndex * getIndexSize());
   }
 
   GLuint getVerticesCount(void) const {
@@ -97,17 +202,31 @@ protected:
     float* normals,
     float* texCoords,
     unsigned int indicesCount,
-    GLuint* indices
+    GLuint* indices,
+    VertexFormat format = FORMAT_FLOAT
   );
 
-  /// identifier for the buffer object for indices
-  GLuint m_elementArrayBufferObject;
-  /// identifier for the buffer object for vertices
-  GLuint m_vertexBufferObject;
-  /// identifier for the buffer object for normals
-  GLuint m_normalBufferObject;
-  /// identifier for the buffer object for texture coordinates
-  GLuint m_texCoordBufferObject;
+  /// bounding boxes of the whole mesh and of the submeshes (their ranges must be set already)
+  void computeBounds(unsigned int verticesCount, const float* vertices, const GLuint* indices);
+
+  /// setMesh() for the packed formats
+  void setPackedMesh(unsigned int verticesCount, const float* vertices, const float* normals, const float* texCoords, bool quantize);
+
+  /// setMesh() for the indices, 16 bit ones if allowed and possible, allocates the ranges once the index type is known
+  void setIndices(unsigned int indicesCount, const GLuint* indices, bool allowShort);
+
+  /// takes the ranges for m_nVertices of the format and m_nIndices of the index type from the arena, frees the old ones
+  void allocate(void);
+  void release(void);
+
+  /// first vertex of the range in the pool of the format
+  GLuint m_firstVertex;
+  /// byte offset of the range in the element buffer
+  GLuint m_indexOffset;
+  /// bytes of the element buffer range, 0 if there is none
+  GLuint m_indexBytes;
+  /// vertices of the range, 0 if there is none
+  GLuint m_allocatedVertices;
 
   /// list of sumbeshes (vertex/material groups)
   SubMeshList m_subMeshList;
@@ -120,6 +239,15 @@ protected:
   ///
   bool m_hasNormals;
   bool m_hasTexCoords;
+
+  VertexFormat m_format;
+  GLenum m_indexType;
+  /// dequantization of the positions
+  glm::vec3 m_positionOffset;
+  glm::vec3 m_positionScale;
+  /// bounding box in the space of the mesh
+  glm::vec3 m_boundsMin;
+  glm::vec3 m_boundsMax;
 };
 
 
@@ -3,97 +3,107 @@
 #include "MeshGeometry.h"
 #include "Resources.h"
 #include "ShaderProgram.h"
+#include "RenderQueue.h"
+#include "CullingHierarchy.h"
+#include "OcclusionCulling.h"
+#include "ShaderVariants.h"
+#include "GLState.h"
 
 
 MeshNode::MeshNode(const std::string &name, SceneNode* parent):
-  SceneNode(name, parent), m_program(0), m_vertexArrayObject(0), m_mesh(NULL)
+  SceneNode(name, parent), m_program(0), m_texturedProgram(0), m_mesh(NULL), m_cullingHandle(-1), m_occlusionHandle(-1)
 {
-  glGenVertexArrays(1, &m_vertexArrayObject );
 }
 
 MeshNode::~MeshNode()
 {
-  glDeleteVertexArrays( 1, &m_vertexArrayObject );
   if(m_program)
-    ShaderManager::Instance()->release("MeshNode-shader");
+  {
+    ShaderVariants::Instance()->release(m_program);
+    ShaderVariants::Instance()->release(m_texturedProgram);
+  }
+  if(m_cullingHandle >= 0)
+    CullingHierarchy::Instance()->remove(m_cullingHandle);
+  if(m_occlusionHandle >= 0)
+    OcclusionCulling::Instance()->remove(m_occlusionHandle);
 }
 
 void MeshNode::loadProgram()
 {
+  ShaderVariants * variants = ShaderVariants::Instance();
   if(m_program)
-    ShaderManager::Instance()->release("MeshNode-shader");
-  if(!ShaderManager::Instance()->exists("MeshNode-shader"))
   {
-    GLuint shaderList[] = {
-      pgr::createShaderFromFile(GL_VERTEX_SHADER,   "resources/MeshNode.vert"),
-      pgr::createShaderFromFile(GL_FRAGMENT_SHADER, "resources/MeshNode.frag"),
-      0
-    };
-    m_program = new MeshShaderProgram(pgr::createProgram(shaderList));
-    ShaderManager::Instance()->insert("MeshNode-shader", m_program);
+    variants->release(m_program);
+    variants->release(m_texturedProgram);
   }
-  else
-    m_program = dynamic_cast<MeshShaderProgram*>(ShaderManager::Instance()->get("MeshNode-shader"));
 
-  m_program->initLocations();
+  // lights and sun as the scene has them, the texture as the submesh has it
+  ShaderVariants::Features features = variants->sceneFeatures();
+  features.textured = 0;
+  m_program = variants->get("resources/MeshNode.vert", "resources/MeshNode.frag", features);
+  features.textured = 1;
+  m_texturedProgram = variants->get("resources/MeshNode.vert", "resources/MeshNode.frag", features);
 }
 
-void MeshNode::setGeometry(MeshGeometry* mesh_p)
+MeshShaderProgram * MeshNode::programFor(const MeshGeometry::SubMesh * sub_mesh) const
+{
+  return sub_mesh->textureID != 0 && m_mesh->hasTexCoords() ? m_texturedProgram : m_program;
+}
+
+void MeshNode::setMesh(MeshGeometry* mesh_p)
 {
   if(m_program == 0)
   {
     loadProgram();
   }
 
+  if(mesh_p != NULL)
+    m_mesh = mesh_p;
+}
+
+void MeshNode::setGeometry(MeshGeometry* mesh_p)
+{
+  setMesh(mesh_p);
   if(mesh_p == NULL)
     return;
 
-  m_mesh = mesh_p;
-
-  glBindVertexArray( m_vertexArrayObject );
-  glBindBuffer(GL_ARRAY_BUFFER, mesh_p->getVertexBuffer());
-  glEnableVertexAttribArray(m_program->m_pos);
-  glVertexAttribPointer(m_program->m_pos, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-  if(m_mesh->hasNormals() == true) {
-    glBindBuffer(GL_ARRAY_BUFFER, mesh_p->getNormalBuffer());
-    glEnableVertexAttribArray(m_program->m_normal);
-    glVertexAttribPointer(m_program->m_normal, 3, GL_FLOAT, GL_FALSE, 0, 0);
-  }
-
-    // todo: up to 4 texture coordinates can be there
-  if(m_mesh->hasTexCoords() == true) {
-    glBindBuffer(GL_ARRAY_BUFFER, mesh_p->getTexCoordBuffer());
-    glEnableVertexAttribArray(m_program->m_texCoord);
-    glVertexAttribPointer(m_program->m_texCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);   //(str)
-  }
-
-  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, mesh_p->getElementBuffer() );
-
-  glBindVertexArray( 0 );
+  if(m_cullingHandle >= 0)
+    CullingHierarchy::Instance()->remove(m_cullingHandle);
+  m_cullingHandle = CullingHierarchy::Instance()->add(this, mesh_p->getBoundsMin(), mesh_p->getBoundsMax());
+  if(m_occlusionHandle < 0)
+    m_occlusionHandle = OcclusionCulling::Instance()->add();
 }
 
 void MeshNode::draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
 {
-  glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+  GLState::Instance()->polygonMode(GL_FILL);
 
   // inherited draw - draws all children
   SceneNode::draw(view_matrix, projection_matrix);
 
-  glm::mat4 PVMmatrix = projection_matrix  * view_matrix * globalMatrix();
-  glm::mat4   Vmatrix = view_matrix;
-  glm::mat4   Mmatrix = globalMatrix();
+  if(m_mesh == NULL || !CullingHierarchy::Instance()->isVisible(m_cullingHandle))
+    return;
 
+  // the box tested in the last frame decides this draw, the box tested now the next one
+  const GLuint condition = OcclusionCulling::Instance()->condition(m_occlusionHandle);
+  OcclusionCulling::Instance()->test(m_occlusionHandle, globalMatrix(), m_mesh->getBoundsMin(), m_mesh->getBoundsMax());
 
-  glUseProgram(m_program->m_programId);
+  // queued draws are only described here, the queue sorts and submits them later
+  if(RenderQueue::active() != NULL)
+  {
+    for(unsigned mat=0; mat<m_mesh->getSubMeshCount(); mat++) {
+      const MeshGeometry::SubMesh* subMesh_p = m_mesh->getSubMesh(mat);
+      bool textured = subMesh_p->textureID != 0 && m_mesh->hasTexCoords() == true;
+      RenderQueue::active()->push(programFor(subMesh_p), m_mesh->getVertexArray(), m_mesh, subMesh_p, textured, &globalMatrix(), condition);
+    }
+    return;
+  }
 
-  glUniformMatrix4fv(m_program->m_PVMmatrix, 1, GL_FALSE, glm::value_ptr(PVMmatrix) );			// model-view-projection
-  glUniformMatrix4fv(  m_program->m_Vmatrix, 1, GL_FALSE, glm::value_ptr(  Vmatrix) );			// view
-  glUniformMatrix4fv(  m_program->m_Mmatrix, 1, GL_FALSE, glm::value_ptr(  Mmatrix) );			// model
+  // view, projection and time are in the Frame block (FrameUniforms), only the per-object matrices are set here
+  glm::mat4   Vmatrix = view_matrix;
+  glm::mat4   Mmatrix = globalMatrix();
   glm::mat4 NormalMatrix = glm::transpose( glm::inverse( Vmatrix * Mmatrix ));			// should be this way, but inverse returns bad matrix
-  glUniformMatrix4fv(m_program->m_NormalMatrix, 1, GL_FALSE, glm::value_ptr(NormalMatrix) );    // correct matrix for non-rigid transf
 
-  glUniform1f( m_program->m_time, m_time );        // in seconds
   // cubemap
   //glUniform1f( m_program->m_reflectFactor, 0.75f);
   //glUniform1i(m_program->m_cubeMapTex, 3);
@@ -101,36 +111,46 @@ void MeshNode::draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_
 
   //glUniform1i(m_texSamplerID, 0);
 
-  glBindVertexArray( m_vertexArrayObject );
+  // shared by the meshes of the format, the attribute locations are the same in both variants
+  GLState::Instance()->bindVertexArray( m_mesh->getVertexArray() );
+
+  if(condition != 0)
+    glBeginConditionalRender(condition, GL_QUERY_NO_WAIT);
 
   // draw all submeshes = all material groups from SubMeshList
   MeshGeometry::SubMesh* subMesh_p = NULL;
+  MeshShaderProgram * program = NULL;
 
   for(unsigned mat=0; mat<m_mesh->getSubMeshCount(); mat++) {
 
     subMesh_p = m_mesh->getSubMesh(mat);
 
-    glUniform3fv(m_program->m_diffuse,  1, subMesh_p->diffuse);  // 2nd parameter must be 1 - it declares number of vectors in the vector array
-    glUniform3fv(m_program->m_ambient,  1, subMesh_p->ambient);
-    glUniform3fv(m_program->m_specular, 1, subMesh_p->specular);
-    glUniform1f(m_program->m_shininess,    subMesh_p->shininess);
+    // textured and untextured submeshes have their own variants, each needs the per-object uniforms
+    if(programFor(subMesh_p) != program) {
+      program = programFor(subMesh_p);
+      GLState::Instance()->useProgram(program->m_programId);
+      GLState::Instance()->uniformMatrix4fv(program->m_Mmatrix, glm::value_ptr(Mmatrix) );			// model
+      GLState::Instance()->uniformMatrix4fv(program->m_NormalMatrix, glm::value_ptr(NormalMatrix) );    // correct matrix for non-rigid transf
+      GLState::Instance()->uniform3fv(program->m_positionOffset, 1, glm::value_ptr(m_mesh->getPositionOffset()));  // quantized positions
+      GLState::Instance()->uniform3fv(program->m_positionScale,  1, glm::value_ptr(m_mesh->getPositionScale()));
+    }
 
-    if(subMesh_p->textureID != 0 && m_mesh->hasTexCoords() == true) {
-      glUniform1i(m_program->m_useTexture, 1);		 // do texture sampling
+    GLState::Instance()->uniform3fv(program->m_diffuse,  1, subMesh_p->diffuse);  // 2nd parameter must be 1 - it declares number of vectors in the vector array
+    GLState::Instance()->uniform3fv(program->m_ambient,  1, subMesh_p->ambient);
+    GLState::Instance()->uniform3fv(program->m_specular, 1, subMesh_p->specular);
+    GLState::Instance()->uniform1f(program->m_shininess,    subMesh_p->shininess);
 
-      glUniform1i(m_program->m_texSampler,   0);  // texturing unit 0 -> samplerID   [for the GPU linker]
-      glActiveTexture(GL_TEXTURE0 + 0);  // texturing unit 0 -> to be bound [for OpenGL BindTexture]
-      glBindTexture(GL_TEXTURE_2D, subMesh_p->textureID);
-    }
-    else {
-      glUniform1i(m_program->m_useTexture, 0);		// do not sample the texture
+    if(program == m_texturedProgram) {
+      // texturing unit 0 (the sampler is set by ShaderVariants)
+      GLState::Instance()->bindTexture(GL_TEXTURE0 + 0, GL_TEXTURE_2D, subMesh_p->textureID);
     }
 
     //glDrawElements( GL_TRIANGLES, subMesh_p->nIndices, GL_UNSIGNED_INT, (void *) (subMesh_p->startIndex * sizeof(unsigned int)));
     // base vertex must be added to the indices for each block (as they are rellative inside the submesh and start from 0)
-    // do it in Resources::Load() and use DrawElements, or use glDrawElementsBaseVertex
-    glDrawElementsBaseVertex( GL_TRIANGLES, subMesh_p->nIndices, GL_UNSIGNED_INT, (void *) (subMesh_p->startIndex * sizeof(unsigned int)), subMesh_p->baseVertex );
+    // and so must the start of the mesh in the arena, glDrawElementsBaseVertex does it
+    glDrawElementsBaseVertex( GL_TRIANGLES, subMesh_p->nIndices, m_mesh->getIndexType(), m_mesh->getIndexOffset(*subMesh_p), m_mesh->getBaseVertex(*subMesh_p) );
   }
 
-  glBindVertexArray( 0 );
+  if(condition != 0)
+    glEndConditionalRender();
 }
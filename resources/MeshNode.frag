@@ -1,4 +1,21 @@
-#version 130
+#version 140
+
+// features fixed by ShaderVariants, each one undefined means decided at runtime (CLUSTERED means off):
+//   TEXTURED     0 or 1, otherwise the useTexture uniform decides
+//   SPOT_LIGHTS  number of the spot lights, otherwise lightCount of the Frame block
+//   SUN          0 or 1, the sun is on when undefined
+//   CLUSTERED    0 or 1, the spot lights of the cluster of the fragment instead of the Frame block ones
+//   INDIRECT     0 or 1, the material comes from drawData of the draw instead of the uniform (see MeshNode.vert)
+
+#ifndef SUN
+#define SUN 1
+#endif
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
+#ifndef INDIRECT
+#define INDIRECT 0
+#endif
 
 struct Material {
    vec3  ambient;
@@ -17,10 +34,31 @@ struct Light {
    float spotExponent;
 };
 
-Light light;
-uniform Light lights[1];
+#define MAX_LIGHTS 8
 
-Light reflight = lights[0];
+struct FrameLight {
+   vec4  ambient;
+   vec4  diffuse;
+   vec4  specular;
+   vec4  position;       // camera space
+   vec4  spotDirection;  // camera space
+   float spotCosCutoff;
+   float spotExponent;
+};
+
+// per-frame data shared by all the shaders, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Frame {
+  mat4  Vmatrix;     // View                       --> world to eye coordinates
+  mat4  Pmatrix;     // Projection                 --> eye to clip coordinates
+  mat4  PVmatrix;    // Projection * View          --> world to clip coordinates
+  vec4  sunDirection; // camera space direction of the sun light
+  vec4  sunAmbient;  // ambient part of the sun, changes with its height
+  vec4  clusterScale; // tile size in pixels, log(distance) scale and bias of the slice (see LightClusters)
+  ivec4 clusterGrid; // tiles in x and y, slices, 0 without clustered lights
+  float time;        // in seconds
+  int   lightCount;  // number of used lights
+  FrameLight lights[MAX_LIGHTS];
+};
 
 smooth in vec3 normal_v;    // camera space normal
 smooth in vec3 position_v;  // camera space fragment position
@@ -29,16 +67,21 @@ uniform samplerCube cubeMapTex;
 //uniform float reflectFactor;
 
 
-uniform float     time;         // used for simulation of moving lights (such as sun)
-
-uniform mat4      Vmatrix;      // View                       --> world to eye coordinates
-
+#if INDIRECT
+#define DRAW_TEXELS 13
+uniform samplerBuffer drawData;
+flat in int drawId_v;
+Material material;          // of the draw, read at the start of main()
+#else
 uniform Material material;  // material of this vertex
+#endif
 
 uniform sampler2D texSampler;		// texture sampler
 smooth in vec2 texCoord_v;			// fragment texture coordinates
 
+#ifndef TEXTURED
 uniform bool       useTexture;
+#endif
 
 out vec4 outputColor;
 out vec4 color_f;
@@ -74,48 +117,113 @@ vec4 directionalLight(Light light, Material material, vec3 position, vec3 normal
   // glsl provides some built-in functions, for example: reflect, normalize, pow, dot 
   // for directional lights, light.position contains the direction 
 
-  ret += max(dot(normalize(normal),normalize(-light.position)),0f) * material.diffuse * light.diffuse;
+  ret += max(dot(normalize(normal),normalize(-light.position)),0.0f) * material.diffuse * light.diffuse;
   ret += material.ambient * light.ambient;
   
   
   vec3 ref = reflect(normalize(-light.position),normalize(normal));
-  float mycos = max(dot(ref,normalize(-position)),0f);
+  float mycos = max(dot(ref,normalize(-position)),0.0f);
   ret += pow(mycos,material.shininess) * material.specular * light.specular;
   // ========  END OF SOLUTION - TASK 1-1  ======== //
 
   return vec4(ret, 1.0f);
 }
 
-void main()
+#if CLUSTERED
+uniform usamplerBuffer clusterTable;  // first index and count of the lights of every cluster
+uniform usamplerBuffer clusterLights; // light indices of all the clusters one after another
+uniform samplerBuffer  lightData;     // five texels per light (see LightClusters::build())
+
+// clustered light in the form the functions above use
+Light clusterLight(int i, out float range)
 {
-  vec3 normal = normalize(normal_v);
-  vec3 global_ambient = vec3(0.4f);
-  float sunSpeed = 0.2f;
+  vec4 position = texelFetch(lightData, 5 * i);
+  vec4 direction = texelFetch(lightData, 5 * i + 1);
+  vec4 diffuse = texelFetch(lightData, 5 * i + 2);
+  Light light;
+  light.position = position.xyz;
+  light.spotDirection = direction.xyz;
+  light.spotCosCutoff = direction.w;
+  light.diffuse = diffuse.rgb;
+  light.spotExponent = diffuse.w;
+  light.specular = texelFetch(lightData, 5 * i + 3).rgb;
+  light.ambient = texelFetch(lightData, 5 * i + 4).rgb;
+  range = position.w;
+  return light;
+}
+#endif
 
-  Light sun;
-  //sun.ambient = vec3(0.0f);
-  sun.diffuse = vec3(1.0f);
-  sun.specular = vec3(1.0f);
+// light of the block in the form the functions above use
+Light frameLight(int i)
+{
+  Light light;
+  light.ambient = lights[i].ambient.xyz;
+  light.diffuse = lights[i].diffuse.xyz;
+  light.specular = lights[i].specular.xyz;
+  light.position = lights[i].position.xyz;
+  light.spotDirection = lights[i].spotDirection.xyz;
+  light.spotCosCutoff = lights[i].spotCosCutoff;
+  light.spotExponent = lights[i].spotExponent;
+  return light;
+}
 
-  // Disco!
-  if (int(floor(time*5)) % 2 == 0) reflight.diffuse = vec3(1.0f,0.0f,0.0f);
+void main()
+{
+#if INDIRECT
+  int base = DRAW_TEXELS * drawId_v;
+  material.ambient = texelFetch(drawData, base + 10).rgb;
+  material.diffuse = texelFetch(drawData, base + 11).rgb;
+  vec4 specular = texelFetch(drawData, base + 12);
+  material.specular = specular.rgb;
+  material.shininess = specular.a;
+#endif
 
-  // ======== BEGIN OF SOLUTION - TASK 1-2 ======== //
-  // calculate correct direction to the sun using the time and sunSpeed variables
-  // dont forget to translate the direction to the view coordinates (using Vmatrix)
-   vec4 four = vec4(sin(time*sunSpeed), cos(time*sunSpeed), 0.0f, 0.0f) * Vmatrix;
-   sun.ambient = vec3(abs(cos(time*sunSpeed)));
-   sun.position = four.xyz;
-  // ========  END OF SOLUTION - TASK 1-2  ======== //
+  vec3 normal = normalize(normal_v);
+  vec3 global_ambient = vec3(0.4f);
 
   // initialize the output with the ambient term
   vec4 outputColor = vec4(material.ambient * global_ambient, 0.0f);
+
   // accumulate contributions from all lights
+#if SUN
+  // the direction and the ambient change once per frame, they come from the CPU (main.cpp, uploadFrame())
+  Light sun;
+  sun.ambient = sunAmbient.xyz;
+  sun.diffuse = vec3(1.0f);
+  sun.specular = vec3(1.0f);
+  sun.position = sunDirection.xyz;
   outputColor += directionalLight(sun, material, position_v, normal);
-  outputColor += spotLight(reflight, material, position_v, normal);
-  
+#endif
+
+  // the disco flicker of the reflector is in its diffuse color already
+#if CLUSTERED
+  // only the lights reaching the cluster of the fragment, they fade out towards their range
+  ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterScale.xy), clusterGrid.xy - 1);
+  int slice = clamp(int(floor(log(-position_v.z) * clusterScale.z + clusterScale.w)), 0, clusterGrid.z - 1);
+  uvec2 cluster = texelFetch(clusterTable, (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x).rg;
+  for(uint i = 0u; i < cluster.y; i++) {
+    float range;
+    Light light = clusterLight(int(texelFetch(clusterLights, int(cluster.x + i)).r), range);
+    float fade = clamp(1.0 - pow(length(light.position - position_v) / range, 4.0), 0.0, 1.0);
+    vec4 spot = spotLight(light, material, position_v, normal);
+    outputColor += vec4(spot.rgb * (fade * fade), spot.a);
+  }
+#elif defined(SPOT_LIGHTS)
+  for(int i = 0; i < SPOT_LIGHTS; i++)
+    outputColor += spotLight(frameLight(i), material, position_v, normal);
+#else
+  for(int i = 0; i < lightCount; i++)
+    outputColor += spotLight(frameLight(i), material, position_v, normal);
+#endif
+
+#ifdef TEXTURED
+#if TEXTURED
+  outputColor =  outputColor * texture(texSampler, texCoord_v);
+#endif
+#else
   if(useTexture)
-    outputColor =  outputColor * texture2D(texSampler, texCoord_v);
+    outputColor =  outputColor * texture(texSampler, texCoord_v);
+#endif
 
   vec4 cubeMapColor = texture(cubeMapTex, reflectDir);
   outputColor = mix(outputColor, cubeMapColor, material.shininess/256);
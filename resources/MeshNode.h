@@ -3,11 +3,21 @@
 
 #include "pgr.h"
 #include "SceneNode.h"
+#include "MeshGeometry.h"
 
-class MeshGeometry;
 class MeshShaderProgram;
 
-/// manages rendering of a MeshGeometry
+/** manages rendering of a MeshGeometry
+ *
+ * The draw is skipped while the bounding box is out of the view (see CullingHierarchy)
+ * and dropped by the GPU while it was hidden in the last frame (see OcclusionCulling).
+ *
+ * Submeshes with and without a texture are drawn by their own variants of the shader
+ * (see ShaderVariants), neither of them branches on the texture.
+ *
+ * The node has no vertex array of its own, it draws with the one the GeometryArena
+ * shares among all the meshes of the vertex format.
+ */
 class MeshNode : public SceneNode
 {
 public:
@@ -24,12 +34,22 @@ protected:
   /// creates shader
   virtual void loadProgram();
 
-  /// shader program to use during the draw() procedure
+  /// the mesh and the programs of setGeometry() without the culling boxes, for nodes culling their own way
+  void setMesh(MeshGeometry* mesh);
+
+  /// the variant of the shader for the submesh
+  MeshShaderProgram * programFor(const MeshGeometry::SubMesh * sub_mesh) const;
+
+  /// shader program of the untextured submeshes
   MeshShaderProgram * m_program;
-  /// identifier for the vertex array object
-  GLuint m_vertexArrayObject;
+  /// shader program of the textured submeshes
+  MeshShaderProgram * m_texturedProgram;
   /// geometry associated with this MeshObject
   MeshGeometry* m_mesh;
+  /// bounding box of the mesh in the CullingHierarchy, -1 without a mesh
+  int m_cullingHandle;
+  /// queries of the box in OcclusionCulling, -1 without a mesh
+  int m_occlusionHandle;
 };
 
 
@@ -1,11 +1,50 @@
-#version 130
+#version 140
 
-uniform mat4 PVMmatrix;    // Projection * View * Model  --> model to clip coordinates
-uniform mat4 Vmatrix;      // View                       --> world to eye coordinates
+// INDIRECT 0 or 1 (ShaderVariants): the per-object data come from drawData of the draw, see RenderQueue
+#ifndef INDIRECT
+#define INDIRECT 0
+#endif
+
+#define MAX_LIGHTS 8
+
+struct FrameLight {
+   vec4  ambient;
+   vec4  diffuse;
+   vec4  specular;
+   vec4  position;       // camera space
+   vec4  spotDirection;  // camera space
+   float spotCosCutoff;
+   float spotExponent;
+};
+
+// per-frame data shared by all the shaders, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Frame {
+  mat4  Vmatrix;     // View                       --> world to eye coordinates
+  mat4  Pmatrix;     // Projection                 --> eye to clip coordinates
+  mat4  PVmatrix;    // Projection * View          --> world to clip coordinates
+  vec4  sunDirection; // camera space direction of the sun light
+  vec4  sunAmbient;  // ambient part of the sun, changes with its height
+  vec4  clusterScale; // tile size in pixels, log(distance) scale and bias of the slice (see LightClusters)
+  ivec4 clusterGrid; // tiles in x and y, slices, 0 without clustered lights
+  float time;        // in seconds
+  int   lightCount;  // number of used lights
+  FrameLight lights[MAX_LIGHTS];
+};
+
+#if INDIRECT
+#define DRAW_TEXELS 13
+in int drawId;                // the instance of the draw is its index in drawData (RenderQueue::submitIndirect())
+uniform samplerBuffer drawData; // DRAW_TEXELS texels per draw: Mmatrix, NormalMatrix, positionOffset, positionScale, material
+flat out int drawId_v;
+#else
 uniform mat4 Mmatrix;      // Model                      --> model to world coordinates
 uniform mat4 NormalMatrix; // inverse transposed VMmatrix
 //uniform float time;
 
+uniform vec3 positionOffset; // dequantization of the position, (0,0,0) and (1,1,1) unless the mesh is quantized
+uniform vec3 positionScale;  //   (see MeshGeometry::getPositionOffset())
+#endif
+
 in vec3 position;     // vertex position in world space
 in vec3 normal;       // vertex normal
 
@@ -19,11 +58,24 @@ noperspective out vec3 reflectDir;
 
 void main() {
 
+#if INDIRECT
+  int base = DRAW_TEXELS * drawId;
+  mat4 Mmatrix = mat4(texelFetch(drawData, base), texelFetch(drawData, base + 1), texelFetch(drawData, base + 2), texelFetch(drawData, base + 3));
+  mat4 NormalMatrix = mat4(texelFetch(drawData, base + 4), texelFetch(drawData, base + 5), texelFetch(drawData, base + 6), texelFetch(drawData, base + 7));
+  vec3 positionOffset = texelFetch(drawData, base + 8).xyz;
+  vec3 positionScale = texelFetch(drawData, base + 9).xyz;
+  drawId_v = drawId;
+#endif
+
+  vec3 objectPosition = positionOffset + positionScale * position;
+
+  vec4 worldPosition = Mmatrix * vec4(objectPosition, 1);
+
   // vertex position after the projection (gl_Position is predefined output variable)
-  gl_Position = PVMmatrix * vec4(position, 1);   // out:v vertex in clip coordinates
+  gl_Position = PVmatrix * worldPosition;   // out:v vertex in clip coordinates
 
   // eye-coordinate position of vertex
-  vec4 VMposition = Vmatrix * Mmatrix * vec4(position, 1);              //vertex in eye coordinates
+  vec4 VMposition = Vmatrix * worldPosition;              //vertex in eye coordinates
   vec3 VMnormal   = normalize( NormalMatrix * vec4(normal, 0.0) ).xyz;  //normal in eye coordinates by NormalMatrix
 
   // outputs entering the fragment shader
@@ -33,6 +85,6 @@ void main() {
   //vec2 offset = vec2(0.0f,time/5); // using this works with the floor, but not with the stream, screw it
   //texCoord_v = texCoord + offset;
   texCoord_v = texCoord;
-  vec3 worldView = normalize(position);
+  vec3 worldView = normalize(objectPosition);
   reflectDir = reflect(-worldView, normal);
 }
@@ -0,0 +1,544 @@
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#include "MeshOptimizer.h"
+
+// Forsyth's scoring, see "Linear-Speed Vertex Cache Optimisation"
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+/// resolution of the overdraw rasterizer
+static const int OVERDRAW_GRID = 256;
+
+static float vertexScore(int cachePosition, unsigned remaining)
+{
+  if(remaining == 0)
+    return -1.0f;  // no triangles left, the vertex does not matter
+
+  float score = 0.0f;
+  if(cachePosition >= 0)
+  {
+    // the vertices of the last triangle get a fixed score, so the next one does not just reuse them
+    if(cachePosition < 3)
+      score = LAST_TRIANGLE_SCORE;
+    else
+      score = pow(1.0f - float(cachePosition - 3) / (MeshOptimizer::CACHE_SIZE - 3), CACHE_DECAY_POWER);
+  }
+
+  // vertices with few triangles left are preferred, so they do not stay alone for later
+  return score + VALENCE_BOOST_SCALE * pow(float(remaining), -VALENCE_BOOST_POWER);
+}
+
+static bool sameMaterial(const MeshGeometry::SubMesh & a, const MeshGeometry::SubMesh & b)
+{
+  for(int i = 0; i < 3; i++)
+  {
+    if(a.ambient[i] != b.ambient[i] || a.diffuse[i] != b.diffuse[i] || a.specular[i] != b.specular[i])
+      return false;
+  }
+  return a.shininess == b.shininess && a.textureID == b.textureID;
+}
+
+MeshOptimizer::MeshOptimizer(unsigned verticesCount, float * vertices, float * normals, float * texCoords,
+                             unsigned indicesCount, GLuint * indices, MeshGeometry::SubMeshList & subMeshes):
+  m_verticesCount(verticesCount), m_vertices(vertices), m_normals(normals), m_texCoords(texCoords),
+  m_indices(indices), m_indicesCount(indicesCount), m_subMeshes(subMeshes), m_absolute(indicesCount)
+{
+  for(unsigned s = 0; s < m_subMeshes.size(); s++)
+  {
+    const MeshGeometry::SubMesh & subMesh = m_subMeshes[s];
+    for(unsigned i = subMesh.startIndex; i < subMesh.startIndex + subMesh.nIndices; i++)
+      m_absolute[i] = indices[i] + subMesh.baseVertex;
+  }
+}
+
+void MeshOptimizer::optimize(const std::string & name)
+{
+  const unsigned subMeshesBefore = m_subMeshes.size();
+  const Stats before = stats();
+
+  mergeSubMeshes();
+  optimizeVertexCache();
+  optimizeOverdraw(1.05f);
+  optimizeVertexFetch();
+
+  const Stats after = stats();
+  std::cout << "optimized " << name << ": submeshes " << subMeshesBefore << " -> " << m_subMeshes.size()
+            << ", ACMR " << before.acmr << " -> " << after.acmr
+            << ", overdraw " << before.overdraw << " -> " << after.overdraw << std::endl;
+}
+
+MeshOptimizer::Stats MeshOptimizer::stats() const
+{
+  Stats stats;
+  stats.acmr = m_indicesCount ? 3.0f * cacheMisses(&m_absolute[0], m_indicesCount) / m_indicesCount : 0.0f;
+  stats.overdraw = overdraw();
+  return stats;
+}
+
+glm::vec3 MeshOptimizer::position(GLuint vertex) const
+{
+  return glm::vec3(m_vertices[3*vertex], m_vertices[3*vertex + 1], m_vertices[3*vertex + 2]);
+}
+
+void MeshOptimizer::mergeSubMeshes()
+{
+  // groups of submeshes with the same material, in the order of the first member
+  std::vector<std::vector<unsigned> > groups;
+  for(unsigned s = 0; s < m_subMeshes.size(); s++)
+  {
+    unsigned g = 0;
+    while(g < groups.size() && !sameMaterial(m_subMeshes[groups[g][0]], m_subMeshes[s]))
+      g++;
+    if(g == groups.size())
+      groups.push_back(std::vector<unsigned>());
+    groups[g].push_back(s);
+  }
+
+  if(groups.size() == m_subMeshes.size())
+    return;
+
+  // the indices of each group one after another, the base vertices are already added
+  std::vector<GLuint> absolute;
+  absolute.reserve(m_indicesCount);
+  MeshGeometry::SubMeshList merged;
+  for(unsigned g = 0; g < groups.size(); g++)
+  {
+    MeshGeometry::SubMesh subMesh = m_subMeshes[groups[g][0]];
+    subMesh.startIndex = absolute.size();
+    subMesh.baseVertex = 0;
+    for(unsigned m = 0; m < groups[g].size(); m++)
+    {
+      const MeshGeometry::SubMesh & member = m_subMeshes[groups[g][m]];
+      absolute.insert(absolute.end(), m_absolute.begin() + member.startIndex, m_absolute.begin() + member.startIndex + member.nIndices);
+    }
+    subMesh.nIndices = absolute.size() - subMesh.startIndex;
+    merged.push_back(subMesh);
+  }
+
+  m_absolute.swap(absolute);
+  m_subMeshes.swap(merged);
+}
+
+void MeshOptimizer::optimizeVertexCache()
+{
+  for(unsigned s = 0; s < m_subMeshes.size(); s++)
+  {
+    if(m_subMeshes[s].nIndices >= 6)
+      optimizeVertexCache(&m_absolute[m_subMeshes[s].startIndex], m_subMeshes[s].nIndices);
+  }
+}
+
+void MeshOptimizer::optimizeVertexCache(GLuint * indices, unsigned count)
+{
+  const unsigned triangles = count / 3;
+
+  // local numbering of the vertices of the submesh
+  std::vector<GLuint> local(count);
+  std::vector<GLuint> global;
+  if(m_localIndex.size() != m_verticesCount)
+    m_localIndex.assign(m_verticesCount, -1);
+  for(unsigned i = 0; i < count; i++)
+  {
+    if(m_localIndex[indices[i]] < 0)
+    {
+      m_localIndex[indices[i]] = global.size();
+      global.push_back(indices[i]);
+    }
+    local[i] = m_localIndex[indices[i]];
+  }
+  // only the entries of this submesh are reset, the next one finds all -1 again
+  for(unsigned v = 0; v < global.size(); v++)
+    m_localIndex[global[v]] = -1;
+  const unsigned vertices = global.size();
+
+  // triangles of every vertex, the first remaining[v] of them are not drawn yet
+  std::vector<unsigned> remaining(vertices, 0);
+  for(unsigned i = 0; i < count; i++)
+    remaining[local[i]]++;
+  std::vector<unsigned> firstTriangle(vertices + 1, 0);
+  for(unsigned v = 0; v < vertices; v++)
+    firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+  std::vector<unsigned> vertexTriangles(count);
+  {
+    std::vector<unsigned> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+    for(unsigned i = 0; i < count; i++)
+      vertexTriangles[filled[local[i]]++] = i / 3;
+  }
+
+  std::vector<int> cachePosition(vertices, -1);
+  std::vector<float> score(vertices);
+  for(unsigned v = 0; v < vertices; v++)
+    score[v] = vertexScore(-1, remaining[v]);
+
+  // candidates for the dead ends, when no cached vertex has a triangle left: the vertices by the
+  // number of their remaining triangles, as the valence boost scores the lowest one best outside
+  // the cache. A vertex is added again whenever it loses a triangle, the entries not matching
+  // remaining[] any more are stale and dropped when they are met, so a dead end costs no scan.
+  unsigned maxValence = 0;
+  for(unsigned v = 0; v < vertices; v++)
+    maxValence = std::max(maxValence, remaining[v]);
+  std::vector<std::vector<unsigned> > byValence(maxValence + 1);
+  for(unsigned v = vertices; v-- > 0; )
+    byValence[remaining[v]].push_back(v);  // the last one is taken first, so the first vertex is on top
+  unsigned lowestValence = 1;
+
+  std::vector<unsigned> cache, newCache;
+  cache.reserve(CACHE_SIZE + 3);
+  newCache.reserve(CACHE_SIZE + 3);
+
+  std::vector<GLuint> result;
+  result.reserve(count);
+
+  int best = -1;
+  for(unsigned t = 0; t < triangles; t++)
+  {
+    // nothing promising in the cache, take the best triangle of the vertex with the fewest left
+    for(unsigned r = lowestValence; best < 0 && r <= maxValence; r++)
+    {
+      std::vector<unsigned> & bucket = byValence[r];
+      while(!bucket.empty() && remaining[bucket.back()] != r)
+        bucket.pop_back();
+      if(bucket.empty())
+        continue;
+      lowestValence = r;
+
+      const unsigned v = bucket.back();
+      float bestScore = -FLT_MAX;
+      for(unsigned k = 0; k < remaining[v]; k++)
+      {
+        const unsigned u = vertexTriangles[firstTriangle[v] + k];
+        const float triangleScore = score[local[3*u]] + score[local[3*u + 1]] + score[local[3*u + 2]];
+        if(triangleScore > bestScore)
+        {
+          bestScore = triangleScore;
+          best = u;
+        }
+      }
+    }
+
+    newCache.clear();
+    for(unsigned k = 0; k < 3; k++)
+    {
+      const unsigned v = local[3*best + k];
+      result.push_back(global[v]);
+      newCache.push_back(v);
+
+      // forget the triangle
+      unsigned * list = &vertexTriangles[firstTriangle[v]];
+      unsigned * found = std::find(list, list + remaining[v], unsigned(best));
+      std::swap(*found, list[remaining[v] - 1]);
+      remaining[v]--;
+      if(remaining[v] > 0)
+      {
+        byValence[remaining[v]].push_back(v);
+        lowestValence = std::min(lowestValence, remaining[v]);
+      }
+    }
+
+    // LRU: the triangle goes to the front, the oldest vertices fall out
+    for(unsigned c = 0; c < cache.size(); c++)
+    {
+      if(cache[c] != newCache[0] && cache[c] != newCache[1] && cache[c] != newCache[2])
+        newCache.push_back(cache[c]);
+    }
+    for(unsigned c = CACHE_SIZE; c < newCache.size(); c++)
+    {
+      cachePosition[newCache[c]] = -1;
+      score[newCache[c]] = vertexScore(-1, remaining[newCache[c]]);
+    }
+    if(newCache.size() > CACHE_SIZE)
+      newCache.resize(CACHE_SIZE);
+    cache.swap(newCache);
+
+    for(unsigned c = 0; c < cache.size(); c++)
+    {
+      cachePosition[cache[c]] = c;
+      score[cache[c]] = vertexScore(c, remaining[cache[c]]);
+    }
+
+    // only the triangles around the cached vertices changed their score
+    best = -1;
+    float bestScore = -FLT_MAX;
+    for(unsigned c = 0; c < cache.size(); c++)
+    {
+      const unsigned v = cache[c];
+      for(unsigned k = 0; k < remaining[v]; k++)
+      {
+        const unsigned u = vertexTriangles[firstTriangle[v] + k];
+        const float triangleScore = score[local[3*u]] + score[local[3*u + 1]] + score[local[3*u + 2]];
+        if(triangleScore > bestScore)
+        {
+          bestScore = triangleScore;
+          best = u;
+        }
+      }
+    }
+  }
+
+  std::copy(result.begin(), result.end(), indices);
+}
+
+void MeshOptimizer::optimizeOverdraw(float threshold)
+{
+  for(unsigned s = 0; s < m_subMeshes.size(); s++)
+  {
+    if(m_subMeshes[s].nIndices >= 6)
+      optimizeOverdraw(&m_absolute[m_subMeshes[s].startIndex], m_subMeshes[s].nIndices, threshold);
+  }
+}
+
+/// cluster of triangles drawn together and its sort key
+struct Cluster
+{
+  unsigned start;
+  unsigned count;
+  float outwardness;
+
+  bool operator<(const Cluster & other) const { return outwardness > other.outwardness; }
+};
+
+void MeshOptimizer::optimizeOverdraw(GLuint * indices, unsigned count, float threshold)
+{
+  const unsigned triangles = count / 3;
+
+  // hard boundaries: the triangles all vertices of which miss the cache, the cache
+  // starts from scratch there anyway, so cutting there costs nothing
+  std::vector<unsigned> boundaries;
+  m_fifo.clear(m_verticesCount);
+  for(unsigned t = 0; t < triangles; t++)
+  {
+    unsigned misses = 0;
+    for(unsigned k = 0; k < 3; k++)
+    {
+      if(m_fifo.load(indices[3*t + k]))
+        misses++;
+    }
+    if(misses == 3)
+      boundaries.push_back(t);
+  }
+  boundaries.push_back(triangles);
+
+  // soft boundaries: the big clusters are cut further while their ACMR stays within threshold
+  std::vector<Cluster> clusters;
+  for(unsigned b = 0; b + 1 < boundaries.size(); b++)
+  {
+    const unsigned start = boundaries[b];
+    const unsigned end = boundaries[b + 1];
+    const float limit = threshold * 3.0f * cacheMisses(indices + 3*start, 3*(end - start)) / (3*(end - start));
+
+    m_fifo.clear(m_verticesCount);
+    unsigned clusterStart = start;
+    unsigned misses = 0;
+    for(unsigned t = start; t < end; t++)
+    {
+      for(unsigned k = 0; k < 3; k++)
+      {
+        if(m_fifo.load(indices[3*t + k]))
+          misses++;
+      }
+
+      const unsigned clusterTriangles = t + 1 - clusterStart;
+      if(t + 1 < end && clusterTriangles >= 16 && float(misses) / clusterTriangles <= limit)
+      {
+        Cluster cluster = { clusterStart, clusterTriangles, 0.0f };
+        clusters.push_back(cluster);
+        clusterStart = t + 1;
+        misses = 0;
+        m_fifo.clear(m_verticesCount);  // the next cluster can come after any other, assume an empty cache
+      }
+    }
+    Cluster cluster = { clusterStart, end - clusterStart, 0.0f };
+    clusters.push_back(cluster);
+  }
+
+  if(clusters.size() < 2)
+    return;
+
+  // area weighted centroid of the submesh
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+  for(unsigned t = 0; t < triangles; t++)
+  {
+    const glm::vec3 a = position(indices[3*t]), b = position(indices[3*t + 1]), c = position(indices[3*t + 2]);
+    const float area = glm::length(glm::cross(b - a, c - a));
+    meshCentroid += (a + b + c) * (area / 3.0f);
+    meshArea += area;
+  }
+  if(meshArea > 0.0f)
+    meshCentroid /= meshArea;
+
+  // clusters facing away from the center are on the outside and hide the rest, so they go first
+  for(unsigned c = 0; c < clusters.size(); c++)
+  {
+    glm::vec3 centroid(0.0f), normal(0.0f);
+    float area = 0.0f;
+    for(unsigned t = clusters[c].start; t < clusters[c].start + clusters[c].count; t++)
+    {
+      const glm::vec3 a = position(indices[3*t]), b = position(indices[3*t + 1]), d = position(indices[3*t + 2]);
+      const glm::vec3 n = glm::cross(b - a, d - a);
+      const float triangleArea = glm::length(n);
+      centroid += (a + b + d) * (triangleArea / 3.0f);
+      normal += n;
+      area += triangleArea;
+    }
+    if(area > 0.0f)
+      centroid /= area;
+    const float length = glm::length(normal);
+    if(length > 0.0f)
+      normal /= length;
+    clusters[c].outwardness = glm::dot(centroid - meshCentroid, normal);
+  }
+
+  std::stable_sort(clusters.begin(), clusters.end());
+
+  std::vector<GLuint> result;
+  result.reserve(count);
+  for(unsigned c = 0; c < clusters.size(); c++)
+    result.insert(result.end(), indices + 3*clusters[c].start, indices + 3*(clusters[c].start + clusters[c].count));
+  std::copy(result.begin(), result.end(), indices);
+}
+
+void MeshOptimizer::optimizeVertexFetch()
+{
+  // new position of every vertex, in the order of the first use, the unused ones at the end
+  const unsigned UNUSED = ~0u;
+  std::vector<unsigned> remap(m_verticesCount, UNUSED);
+  unsigned next = 0;
+  for(unsigned i = 0; i < m_indicesCount; i++)
+  {
+    if(remap[m_absolute[i]] == UNUSED)
+      remap[m_absolute[i]] = next++;
+  }
+  for(unsigned v = 0; v < m_verticesCount; v++)
+  {
+    if(remap[v] == UNUSED)
+      remap[v] = next++;
+  }
+
+  float * arrays[] = { m_vertices, m_normals, m_texCoords };
+  const unsigned components[] = { 3, 3, 2 };
+  for(unsigned a = 0; a < 3; a++)
+  {
+    if(arrays[a] == NULL)
+      continue;
+    std::vector<float> copy(arrays[a], arrays[a] + components[a] * m_verticesCount);
+    for(unsigned v = 0; v < m_verticesCount; v++)
+      std::copy(&copy[components[a] * v], &copy[components[a] * (v + 1)], arrays[a] + components[a] * remap[v]);
+  }
+
+  for(unsigned i = 0; i < m_indicesCount; i++)
+    m_absolute[i] = remap[m_absolute[i]];
+
+  // submeshes now use consecutive vertex ranges, the indices become relative to their starts again
+  for(unsigned s = 0; s < m_subMeshes.size(); s++)
+  {
+    MeshGeometry::SubMesh & subMesh = m_subMeshes[s];
+    const GLuint * begin = &m_absolute[0] + subMesh.startIndex;
+    subMesh.baseVertex = subMesh.nIndices ? *std::min_element(begin, begin + subMesh.nIndices) : 0;
+    for(unsigned i = subMesh.startIndex; i < subMesh.startIndex + subMesh.nIndices; i++)
+      m_indices[i] = m_absolute[i] - subMesh.baseVertex;
+  }
+}
+
+void MeshOptimizer::FifoCache::clear(unsigned vertices)
+{
+  if(stamp.size() != vertices || time > 0x80000000u)
+  {
+    stamp.assign(vertices, 0);
+    time = 0;
+  }
+  time += FIFO_SIZE + 1;
+}
+
+unsigned MeshOptimizer::cacheMisses(const GLuint * indices, unsigned count) const
+{
+  m_fifo.clear(m_verticesCount);
+  unsigned misses = 0;
+  for(unsigned i = 0; i < count; i++)
+  {
+    if(m_fifo.load(indices[i]))
+      misses++;
+  }
+  return misses;
+}
+
+float MeshOptimizer::overdraw() const
+{
+  if(m_indicesCount == 0)
+    return 0.0f;
+
+  glm::vec3 low = position(m_absolute[0]), high = low;
+  for(unsigned i = 1; i < m_indicesCount; i++)
+  {
+    low = glm::min(low, position(m_absolute[i]));
+    high = glm::max(high, position(m_absolute[i]));
+  }
+  const glm::vec3 extent = glm::max(high - low, glm::vec3(1e-6f));
+
+  std::vector<float> depth(OVERDRAW_GRID * OVERDRAW_GRID);
+  unsigned long long shaded = 0, covered = 0;
+
+  // orthographic views from both sides of every axis, back faces culled, triangles in the draw order
+  for(int axis = 0; axis < 3; axis++)
+  {
+    for(int side = -1; side <= 1; side += 2)
+    {
+      const int u = (axis + 1) % 3;
+      const int v = (axis + 2) % 3;
+      std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+      for(unsigned t = 0; t + 2 < m_indicesCount; t += 3)
+      {
+        float x[3], y[3], z[3];
+        for(int k = 0; k < 3; k++)
+        {
+          const glm::vec3 p = (position(m_absolute[t + k]) - low) / extent;
+          // mirroring u for the other side keeps the front faces counter clockwise
+          x[k] = (side > 0 ? p[u] : 1.0f - p[u]) * (OVERDRAW_GRID - 1);
+          y[k] = p[v] * (OVERDRAW_GRID - 1);
+          z[k] = side > 0 ? 1.0f - p[axis] : p[axis];
+        }
+
+        const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if(area <= 0.0f)
+          continue;
+
+        const int minX = std::max(0, int(floor(std::min(x[0], std::min(x[1], x[2])))));
+        const int maxX = std::min(OVERDRAW_GRID - 1, int(ceil(std::max(x[0], std::max(x[1], x[2])))));
+        const int minY = std::max(0, int(floor(std::min(y[0], std::min(y[1], y[2])))));
+        const int maxY = std::min(OVERDRAW_GRID - 1, int(ceil(std::max(y[0], std::max(y[1], y[2])))));
+
+        for(int py = minY; py <= maxY; py++)
+        {
+          for(int px = minX; px <= maxX; px++)
+          {
+            // barycentrics of the pixel center from the edge functions
+            const float w0 = (x[2] - x[1]) * (py - y[1]) - (y[2] - y[1]) * (px - x[1]);
+            const float w1 = (x[0] - x[2]) * (py - y[2]) - (y[0] - y[2]) * (px - x[2]);
+            const float w2 = (x[1] - x[0]) * (py - y[0]) - (y[1] - y[0]) * (px - x[0]);
+            if(w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+              continue;
+
+            const float d = (w0 * z[0] + w1 * z[1] + w2 * z[2]) / area;
+            float & stored = depth[py * OVERDRAW_GRID + px];
+            if(d < stored)
+            {
+              if(stored == FLT_MAX)
+                covered++;
+              stored = d;
+              shaded++;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return covered ? float(shaded) / covered : 0.0f;
+}
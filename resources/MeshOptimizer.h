@@ -0,0 +1,112 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <vector>
+#include <string>
+
+#include "pgr.h"
+#include "MeshGeometry.h"
+
+/** Reorders triangles and vertices of an imported mesh for the GPU
+ *
+ * Runs on the arrays MeshGeometry::LoadFromFile() builds, before they are uploaded.
+ * The stages of optimize(), in order:
+ *
+ *   1. submeshes with the same material are merged into one (fewer draw calls)
+ *   2. triangles are reordered for the post-transform vertex cache (Forsyth)
+ *   3. the cache friendly order is cut into clusters, which are sorted from the most
+ *      outward facing ones so that they occlude the rest (Tipsify style overdraw ordering)
+ *   4. vertices are renumbered in the order of the first use (vertex fetch locality)
+ *
+ * Sizes of the arrays do not change, only the order of their contents, so they are
+ * rewritten in place. The submesh list can get shorter.
+ */
+class MeshOptimizer
+{
+public:
+  /// quality of the index order
+  struct Stats
+  {
+    /// average cache miss ratio, transformed vertices per triangle with a FIFO of FIFO_SIZE (0.5 .. 3)
+    float acmr;
+    /// shaded pixels per visible pixel, rasterized from the 6 axis directions (1 is no overdraw)
+    float overdraw;
+  };
+
+  /// entries of the cache Forsyth's scoring is tuned for
+  static const unsigned CACHE_SIZE = 32;
+  /// entries of the simulated hardware cache the ACMR is measured with
+  static const unsigned FIFO_SIZE = 16;
+
+  /** takes the arrays of the mesh, normals and texCoords may be NULL
+   *
+   * Indices are relative to SubMesh::baseVertex, as in MeshGeometry.
+   */
+  MeshOptimizer(unsigned verticesCount, float * vertices, float * normals, float * texCoords,
+                unsigned indicesCount, GLuint * indices, MeshGeometry::SubMeshList & subMeshes);
+
+  /// runs all the stages, prints the statistics before and after (name identifies the mesh)
+  void optimize(const std::string & name);
+
+  /// statistics of the current order
+  Stats stats() const;
+
+protected:
+  void mergeSubMeshes();
+  void optimizeVertexCache();
+  /// threshold is the ACMR increase allowed for finer clusters
+  void optimizeOverdraw(float threshold);
+  /// also writes the indices back relative to the new base vertices
+  void optimizeVertexFetch();
+
+  /// Forsyth's order of the triangles of one submesh
+  void optimizeVertexCache(GLuint * indices, unsigned count);
+  /// overdraw ordering of the triangles of one submesh
+  void optimizeOverdraw(GLuint * indices, unsigned count, float threshold);
+
+  /// vertices missing the FIFO cache while drawing the indices, starting with an empty one
+  unsigned cacheMisses(const GLuint * indices, unsigned count) const;
+  float overdraw() const;
+
+  glm::vec3 position(GLuint vertex) const;
+
+  /** FIFO cache of the ACMR, a vertex is in it while less than FIFO_SIZE other vertices were loaded after it
+   *
+   * All the simulations share one buffer of stamps, clear() only moves the time FIFO_SIZE + 1 on,
+   * so every older stamp is a miss and nothing is allocated or filled per cluster.
+   */
+  struct FifoCache
+  {
+    std::vector<unsigned> stamp;  ///< time of the last load of every vertex
+    unsigned time;
+
+    FifoCache(): time(0) {}
+    /// empties the cache, the stamps are only reset when the time gets close to the overflow
+    void clear(unsigned vertices);
+    /// loads the vertex, true if it missed the cache
+    bool load(GLuint vertex)
+    {
+      if(time - stamp[vertex] <= FIFO_SIZE)
+        return false;
+      stamp[vertex] = time++;
+      return true;
+    }
+  };
+
+  unsigned m_verticesCount;
+  float * m_vertices;
+  float * m_normals;
+  float * m_texCoords;
+  GLuint * m_indices;       ///< written back by optimizeVertexFetch()
+  unsigned m_indicesCount;
+  MeshGeometry::SubMeshList & m_subMeshes;
+
+  /// indices with the base vertex added, while the stages run
+  std::vector<GLuint> m_absolute;
+
+  mutable FifoCache m_fifo;
+  /// local number of every vertex in optimizeVertexCache(), -1 outside of the submesh being ordered
+  std::vector<int> m_localIndex;
+};
+
+#endif // MESHOPTIMIZER_H
@@ -0,0 +1,9 @@
+#version 140
+
+// only the samples are counted, the color is masked off
+
+out vec4 color_f;
+
+void main() {
+  color_f = vec4(1.0);
+}
@@ -0,0 +1,13 @@
+#version 140
+
+// bounding box of an occlusion query, see OcclusionCulling
+
+uniform mat4 PVMmatrix;  // Projection * View * Model
+uniform vec3 boxMin;     // the box in model space
+uniform vec3 boxMax;
+
+in vec3 corner;          // corner of the unit cube
+
+void main() {
+  gl_Position = PVMmatrix * vec4(mix(boxMin, boxMax, corner), 1.0);
+}
@@ -0,0 +1,226 @@
+
+#include <cstring>
+
+#include "OcclusionCulling.h"
+#include "CullingHierarchy.h"
+#include "ShaderProgram.h"
+#include "Resources.h"
+#include "GLState.h"
+
+OcclusionCulling * OcclusionCulling::m_instance = 0;
+
+OcclusionCulling * OcclusionCulling::Instance()
+{
+  if(m_instance == 0)
+    m_instance = new OcclusionCulling();
+  return m_instance;
+}
+
+OcclusionCulling::OcclusionCulling():
+  m_program(NULL), m_boxMin(-1), m_boxMax(-1), m_corner(-1),
+  m_vertexArrayObject(0), m_vertexBufferObject(0), m_indexBufferObject(0), m_target(GL_SAMPLES_PASSED),
+  m_frame(0), m_enabled(true)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void OcclusionCulling::initialize()
+{
+  if(!ShaderManager::Instance()->exists("OcclusionBox-shader"))
+  {
+    GLuint shaderList[] = {
+      pgr::createShaderFromFile(GL_VERTEX_SHADER,   "resources/OcclusionBox.vert"),
+      pgr::createShaderFromFile(GL_FRAGMENT_SHADER, "resources/OcclusionBox.frag"),
+      0
+    };
+    m_program = new BasicShaderProgram(pgr::createProgram(shaderList));
+    ShaderManager::Instance()->insert("OcclusionBox-shader", m_program);
+  }
+  else
+    m_program = ShaderManager::Instance()->get("OcclusionBox-shader");
+
+  m_program->initLocations();
+  m_boxMin = glGetUniformLocation(m_program->m_programId, "boxMin");
+  m_boxMax = glGetUniformLocation(m_program->m_programId, "boxMax");
+  m_corner = glGetAttribLocation(m_program->m_programId, "corner");
+
+  // unit cube, the box is stretched over it in the shader
+  static const GLubyte corners[] = {
+    0, 0, 0,  1, 0, 0,  0, 1, 0,  1, 1, 0,
+    0, 0, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1
+  };
+  static const GLubyte indices[] = {
+    0, 2, 1,  1, 2, 3,  4, 5, 6,  5, 7, 6,  // z
+    0, 1, 4,  1, 5, 4,  2, 6, 3,  3, 6, 7,  // y
+    0, 4, 2,  2, 4, 6,  1, 3, 5,  3, 7, 5   // x
+  };
+  glGenVertexArrays(1, &m_vertexArrayObject);
+  glGenBuffers(1, &m_vertexBufferObject);
+  glGenBuffers(1, &m_indexBufferObject);
+  GLState::Instance()->bindVertexArray(m_vertexArrayObject);
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, m_vertexBufferObject);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+  glEnableVertexAttribArray(m_corner);
+  glVertexAttribPointer(m_corner, 3, GL_UNSIGNED_BYTE, GL_FALSE, 0, 0);
+  GLState::Instance()->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBufferObject);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+  GLState::Instance()->bindVertexArray(0);
+  GLState::Instance()->bindBuffer(GL_ARRAY_BUFFER, 0);
+
+  // a boolean answer is all the condition needs and may be faster, it came with OpenGL 3.3
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  m_target = (major > 3 || (major == 3 && minor >= 3)) ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+}
+
+static bool insideBox(const glm::vec3 & point, const glm::vec3 & box_min, const glm::vec3 & box_max)
+{
+  return point.x >= box_min.x && point.y >= box_min.y && point.z >= box_min.z
+      && point.x <= box_max.x && point.y <= box_max.y && point.z <= box_max.z;
+}
+
+int OcclusionCulling::add()
+{
+  if(m_program == NULL)
+    initialize();
+
+  int handle;
+  if(m_freeEntries.empty())
+  {
+    m_entries.push_back(Entry());
+    handle = m_entries.size() - 1;
+    glGenQueries(2, m_entries[handle].queries);
+  }
+  else
+  {
+    handle = m_freeEntries.back();
+    m_freeEntries.pop_back();
+  }
+
+  Entry & entry = m_entries[handle];
+  entry.issued[0] = entry.issued[1] = 0;
+  entry.conditioned[0] = entry.conditioned[1] = false;
+  entry.used = true;
+  return handle;
+}
+
+void OcclusionCulling::remove(int handle)
+{
+  // the queries are kept for the next add()
+  m_entries[handle].used = false;
+  m_freeEntries.push_back(handle);
+}
+
+void OcclusionCulling::begin()
+{
+  m_frame++;
+  m_stats.conditional = 0;
+  m_stats.skipped = 0;
+
+  // queries tested again in this frame conditioned the draws of the last one, count the dropped
+  // ones if the results are in already, waiting for them would stall the CPU
+  const unsigned slot = m_frame & 1;
+  for(unsigned i = 0; i < m_entries.size(); i++)
+  {
+    Entry & entry = m_entries[i];
+    if(!entry.used || !entry.conditioned[slot])
+      continue;
+    entry.conditioned[slot] = false;
+
+    GLuint available = GL_FALSE, samples = 0;
+    glGetQueryObjectuiv(entry.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(available == GL_FALSE)
+      continue;
+    glGetQueryObjectuiv(entry.queries[slot], GL_QUERY_RESULT, &samples);
+    if(samples == 0)
+      m_stats.skipped++;
+  }
+  m_boxes.clear();
+}
+
+GLuint OcclusionCulling::condition(int handle)
+{
+  if(!m_enabled || handle < 0)
+    return 0;
+
+  // only the test of the last frame is recent enough
+  const unsigned slot = (m_frame - 1) & 1;
+  Entry & entry = m_entries[handle];
+  if(entry.issued[slot] != m_frame - 1 || m_frame < 2)
+    return 0;
+
+  if(!entry.conditioned[slot])
+  {
+    entry.conditioned[slot] = true;
+    m_stats.conditional++;
+  }
+  return entry.queries[slot];
+}
+
+void OcclusionCulling::test(int handle, const glm::mat4 & model_matrix, const glm::vec3 & box_min, const glm::vec3 & box_max)
+{
+  if(!m_enabled || handle < 0)
+    return;
+
+  Box box;
+  box.handle = handle;
+  box.model = model_matrix;
+  box.min = box_min;
+  box.max = box_max;
+  m_boxes.push_back(box);
+}
+
+void OcclusionCulling::flush(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
+{
+  m_stats.tested = 0;
+  if(m_boxes.empty())
+    return;
+
+  // boxes closer to the camera than the near plane could be clipped whole
+  const glm::vec3 camera = glm::vec3(glm::inverse(view_matrix)[3]);
+  const float nearPlane = projection_matrix[3][2] / (projection_matrix[2][2] - 1.0f);
+  const glm::vec3 margin(2.0f * nearPlane);
+
+  // only the depth test, nothing is written
+  GLState::Instance()->colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  GLState::Instance()->depthMask(GL_FALSE);
+  const bool cullFace = GLState::Instance()->isEnabled(GL_CULL_FACE);
+  GLState::Instance()->setEnabled(GL_CULL_FACE, false);
+
+  GLState::Instance()->useProgram(m_program->m_programId);
+  GLState::Instance()->bindVertexArray(m_vertexArrayObject);
+
+  const unsigned slot = m_frame & 1;
+  const glm::mat4 PVmatrix = projection_matrix * view_matrix;
+  for(unsigned i = 0; i < m_boxes.size(); i++)
+  {
+    const Box & box = m_boxes[i];
+    Entry & entry = m_entries[box.handle];
+    if(!entry.used)
+      continue;
+
+    // not issued means drawn unconditionally in the next frame
+    glm::vec3 worldMin, worldMax;
+    CullingHierarchy::transformBox(box.model, box.min, box.max, worldMin, worldMax);
+    if(insideBox(camera, worldMin - margin, worldMax + margin))
+      continue;
+
+    const glm::mat4 PVMmatrix = PVmatrix * box.model;
+    GLState::Instance()->uniformMatrix4fv(m_program->m_PVMmatrix, glm::value_ptr(PVMmatrix));
+    GLState::Instance()->uniform3fv(m_boxMin, 1, glm::value_ptr(box.min));
+    GLState::Instance()->uniform3fv(m_boxMax, 1, glm::value_ptr(box.max));
+
+    glBeginQuery(m_target, entry.queries[slot]);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+    glEndQuery(m_target);
+    entry.issued[slot] = m_frame;
+    m_stats.tested++;
+  }
+
+  if(cullFace)
+    GLState::Instance()->setEnabled(GL_CULL_FACE, true);
+  GLState::Instance()->depthMask(GL_TRUE);
+  GLState::Instance()->colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  m_boxes.clear();
+}
@@ -0,0 +1,100 @@
+#ifndef OCCLUSIONCULLING_H
+#define OCCLUSIONCULLING_H
+
+#include <vector>
+
+#include "pgr.h"
+
+class BasicShaderProgram;
+
+/** Skips draws hidden behind the rest of the scene, decided by the GPU itself
+ *
+ * After the scene is drawn, flush() draws the bounding box of every object test()ed in the
+ * frame, with the color and depth writes off, inside an occlusion query. In the next frame
+ * the object is drawn under glBeginConditionalRender() with that query, in the
+ * GL_QUERY_NO_WAIT mode, so the GPU drops the draw if no sample of the box passed and the
+ * CPU never waits for the result. Each object therefore has two queries, the one of the
+ * last frame conditions the draws while the other one is tested again.
+ *
+ * Objects whose box contains the camera (the box may be clipped whole) and objects not
+ * tested in the last frame are drawn unconditionally.
+ */
+class OcclusionCulling
+{
+public:
+  /// what the last frame did, the skipped draws are known one frame later
+  struct Stats
+  {
+    unsigned tested;      ///< boxes drawn by the last flush()
+    unsigned conditional; ///< objects drawn under a condition in this frame
+    unsigned skipped;     ///< of those in the last frame, the ones the GPU dropped
+  };
+
+  /// occlusion culling used by all scene nodes
+  static OcclusionCulling * Instance();
+
+  /// returns a handle of a new object, with its pair of queries
+  int add();
+  void remove(int handle);
+
+  /// starts the frame, before any condition() or test()
+  void begin();
+
+  /// query to pass to glBeginConditionalRender() when drawing the object, 0 to draw it anyway
+  GLuint condition(int handle);
+
+  /// the box (in the space of the model matrix) decides whether the object is drawn in the next frame
+  void test(int handle, const glm::mat4 & model_matrix, const glm::vec3 & box_min, const glm::vec3 & box_max);
+
+  /// draws the test()ed boxes against the depth of the drawn scene
+  void flush(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+
+  void setEnabled(bool enabled) { m_enabled = enabled; }
+  bool enabled() const { return m_enabled; }
+
+  const Stats & stats() const { return m_stats; }
+
+protected:
+  OcclusionCulling();
+
+  /// creates the box program and the unit cube
+  void initialize();
+
+  struct Entry
+  {
+    GLuint queries[2];
+    /// frame whose flush() last issued queries[frame & 1], 0 never
+    unsigned issued[2];
+    /// queries[i] conditioned the draws of the next frame, the result is not counted yet
+    bool conditioned[2];
+    bool used;
+  };
+
+  /// box to test in flush()
+  struct Box
+  {
+    int handle;
+    glm::mat4 model;
+    glm::vec3 min;
+    glm::vec3 max;
+  };
+
+  static OcclusionCulling * m_instance;
+
+  std::vector<Entry> m_entries;
+  std::vector<int> m_freeEntries;
+  std::vector<Box> m_boxes;
+
+  BasicShaderProgram * m_program;
+  GLint m_boxMin, m_boxMax, m_corner;
+  GLuint m_vertexArrayObject, m_vertexBufferObject, m_indexBufferObject;
+  /// GL_ANY_SAMPLES_PASSED with OpenGL 3.3, GL_SAMPLES_PASSED before
+  GLenum m_target;
+
+  /// number of begin() calls
+  unsigned m_frame;
+  bool m_enabled;
+  Stats m_stats;
+};
+
+#endif // OCCLUSIONCULLING_H
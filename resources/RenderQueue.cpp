@@ -0,0 +1,388 @@
+
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+#include "RenderQueue.h"
+#include "ShaderProgram.h"
+#include "ShaderVariants.h"
+#include "GeometryArena.h"
+#include "RingBuffer.h"
+#include "GLState.h"
+
+RenderQueue * RenderQueue::m_active = NULL;
+
+/// 16 bit hash of the material values, equal materials of different meshes get the same one
+static unsigned materialHash(const MeshGeometry::SubMesh * subMesh)
+{
+  const GLfloat * values[] = { subMesh->ambient, subMesh->diffuse, subMesh->specular, &subMesh->shininess };
+  const unsigned counts[] = { 3, 3, 3, 1 };
+
+  // FNV-1a over the bytes
+  unsigned hash = 2166136261u;
+  for(unsigned v = 0; v < 4; v++)
+  {
+    const unsigned char * bytes = reinterpret_cast<const unsigned char *>(values[v]);
+    for(unsigned b = 0; b < counts[v] * sizeof(GLfloat); b++)
+      hash = (hash ^ bytes[b]) * 16777619u;
+  }
+  return (hash ^ (hash >> 16)) & 0xFFFF;
+}
+
+static bool sameMaterial(const MeshGeometry::SubMesh * a, const MeshGeometry::SubMesh * b)
+{
+  return a == b || (memcmp(a->ambient, b->ambient, sizeof(a->ambient)) == 0
+                    && memcmp(a->diffuse, b->diffuse, sizeof(a->diffuse)) == 0
+                    && memcmp(a->specular, b->specular, sizeof(a->specular)) == 0
+                    && a->shininess == b->shininess);
+}
+
+RenderQueue::RenderQueue():
+  m_farPlane(1.0f), m_indirect(false), m_queryBuffer(false), m_drawDataTexture(0), m_drawDataAlignment(16)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+bool RenderQueue::indirectSupported()
+{
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  return major > 4 || (major == 4 && minor >= 3);
+}
+
+bool RenderQueue::queryBufferSupported()
+{
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  return major > 4 || (major == 4 && minor >= 4);
+}
+
+void RenderQueue::setIndirect(bool indirect)
+{
+  m_indirect = indirect && indirectSupported();
+  m_queryBuffer = m_indirect && queryBufferSupported();
+}
+
+MeshShaderProgram * RenderQueue::indirectProgram(MeshShaderProgram * program)
+{
+  std::map<MeshShaderProgram *, MeshShaderProgram *>::iterator it = m_indirectPrograms.find(program);
+  if(it != m_indirectPrograms.end())
+    return it->second;
+
+  // not a variant, so there is nothing to read the draw data, it would draw everything with the first matrix
+  MeshShaderProgram * indirect = ShaderVariants::Instance()->indirect(program);
+  m_indirectPrograms[program] = indirect;
+  return indirect;
+}
+
+void RenderQueue::begin(const glm::mat4 & view_matrix, float far_plane)
+{
+  m_view = view_matrix;
+  m_farPlane = far_plane;
+
+  m_packets.clear();
+  m_keys.clear();
+  m_active = this;
+}
+
+void RenderQueue::push(MeshShaderProgram * program, GLuint vertex_array, const MeshGeometry * mesh, const MeshGeometry::SubMesh * sub_mesh, bool textured, const glm::mat4 * model,
+                       GLuint condition)
+{
+  // distance of the origin of the node from the camera, quantized to 16 bits
+  const glm::mat4 & m = *model;
+  float depth = -(m_view[0][2] * m[3][0] + m_view[1][2] * m[3][1] + m_view[2][2] * m[3][2] + m_view[3][2]);
+  float normalized = depth / m_farPlane;
+  if(normalized < 0.0f)
+    normalized = 0.0f;
+  if(normalized > 1.0f)
+    normalized = 1.0f;
+
+  const unsigned long long texture = textured ? sub_mesh->textureID : 0;
+  unsigned long long key = 0;
+  key |= (unsigned long long)(program->m_programId & 0xFF) << 56;
+  key |= (unsigned long long)(vertex_array & 0xFFF) << 44;
+  key |= (texture & 0xFFF) << 32;
+  key |= (unsigned long long)materialHash(sub_mesh) << 16;
+  key |= (unsigned long long)(normalized * 65535.0f);
+
+  Packet packet;
+  packet.program = program;
+  packet.vertexArray = vertex_array;
+  packet.mesh = mesh;
+  packet.subMesh = sub_mesh;
+  packet.model = model;
+  packet.textured = textured;
+  packet.condition = condition;
+
+  m_packets.push_back(packet);
+  m_keys.push_back(key);
+}
+
+void RenderQueue::sort()
+{
+  const unsigned count = m_keys.size();
+  m_order.resize(count);
+  for(unsigned i = 0; i < count; i++)
+    m_order[i] = i;
+  m_keysTmp.resize(count);
+  m_orderTmp.resize(count);
+
+  // 8 passes of 8 bits from the least significant byte, each pass is stable
+  for(unsigned shift = 0; shift < 64; shift += 8)
+  {
+    unsigned histogram[257];
+    memset(histogram, 0, sizeof(histogram));
+    for(unsigned i = 0; i < count; i++)
+      histogram[((m_keys[i] >> shift) & 0xFF) + 1]++;
+
+    // all the keys share the byte, the pass would not move anything
+    if(count == 0 || histogram[((m_keys[0] >> shift) & 0xFF) + 1] == count)
+      continue;
+
+    for(unsigned d = 1; d < 257; d++)
+      histogram[d] += histogram[d - 1];
+
+    for(unsigned i = 0; i < count; i++)
+    {
+      unsigned slot = histogram[(m_keys[i] >> shift) & 0xFF]++;
+      m_keysTmp[slot] = m_keys[i];
+      m_orderTmp[slot] = m_order[i];
+    }
+    m_keys.swap(m_keysTmp);
+    m_order.swap(m_orderTmp);
+  }
+}
+
+void RenderQueue::submit()
+{
+  // a frame too big for the ring falls back to the draws one by one
+  if(m_indirect && submitIndirect())
+    return;
+
+  MeshShaderProgram * program = NULL;
+  GLuint vertexArray = 0;
+  GLuint texture = 0;
+  int textured = -1; // useTexture uniform of the current program, -1 unknown
+  const MeshGeometry::SubMesh * material = NULL;
+  const MeshGeometry * mesh = NULL;  // whose position quantization is set
+
+  GLState::Instance()->polygonMode(GL_FILL);
+  GLState::Instance()->activeTexture(GL_TEXTURE0 + 0);
+
+  for(unsigned i = 0; i < m_order.size(); i++)
+  {
+    const Packet & packet = m_packets[m_order[i]];
+
+    if(packet.program != program)
+    {
+      program = packet.program;
+      GLState::Instance()->useProgram(program->m_programId);
+      // view, projection and time are in the Frame block (FrameUniforms), the sampler unit is per program
+      GLState::Instance()->uniform1i(program->m_texSampler, 0);
+      // uniforms belong to the program, the new one has its own
+      textured = -1;
+      material = NULL;
+      mesh = NULL;
+      m_stats.programs++;
+    }
+
+    if(packet.vertexArray != vertexArray)
+    {
+      vertexArray = packet.vertexArray;
+      GLState::Instance()->bindVertexArray(vertexArray);
+      m_stats.vertexArrays++;
+    }
+
+    if(packet.mesh != mesh)
+    {
+      mesh = packet.mesh;
+      GLState::Instance()->uniform3fv(program->m_positionOffset, 1, glm::value_ptr(mesh->getPositionOffset()));
+      GLState::Instance()->uniform3fv(program->m_positionScale,  1, glm::value_ptr(mesh->getPositionScale()));
+    }
+
+    if(int(packet.textured) != textured)
+    {
+      textured = packet.textured ? 1 : 0;
+      GLState::Instance()->uniform1i(program->m_useTexture, textured);
+    }
+
+    if(packet.textured && packet.subMesh->textureID != texture)
+    {
+      texture = packet.subMesh->textureID;
+      GLState::Instance()->bindTexture(GL_TEXTURE0 + 0, GL_TEXTURE_2D, texture);
+      m_stats.textures++;
+    }
+
+    if(material == NULL || !sameMaterial(material, packet.subMesh))
+    {
+      material = packet.subMesh;
+      GLState::Instance()->uniform3fv(program->m_diffuse,  1, material->diffuse);
+      GLState::Instance()->uniform3fv(program->m_ambient,  1, material->ambient);
+      GLState::Instance()->uniform3fv(program->m_specular, 1, material->specular);
+      GLState::Instance()->uniform1f(program->m_shininess,    material->shininess);
+      m_stats.materials++;
+    }
+
+    // per-draw data
+    const glm::mat4 & Mmatrix = *packet.model;
+    glm::mat4 NormalMatrix = glm::transpose(glm::inverse(m_view * Mmatrix));
+    GLState::Instance()->uniformMatrix4fv(program->m_Mmatrix, glm::value_ptr(Mmatrix));
+    GLState::Instance()->uniformMatrix4fv(program->m_NormalMatrix, glm::value_ptr(NormalMatrix));
+
+    // the state above is set even for a dropped draw, the next packets rely on it
+    if(packet.condition != 0)
+      glBeginConditionalRender(packet.condition, GL_QUERY_NO_WAIT);
+    glDrawElementsBaseVertex(GL_TRIANGLES, packet.subMesh->nIndices, packet.mesh->getIndexType(),
+                             packet.mesh->getIndexOffset(*packet.subMesh), packet.mesh->getBaseVertex(*packet.subMesh));
+    if(packet.condition != 0)
+      glEndConditionalRender();
+    m_stats.drawCalls++;
+  }
+}
+
+bool RenderQueue::submitIndirect()
+{
+  const unsigned count = m_order.size();
+  if(count == 0)
+    return true;
+
+  if(m_drawDataTexture == 0)
+  {
+    glGenTextures(1, &m_drawDataTexture);
+    glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &m_drawDataAlignment);
+  }
+
+  // the commands and the draw data are written straight to the ring, no copy of them is kept
+  RingBuffer * ring = RingBuffer::Instance();
+  GLintptr commandOffset = 0, drawDataOffset = 0;
+  DrawCommand * commands = static_cast<DrawCommand *>(ring->allocate(count * sizeof(DrawCommand), sizeof(GLuint), commandOffset));
+  if(commands == NULL)
+    return false;
+  const size_t drawDataSize = count * DRAW_TEXELS * sizeof(glm::vec4);
+  glm::vec4 * drawData = static_cast<glm::vec4 *>(ring->allocate(drawDataSize, std::max<size_t>(m_drawDataAlignment, sizeof(glm::vec4)), drawDataOffset));
+  if(drawData == NULL)
+    return false;
+  m_batches.clear();
+
+  for(unsigned i = 0; i < count; i++)
+  {
+    const Packet & packet = m_packets[m_order[i]];
+    MeshShaderProgram * program = indirectProgram(packet.program);
+    const GLuint texture = packet.textured ? packet.subMesh->textureID : 0;
+    if(program == NULL)
+      continue;
+
+    // the material, the matrices and the condition are in the draw data and the command, only the rest splits the batches
+    Batch * batch = m_batches.empty() ? NULL : &m_batches.back();
+    if(batch == NULL || batch->program != program || batch->vertexArray != packet.vertexArray || batch->indexType != packet.mesh->getIndexType()
+       || batch->texture != texture || batch->first + batch->count != i)
+    {
+      const Batch next = { program, packet.vertexArray, packet.mesh->getIndexType(), texture, i, 0 };
+      m_batches.push_back(next);
+      batch = &m_batches.back();
+    }
+    batch->count++;
+
+    DrawCommand & command = commands[i];
+    command.count = packet.subMesh->nIndices;
+    command.instanceCount = 1;
+    // without the query buffer the result is read here, if the GPU has it already
+    if(packet.condition != 0 && !m_queryBuffer)
+    {
+      GLuint available = GL_FALSE;
+      glGetQueryObjectuiv(packet.condition, GL_QUERY_RESULT_AVAILABLE, &available);
+      if(available != GL_FALSE)
+        glGetQueryObjectuiv(packet.condition, GL_QUERY_RESULT, &command.instanceCount);
+    }
+    command.firstIndex = GLuint(size_t(packet.mesh->getIndexOffset(*packet.subMesh)) / packet.mesh->getIndexSize());
+    command.baseVertex = packet.mesh->getBaseVertex(*packet.subMesh);
+    command.baseInstance = i;  // the draw ID
+
+    glm::vec4 * data = &drawData[i * DRAW_TEXELS];
+    const glm::mat4 & Mmatrix = *packet.model;
+    const glm::mat4 NormalMatrix = glm::transpose(glm::inverse(m_view * Mmatrix));
+    for(int column = 0; column < 4; column++)
+    {
+      data[column] = Mmatrix[column];
+      data[4 + column] = NormalMatrix[column];
+    }
+    data[8] = glm::vec4(packet.mesh->getPositionOffset(), 0.0f);
+    data[9] = glm::vec4(packet.mesh->getPositionScale(), 0.0f);
+    const MeshGeometry::SubMesh * material = packet.subMesh;
+    data[10] = glm::vec4(material->ambient[0], material->ambient[1], material->ambient[2], 0.0f);
+    data[11] = glm::vec4(material->diffuse[0], material->diffuse[1], material->diffuse[2], 0.0f);
+    data[12] = glm::vec4(material->specular[0], material->specular[1], material->specular[2], material->shininess);
+  }
+
+  ring->flush();
+  GLState::Instance()->bindBuffer(GL_DRAW_INDIRECT_BUFFER, ring->buffer());
+
+  // the GPU overwrites the instance counts of the conditioned draws by the results it has, the rest stays 1
+  if(m_queryBuffer)
+  {
+    glBindBuffer(GL_QUERY_BUFFER, ring->buffer());
+    for(unsigned i = 0; i < count; i++)
+    {
+      const GLuint condition = m_packets[m_order[i]].condition;
+      if(condition != 0)
+        glGetQueryObjectuiv(condition, GL_QUERY_RESULT_NO_WAIT, (GLuint *) (commandOffset + i * sizeof(DrawCommand) + offsetof(DrawCommand, instanceCount)));
+    }
+    glBindBuffer(GL_QUERY_BUFFER, 0);
+  }
+
+  GLState::Instance()->bindTexture(GL_TEXTURE0 + DRAW_DATA_UNIT, GL_TEXTURE_BUFFER, m_drawDataTexture);
+  glTexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, ring->buffer(), drawDataOffset, drawDataSize);
+  GLState::Instance()->activeTexture(GL_TEXTURE0 + 0);
+
+  GeometryArena::Instance()->reserveDrawIds(count);
+
+  GLState::Instance()->polygonMode(GL_FILL);
+
+  MeshShaderProgram * program = NULL;
+  GLuint vertexArray = 0;
+  GLuint texture = 0;
+  for(unsigned b = 0; b < m_batches.size(); b++)
+  {
+    const Batch & batch = m_batches[b];
+
+    if(batch.program != program)
+    {
+      program = batch.program;
+      GLState::Instance()->useProgram(program->m_programId);
+      m_stats.programs++;
+    }
+
+    if(batch.vertexArray != vertexArray)
+    {
+      vertexArray = batch.vertexArray;
+      GLState::Instance()->bindVertexArray(vertexArray);
+      m_stats.vertexArrays++;
+    }
+
+    if(batch.texture != 0 && batch.texture != texture)
+    {
+      texture = batch.texture;
+      GLState::Instance()->bindTexture(GL_TEXTURE0 + 0, GL_TEXTURE_2D, texture);
+      m_stats.textures++;
+    }
+
+    glMultiDrawElementsIndirect(GL_TRIANGLES, batch.indexType, (void *) (commandOffset + batch.first * sizeof(DrawCommand)), batch.count, 0);
+    m_stats.drawCalls++;
+  }
+
+  GLState::Instance()->bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  return true;
+}
+
+void RenderQueue::flush()
+{
+  m_active = NULL;
+
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_stats.packets = m_packets.size();
+
+  sort();
+  submit();
+}
@@ -0,0 +1,162 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <vector>
+#include <map>
+
+#include "pgr.h"
+#include "MeshGeometry.h"
+
+class MeshShaderProgram;
+
+/** Collects draws of the scene and submits them sorted by the GL state they need
+ *
+ * While a queue is active (between begin() and flush()), MeshNode::draw() does not
+ * touch OpenGL, it only pushes one packet per submesh. flush() then sorts the packets
+ * by a 64 bit key and submits them, skipping state changes equal to the current state:
+ *
+ *   bits 63-56 program, 55-44 vertex array, 43-32 texture, 31-16 material, 15-0 depth
+ *
+ * Packets sharing the state are thus drawn front to back, so the early depth test
+ * rejects most of the hidden fragments. The key only groups the packets, the state
+ * itself is compared by value, so collisions in the truncated names cost a state
+ * change, never a wrong one.
+ *
+ * With setIndirect() (OpenGL 4.3) the sorted packets become draw commands in a piece of
+ * the RingBuffer, bound as GL_DRAW_INDIRECT_BUFFER, and the runs sharing the program, vertex array, index type
+ * and texture are each submitted by one glMultiDrawElementsIndirect(). The condition does not
+ * split the runs, the occlusion query of the last frame becomes the instance count of the
+ * command instead: with OpenGL 4.4 the GPU writes it there (GL_QUERY_BUFFER, GL_QUERY_RESULT_NO_WAIT),
+ * with 4.3 the CPU reads it if it is available. An unavailable result leaves the count 1, the
+ * same as GL_QUERY_NO_WAIT does for a conditional render. The
+ * matrices, the position quantization and the material of every draw go to a texture
+ * buffer instead of uniforms, DRAW_TEXELS texels at the index of the draw, and the
+ * indirect variant of the program (ShaderVariants::indirect()) reads them there, the draw
+ * gets its index as the base instance (see GeometryArena::reserveDrawIds()). Meshes of one
+ * vertex format share the vertex array, so a run spans any number of nodes and meshes.
+ */
+class RenderQueue
+{
+public:
+  /// one draw call and everything it needs
+  struct Packet
+  {
+    MeshShaderProgram * program;
+    GLuint vertexArray;
+    /// mesh of the submesh, for its index type and position quantization
+    const MeshGeometry * mesh;
+    const MeshGeometry::SubMesh * subMesh;
+    /// global matrix of the node, must stay valid until flush()
+    const glm::mat4 * model;
+    bool textured;
+    /// query for glBeginConditionalRender(), 0 for an unconditional draw (see OcclusionCulling),
+    /// a GL_ANY_SAMPLES_PASSED one with setIndirect(), its 0 or 1 is the instance count
+    GLuint condition;
+  };
+
+  /// state changes actually made by the last flush()
+  struct Stats
+  {
+    unsigned packets;
+    unsigned programs;
+    unsigned vertexArrays;
+    unsigned textures;
+    unsigned materials;
+    unsigned drawCalls;  ///< glMultiDrawElementsIndirect() calls with setIndirect(), otherwise one per packet
+  };
+
+  enum
+  {
+    DRAW_DATA_UNIT = 7, ///< texture unit of the per-draw data of the indirect submission
+    DRAW_TEXELS = 13    ///< RGBA32F texels per draw: model matrix, normal matrix, position offset and scale, ambient, diffuse, specular + shininess
+  };
+
+  RenderQueue();
+
+  /// OpenGL 4.3, glMultiDrawElementsIndirect() and the base instance of its commands
+  static bool indirectSupported();
+  /// OpenGL 4.4, the query results go to the commands without the CPU
+  static bool queryBufferSupported();
+
+  /// submits by glMultiDrawElementsIndirect() from the next flush(), ignored if it is not supported
+  void setIndirect(bool indirect);
+  bool indirect() const { return m_indirect; }
+
+  /// queue collecting the draws right now, NULL if the nodes should draw immediately
+  static RenderQueue * active() { return m_active; }
+
+  /** starts collecting, the view matrix is the one passed to SceneNode::draw()
+   *
+   * far_plane is the distance mapped to the last depth bucket of the key. The rest
+   * of the per-frame data is taken from FrameUniforms.
+   */
+  void begin(const glm::mat4 & view_matrix, float far_plane = 10000.0f);
+
+  /// queues one submesh
+  void push(MeshShaderProgram * program, GLuint vertex_array, const MeshGeometry * mesh, const MeshGeometry::SubMesh * sub_mesh, bool textured, const glm::mat4 * model,
+            GLuint condition = 0);
+
+  /// sorts and draws everything pushed since begin(), the queue is not active afterwards
+  void flush();
+
+  const Stats & stats() const { return m_stats; }
+
+protected:
+  /// sorts m_keys (the full 64 bit keys of the layout above) by a stable LSD radix sort,
+  /// m_order gets the packet indices moved along with them, equal keys keep the push order
+  void sort();
+
+  /// submits the packets in m_order
+  void submit();
+
+  /// submit() through glMultiDrawElementsIndirect(), false if the frame does not fit the RingBuffer
+  bool submitIndirect();
+
+  /// the indirect variant of the program, kept by the queue from the first use
+  MeshShaderProgram * indirectProgram(MeshShaderProgram * program);
+
+  /// the layout glMultiDrawElementsIndirect() reads
+  struct DrawCommand
+  {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint  baseVertex;
+    GLuint baseInstance;
+  };
+
+  /// run of commands submitted by one call
+  struct Batch
+  {
+    MeshShaderProgram * program;
+    GLuint vertexArray;
+    GLenum indexType;
+    GLuint texture;    ///< 0 for untextured draws
+    unsigned first;
+    unsigned count;
+  };
+
+  static RenderQueue * m_active;
+
+  std::vector<Packet> m_packets;
+  std::vector<unsigned long long> m_keys;  ///< sort key of every packet
+  std::vector<unsigned> m_order;           ///< packet indices, sorted by sort()
+  std::vector<unsigned long long> m_keysTmp; ///< second buffer of the radix sort
+  std::vector<unsigned> m_orderTmp;
+
+  glm::mat4 m_view;
+  float m_farPlane;
+
+  bool m_indirect;
+  bool m_queryBuffer;  ///< queryBufferSupported(), checked by setIndirect()
+  std::vector<Batch> m_batches;
+  std::map<MeshShaderProgram *, MeshShaderProgram *> m_indirectPrograms;
+  /// created by the first indirect flush(), a view of the RingBuffer
+  GLuint m_drawDataTexture;
+  /// GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, queried with the texture
+  GLint m_drawDataAlignment;
+
+  Stats m_stats;
+};
+
+#endif // RENDERQUEUE_H
@@ -2,6 +2,7 @@
 #include "Resources.h"
 #include "MeshGeometry.h"
 #include "ShaderProgram.h"
+#include "GLState.h"
 
 SINGLETON_DEF(TextureManager)
 SINGLETON_DEF(MeshManager)
@@ -24,7 +25,7 @@ GLuint TextureLoader::operator ()(const std::string &name)
 
 void TextureDeleter::operator ()(GLuint texture)
 {
-  glDeleteTextures(1, &texture);
+  GLState::Instance()->deleteTextures(1, &texture);
 }
 
 void ShaderDeleter::operator ()(BasicShaderProgram *shader)
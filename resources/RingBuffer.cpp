@@ -0,0 +1,173 @@
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <cstring>
+#include <algorithm>
+
+#include "RingBuffer.h"
+
+/// seconds from some fixed point, for the wait times
+static double now()
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return double(counter.QuadPart) / double(frequency.QuadPart);
+#else
+  timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+RingBuffer * RingBuffer::m_instance = 0;
+
+RingBuffer * RingBuffer::Instance()
+{
+  if(m_instance == 0)
+    m_instance = new RingBuffer();
+  return m_instance;
+}
+
+RingBuffer::RingBuffer():
+  m_buffer(0), m_frameSize(1 << 20), m_capacity(0), m_mapped(NULL), m_head(0), m_flushed(0), m_frameStart(0)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+bool RingBuffer::persistentSupported()
+{
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  return major > 4 || (major == 4 && minor >= 4);
+}
+
+void RingBuffer::create()
+{
+  m_capacity = FRAMES * m_frameSize;
+  glGenBuffers(1, &m_buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+
+  if(persistentSupported())
+  {
+    // the dynamic storage keeps glBufferSubData() allowed, should the mapping fail
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, m_capacity, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+    m_mapped = static_cast<unsigned char *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, m_capacity, flags));
+  }
+  else
+    glBufferData(GL_COPY_WRITE_BUFFER, m_capacity, NULL, GL_STREAM_DRAW);
+
+  if(m_mapped == NULL)
+    m_shadow.resize(m_capacity);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void * RingBuffer::allocate(size_t size, size_t alignment, GLintptr & offset)
+{
+  if(m_buffer == 0)
+    create();
+  if(size > m_capacity)
+    return NULL;
+
+  // padding to the alignment, or the rest of the ring if the piece does not fit before its end
+  const size_t position = size_t(m_head % m_capacity);
+  size_t aligned = (position + alignment - 1) / alignment * alignment;
+  if(aligned + size > m_capacity)
+  {
+    aligned = 0;
+    m_head += m_capacity - position;
+    m_stats.wraps++;
+  }
+  else
+    m_head += aligned - position;
+
+  // the piece takes the place of the data one ring earlier, the GPU must be done with it
+  const unsigned long long end = m_head + size;
+  if(end > m_frameStart + m_capacity)
+  {
+    // the frame itself was there, it cannot wait for its own fence
+    flush();
+    fence();
+    m_stats.overruns++;
+  }
+  waitBefore(end >= m_capacity ? end - m_capacity : 0);
+
+  m_head = end;
+  offset = aligned;
+  return m_mapped != NULL ? m_mapped + aligned : &m_shadow[aligned];
+}
+
+void RingBuffer::flush()
+{
+  if(m_mapped != NULL || m_flushed == m_head)
+    return;
+
+  // the written span, split in two where it wraps around
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+  if(m_head - m_flushed >= m_capacity)
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, m_capacity, &m_shadow[0]);
+  else
+  {
+    const size_t start = size_t(m_flushed % m_capacity);
+    const size_t length = size_t(m_head - m_flushed);
+    const size_t first = std::min(length, m_capacity - start);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, start, first, &m_shadow[start]);
+    if(first < length)
+      glBufferSubData(GL_COPY_WRITE_BUFFER, 0, length - first, &m_shadow[0]);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  m_flushed = m_head;
+}
+
+void RingBuffer::fence()
+{
+  if(m_head == m_frameStart)
+    return;
+  // the uploads serialize with the draws, only the persistent writes need the fences
+  if(m_mapped != NULL)
+  {
+    Frame frame;
+    frame.start = m_frameStart;
+    frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_frames.push_back(frame);
+  }
+  m_frameStart = m_head;
+}
+
+void RingBuffer::endFrame()
+{
+  m_stats.frames++;
+  m_stats.frameBytes = unsigned(m_head - m_frameStart);
+  m_stats.peakFrameBytes = std::max(m_stats.peakFrameBytes, m_stats.frameBytes);
+  fence();
+}
+
+void RingBuffer::waitBefore(unsigned long long position)
+{
+  while(!m_frames.empty() && m_frames.front().start < position)
+  {
+    GLsync fence = m_frames.front().fence;
+    m_frames.pop_front();
+
+    // usually passed long ago, the clock only runs when the GPU is behind
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if(result == GL_TIMEOUT_EXPIRED)
+    {
+      const double start = now();
+      do
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+      while(result == GL_TIMEOUT_EXPIRED);
+      const double waited = now() - start;
+      m_stats.waits++;
+      m_stats.waitTime += waited;
+      m_stats.maxWaitTime = std::max(m_stats.maxWaitTime, waited);
+    }
+    glDeleteSync(fence);
+  }
+}
@@ -0,0 +1,108 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <deque>
+#include <vector>
+
+#include "pgr.h"
+
+/** GPU visible memory for the data written anew every frame
+ *
+ * One buffer object with the space of FRAMES frames (triple buffering). allocate() hands out
+ * consecutive pieces of it and wraps around at the end. The CPU writes the piece through the
+ * returned pointer, the GPU reads it from buffer() at the returned offset, so nothing is
+ * reallocated or orphaned per frame.
+ *
+ * With OpenGL 4.4 the buffer is mapped once for good (persistent and coherent) and the writes
+ * go straight to the memory the GPU reads. endFrame() puts a fence after the commands of the
+ * frame and a piece is handed out again only after the fences of the frames which used it
+ * were passed, waiting for the GPU if it is that far behind (see Stats::waitTime). Older
+ * versions write to a copy in the memory and flush() uploads what was written since the last
+ * flush() by glBufferSubData(), which the driver synchronizes itself.
+ *
+ * A piece must be drawn from before the ring wraps around past it. A frame needing more than
+ * the whole ring is split by a fence in the middle (Stats::overruns), so size the frames by
+ * Stats::peakFrameBytes.
+ */
+class RingBuffer
+{
+public:
+  enum { FRAMES = 3 };
+
+  struct Stats
+  {
+    unsigned frames;         ///< endFrame() calls
+    unsigned wraps;          ///< times the allocation went back to the start of the ring
+    unsigned waits;          ///< allocations which had to wait for the GPU
+    double waitTime;         ///< seconds spent waiting, all together
+    double maxWaitTime;      ///< the longest single wait
+    unsigned frameBytes;     ///< allocated in the last finished frame, with the alignment
+    unsigned peakFrameBytes;
+    unsigned overruns;       ///< frames which did not fit the ring
+  };
+
+  /// ring used by all the per-frame data
+  static RingBuffer * Instance();
+
+  /// OpenGL 4.4, glBufferStorage() and the persistent mapping
+  static bool persistentSupported();
+
+  /// space of one frame in bytes, only before the first allocate()
+  void setFrameSize(size_t bytes) { if(m_buffer == 0) m_frameSize = bytes; }
+  size_t frameSize() const { return m_frameSize; }
+
+  /** size bytes for the GPU, the offset in buffer() is aligned to alignment
+   *
+   * Creates the buffer on the first call. NULL if the piece is bigger than the whole ring.
+   */
+  void * allocate(size_t size, size_t alignment, GLintptr & offset);
+
+  /// makes the pieces written so far readable by the GPU, before the draws using them
+  void flush();
+
+  /// after the last command reading the data of the frame
+  void endFrame();
+
+  GLuint buffer() const { return m_buffer; }
+  /// true if the writes go straight to the buffer, after the first allocate()
+  bool persistent() const { return m_mapped != NULL; }
+
+  const Stats & stats() const { return m_stats; }
+
+protected:
+  RingBuffer();
+
+  void create();
+
+  /// fence after the commands so far, they are the last ones using [m_frameStart, m_head)
+  void fence();
+
+  /// waits for the fences of the frames starting before the position
+  void waitBefore(unsigned long long position);
+
+  struct Frame
+  {
+    unsigned long long start;  ///< m_head when the frame started
+    GLsync fence;
+  };
+
+  static RingBuffer * m_instance;
+
+  GLuint m_buffer;
+  size_t m_frameSize;
+  size_t m_capacity;
+  /// persistent mapping of the buffer, NULL when writing to m_shadow
+  unsigned char * m_mapped;
+  std::vector<unsigned char> m_shadow;
+  /// bytes handed out since the start, the offset in the ring is m_head % m_capacity
+  unsigned long long m_head;
+  /// m_head at the last flush()
+  unsigned long long m_flushed;
+  /// m_head when the current frame started
+  unsigned long long m_frameStart;
+  /// fenced frames the GPU may still read, oldest first
+  std::deque<Frame> m_frames;
+  Stats m_stats;
+};
+
+#endif // RINGBUFFER_H
@@ -4,41 +4,28 @@
 #include "SceneNode.h"
 
 SceneNode::SceneNode(const std::string &name, SceneNode *parent):
-  m_name(name), m_parent(0)
+  m_name(name), m_parent(0), m_hierarchy(TransformHierarchy::Instance())
 {
+  m_index = m_hierarchy->addNode(this);
   setParentNode(parent);
-  m_local_mat = glm::mat4(1.0f);
 }
 
 SceneNode::~SceneNode()
 {
   setParentNode(0);
 
+  // child removes itself from m_children in its destructor
   while(!m_children.empty())
-  {
     delete m_children.back();
-    m_children.pop_back();
-  }
+
+  m_hierarchy->removeNode(m_index);
 }
 
 void SceneNode::update(double elapsed_time)  // elapsed time in seconds
 {
-  m_time = elapsed_time;
-
-  // if we have parent, multiply parent's matrix with ours
-  if(m_parent)
-    m_global_mat = m_parent->globalMatrix() * m_local_mat;
-  else
-    m_global_mat = m_local_mat;
-
-  for(Children::iterator it = m_children.begin(); it != m_children.end(); ++it)
-  {
-    SceneNode * child = *it;
-    if(child)
-      child->update(elapsed_time);
-    else
-      std::cerr << "node " << m_name << " has NULL child, that should not happen" << std::endl;
-  }
+  // the order may change (and so our index) if the tree was modified since the last update
+  m_hierarchy->validateOrder();
+  m_hierarchy->update(m_index, elapsed_time);
 }
 
 void SceneNode::draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
@@ -62,6 +49,7 @@ void SceneNode::setParentNode(SceneNode * new_parent)
     m_parent->removeChildNode(this);
 
   m_parent = new_parent;
+  m_hierarchy->setParent(m_index, new_parent != NULL ? int(new_parent->m_index) : -1);
 
   if(new_parent != NULL)
     new_parent->addChildNode(this);
@@ -78,9 +66,10 @@ void SceneNode::addChildNode(SceneNode* node)
 
 void SceneNode::removeChildNode(SceneNode* node)
 {
-  for(Children::iterator it = m_children.begin(); it != m_children.end(); ++it)
+  // from the back, the destructor removes the children starting with the last one
+  for(Children::iterator it = m_children.end(); it != m_children.begin(); )
   {
-    SceneNode * child = *it;
+    SceneNode * child = *--it;
     if(child == node)
     {
       m_children.erase(it);
@@ -5,10 +5,13 @@
 #include <string>
 
 #include "pgr.h"
+#include "TransformHierarchy.h"
 
 /** Basic scene graph node
  *
- * You can derive this class and reimplement update() and draw() methods.
+ * You can derive this class and reimplement animate() and draw() methods.
+ * Transformations are not stored in the node itself, the node is a handle
+ * to its slot in the TransformHierarchy.
  */
 class SceneNode
 {
@@ -20,13 +23,19 @@ public:
   /// destroy children
   virtual ~SceneNode();
 
-  /** recalculates global matrix and updates all children
+  /** recalculates global matrix of this node and all the nodes below
    *
-   * Derived classes should also call this method (using SceneNode::update()).
-   * If you want to play with transformations, don't forget to set m_loc_mat matrix!
+   * Animated nodes (see setAnimated()) in the subtree get animate() called first,
+   * the global matrices are then computed by one linear pass in TransformHierarchy.
    */
   virtual void update(double elapsed_time);
 
+  /** changes local matrix in time, called from update() for animated nodes only
+   *
+   * If you want to play with transformations, don't forget to call setLocalMatrix()!
+   */
+  virtual void animate(double elapsed_time) {}
+
   /// calls draw on child nodes
   virtual void draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
 
@@ -45,21 +54,38 @@ public:
   const std::string & nodeName() const { return m_name; }
 
   /// calculated global matrix (valid after update() call)
-  const glm::mat4 & globalMatrix() const { return m_global_mat; }
+  const glm::mat4 & globalMatrix() const { return m_hierarchy->globalMatrix(m_index); }
+
+  /// changes whenever the global matrix is recalculated
+  unsigned globalMatrixStamp() const { return m_hierarchy->stamp(m_index); }
 
   /// local matrix
-  const glm::mat4  & localMatrix() const { return m_local_mat; }
+  const glm::mat4  & localMatrix() const { return m_hierarchy->localMatrix(m_index); }
+
+  /// sets local matrix, global one is recalculated in the next update()
+  void setLocalMatrix(const glm::mat4 & local) { m_hierarchy->setLocalMatrix(m_index, local); }
+
+  /// sets only the translation of the local matrix (cheaper when the rest does not change)
+  void setLocalTranslation(const glm::vec3 & translation) { m_hierarchy->setLocalTranslation(m_index, translation); }
+
+  /// time passed to the last update(), in seconds
+  double elapsedTime() const { return m_hierarchy->time(); }
 
   /// dumps the node + subtree to stdout (you can reimplement this to display additional stuff)
   virtual void dump(unsigned indent = 0);
 
 protected:
+  /// animate() is called from update() only if set
+  void setAnimated(bool animated) { m_hierarchy->setAnimated(m_index, animated); }
+
   std::string m_name;    ///< node name
   SceneNode*  m_parent;
   Children    m_children;
-  double      m_time;  // updated in update()
-  glm::mat4   m_global_mat; ///< final global model matrix, calculated in update()
-  glm::mat4   m_local_mat;  ///< local model matrix, derived transformation nodes should calculate it
+
+  TransformHierarchy * m_hierarchy; ///< storage of the matrices
+  unsigned    m_index;   ///< slot in m_hierarchy, maintained by the hierarchy
+
+  friend class TransformHierarchy;
 };
 
 #endif // of __SCENENODE_H
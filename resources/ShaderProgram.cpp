@@ -1,5 +1,7 @@
 
 #include "ShaderProgram.h"
+#include "FrameUniforms.h"
+#include "GLState.h"
 
 BasicShaderProgram::BasicShaderProgram(GLuint prId):
   m_programId(prId),
@@ -13,7 +15,7 @@ BasicShaderProgram::BasicShaderProgram(GLuint prId):
 
 BasicShaderProgram::~BasicShaderProgram()
 {
-  pgr::deleteProgramAndShaders(m_programId);
+  GLState::Instance()->deleteProgram(m_programId);
 }
 
 void BasicShaderProgram::initLocations()
@@ -25,6 +27,9 @@ void BasicShaderProgram::initLocations()
 
   m_time         =  glGetUniformLocation(m_programId, "time" );
 
+  // view, projection, lights and time come from the shared block if the shader has it
+  FrameUniforms::bindProgram(m_programId);
+
 }
 
 void BasicShaderProgram::updateUniforms(SceneNode *nd)
@@ -41,6 +46,7 @@ MeshShaderProgram::MeshShaderProgram(GLuint prId):
   m_pos(-1),
   m_normal(-1),
   m_texCoord(-1),
+  m_instanceMatrix(-1),
   m_useTexture(-1),
   m_cubeMapTex(-1)
   //m_worldCameraPosition(-1)
@@ -54,6 +60,7 @@ void MeshShaderProgram::initLocations()
   m_pos          =  glGetAttribLocation( m_programId, "position");
   m_normal       =  glGetAttribLocation( m_programId, "normal");
   m_texCoord     =  glGetAttribLocation( m_programId, "texCoord");
+  m_instanceMatrix = glGetAttribLocation( m_programId, "instanceMatrix");
 
   m_ambient      =  glGetUniformLocation(m_programId, "material.ambient");
   m_diffuse      =  glGetUniformLocation(m_programId, "material.diffuse");
@@ -63,6 +70,9 @@ void MeshShaderProgram::initLocations()
   m_texSampler   = glGetUniformLocation(m_programId, "texSampler");
   m_useTexture   = glGetUniformLocation( m_programId, "useTexture");
 
+  m_positionOffset = glGetUniformLocation(m_programId, "positionOffset");
+  m_positionScale  = glGetUniformLocation(m_programId, "positionScale");
+
   
   // cubemap
   m_cubeMapTex = glGetUniformLocation(m_programId, "cubeMapTex");
@@ -46,11 +46,17 @@ public:
 
   GLint m_texSampler;
 
+  /// dequantization of the positions (MeshGeometry::getPositionOffset())
+  GLint m_positionOffset;
+  GLint m_positionScale;
+
   // attributes
   /// position attribute ation
   GLint m_pos;
   GLint m_normal;
   GLint m_texCoord;
+  /// per-instance model matrix (four consecutive locations), -1 if not instanced
+  GLint m_instanceMatrix;
   GLint m_useTexture;
   // cubemap
   GLint m_cubeMapTex;
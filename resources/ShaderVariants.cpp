@@ -0,0 +1,211 @@
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <vector>
+
+#include "ShaderVariants.h"
+#include "ShaderProgram.h"
+#include "Resources.h"
+#include "LightClusters.h"
+#include "RenderQueue.h"
+#include "GLState.h"
+
+ShaderVariants * ShaderVariants::m_instance = 0;
+
+ShaderVariants * ShaderVariants::Instance()
+{
+  if(m_instance == 0)
+    m_instance = new ShaderVariants();
+  return m_instance;
+}
+
+ShaderVariants::ShaderVariants():
+  m_compiled(0)
+{
+}
+
+/// one letter and the value of every feature, "-" for RUNTIME
+std::string ShaderVariants::Features::key() const
+{
+  std::ostringstream key;
+  const char names[] = { 't', 'l', 's', 'c', 'i' };
+  const int values[] = { textured, spotLights, sun, clustered, indirect };
+  for(unsigned i = 0; i < 5; i++)
+  {
+    key << names[i];
+    if(values[i] == RUNTIME)
+      key << '-';
+    else
+      key << values[i];
+  }
+  return key.str();
+}
+
+std::string ShaderVariants::Features::defines() const
+{
+  std::ostringstream defines;
+  if(textured != RUNTIME)
+    defines << "#define TEXTURED " << textured << "\n";
+  if(spotLights != RUNTIME)
+    defines << "#define SPOT_LIGHTS " << spotLights << "\n";
+  if(sun != RUNTIME)
+    defines << "#define SUN " << sun << "\n";
+  if(clustered != RUNTIME)
+    defines << "#define CLUSTERED " << clustered << "\n";
+  if(indirect != RUNTIME)
+    defines << "#define INDIRECT " << indirect << "\n";
+  return defines.str();
+}
+
+/// source of the file with the defines after the #version line (which must stay the first one)
+static bool readSource(const std::string & file, const std::string & defines, std::string & source)
+{
+  std::ifstream stream(file.c_str());
+  if(!stream)
+  {
+    std::cerr << "ShaderVariants: cannot read " << file << std::endl;
+    return false;
+  }
+  std::ostringstream content;
+  content << stream.rdbuf();
+  source = content.str();
+
+  std::string::size_type line = 0;
+  if(source.compare(0, 8, "#version") == 0)
+  {
+    line = source.find('\n');
+    line = line == std::string::npos ? source.size() : line + 1;
+  }
+  source.insert(line, defines);
+  return true;
+}
+
+GLuint ShaderVariants::compile(const Variant & variant)
+{
+  const std::string defines = variant.features.defines();
+  std::string vertexSource, fragmentSource;
+  if(!readSource(variant.vertexFile, defines, vertexSource) || !readSource(variant.fragmentFile, defines, fragmentSource))
+    return 0;
+
+  GLuint shaderList[] = {
+    pgr::createShaderFromSource(GL_VERTEX_SHADER,   vertexSource),
+    pgr::createShaderFromSource(GL_FRAGMENT_SHADER, fragmentSource),
+    0
+  };
+  GLuint program = shaderList[0] != 0 && shaderList[1] != 0 ? pgr::createProgram(shaderList) : 0;
+  if(program == 0)
+  {
+    for(int i = 0; i < 2; i++)
+      if(shaderList[i] != 0)
+        glDeleteShader(shaderList[i]);
+    std::cerr << "ShaderVariants: cannot build " << variant.vertexFile << " and " << variant.fragmentFile
+              << " with " << variant.features.key() << std::endl;
+    return 0;
+  }
+
+  // the same locations in every variant, they have to be bound before linking, so link once more
+  glBindAttribLocation(program, ATTRIBUTE_POSITION, "position");
+  glBindAttribLocation(program, ATTRIBUTE_NORMAL,   "normal");
+  glBindAttribLocation(program, ATTRIBUTE_TEXCOORD, "texCoord");
+  glBindAttribLocation(program, ATTRIBUTE_DRAW_ID,  "drawId");
+  glLinkProgram(program);
+
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if(linked == GL_FALSE)
+  {
+    GLint length = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+    std::vector<GLchar> log(length + 1, '\0');
+    glGetProgramInfoLog(program, length, NULL, &log[0]);
+    std::cerr << "ShaderVariants: cannot link " << variant.vertexFile << " and " << variant.fragmentFile
+              << " with " << variant.features.key() << std::endl << &log[0] << std::endl;
+    GLState::Instance()->deleteProgram(program);
+    return 0;
+  }
+
+  m_compiled++;
+  return program;
+}
+
+/// samplers keep their units, set them once (texture of the mesh 0, cube map 1, light clusters, indirect draws)
+static void setSamplers(MeshShaderProgram * program)
+{
+  GLState::Instance()->useProgram(program->m_programId);
+  GLState::Instance()->uniform1i(program->m_texSampler, 0);
+  GLState::Instance()->uniform1i(program->m_cubeMapTex, 1);
+  GLState::Instance()->uniform1i(glGetUniformLocation(program->m_programId, "clusterTable"),  LightClusters::TABLE_UNIT);
+  GLState::Instance()->uniform1i(glGetUniformLocation(program->m_programId, "clusterLights"), LightClusters::INDEX_UNIT);
+  GLState::Instance()->uniform1i(glGetUniformLocation(program->m_programId, "lightData"),     LightClusters::LIGHT_UNIT);
+  GLState::Instance()->uniform1i(glGetUniformLocation(program->m_programId, "drawData"),      RenderQueue::DRAW_DATA_UNIT);
+  GLState::Instance()->useProgram(0);
+}
+
+MeshShaderProgram * ShaderVariants::get(const std::string & vertex_file, const std::string & fragment_file, const Features & features)
+{
+  const std::string name = vertex_file + "|" + fragment_file + "|" + features.key();
+  if(ShaderManager::Instance()->exists(name))
+    return dynamic_cast<MeshShaderProgram*>(ShaderManager::Instance()->get(name));
+
+  Variant variant;
+  variant.vertexFile = vertex_file;
+  variant.fragmentFile = fragment_file;
+  variant.features = features;
+  // the scene cannot do without its programs, nor should a broken one stay cached under the name
+  const GLuint program = compile(variant);
+  if(program == 0)
+    pgr::dieWithError("ShaderVariants: a program of the scene failed, see above");
+  variant.program = new MeshShaderProgram(program);
+  variant.program->initLocations();
+
+  setSamplers(variant.program);
+
+  ShaderManager::Instance()->insert(name, variant.program);
+  m_variants[name] = variant;
+  return variant.program;
+}
+
+void ShaderVariants::release(MeshShaderProgram * program)
+{
+  for(std::map<std::string, Variant>::iterator it = m_variants.begin(); it != m_variants.end(); ++it)
+  {
+    if(it->second.program != program)
+      continue;
+    ShaderManager::Instance()->release(it->first);
+    // the last user deleted the program
+    if(!ShaderManager::Instance()->exists(it->first))
+      m_variants.erase(it);
+    return;
+  }
+  std::cerr << "ShaderVariants::release(): not a variant" << std::endl;
+}
+
+MeshShaderProgram * ShaderVariants::indirect(MeshShaderProgram * program)
+{
+  for(std::map<std::string, Variant>::iterator it = m_variants.begin(); it != m_variants.end(); ++it)
+  {
+    if(it->second.program != program)
+      continue;
+    Features features = it->second.features;
+    features.indirect = 1;
+    return get(it->second.vertexFile, it->second.fragmentFile, features);
+  }
+  return NULL;
+}
+
+void ShaderVariants::reload()
+{
+  for(std::map<std::string, Variant>::iterator it = m_variants.begin(); it != m_variants.end(); ++it)
+  {
+    GLuint program = compile(it->second);
+    if(program == 0)
+      continue;
+
+    MeshShaderProgram * variant = it->second.program;
+    GLState::Instance()->deleteProgram(variant->m_programId);
+    variant->m_programId = program;
+    variant->initLocations();
+    setSamplers(variant);
+  }
+}
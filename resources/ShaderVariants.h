@@ -0,0 +1,95 @@
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include <map>
+#include <string>
+
+#include "pgr.h"
+
+class MeshShaderProgram;
+
+/** Programs specialized by #define features, compiled once per feature set
+ *
+ * The defines are inserted after the #version line of both shaders, see MeshNode.frag
+ * for the ones it knows. Every variant lives in the ShaderManager under a name made of
+ * the files and the feature key, so the nodes asking for the same variant share it and
+ * release() it like any other shader.
+ *
+ * The attributes of all the variants have the same locations (ATTRIBUTE_POSITION, ...),
+ * so one vertex array object serves every variant of its vertex shader.
+ */
+class ShaderVariants
+{
+public:
+  enum {
+    RUNTIME = -1, ///< feature left undefined, decided by a uniform in the shader
+
+    ATTRIBUTE_POSITION = 0,
+    ATTRIBUTE_NORMAL = 1,
+    ATTRIBUTE_TEXCOORD = 2,
+    ATTRIBUTE_DRAW_ID = 3   ///< index of the draw in the indirect submission (see RenderQueue)
+  };
+
+  /// features of one variant, each 0/1 (a count for spotLights) or RUNTIME
+  struct Features
+  {
+    int textured;
+    int spotLights;
+    int sun;
+    int clustered;
+    int indirect;
+
+    /// everything decided at runtime, the same as the shader without any defines
+    Features(): textured(RUNTIME), spotLights(RUNTIME), sun(RUNTIME), clustered(RUNTIME), indirect(RUNTIME) {}
+
+    /// key of the variant, a part of its name in the ShaderManager
+    std::string key() const;
+    /// the #define lines
+    std::string defines() const;
+  };
+
+  /// variants used by all scene nodes
+  static ShaderVariants * Instance();
+
+  /// the variant, compiled if nobody has it yet, release() it when done
+  /// (a variant which does not build ends the program, the scene cannot be drawn without it)
+  MeshShaderProgram * get(const std::string & vertex_file, const std::string & fragment_file, const Features & features);
+  void release(MeshShaderProgram * program);
+
+  /// the variant of the same files and features with indirect on, NULL if the program is not a variant, release() it when done
+  MeshShaderProgram * indirect(MeshShaderProgram * program);
+
+  /// features the same for the whole scene (lights and sun), the nodes add their own ones to them
+  void setSceneFeatures(const Features & features) { m_sceneFeatures = features; }
+  const Features & sceneFeatures() const { return m_sceneFeatures; }
+
+  /// compiles all the variants again from the files, the program objects stay the same,
+  /// a variant which does not build keeps its old program
+  void reload();
+
+  /// number of variants compiled so far
+  unsigned compiled() const { return m_compiled; }
+
+protected:
+  ShaderVariants();
+
+  struct Variant
+  {
+    std::string vertexFile;
+    std::string fragmentFile;
+    Features features;
+    MeshShaderProgram * program;
+  };
+
+  /// links the variant, 0 (with the reason on stderr) if the files cannot be read, compiled or linked
+  GLuint compile(const Variant & variant);
+
+  static ShaderVariants * m_instance;
+
+  /// living variants by their names in the ShaderManager
+  std::map<std::string, Variant> m_variants;
+  Features m_sceneFeatures;
+  unsigned m_compiled;
+};
+
+#endif // SHADERVARIANTS_H
@@ -0,0 +1,270 @@
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "TaskPool.h"
+
+namespace {
+
+// thin wrappers over the platform threading primitives
+
+#ifdef _WIN32
+
+class Mutex
+{
+public:
+  Mutex() { InitializeCriticalSection(&m_cs); }
+  ~Mutex() { DeleteCriticalSection(&m_cs); }
+  void lock() { EnterCriticalSection(&m_cs); }
+  void unlock() { LeaveCriticalSection(&m_cs); }
+  CRITICAL_SECTION m_cs;
+};
+
+class Condition
+{
+public:
+  Condition() { InitializeConditionVariable(&m_cv); }
+  void wait(Mutex & mutex) { SleepConditionVariableCS(&m_cv, &mutex.m_cs, INFINITE); }
+  void broadcast() { WakeAllConditionVariable(&m_cv); }
+  CONDITION_VARIABLE m_cv;
+};
+
+typedef HANDLE ThreadHandle;
+
+long atomicIncrement(volatile long * value) { return InterlockedIncrement(value); }
+long atomicDecrement(volatile long * value) { return InterlockedDecrement(value); }
+long atomicRead(volatile long * value) { return InterlockedCompareExchange(value, 0, 0); }
+
+#else
+
+class Mutex
+{
+public:
+  Mutex() { pthread_mutex_init(&m_mutex, NULL); }
+  ~Mutex() { pthread_mutex_destroy(&m_mutex); }
+  void lock() { pthread_mutex_lock(&m_mutex); }
+  void unlock() { pthread_mutex_unlock(&m_mutex); }
+  pthread_mutex_t m_mutex;
+};
+
+class Condition
+{
+public:
+  Condition() { pthread_cond_init(&m_cond, NULL); }
+  ~Condition() { pthread_cond_destroy(&m_cond); }
+  void wait(Mutex & mutex) { pthread_cond_wait(&m_cond, &mutex.m_mutex); }
+  void broadcast() { pthread_cond_broadcast(&m_cond); }
+  pthread_cond_t m_cond;
+};
+
+typedef pthread_t ThreadHandle;
+
+long atomicIncrement(volatile long * value) { return __sync_add_and_fetch(value, 1); }
+long atomicDecrement(volatile long * value) { return __sync_sub_and_fetch(value, 1); }
+long atomicRead(volatile long * value) { return __sync_fetch_and_add(value, 0); }
+
+#endif
+
+}
+
+struct TaskPool::Sync
+{
+  Mutex lock;
+  Condition wake; ///< new tasks were queued or the pool is quitting
+  Condition done; ///< all tasks are finished
+};
+
+struct TaskPool::Worker
+{
+  TaskPool * pool;
+  unsigned index;
+  Mutex lock;
+  std::deque<Task*> tasks;
+  ThreadHandle thread;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI threadProc(LPVOID worker)
+{
+  TaskPool::workerLoop(static_cast<TaskPool::Worker*>(worker));
+  return 0;
+}
+#else
+static void * threadProc(void * worker)
+{
+  TaskPool::workerLoop(static_cast<TaskPool::Worker*>(worker));
+  return NULL;
+}
+#endif
+
+unsigned TaskPool::processorCount()
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? unsigned(count) : 1;
+#endif
+}
+
+TaskPool::TaskPool(unsigned threads):
+  m_next(0), m_sync(new Sync()), m_pending(0), m_queued(0), m_quit(false)
+{
+  if(threads == 0)
+    threads = processorCount() > 1 ? processorCount() - 1 : 1;
+
+  for(unsigned i = 0; i <= threads; i++)
+  {
+    Worker * worker = new Worker();
+    worker->pool = this;
+    worker->index = i;
+    m_workers.push_back(worker);
+  }
+
+  // the last queue is served by the thread calling wait()
+  for(unsigned i = 0; i < threads; i++)
+  {
+#ifdef _WIN32
+    m_workers[i]->thread = CreateThread(NULL, 0, threadProc, m_workers[i], 0, NULL);
+#else
+    pthread_create(&m_workers[i]->thread, NULL, threadProc, m_workers[i]);
+#endif
+  }
+}
+
+TaskPool::~TaskPool()
+{
+  m_sync->lock.lock();
+  m_quit = true;
+  m_sync->wake.broadcast();
+  m_sync->lock.unlock();
+
+  for(unsigned i = 0; i + 1 < m_workers.size(); i++)
+  {
+#ifdef _WIN32
+    WaitForSingleObject(m_workers[i]->thread, INFINITE);
+    CloseHandle(m_workers[i]->thread);
+#else
+    pthread_join(m_workers[i]->thread, NULL);
+#endif
+  }
+
+  for(unsigned i = 0; i < m_workers.size(); i++)
+    delete m_workers[i];
+  delete m_sync;
+}
+
+void TaskPool::submit(Task * task)
+{
+  atomicIncrement(&m_pending);
+
+  // counted before it is visible, a worker may spin shortly but never sleeps over a task
+  m_sync->lock.lock();
+  atomicIncrement(&m_queued);
+  m_sync->wake.broadcast();
+  m_sync->lock.unlock();
+
+  Worker * worker = m_workers[m_next++ % m_workers.size()];
+  worker->lock.lock();
+  worker->tasks.push_back(task);
+  worker->lock.unlock();
+}
+
+TaskPool::Task * TaskPool::take(unsigned index)
+{
+  Task * task = NULL;
+
+  // own queue from the back - the most recently submitted task
+  Worker * own = m_workers[index];
+  own->lock.lock();
+  if(!own->tasks.empty())
+  {
+    task = own->tasks.back();
+    own->tasks.pop_back();
+  }
+  own->lock.unlock();
+
+  // steal from the front of the others
+  for(unsigned k = 1; task == NULL && k < m_workers.size(); k++)
+  {
+    Worker * victim = m_workers[(index + k) % m_workers.size()];
+    victim->lock.lock();
+    if(!victim->tasks.empty())
+    {
+      task = victim->tasks.front();
+      victim->tasks.pop_front();
+    }
+    victim->lock.unlock();
+  }
+
+  if(task != NULL)
+    atomicDecrement(&m_queued);
+  return task;
+}
+
+void TaskPool::execute(Task * task)
+{
+  task->run();
+
+  if(atomicDecrement(&m_pending) == 0)
+  {
+    m_sync->lock.lock();
+    m_sync->done.broadcast();
+    m_sync->lock.unlock();
+  }
+}
+
+void TaskPool::workerLoop(Worker * worker)
+{
+  TaskPool * pool = worker->pool;
+
+  for(;;)
+  {
+    Task * task = pool->take(worker->index);
+    if(task != NULL)
+    {
+      pool->execute(task);
+      continue;
+    }
+
+    pool->m_sync->lock.lock();
+    while(!pool->m_quit && atomicRead(&pool->m_queued) <= 0)
+      pool->m_sync->wake.wait(pool->m_sync->lock);
+    bool quit = pool->m_quit;
+    pool->m_sync->lock.unlock();
+
+    if(quit)
+      return;
+  }
+}
+
+void TaskPool::wait()
+{
+  const unsigned self = m_workers.size() - 1;
+
+  for(;;)
+  {
+    Task * task = take(self);
+    if(task != NULL)
+    {
+      execute(task);
+      continue;
+    }
+
+    // nothing left to take, the rest is running on the workers
+    m_sync->lock.lock();
+    while(atomicRead(&m_pending) > 0 && atomicRead(&m_queued) <= 0)
+      m_sync->done.wait(m_sync->lock);
+    bool finished = atomicRead(&m_pending) <= 0;
+    m_sync->lock.unlock();
+
+    if(finished)
+      return;
+  }
+}
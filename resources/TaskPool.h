@@ -0,0 +1,75 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <deque>
+#include <vector>
+
+/** Pool of worker threads running independent tasks
+ *
+ * Every worker owns a queue of tasks. It takes tasks from the back of its own
+ * queue and when that is empty, it steals from the front of the others, so the
+ * load is balanced even if the tasks differ in size. The thread calling wait()
+ * helps with the work until all submitted tasks are finished.
+ *
+ * Tasks must not make any OpenGL calls, the context belongs to the main thread.
+ */
+class TaskPool
+{
+public:
+  /// unit of work, must stay alive until wait() returns
+  class Task
+  {
+  public:
+    virtual ~Task() {}
+    virtual void run() = 0;
+  };
+
+  /// starts the workers, 0 means one less than the number of cores (the waiting thread works too)
+  explicit TaskPool(unsigned threads = 0);
+  /// stops and joins the workers
+  ~TaskPool();
+
+  /// number of threads working on the tasks including the one calling wait()
+  unsigned concurrency() const { return m_workers.size(); }
+
+  /// queues the task, it may start running immediately
+  void submit(Task * task);
+
+  /// runs queued tasks on the calling thread too and returns when all of them are finished
+  void wait();
+
+  /// number of logical processors
+  static unsigned processorCount();
+
+  struct Worker;
+  /// body of the worker threads
+  static void workerLoop(Worker * worker);
+
+protected:
+  /// takes a task from the back of own queue or steals one from the others, NULL if there is none
+  Task * take(unsigned worker);
+
+  /// runs the task and accounts for it
+  void execute(Task * task);
+
+  /// task queues, the last one belongs to the thread calling wait() and has no thread of its own
+  std::vector<Worker*> m_workers;
+  /// worker receiving the next submitted task
+  unsigned m_next;
+
+  struct Sync;
+  /// platform specific mutexes and conditions
+  Sync * m_sync;
+
+  /// tasks submitted and not finished yet
+  volatile long m_pending;
+  /// tasks sitting in the queues
+  volatile long m_queued;
+  bool m_quit;
+
+private:
+  TaskPool(const TaskPool &);
+  TaskPool & operator=(const TaskPool &);
+};
+
+#endif // TASKPOOL_H
@@ -0,0 +1,219 @@
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "TerrainGeometry.h"
+#include "Resources.h"
+
+namespace {
+
+/// point of the tile grid, t is the position along the edge being stitched
+struct GridPoint
+{
+  unsigned x, z, t;
+};
+
+} // anonymous namespace
+
+TerrainGeometry::TerrainGeometry():
+  m_tilesX(0), m_tilesZ(0), m_tileQuads(0), m_levelCount(0)
+{
+}
+
+/// adds the triangle with the normal pointing up (+y), degenerate ones are dropped
+static void addTriangle(std::vector<GLuint> & indices, unsigned row, const GridPoint & a, const GridPoint & b, const GridPoint & c)
+{
+  int cross = (int(b.z) - int(a.z)) * (int(c.x) - int(a.x)) - (int(b.x) - int(a.x)) * (int(c.z) - int(a.z));
+  if(cross == 0)
+    return;
+  indices.push_back(a.z * row + a.x);
+  if(cross > 0)
+  {
+    indices.push_back(b.z * row + b.x);
+    indices.push_back(c.z * row + c.x);
+  }
+  else
+  {
+    indices.push_back(c.z * row + c.x);
+    indices.push_back(b.z * row + b.x);
+  }
+}
+
+void TerrainGeometry::buildPattern(unsigned level, unsigned stitched, std::vector<GLuint> & indices) const
+{
+  const unsigned n = m_tileQuads;
+  const unsigned step = 1 << level;
+  const unsigned row = n + 1;
+
+  // regular grid inside, one step away from the edges
+  for(unsigned z = step; z + 2*step <= n; z += step)
+  {
+    for(unsigned x = step; x + 2*step <= n; x += step)
+    {
+      GridPoint p00 = { x, z, 0 }, p10 = { x + step, z, 0 }, p01 = { x, z + step, 0 }, p11 = { x + step, z + step, 0 };
+      addTriangle(indices, row, p00, p01, p10);
+      addTriangle(indices, row, p10, p01, p11);
+    }
+  }
+
+  // every edge is a strip zipping the outer line (step or twice the step if stitched)
+  // with the inner line (the border of the regular grid), the strips meet in the corners
+  const unsigned edges[] = { EDGE_MIN_X, EDGE_MAX_X, EDGE_MIN_Z, EDGE_MAX_Z };
+  for(unsigned e = 0; e < 4; e++)
+  {
+    const bool alongX = edges[e] == EDGE_MIN_Z || edges[e] == EDGE_MAX_Z;
+    const bool atMax = edges[e] == EDGE_MAX_X || edges[e] == EDGE_MAX_Z;
+    const unsigned outerLine = atMax ? n : 0;
+    const unsigned innerLine = atMax ? n - step : step;
+    const unsigned outerStep = (stitched & edges[e]) ? 2*step : step;
+
+    std::vector<GridPoint> outer, inner;
+    for(unsigned t = 0; t <= n; t += outerStep)
+    {
+      GridPoint p = { alongX ? t : outerLine, alongX ? outerLine : t, t };
+      outer.push_back(p);
+    }
+    for(unsigned t = step; t <= n - step; t += step)
+    {
+      GridPoint p = { alongX ? t : innerLine, alongX ? innerLine : t, t };
+      inner.push_back(p);
+    }
+
+    unsigned i = 0, j = 0;
+    while(i + 1 < outer.size() || j + 1 < inner.size())
+    {
+      if(j + 1 == inner.size() || (i + 1 < outer.size() && outer[i + 1].t <= inner[j + 1].t))
+      {
+        addTriangle(indices, row, outer[i], outer[i + 1], inner[j]);
+        i++;
+      }
+      else
+      {
+        addTriangle(indices, row, outer[i], inner[j + 1], inner[j]);
+        j++;
+      }
+    }
+  }
+}
+
+TerrainGeometry * TerrainGeometry::LoadRawHeightMap(const std::string & path, unsigned tileQuads, VertexFormat format)
+{
+  if(tileQuads < 2 || (tileQuads & (tileQuads - 1)) != 0)
+  {
+    std::cerr << "TerrainGeometry::LoadRawHeightMap(): tile size " << tileQuads << " is not a power of two" << std::endl;
+    return NULL;
+  }
+
+  int resX = 0, resZ = 0;
+  std::vector<float> vertices, normals, texCoords;
+  if(!ReadRawHeightMap(path, resX, resZ, vertices, normals, texCoords))
+    return NULL;
+
+  if((resX - 1) % tileQuads != 0 || (resZ - 1) % tileQuads != 0)
+  {
+    std::cerr << "TerrainGeometry::LoadRawHeightMap(): tile size " << tileQuads << " does not divide the map " << resX << "x" << resZ << std::endl;
+    return NULL;
+  }
+
+  char file[256];
+  sprintf(file, "%s.tga", path.c_str());
+  std::cout << "Loading terrain texture " << file << " [" << resX << "x" << resZ << "] ";
+  std::cout.flush();
+
+  GLuint texture = TextureManager::Instance()->get(file);
+
+  TerrainGeometry * terrain = new TerrainGeometry();
+  terrain->m_tileQuads = tileQuads;
+  terrain->m_tilesX = (resX - 1) / tileQuads;
+  terrain->m_tilesZ = (resZ - 1) / tileQuads;
+  terrain->m_levelCount = 0;
+  while((2u << terrain->m_levelCount) <= tileQuads && terrain->m_levelCount < MAX_LEVELS)
+    terrain->m_levelCount++;
+
+  // vertices of every tile together, the shared edges are duplicated
+  const unsigned row = tileQuads + 1;
+  const unsigned tileVertices = row * row;
+  const unsigned tileCount = terrain->m_tilesX * terrain->m_tilesZ;
+  std::vector<float> tileVertexData(3 * tileVertices * tileCount);
+  std::vector<float> tileNormals(3 * tileVertices * tileCount);
+  std::vector<float> tileTexCoords(2 * tileVertices * tileCount);
+  std::vector<float> heights(tileVertices);
+
+  terrain->m_tiles.resize(tileCount);
+  for(unsigned tz = 0; tz < terrain->m_tilesZ; tz++)
+  {
+    for(unsigned tx = 0; tx < terrain->m_tilesX; tx++)
+    {
+      const unsigned base = terrain->tileBaseVertex(tx, tz);
+      Tile & tile = terrain->m_tiles[tz * terrain->m_tilesX + tx];
+
+      for(unsigned z = 0; z < row; z++)
+      {
+        for(unsigned x = 0; x < row; x++)
+        {
+          const unsigned source = (tz * tileQuads + z) * resX + tx * tileQuads + x;
+          const unsigned target = base + z * row + x;
+          std::copy(&vertices[3*source], &vertices[3*source] + 3, &tileVertexData[3*target]);
+          std::copy(&normals[3*source], &normals[3*source] + 3, &tileNormals[3*target]);
+          std::copy(&texCoords[2*source], &texCoords[2*source] + 2, &tileTexCoords[2*target]);
+          heights[z * row + x] = vertices[3*source + 1];
+
+          const glm::vec3 position(vertices[3*source], vertices[3*source + 1], vertices[3*source + 2]);
+          if(x == 0 && z == 0)
+            tile.min = tile.max = position;
+          tile.min = glm::min(tile.min, position);
+          tile.max = glm::max(tile.max, position);
+        }
+      }
+
+      // error of every level: the height of each vertex against the triangles of the level
+      for(unsigned level = 0; level < MAX_LEVELS; level++)
+        tile.error[level] = 0.0f;
+      for(unsigned level = 1; level < terrain->m_levelCount; level++)
+      {
+        const unsigned step = 1 << level;
+        float error = tile.error[level - 1];
+        for(unsigned z = 0; z < row; z++)
+        {
+          for(unsigned x = 0; x < row; x++)
+          {
+            const unsigned x0 = std::min(x / step * step, tileQuads - step);
+            const unsigned z0 = std::min(z / step * step, tileQuads - step);
+            const float u = float(x - x0) / step, v = float(z - z0) / step;
+            const float h00 = heights[z0 * row + x0], h10 = heights[z0 * row + x0 + step];
+            const float h01 = heights[(z0 + step) * row + x0], h11 = heights[(z0 + step) * row + x0 + step];
+            // the cells are split by the diagonal from (x0 + step, z0) to (x0, z0 + step)
+            const float h = u + v <= 1.0f ? h00 + u * (h10 - h00) + v * (h01 - h00)
+                                          : h11 + (1.0f - u) * (h01 - h11) + (1.0f - v) * (h10 - h11);
+            error = std::max(error, float(fabs(heights[z * row + x] - h)));
+          }
+        }
+        tile.error[level] = error;
+      }
+    }
+  }
+
+  // all the patterns, each of them a submesh with the material of the terrain
+  std::vector<GLuint> indices;
+  terrain->m_subMeshList.resize(terrain->m_levelCount * EDGE_COMBINATIONS);
+  for(unsigned level = 0; level < terrain->m_levelCount; level++)
+  {
+    for(unsigned stitched = 0; stitched < EDGE_COMBINATIONS; stitched++)
+    {
+      SubMesh & subMesh = terrain->m_subMeshList[level * EDGE_COMBINATIONS + stitched];
+      SetTerrainMaterial(subMesh, texture);
+      subMesh.startIndex = indices.size();
+      subMesh.baseVertex = 0;
+      terrain->buildPattern(level, stitched, indices);
+      subMesh.nIndices = indices.size() - subMesh.startIndex;
+    }
+  }
+
+  terrain->setMesh(tileVertices * tileCount, &tileVertexData[0], &tileNormals[0], &tileTexCoords[0], indices.size(), &indices[0], format);
+
+  std::cout << "terrain split to " << terrain->m_tilesX << "x" << terrain->m_tilesZ << " tiles of " << tileQuads << "x" << tileQuads
+            << " quads, " << terrain->m_levelCount << " levels" << std::endl;
+
+  return terrain;
+}
@@ -0,0 +1,71 @@
+#ifndef TERRAINGEOMETRY_H
+#define TERRAINGEOMETRY_H
+
+#include <vector>
+
+#include "pgr.h"
+#include "MeshGeometry.h"
+
+/** Heightmap split to square tiles with several levels of detail each (geomipmapping)
+ *
+ * Every tile has its own (tileQuads + 1)^2 vertices in the vertex buffer, tile after tile,
+ * so the index patterns are shared by all the tiles: a pattern is drawn with the base vertex
+ * of the tile. Level l uses every 2^l-th vertex of the tile.
+ *
+ * There is a pattern for every level and every combination of the tile edges whose
+ * neighbour is one level coarser. Those edges skip every other vertex of the level,
+ * so the neighbours share the edge and no cracks appear. Levels of neighbours
+ * therefore must not differ by more than one, see TerrainNode.
+ *
+ * The patterns are the submeshes, pattern(level, stitched) returns the right one.
+ */
+class TerrainGeometry : public MeshGeometry
+{
+public:
+  /// edges of the tile in the stitching mask
+  enum Edge { EDGE_MIN_X = 1, EDGE_MAX_X = 2, EDGE_MIN_Z = 4, EDGE_MAX_Z = 8 };
+  static const unsigned EDGE_COMBINATIONS = 16;
+  static const unsigned MAX_LEVELS = 16;
+
+  struct Tile
+  {
+    /// bounding box in the space of the mesh
+    glm::vec3 min;
+    glm::vec3 max;
+    /// the largest height difference between the full resolution and the level, in the space of the mesh
+    float error[MAX_LEVELS];
+  };
+
+  /** loads the heightmap (see MeshGeometry::LoadRawHeightMap()) and splits it
+   *
+   * tileQuads must be a power of two dividing the resolution of the map minus one
+   * (32 or 64 for the 513 x 513 terrain), NULL otherwise.
+   */
+  static TerrainGeometry * LoadRawHeightMap(const std::string & path, unsigned tileQuads = 64, VertexFormat format = FORMAT_PACKED_QUANTIZED);
+
+  unsigned tilesX() const { return m_tilesX; }
+  unsigned tilesZ() const { return m_tilesZ; }
+  unsigned tileQuads() const { return m_tileQuads; }
+  unsigned levelCount() const { return m_levelCount; }
+
+  /// tile x, z, row by row
+  const Tile & tile(unsigned x, unsigned z) const { return m_tiles[z * m_tilesX + x]; }
+  GLuint tileBaseVertex(unsigned x, unsigned z) const { return (z * m_tilesX + x) * (m_tileQuads + 1) * (m_tileQuads + 1); }
+
+  /// indices of the level with the edges in the stitched mask (Edge bits) matching one level coarser
+  const SubMesh * pattern(unsigned level, unsigned stitched) const { return &m_subMeshList[level * EDGE_COMBINATIONS + stitched]; }
+
+protected:
+  TerrainGeometry();
+
+  /// appends the triangles of one pattern to the indices
+  void buildPattern(unsigned level, unsigned stitched, std::vector<GLuint> & indices) const;
+
+  unsigned m_tilesX;
+  unsigned m_tilesZ;
+  unsigned m_tileQuads;
+  unsigned m_levelCount;
+  std::vector<Tile> m_tiles;
+};
+
+#endif // TERRAINGEOMETRY_H
@@ -0,0 +1,150 @@
+
+#include <cstring>
+#include <algorithm>
+
+#include "TerrainNode.h"
+#include "TerrainGeometry.h"
+#include "ShaderProgram.h"
+#include "Frustum.h"
+#include "GLState.h"
+
+TerrainNode::TerrainNode(const std::string &name, SceneNode* parent):
+  MeshNode(name, parent), m_terrain(NULL), m_pixelError(2.0f), m_viewportHeight(0)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void TerrainNode::setGeometry(TerrainGeometry* terrain)
+{
+  // the tiles are culled by the node itself, the mesh has no box in the culling of the scene
+  setMesh(terrain);
+  m_terrain = terrain;
+  if(m_terrain != NULL)
+    m_levels.assign(m_terrain->tilesX() * m_terrain->tilesZ(), 0);
+}
+
+void TerrainNode::selectLevels(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
+{
+  const glm::mat4 VMmatrix = view_matrix * globalMatrix();
+  const glm::vec3 camera = glm::vec3(glm::inverse(VMmatrix) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+  // the errors are vertical, in the space of the mesh
+  const float errorScale = glm::length(glm::vec3(globalMatrix() * glm::vec4(0.0f, 1.0f, 0.0f, 0.0f)));
+  if(m_viewportHeight == 0)
+  {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    m_viewportHeight = viewport[3];
+  }
+  // pixels covered by a unit long segment in the distance of 1
+  const float pixelsPerUnit = projection_matrix[1][1] * m_viewportHeight * 0.5f;
+  const float limit = m_pixelError / (errorScale * pixelsPerUnit);
+
+  const unsigned tilesX = m_terrain->tilesX();
+  const unsigned tilesZ = m_terrain->tilesZ();
+  for(unsigned z = 0; z < tilesZ; z++)
+  {
+    for(unsigned x = 0; x < tilesX; x++)
+    {
+      const TerrainGeometry::Tile & tile = m_terrain->tile(x, z);
+      const glm::vec3 closest = glm::clamp(camera, tile.min, tile.max);
+      const float distance = std::max(glm::length(glm::vec3(VMmatrix * glm::vec4(closest, 1.0f))), 1e-3f);
+
+      // error / distance * pixelsPerUnit * errorScale <= pixel error
+      unsigned level = 0;
+      while(level + 1 < m_terrain->levelCount() && tile.error[level + 1] <= limit * distance)
+        level++;
+      m_levels[z * tilesX + x] = level;
+    }
+  }
+
+  // a tile can only be stitched to a neighbour one level coarser, refine the others
+  bool changed = true;
+  while(changed)
+  {
+    changed = false;
+    for(unsigned z = 0; z < tilesZ; z++)
+    {
+      for(unsigned x = 0; x < tilesX; x++)
+      {
+        unsigned & level = m_levels[z * tilesX + x];
+        unsigned finest = level;
+        if(x > 0)          finest = std::min(finest, m_levels[z * tilesX + x - 1] + 1);
+        if(x + 1 < tilesX) finest = std::min(finest, m_levels[z * tilesX + x + 1] + 1);
+        if(z > 0)          finest = std::min(finest, m_levels[(z - 1) * tilesX + x] + 1);
+        if(z + 1 < tilesZ) finest = std::min(finest, m_levels[(z + 1) * tilesX + x] + 1);
+        if(finest != level)
+        {
+          level = finest;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+void TerrainNode::draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix)
+{
+  // inherited draw - draws all children
+  SceneNode::draw(view_matrix, projection_matrix);
+
+  memset(&m_stats, 0, sizeof(m_stats));
+  if(m_terrain == NULL)
+    return;
+
+  selectLevels(view_matrix, projection_matrix);
+
+  GLState::Instance()->polygonMode(GL_FILL);
+
+  // view, projection and time are in the Frame block (FrameUniforms), only the per-object data is set here
+  const glm::mat4 & Mmatrix = globalMatrix();
+  // all the patterns share the material of the terrain
+  const MeshGeometry::SubMesh * material = m_terrain->pattern(0, 0);
+  MeshShaderProgram * program = programFor(material);
+  GLState::Instance()->useProgram(program->m_programId);
+  GLState::Instance()->uniformMatrix4fv(program->m_Mmatrix, glm::value_ptr(Mmatrix));
+  glm::mat4 NormalMatrix = glm::transpose(glm::inverse(view_matrix * Mmatrix));
+  GLState::Instance()->uniformMatrix4fv(program->m_NormalMatrix, glm::value_ptr(NormalMatrix));
+  GLState::Instance()->uniform3fv(program->m_positionOffset, 1, glm::value_ptr(m_terrain->getPositionOffset()));
+  GLState::Instance()->uniform3fv(program->m_positionScale,  1, glm::value_ptr(m_terrain->getPositionScale()));
+
+  GLState::Instance()->uniform3fv(program->m_diffuse,  1, material->diffuse);
+  GLState::Instance()->uniform3fv(program->m_ambient,  1, material->ambient);
+  GLState::Instance()->uniform3fv(program->m_specular, 1, material->specular);
+  GLState::Instance()->uniform1f(program->m_shininess,    material->shininess);
+  if(program == m_texturedProgram) {
+    GLState::Instance()->bindTexture(GL_TEXTURE0 + 0, GL_TEXTURE_2D, material->textureID);
+  }
+
+  GLState::Instance()->bindVertexArray( m_terrain->getVertexArray() );
+
+  const Frustum frustum(projection_matrix * view_matrix * Mmatrix);
+  const unsigned tilesX = m_terrain->tilesX();
+  const unsigned tilesZ = m_terrain->tilesZ();
+  for(unsigned z = 0; z < tilesZ; z++)
+  {
+    for(unsigned x = 0; x < tilesX; x++)
+    {
+      const TerrainGeometry::Tile & tile = m_terrain->tile(x, z);
+      if(!frustum.intersects(tile.min, tile.max)) {
+        m_stats.culled++;
+        continue;
+      }
+
+      // edges towards coarser neighbours skip every other vertex
+      const unsigned level = m_levels[z * tilesX + x];
+      unsigned stitched = 0;
+      if(x > 0 && m_levels[z * tilesX + x - 1] > level)          stitched |= TerrainGeometry::EDGE_MIN_X;
+      if(x + 1 < tilesX && m_levels[z * tilesX + x + 1] > level) stitched |= TerrainGeometry::EDGE_MAX_X;
+      if(z > 0 && m_levels[(z - 1) * tilesX + x] > level)          stitched |= TerrainGeometry::EDGE_MIN_Z;
+      if(z + 1 < tilesZ && m_levels[(z + 1) * tilesX + x] > level) stitched |= TerrainGeometry::EDGE_MAX_Z;
+
+      const MeshGeometry::SubMesh * pattern = m_terrain->pattern(level, stitched);
+      glDrawElementsBaseVertex(GL_TRIANGLES, pattern->nIndices, m_terrain->getIndexType(),
+                               m_terrain->getIndexOffset(*pattern), m_terrain->getFirstVertex() + m_terrain->tileBaseVertex(x, z));
+
+      m_stats.tiles++;
+      m_stats.triangles += pattern->nIndices / 3;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef TERRAINNODE_H
+#define TERRAINNODE_H
+
+#include <vector>
+
+#include "pgr.h"
+#include "MeshNode.h"
+
+class TerrainGeometry;
+
+/** Draws the tiles of a TerrainGeometry in the view, each at its own level of detail
+ *
+ * The level of every tile is the coarsest one whose error, projected to the screen from
+ * the closest point of the tile, stays under pixelError(). Levels of neighbouring tiles are
+ * then limited to differ by one at most and the finer tile of such a pair uses the pattern
+ * stitched to the coarser neighbour. Tiles outside the view frustum are not drawn.
+ *
+ * The number of triangles thus depends on the view and the error limit, not on the size
+ * of the map.
+ */
+class TerrainNode : public MeshNode
+{
+public:
+  /// what the last draw() did
+  struct Stats
+  {
+    unsigned tiles;      ///< tiles in the frustum
+    unsigned culled;     ///< tiles outside of it
+    unsigned triangles;
+  };
+
+  TerrainNode(const std::string & name = "<TerrainNode>", SceneNode* parent = NULL);
+
+  /// associates the terrain with this node (also calls loadProgram())
+  void setGeometry(TerrainGeometry* terrain);
+
+  /// allowed error of the terrain on the screen, in pixels
+  void setPixelError(float pixels) { m_pixelError = pixels; }
+  float pixelError() const { return m_pixelError; }
+  /// height of the viewport the error is measured in, from reshape(), the viewport at the first draw until then
+  void setViewportHeight(int pixels) { m_viewportHeight = pixels; }
+
+  /// reimplemented draw
+  void draw(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+
+  const Stats & stats() const { return m_stats; }
+
+protected:
+  /// levels of all the tiles for the camera, neighbours differing by one at most
+  void selectLevels(const glm::mat4 & view_matrix, const glm::mat4 & projection_matrix);
+
+  TerrainGeometry * m_terrain;
+  float m_pixelError;
+  int m_viewportHeight;
+  /// level of every tile, row by row
+  std::vector<unsigned> m_levels;
+  Stats m_stats;
+};
+
+#endif // TERRAINNODE_H
@@ -0,0 +1,316 @@
+
+#include <algorithm>
+
+#include "TransformHierarchy.h"
+#include "SceneNode.h"
+#include "TaskPool.h"
+
+/// smaller subtrees are not worth the synchronization of the parallel update
+static const unsigned PARALLEL_MIN_NODES = 4096;
+
+/// calls animate() for a range of slots on a thread of the pool
+struct TransformHierarchy::AnimateTask: public TaskPool::Task
+{
+  TransformHierarchy * hierarchy;
+  unsigned first, last;
+
+  void run() { hierarchy->animateRange(first, last); }
+};
+
+/// calculates global matrices of a range of sibling subtrees on a thread of the pool
+struct TransformHierarchy::PropagateTask: public TaskPool::Task
+{
+  TransformHierarchy * hierarchy;
+  unsigned first, last;
+  unsigned recalculated;
+
+  void run() { recalculated = hierarchy->propagateRange(first, last); }
+};
+
+TransformHierarchy * TransformHierarchy::m_instance = 0;
+
+TransformHierarchy * TransformHierarchy::Instance()
+{
+  if(m_instance == 0)
+    m_instance = new TransformHierarchy();
+  return m_instance;
+}
+
+TransformHierarchy::TransformHierarchy():
+  m_orderValid(true), m_time(0.0), m_pass(0), m_recalculated(0), m_pool(NULL), m_deferMarking(false)
+{
+}
+
+unsigned TransformHierarchy::addNode(SceneNode * node)
+{
+  // a new root at the end does not break the depth first order
+  m_nodes.push_back(node);
+  m_parent.push_back(-1);
+  m_subtreeSize.push_back(1);
+  m_animated.push_back(0);
+  m_dirty.push_back(DIRTY_LOCAL);
+  m_stamp.push_back(0);
+  m_local.push_back(glm::mat4(1.0f));
+  m_global.push_back(glm::mat4(1.0f));
+  return m_nodes.size() - 1;
+}
+
+void TransformHierarchy::removeNode(unsigned index)
+{
+  m_nodes[index] = NULL;
+  m_orderValid = false;
+}
+
+void TransformHierarchy::setParent(unsigned index, int parent)
+{
+  if(m_parent[index] == parent)
+    return;
+
+  // Common case while building the scene - new leaf attached to a parent whose
+  // subtree ends at the end of the arrays, appending keeps the order valid.
+  // Anything else is resolved by rebuilding the order before the next update.
+  if(m_orderValid && m_parent[index] < 0 && parent >= 0 && index == m_nodes.size() - 1 && m_subtreeSize[index] == 1
+     && parent + m_subtreeSize[parent] == index)
+  {
+    m_parent[index] = parent;
+    for(int p = parent; p >= 0; p = m_parent[p])
+      m_subtreeSize[p]++;
+    markDirty(index);
+    return;
+  }
+
+  m_parent[index] = parent;
+  m_orderValid = false;
+}
+
+void TransformHierarchy::setAnimated(unsigned index, bool animated)
+{
+  m_animated[index] = animated ? 1 : 0;
+}
+
+void TransformHierarchy::rebuildOrder()
+{
+  std::vector<SceneNode*> nodes;
+  std::vector<unsigned> oldIndex;
+  nodes.reserve(m_nodes.size());
+  oldIndex.reserve(m_nodes.size());
+
+  // depth first traversal from every root, children in the order of SceneNode::m_children
+  std::vector<SceneNode*> stack;
+  for(unsigned i = 0; i < m_nodes.size(); i++)
+  {
+    if(m_nodes[i] == NULL || m_nodes[i]->parentNode() != NULL)
+      continue;
+
+    stack.push_back(m_nodes[i]);
+    while(!stack.empty())
+    {
+      SceneNode * node = stack.back();
+      stack.pop_back();
+      nodes.push_back(node);
+      oldIndex.push_back(node->m_index);
+      // reversed, so the first child is popped first
+      for(SceneNode::Children::reverse_iterator it = node->m_children.rbegin(); it != node->m_children.rend(); ++it)
+        if(*it)
+          stack.push_back(*it);
+    }
+  }
+
+  unsigned count = nodes.size();
+  std::vector<int> parent(count, -1);
+  std::vector<unsigned> subtreeSize(count, 1);
+  std::vector<unsigned char> animated(count);
+  // the nodes may have been moved under another parent, recalculate everything
+  std::vector<unsigned char> dirty(count, DIRTY_LOCAL | DIRTY_CHILD);
+  std::vector<unsigned> stamp(count, 0);
+  std::vector<glm::mat4> local(count);
+  std::vector<glm::mat4> global(count);
+
+  for(unsigned i = 0; i < count; i++)
+  {
+    nodes[i]->m_index = i;
+    animated[i] = m_animated[oldIndex[i]];
+    local[i] = m_local[oldIndex[i]];
+    global[i] = m_global[oldIndex[i]];
+    // parent precedes its children, so it is already renumbered
+    if(nodes[i]->parentNode() != NULL)
+      parent[i] = nodes[i]->parentNode()->m_index;
+  }
+
+  for(unsigned i = count; i-- > 0; )
+    if(parent[i] >= 0)
+      subtreeSize[parent[i]] += subtreeSize[i];
+
+  m_nodes.swap(nodes);
+  m_parent.swap(parent);
+  m_subtreeSize.swap(subtreeSize);
+  m_animated.swap(animated);
+  m_dirty.swap(dirty);
+  m_stamp.swap(stamp);
+  m_local.swap(local);
+  m_global.swap(global);
+  m_orderValid = true;
+}
+
+void TransformHierarchy::update(unsigned index, double elapsed_time)
+{
+  assert(m_orderValid);
+
+  m_time = elapsed_time;
+  m_pass++;
+
+  const unsigned end = index + m_subtreeSize[index];
+
+  if(m_pool != NULL && end - index >= PARALLEL_MIN_NODES)
+    updateParallel(index, end);
+  else
+    updateSerial(index, end);
+}
+
+void TransformHierarchy::animateRange(unsigned first, unsigned last)
+{
+  for(unsigned i = first; i < last; i++)
+    if(m_animated[i])
+      m_nodes[i]->animate(m_time);
+}
+
+bool TransformHierarchy::propagate(unsigned i)
+{
+  int p = m_parent[i];
+  // parent calculated after us - its global matrix changed
+  bool parentChanged = p >= 0 && m_stamp[p] > m_stamp[i];
+  bool changed = (m_dirty[i] & DIRTY_LOCAL) || parentChanged;
+
+  if(changed)
+  {
+    if(p >= 0)
+      m_global[i] = m_global[p] * m_local[i];
+    else
+      m_global[i] = m_local[i];
+    m_stamp[i] = m_pass;
+  }
+
+  m_dirty[i] = 0;
+  return changed;
+}
+
+unsigned TransformHierarchy::propagateRange(unsigned first, unsigned last)
+{
+  unsigned recalculated = 0;
+  for(unsigned i = first; i < last; i++)
+    if(propagate(i))
+      recalculated++;
+  return recalculated;
+}
+
+void TransformHierarchy::updateSerial(unsigned index, unsigned end)
+{
+  // animated nodes change their local matrices first
+  animateRange(index, end);
+
+  m_recalculated = 0;
+
+  // parents precede children, so one pass is enough
+  unsigned i = index;
+  while(i < end)
+  {
+    int p = m_parent[i];
+    if(m_dirty[i] == 0 && !(p >= 0 && m_stamp[p] > m_stamp[i]))
+    {
+      // nothing changed in the whole subtree
+      i += m_subtreeSize[i];
+      continue;
+    }
+
+    if(propagate(i))
+      m_recalculated++;
+    i++;
+  }
+}
+
+void TransformHierarchy::partition(unsigned index, unsigned grain, std::vector<unsigned> & serial, std::vector<unsigned> & ranges) const
+{
+  std::vector<unsigned> stack(1, index);
+  while(!stack.empty())
+  {
+    unsigned node = stack.back();
+    stack.pop_back();
+    serial.push_back(node);
+
+    // children of the node are contiguous sibling subtrees, collect them to runs of about grain nodes
+    const unsigned end = node + m_subtreeSize[node];
+    unsigned runStart = node + 1;
+    for(unsigned child = node + 1; child < end; child += m_subtreeSize[child])
+    {
+      if(m_subtreeSize[child] > grain)
+      {
+        // too big, split it further
+        if(runStart < child)
+        {
+          ranges.push_back(runStart);
+          ranges.push_back(child);
+        }
+        stack.push_back(child);
+        runStart = child + m_subtreeSize[child];
+      }
+      else if(child + m_subtreeSize[child] - runStart > grain)
+      {
+        ranges.push_back(runStart);
+        ranges.push_back(child);
+        runStart = child;
+      }
+    }
+
+    if(runStart < end)
+    {
+      ranges.push_back(runStart);
+      ranges.push_back(end);
+    }
+  }
+}
+
+void TransformHierarchy::updateParallel(unsigned index, unsigned end)
+{
+  const unsigned count = end - index;
+  const unsigned threads = m_pool->concurrency();
+
+  // 1) animate, any split of the slots will do, the nodes only touch themselves
+  const unsigned chunks = 4 * threads;
+  std::vector<AnimateTask> animateTasks(chunks);
+  m_deferMarking = true;
+  for(unsigned c = 0; c < chunks; c++)
+  {
+    animateTasks[c].hierarchy = this;
+    animateTasks[c].first = index + unsigned((unsigned long long)count * c / chunks);
+    animateTasks[c].last  = index + unsigned((unsigned long long)count * (c + 1) / chunks);
+    m_pool->submit(&animateTasks[c]);
+  }
+  m_pool->wait();
+  m_deferMarking = false;
+
+  // 2) global matrices, parents of the split subtrees here, their children on the threads
+  // several tasks per thread, so the stealing can even out subtrees of different cost
+  const unsigned grain = std::max(count / (8 * threads), 256u);
+  std::vector<unsigned> serial;
+  std::vector<unsigned> ranges;
+  partition(index, grain, serial, ranges);
+
+  m_recalculated = 0;
+  for(unsigned i = 0; i < serial.size(); i++)
+    if(propagate(serial[i]))
+      m_recalculated++;
+
+  std::vector<PropagateTask> propagateTasks(ranges.size() / 2);
+  for(unsigned t = 0; t < propagateTasks.size(); t++)
+  {
+    propagateTasks[t].hierarchy = this;
+    propagateTasks[t].first = ranges[2 * t];
+    propagateTasks[t].last = ranges[2 * t + 1];
+    propagateTasks[t].recalculated = 0;
+    m_pool->submit(&propagateTasks[t]);
+  }
+  m_pool->wait();
+
+  for(unsigned t = 0; t < propagateTasks.size(); t++)
+    m_recalculated += propagateTasks[t].recalculated;
+}
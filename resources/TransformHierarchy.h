@@ -0,0 +1,156 @@
+#ifndef TRANSFORMHIERARCHY_H
+#define TRANSFORMHIERARCHY_H
+
+#include <vector>
+
+#include "pgr.h"
+
+class SceneNode;
+class TaskPool;
+
+/** Flat storage of the scene graph transformations
+ *
+ * Local and global matrices of all the nodes live in contiguous arrays sorted
+ * depth first, parent before child. Subtree of the node at index i therefore
+ * occupies the range [i, i + subtreeSize(i)) and its global matrices are computed
+ * by a single linear pass, without recursion, virtual calls or pointer chasing.
+ *
+ * Only the nodes whose local matrix changed (see setLocalMatrix()) and their
+ * descendants are recalculated, subtrees without any change are skipped at once.
+ *
+ * With a TaskPool set, big subtrees are split among its threads, see setTaskPool().
+ *
+ * SceneNode only keeps its index in here. Indices change when the order is
+ * rebuilt after a structural change (re-parenting, removing), the nodes
+ * are notified about the new ones.
+ */
+class TransformHierarchy
+{
+public:
+  /// hierarchy used by all scene nodes
+  static TransformHierarchy * Instance();
+
+  /// appends node without parent, returns its index
+  unsigned addNode(SceneNode * node);
+
+  /// forgets the node, its slot is reclaimed by the next rebuild
+  void removeNode(unsigned index);
+
+  /// moves node under the parent (parent < 0 means no parent)
+  void setParent(unsigned index, int parent);
+
+  /// marks the node to get SceneNode::animate() called before its global matrix is computed
+  void setAnimated(unsigned index, bool animated);
+
+  /** animates and recalculates global matrices of the node and its whole subtree
+   *
+   * Global matrix of the parent of the node must be valid already and so must be
+   * the order (call validateOrder() before taking the index of the node).
+   */
+  void update(unsigned index, double elapsed_time);
+
+  /** update() of big subtrees runs on the threads of the pool, NULL for serial update
+   *
+   * SceneNode::animate() is then called from several threads at once, so it must only
+   * touch the node itself. The result is the same as the one of the serial update.
+   */
+  void setTaskPool(TaskPool * pool) { m_pool = pool; }
+  TaskPool * taskPool() const { return m_pool; }
+
+  /// time passed to the last update() call, in seconds
+  double time() const { return m_time; }
+
+  const glm::mat4 & localMatrix(unsigned index) const { return m_local[index]; }
+  const glm::mat4 & globalMatrix(unsigned index) const { return m_global[index]; }
+  void setLocalMatrix(unsigned index, const glm::mat4 & local) { m_local[index] = local; markDirty(index); }
+  /// replaces the translation column of the local matrix, the rest is kept
+  void setLocalTranslation(unsigned index, const glm::vec3 & translation) { m_local[index][3] = glm::vec4(translation, 1.0f); markDirty(index); }
+
+  /// global matrix of the node and its subtree will be recalculated in the next update()
+  void markDirty(unsigned index)
+  {
+    m_dirty[index] |= DIRTY_LOCAL;
+    // the ancestors are shared by the threads of the parallel update, which does not need the marks anyway
+    if(m_deferMarking)
+      return;
+    // ancestors already marked have all their ancestors marked as well
+    for(int p = m_parent[index]; p >= 0 && !(m_dirty[p] & DIRTY_CHILD); p = m_parent[p])
+      m_dirty[p] |= DIRTY_CHILD;
+  }
+
+  /// number of the update() pass which last changed the global matrix, to notice the change later
+  unsigned stamp(unsigned index) const { return m_stamp[index]; }
+
+  /// number of global matrices actually recalculated by the last update()
+  unsigned recalculatedCount() const { return m_recalculated; }
+
+  /// index of the parent, -1 for roots
+  int parent(unsigned index) const { return m_parent[index]; }
+
+  /// number of nodes in the subtree including the node itself (valid order only)
+  unsigned subtreeSize(unsigned index) const { return m_subtreeSize[index]; }
+
+  /// number of slots (including the removed ones not reclaimed yet)
+  unsigned size() const { return m_nodes.size(); }
+
+  /// rebuilds the depth first order if it was broken by a structural change
+  void validateOrder() { if(!m_orderValid) rebuildOrder(); }
+
+protected:
+  TransformHierarchy();
+
+  enum DirtyFlags {
+    DIRTY_LOCAL = 1, ///< local matrix of the slot changed
+    DIRTY_CHILD = 2  ///< some slot in the subtree has DIRTY_LOCAL set
+  };
+
+  /// sorts all the arrays depth first, drops removed nodes and renumbers the nodes
+  void rebuildOrder();
+
+  /// update() of the subtree [index, end) on the calling thread
+  void updateSerial(unsigned index, unsigned end);
+  /// update() of the subtree [index, end) on the threads of m_pool
+  void updateParallel(unsigned index, unsigned end);
+
+  /** splits the subtree to nodes calculated serially (parents first) and ranges of whole sibling subtrees
+   *
+   * Each range is at most grain nodes long unless it is a single leaf subtree,
+   * parents of the ranges are always among the serial nodes.
+   */
+  void partition(unsigned index, unsigned grain, std::vector<unsigned> & serial, std::vector<unsigned> & ranges) const;
+
+  /// calls animate() of the animated nodes in [first, last)
+  void animateRange(unsigned first, unsigned last);
+  /// calculates global matrix of the slot if it or its parent changed, returns true if it did
+  bool propagate(unsigned index);
+  /// propagate() for every slot in [first, last), parents must be calculated already, returns number of recalculated
+  unsigned propagateRange(unsigned first, unsigned last);
+
+  struct AnimateTask;
+  struct PropagateTask;
+
+  static TransformHierarchy * m_instance;
+
+  std::vector<SceneNode*> m_nodes;       ///< node owning the slot, NULL if removed
+  std::vector<int>        m_parent;      ///< index of the parent, -1 for roots
+  std::vector<unsigned>   m_subtreeSize; ///< size of the subtree rooted in the slot
+  std::vector<unsigned char> m_animated; ///< call SceneNode::animate() for the slot
+  std::vector<unsigned char> m_dirty;    ///< DirtyFlags of the slot
+  std::vector<unsigned>   m_stamp;       ///< number of the update() pass which calculated the global matrix
+  std::vector<glm::mat4>  m_local;       ///< local model matrices
+  std::vector<glm::mat4>  m_global;      ///< global model matrices, calculated in update()
+
+  /// false when the arrays are not sorted depth first
+  bool m_orderValid;
+  double m_time;
+  /// number of update() passes so far
+  unsigned m_pass;
+  /// global matrices calculated by the last update()
+  unsigned m_recalculated;
+  /// pool for the parallel update, NULL for serial
+  TaskPool * m_pool;
+  /// only DIRTY_LOCAL is set by markDirty() (while animating in parallel)
+  bool m_deferMarking;
+};
+
+#endif // TRANSFORMHIERARCHY_H
@@ -10,20 +10,20 @@ TransformNode::TransformNode(const std::string &name, SceneNode *parent):
 
 void TransformNode::setIdentity()
 {
-  m_local_mat = glm::mat4(1.0f);
+  setLocalMatrix(glm::mat4(1.0f));
 }
 
 void TransformNode::translate(const glm::vec3 &tr)
 {
-  m_local_mat = glm::translate( m_local_mat, tr);
+  setLocalMatrix(glm::translate( localMatrix(), tr));
 }
 
 void TransformNode::rotate(float angle, const glm::vec3 &axis)
 {
-  m_local_mat = glm::rotate( m_local_mat, angle, axis);
+  setLocalMatrix(glm::rotate( localMatrix(), angle, axis));
 }
 
 void TransformNode::scale(const glm::vec3 &scale)
 {
-  m_local_mat = glm::scale( m_local_mat, scale);
+  setLocalMatrix(glm::scale( localMatrix(), scale));
 }